@@ -0,0 +1,3956 @@
+/*
+ * This file was generated automatically by ExtUtils::ParseXS version 3.45 from the
+ * contents of Cluster.xs. Do not edit this file, edit Cluster.xs instead.
+ *
+ *    ANY CHANGES MADE HERE WILL BE LOST!
+ *
+ */
+
+#line 1 "Cluster.xs"
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+/* The Perl include files perl.h redefines malloc and free. Here, we need the
+ * usual malloc and free, defined in stdlib.h. So we undefine the ones in
+ * perl.h.
+ */
+
+#ifdef malloc
+#undef malloc
+#endif
+#ifdef free
+#undef free
+#endif
+
+#include <stdlib.h>
+
+#include "../src/cluster.h"
+
+
+typedef struct {Node* nodes; int n;} Tree;
+
+/* -------------------------------------------------
+ * Using the warnings registry, check to see if warnings
+ * are enabled for the Algorithm::Cluster module.
+ */
+static int
+warnings_enabled(pTHX) {
+
+    dSP;
+
+    I32 count;
+    bool isEnabled; 
+    SV * mysv;
+
+    ENTER ;
+    SAVETMPS;
+    PUSHMARK(SP) ;
+    XPUSHs(sv_2mortal(newSVpv("Algorithm::Cluster",18)));
+    PUTBACK ;
+
+    count = perl_call_pv("warnings::enabled", G_SCALAR) ;
+
+    if (count != 1) croak("No arguments returned from call_pv()\n") ;
+
+    mysv = POPs; 
+    isEnabled = (bool) SvTRUE(mysv); 
+
+    PUTBACK ;
+    FREETMPS ;
+    LEAVE ;
+
+    return isEnabled;
+}
+
+/* -------------------------------------------------
+ * Create a row of doubles, initialized to a value
+ */
+static double*
+malloc_row_dbl(pTHX_ int ncols, double val) {
+
+    int j;
+    double * row;
+
+    row = malloc(ncols * sizeof(double) );
+    if (!row) {
+        return NULL;
+    }
+
+    for (j = 0; j < ncols; j++) { 
+        row[j] = val;
+    }
+    return row;
+}
+
+/* -------------------------------------------------
+ * Only coerce to a double if we already know it's 
+ * an integer or double, or a string which is actually numeric.
+ * Don't blindly run the macro SvNV, because that will coerce 
+ * a non-numeric string to be a double of value 0.0, 
+ * and we do not want that to happen, because if we test it again, 
+ * it will then appear to be a valid double value. 
+ */
+static int
+extract_double_from_scalar(pTHX_ SV * mysv, double * number) {
+
+    if (SvPOKp(mysv) && SvLEN(mysv)) {  
+
+        /* This function is not in the public perl API */
+        if (Perl_looks_like_number(aTHX_ mysv)) {
+            *number = SvNV( mysv );
+            return 1;
+        } else {
+            return 0;
+        } 
+    } else if (SvNIOK(mysv)) {  
+        *number = SvNV( mysv );
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+
+
+/* -------------------------------------------------
+ * Convert a Perl 2D matrix into a 2D matrix of C doubles.
+ * If no data are masked, mask can be passed as NULL.
+ * NOTE: on errors this function returns a value greater than zero.
+ */
+static double**
+parse_data(pTHX_ SV * matrix_ref, int** mask) {
+
+    AV * matrix_av;
+    SV * row_ref;
+    AV * row_av;
+    SV * cell;
+
+    int type, i, j, nrows, ncols, n;
+
+    double** matrix;
+
+    /* NOTE -- we will just assume that matrix_ref points to an arrayref,
+     * and that the first item in the array is itself an arrayref.
+     * The calling perl functions must check this before we get this pointer.  
+     * (It's easier to implement these checks in Perl rather than C.)
+     * The value of perl_rows is now fixed. But the value of
+     * rows will be decremented, if we skip any (invalid) Perl rows.
+     */
+    matrix_av  = (AV *) SvRV(matrix_ref);
+    nrows = (int) av_len(matrix_av) + 1;
+
+    if(nrows <= 0) {
+        return NULL;
+    }
+    matrix   = malloc(nrows*sizeof(double*));
+    if (!matrix) {
+        return NULL;
+    }
+
+    row_ref  = *(av_fetch(matrix_av, (I32) 0, 0)); 
+    row_av   = (AV *) SvRV(row_ref);
+    ncols    = (int) av_len(row_av) + 1;
+
+
+    /* ------------------------------------------------------------ 
+     * Loop once for each row in the Perl matrix, and convert it to
+     * C doubles. 
+     */
+    for (i=0; i < nrows; i++) { 
+
+        row_ref = *(av_fetch(matrix_av, (I32) i, 0)); 
+
+        if(! SvROK(row_ref) ) {
+
+            if(warnings_enabled(aTHX))
+                Perl_warn(aTHX_ 
+                    "Row %d: Wanted array reference, but "
+                    "got a scalar. No row to process?\n", i);
+            break;
+        }
+
+        row_av = (AV *) SvRV(row_ref);
+        type = SvTYPE(row_av); 
+    
+        /* Handle unexpected cases */
+        if(type != SVt_PVAV ) {
+
+             /* Reference doesn't point to an array at all. */
+            if(warnings_enabled(aTHX))
+                Perl_warn(aTHX_ 
+                    "Row %d: Wanted array reference, but got "
+                    "a reference to something else (%d)\n",
+                    i, type);
+            break;
+
+        }
+
+        n = (int) av_len(row_av) + 1;
+        if (n != ncols) {
+            /* All rows in the matrix should have the same
+             * number of columns. */
+            if(warnings_enabled(aTHX))
+                Perl_warn(aTHX_ 
+                    "Row %d: Contains %d columns "
+                    "(expected %d)\n", i, n, ncols);
+            break;
+        }
+
+        matrix[i] = malloc(ncols*sizeof(double));
+        if (!matrix[i])
+            break;
+
+        /* Loop once for each cell in the row. */
+        for (j=0; j < ncols; j++) { 
+        
+            double num;
+            if (!mask || mask[i][j]) {
+                cell = *(av_fetch(row_av, (I32) j, 0)); 
+                if(extract_double_from_scalar(aTHX_ cell,&num) <= 0) {    
+                    if(warnings_enabled(aTHX))
+                        Perl_warn(aTHX_ 
+                            "Row %d col %d: Value is not "
+                                                    "a number.\n", i, j);
+                    free(matrix[i]); /* not included below */
+                    break;
+                }
+            }
+            else {
+                /* Don't read the value if it is masked.
+                 * Set it to some arbitrary value. */
+                num = 0.0;
+            }
+            matrix[i][j] = num;
+
+        } /* End for (j=0; j < ncols; j++) */
+        if (j < ncols) break;
+
+    } /* End for (i=0; i < nrows; i++) */
+
+    if (i < nrows) { /* encountered a break */
+        nrows = i;
+        for (i = 0; i < nrows; i++) free(matrix[i]);
+        free(matrix);
+        matrix = NULL;
+    }
+
+    return matrix;
+}
+
+
+/* -------------------------------------------------
+ * Convert a Perl 2D matrix into a 2D matrix of C ints.
+ * On errors this function returns a value greater than zero.
+ */
+static int**
+parse_mask(pTHX_ SV * matrix_ref) {
+
+    AV * matrix_av;
+    SV * row_ref;
+    AV * row_av;
+    SV * cell;
+
+    int type, i, j, nrows, ncols, n;
+
+    int** matrix;
+
+    /* NOTE -- we will just assume that matrix_ref points to an arrayref,
+     * and that the first item in the array is itself an arrayref.
+     * The calling perl functions must check this before we get this pointer.  
+     * (It's easier to implement these checks in Perl rather than C.)
+     * The value of perl_rows is now fixed. But the value of
+     * rows will be decremented, if we skip any (invalid) Perl rows.
+     */
+    matrix_av = (AV *) SvRV(matrix_ref);
+    nrows = (int) av_len(matrix_av) + 1;
+
+    if(nrows <= 0) {
+        return NULL;  /* Caller must handle this case!! */
+    }
+    matrix    = malloc(nrows * sizeof(int *) );
+    if (!matrix) {
+        return NULL;
+    }
+
+    row_ref   = *(av_fetch(matrix_av, (I32) 0, 0)); 
+    row_av    = (AV *) SvRV(row_ref);
+    ncols     = (int) av_len(row_av) + 1;
+
+
+
+    /* ------------------------------------------------------------ 
+     * Loop once for each row in the Perl matrix, and convert it to C ints. 
+     */
+    for (i=0; i < nrows; i++) { 
+
+        row_ref = *(av_fetch(matrix_av, (I32) i, 0)); 
+
+        if(! SvROK(row_ref) ) {
+
+            if(warnings_enabled(aTHX))
+                Perl_warn(aTHX_ 
+                    "Row %d: Wanted array reference, but "
+                    "got a scalar. No row to process?\n", i);
+            break;
+        }
+
+        row_av = (AV *) SvRV(row_ref);
+        type = SvTYPE(row_av); 
+    
+        /* Handle unexpected cases */
+        if(type != SVt_PVAV ) {
+
+             /* Reference doesn't point to an array at all. */
+            if(warnings_enabled(aTHX))
+                Perl_warn(aTHX_ 
+                    "Row %d: Wanted array reference, but got "
+                    "a reference to something else (%d)\n",
+                    i, type);
+            break;
+
+        }
+
+        n = (int) av_len(row_av) + 1;
+        if (n != ncols) {
+            /* All rows in the matrix should have the same
+             * number of columns. */
+            if(warnings_enabled(aTHX))
+                Perl_warn(aTHX_ 
+                    "Row %d: Contains %d columns "
+                    "(expected %d)\n", i, n, ncols);
+            break;
+        }
+
+        matrix[i] = malloc(ncols * sizeof(int) );
+        if (!matrix[i]) {
+            break;
+        }
+
+        /* Loop once for each cell in the row. */
+        for (j=0; j < ncols; ++j) { 
+            double num;
+            cell = *(av_fetch(row_av, (I32) j, 0)); 
+            if(extract_double_from_scalar(aTHX_ cell,&num) <= 0) {    
+                if(warnings_enabled(aTHX))
+                    Perl_warn(aTHX_
+                        "Row %d col %d: Value is not "
+                        "a number.\n", i, j);
+                free(matrix[i]); /* not included below */
+                break;
+            }
+            matrix[i][j] = (int) num;
+
+        } /* End for (j=0; j < ncols; j++) */
+        if (j < ncols) break;
+
+    } /* End for (i=0; i < nrows; i++) */
+
+    if (i < nrows) { /* break statement encountered */
+        nrows = i;
+        for (i = 0; i < nrows; i++) free(matrix[i]);
+        free(matrix);
+        matrix = NULL;
+    }
+
+    return matrix;
+}
+
+
+/* -------------------------------------------------
+ *
+ */
+static void
+free_matrix_int(int ** matrix, int nrows) {
+
+    int i;
+    for(i = 0; i < nrows; ++i ) {
+        free(matrix[i]);
+    }
+
+    free(matrix);
+}
+
+
+/* -------------------------------------------------
+ *
+ */
+static void
+free_matrix_dbl(double ** matrix, int nrows) {
+
+    int i;
+    for(i = 0; i < nrows; ++i ) {
+        free(matrix[i]);
+    }
+
+    free(matrix);
+}
+
+
+/* -------------------------------------------------
+ *
+ */
+static void
+free_ragged_matrix_dbl(double ** matrix, int nrows) {
+
+    int i;
+    for(i = 1; i < nrows; ++i ) {
+        free(matrix[i]);
+    }
+
+    free(matrix);
+}
+
+
+/* -------------------------------------------------
+ * Convert a Perl array into an array of doubles
+ * On error, this function returns NULL.
+ */
+static double*
+malloc_row_perl2c_dbl (pTHX_ SV * input, int* np) {
+
+    int i;
+    AV* array    = (AV *) SvRV(input);
+    const int n  = (int) av_len(array) + 1;
+    double* data = malloc(n * sizeof(double)); 
+    if (!data) {
+        return NULL;
+    }
+
+    /* Loop once for each item in the Perl array, and convert
+         * it to a C double. 
+     */
+    for (i=0; i < n; i++) {
+        double num;
+        SV * mysv = *(av_fetch(array, (I32) i, (I32) 0));
+        if(extract_double_from_scalar(aTHX_ mysv,&num) > 0) {    
+            data[i] = num;
+        } else {
+            /* Error reading data */
+            if (warnings_enabled(aTHX))
+                Perl_warn(aTHX_ 
+                    "Error parsing array: item %d is not a number\n", i);      
+            free(data);
+            return NULL;
+        }
+    }
+    if(np) *np = n;
+    return data;
+}
+
+/* -------------------------------------------------
+ * Convert a Perl array into an array of ints
+ * On errors this function returns NULL.
+ */
+static int*
+malloc_row_perl2c_int (pTHX_ SV * input) {
+
+    int i;
+
+    AV* array = (AV *) SvRV(input);
+    const int n = (int) av_len(array) + 1;
+    int* data = malloc(n*sizeof(int)); 
+    if (!data) {
+        return NULL;
+    }
+
+    /* Loop once for each item in the Perl array,
+     * and convert it to a C double. 
+     */
+    for (i=0; i < n; i++) {
+        double num;
+        SV * mysv = *(av_fetch(array, (I32) i, (I32) 0));
+        if(extract_double_from_scalar(aTHX_ mysv,&num) > 0) {    
+            data[i] = (int) num;
+        } else {
+            /* Check if the item is numeric */
+            if (warnings_enabled(aTHX))
+                Perl_warn(aTHX_ "Error when parsing array: item %d is"
+                    " not a number, skipping\n", i);      
+            free(data);
+            return NULL;
+        }
+    }
+
+    return data;
+}
+
+/* -------------------------------------------------
+ * Copy a Perl array into an array of ints.
+ * If an error occurs, return 0; otherwise return 1.
+ */
+static int
+copy_row_perl2c_int (pTHX_ SV * input, int* output) {
+
+    int i;
+
+    AV* array = (AV *) SvRV(input);
+    const int n = (int) av_len(array) + 1;
+
+    /* Loop once for each item in the Perl array,
+     * and convert it to a C double. 
+     */
+    for (i=0; i < n; i++) {
+        double num;
+        SV * mysv = *(av_fetch(array, (I32) i, (I32) 0));
+        if(extract_double_from_scalar(aTHX_ mysv,&num) > 0) {    
+            output[i] = (int) num;
+        } else {
+            /* Skip any items which are not numeric */
+            if (warnings_enabled(aTHX))
+                Perl_warn(aTHX_ 
+                    "Error when parsing array: item %d is"
+                    " not a number\n", i);      
+            return 0;
+        }
+    }
+    return 1;
+}
+/* -------------------------------------------------
+ *
+ */
+static SV *
+row_c2perl_dbl(pTHX_ double * row, int ncols) {
+
+    int j;
+    AV * row_av = newAV();
+    for(j=0; j<ncols; ++j) {
+        av_push(row_av, newSVnv(row[j]));
+    }
+    return newRV_noinc((SV*) row_av);
+}
+
+/* -------------------------------------------------
+ *
+ */
+static SV*
+row_c2perl_int(pTHX_ int * row, int ncols) {
+
+    int j;
+    AV * row_av = newAV();
+    for(j=0; j<ncols; ++j) {
+        av_push(row_av, newSVnv(row[j]));
+    }
+    return ( newRV_noinc( (SV*) row_av ) );
+}
+
+/* -------------------------------------------------
+ *
+ */
+static SV*
+matrix_c2perl_dbl(pTHX_ double ** matrix, int nrows, int ncols) {
+
+    int i;
+    AV * matrix_av = newAV();
+    SV * row_ref;
+    for(i=0; i<nrows; ++i) {
+        row_ref = row_c2perl_dbl(aTHX_ matrix[i], ncols);
+        av_push(matrix_av, row_ref);
+    }
+    return ( newRV_noinc( (SV*) matrix_av ) );
+}
+
+/* -------------------------------------------------
+ *
+ */
+static SV*
+matrix_c2perl_int(pTHX_ int ** matrix, int nrows, int ncols) {
+
+    int i;
+    AV * matrix_av = newAV();
+    SV * row_ref;
+    for(i=0; i<nrows; ++i) {
+        row_ref = row_c2perl_int(aTHX_ matrix[i], ncols);
+        av_push(matrix_av, row_ref);
+    }
+    return ( newRV_noinc( (SV*) matrix_av ) );
+}
+
+/* -------------------------------------------------
+ *
+ */
+static SV*
+ragged_matrix_c2perl_dbl(pTHX_ double ** matrix, int nobjects) {
+
+    int i;
+    AV * matrix_av = newAV();
+    SV * row_ref;
+    for(i=0; i<nobjects; ++i) {
+        row_ref = row_c2perl_dbl(aTHX_ matrix[i], i);
+        av_push(matrix_av, row_ref);
+    }
+    return ( newRV_noinc( (SV*) matrix_av ) );
+}
+
+/* -------------------------------------------------
+ * Create an Algorithm::Cluster::Tree object from the n nodes
+ * returned by the C library. The Tree object takes ownership
+ * of the nodes. Returns NULL if a memory error occurs.
+ */
+static SV*
+tree_c2perl(pTHX_ Node* nodes, int n) {
+
+    SV* ref;
+    SV* obj;
+    Tree* tree = malloc(sizeof(Tree));
+    if (!tree) return NULL;
+    tree->n = n;
+    tree->nodes = nodes;
+    ref = newSViv(0);
+    obj = newSVrv(ref, "Algorithm::Cluster::Tree");
+    sv_setiv(obj, PTR2IV(tree));
+    SvREADONLY_on(obj);
+    return ref;
+}
+
+/* -------------------------------------------------
+ * Cut the tree into nclusters[l] clusters for each level l,
+ * and return the cluster numbers as an array with one entry
+ * per level. Each entry is a reference to an array, or, if
+ * packed is true, a string of packed native integers.
+ */
+static AV*
+cuts_c2perl(pTHX_ Tree* tree, int nlevels, const int nclusters[], int packed)
+{
+    int i;
+    const int n = tree->n + 1;
+    AV* result;
+    int** clusterid = malloc(nlevels*sizeof(int*));
+    if (!clusterid) croak("cut: Insufficient memory");
+    for (i = 0; i < nlevels; i++) {
+        clusterid[i] = malloc(n*sizeof(int));
+        if (!clusterid[i]) break;
+    }
+    if (i < nlevels) {
+        while (--i >= 0) free(clusterid[i]);
+        free(clusterid);
+        croak("cut: Insufficient memory");
+    }
+    cuttrees(n, tree->nodes, nlevels, nclusters, clusterid);
+    if (nlevels > 0 && clusterid[0][0]==-1) {
+        for (i = 0; i < nlevels; i++) free(clusterid[i]);
+        free(clusterid);
+        croak("cut: Error in the cuttrees routine");
+    }
+    result = newAV();
+    for (i = 0; i < nlevels; i++) {
+        if (packed)
+            av_push(result, newSVpvn((char*)clusterid[i], n*sizeof(int)));
+        else
+            av_push(result, row_c2perl_int(aTHX_ clusterid[i], n));
+        free(clusterid[i]);
+    }
+    free(clusterid);
+    return result;
+}
+
+/* -------------------------------------------------
+ * Check if the data matrix is a distance matrix, or
+ * a raw distance matrix.
+ */
+static int
+is_distance_matrix(pTHX_ SV * data_ref)
+{
+    /* We don't check data_ref because we expect the caller to check it 
+     */
+    AV * matrix_av  = (AV *) SvRV(data_ref);
+    SV * row_ref    = *(av_fetch(matrix_av, (I32) 0, 0)); 
+    AV * row_av     = (AV *) SvRV(row_ref);
+    const int ncols = (int) av_len(row_av) + 1;
+    if (ncols==0) return 1;
+
+    return 0;
+}
+
+
+/* -------------------------------------------------
+ * Convert the 'data' and 'mask' matrices and the 'weight' array
+ * from C to Perl.  Also check for errors, and bail out if there are any.
+ */
+static int
+malloc_matrices(pTHX_
+    SV *  weight_ref, double  ** weight, int nweights, 
+    SV *  data_ref,   double *** matrix,
+    SV *  mask_ref,   int    *** mask,
+    int   nrows,      int        ncols
+) {
+
+    if(SvROK(mask_ref) && SvTYPE(SvRV(mask_ref)) == SVt_PVAV) { 
+        *mask = parse_mask(aTHX_ mask_ref);
+        if(*mask==NULL) return 0;
+    } else {
+        int i,j;
+        int** p = malloc(nrows*sizeof(int*));
+        if(!p) return 0;
+        for (i = 0; i < nrows; ++i) { 
+            p[i] = malloc(ncols*sizeof(int));
+            if(!p[i]) {
+                while(--i >= 0) free(p[i]);
+                free(p);
+                return 0;
+            }
+            for (j = 0; j < ncols; j++) p[i][j] = 1;
+        }
+        *mask = p;
+    }
+
+    /* We don't check data_ref because we expect the caller to check it 
+     */
+    *matrix = parse_data(aTHX_ data_ref, *mask);
+    if(*matrix==NULL) {
+        free_matrix_int(*mask,     nrows);
+        return 0;
+    }
+
+    if(weight_ref==NULL) return 1; /* Weights not needed */
+    if(SvROK(weight_ref) && SvTYPE(SvRV(weight_ref)) == SVt_PVAV) { 
+        *weight = malloc_row_perl2c_dbl(aTHX_ weight_ref, NULL);
+    } else {
+        *weight = malloc_row_dbl(aTHX_ nweights,1.0);
+    }
+
+    if(!(*weight)) {
+        free_matrix_int(*mask,     nrows);
+        free_matrix_dbl(*matrix,   nrows);
+        return 0;
+    }
+
+    return 1;
+}
+
+static double**
+parse_distance(pTHX_ SV* matrix_ref, int nobjects)
+{
+    int i,j;
+
+    AV* matrix_av  = (AV *) SvRV(matrix_ref);
+    double** matrix = malloc(nobjects*sizeof(double*));
+    if (!matrix) {
+        return NULL;
+    }
+
+    matrix[0] = NULL;
+    for (i=1; i < nobjects; i++) { 
+        SV* row_ref = *(av_fetch(matrix_av, (I32) i, 0)); 
+        AV* row_av  = (AV *) SvRV(row_ref);
+        matrix[i] = malloc(i * sizeof(double));
+        if (!matrix[i]) {
+            break;
+        }
+        /* Loop once for each cell in the row. */
+        for (j=0; j < i; j++) { 
+            double num;
+            SV* cell = *(av_fetch(row_av, (I32) j, 0)); 
+            if(extract_double_from_scalar(aTHX_ cell,&num) > 0) {    
+                matrix[i][j] = num;
+            } else {
+                if(warnings_enabled(aTHX))
+                    Perl_warn(aTHX_ 
+                        "Row %d col %d: Value is not "
+                                                "a number.\n", i, j);
+                break;
+            }
+        }
+    }
+
+    if (i < nobjects) {
+        nobjects = i+1;
+        for (i = 1; i < nobjects; i++) free(matrix[i]);
+        free(matrix);
+        matrix = NULL;
+    }
+
+    return matrix;
+}
+
+/* -------------------------------------------------
+ * Row sources for minibatchkcluster. The rows are copied either from a
+ * matrix of C doubles by the library function getdatarows, or from the array
+ * of rows returned by a Perl function that is called with a reference to an
+ * array of row numbers.
+ */
+typedef struct {
+    DataSource matrix;
+    SV* function;
+    SV* error;
+} RowSource;
+
+static int
+get_perl_rows(void* context, int n, const int index[], double** data,
+              int** mask)
+{
+    dTHX;
+    dSP;
+    int i, j;
+    int count;
+    int ok = 1;
+    SV* result;
+    AV* rows_av;
+    AV* index_av;
+    RowSource* source = context;
+
+    index_av = newAV();
+    av_extend(index_av, n);
+    for (i = 0; i < n; i++) av_push(index_av, newSViv(index[i]));
+
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    XPUSHs(sv_2mortal(newRV_noinc((SV*)index_av)));
+    PUTBACK;
+    count = call_sv(source->function, G_SCALAR | G_EVAL);
+    SPAGAIN;
+    if (SvTRUE(ERRSV)) {
+        source->error = newSVsv(ERRSV);
+        ok = 0;
+    }
+    else if (count != 1) {
+        source->error = newSVpv("function passed as 'rows' should return a single value", 0);
+        ok = 0;
+    }
+    else {
+        result = POPs;
+        if (!SvROK(result) || SvTYPE(SvRV(result)) != SVt_PVAV
+         || av_len((AV*) SvRV(result)) + 1 != n) {
+            source->error = newSVpvf("function passed as 'rows' should return a reference to an array of %d rows", n);
+            ok = 0;
+        }
+    }
+    if (ok) {
+        rows_av = (AV*) SvRV(result);
+        for (i = 0; i < n && ok; i++) {
+            AV* row_av;
+            SV* row_ref = *(av_fetch(rows_av, (I32) i, 0));
+            if (!SvROK(row_ref) || SvTYPE(SvRV(row_ref)) != SVt_PVAV
+             || av_len((AV*) SvRV(row_ref)) + 1 != source->matrix.ndata) {
+                source->error = newSVpvf("row %d returned by the function passed as 'rows' should be a reference to an array of %d values", index[i], source->matrix.ndata);
+                ok = 0;
+                break;
+            }
+            row_av = (AV*) SvRV(row_ref);
+            for (j = 0; j < source->matrix.ndata; j++) {
+                SV* cell = *(av_fetch(row_av, (I32) j, 0));
+                if (!SvOK(cell)) {
+                    /* Missing value */
+                    data[i][j] = 0.0;
+                    mask[i][j] = 0;
+                }
+                else if (extract_double_from_scalar(aTHX_ cell, &data[i][j]) > 0) {
+                    mask[i][j] = 1;
+                }
+                else {
+                    source->error = newSVpvf("row %d col %d returned by the function passed as 'rows' is not a number", index[i], j);
+                    ok = 0;
+                    break;
+                }
+            }
+        }
+    }
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+    return ok;
+}
+
+/* -------------------------------------------------
+ * Progress callback for kcluster, kmedoids, and somcluster. The Perl
+ * function is called with a reference to a hash with the fields of the
+ * ClusterProgress struct; if it returns a true value, clustering stops.
+ * If the Perl function dies, clustering stops and the error is saved.
+ */
+typedef struct {
+    SV* function;
+    SV* error;
+} ProgressCallback;
+
+static int
+call_perl_progress(const ClusterProgress* progress, void* context)
+{
+    dTHX;
+    dSP;
+    int count;
+    int stop = 0;
+    HV* progress_hv;
+    ProgressCallback* callback = context;
+
+    progress_hv = newHV();
+    hv_store(progress_hv, "pass",      4, newSViv(progress->pass), 0);
+    hv_store(progress_hv, "iteration", 9, newSViv(progress->iteration), 0);
+    hv_store(progress_hv, "total",     5, newSVnv(progress->total), 0);
+    hv_store(progress_hv, "nmoved",    6, newSViv(progress->nmoved), 0);
+    hv_store(progress_hv, "elapsed",   7, newSVnv(progress->elapsed), 0);
+
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    XPUSHs(sv_2mortal(newRV_noinc((SV*)progress_hv)));
+    PUTBACK;
+    count = call_sv(callback->function, G_SCALAR | G_EVAL);
+    SPAGAIN;
+    if (SvTRUE(ERRSV)) {
+        callback->error = newSVsv(ERRSV);
+        stop = 1;
+        if (count == 1) (void) POPs;
+    }
+    else if (count == 1) {
+        stop = SvTRUE(POPs) ? 1 : 0;
+    }
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+    return stop;
+}
+
+static void
+init_progress_callback(pTHX_ ProgressCallback* callback, SV* callback_ref)
+{
+    callback->error = NULL;
+    if (SvROK(callback_ref) && SvTYPE(SvRV(callback_ref)) == SVt_PVCV)
+        callback->function = callback_ref;
+    else
+        callback->function = NULL;
+}
+
+/******************************************************************************/
+/**                                                                          **/
+/** XS code begins here                                                      **/
+/**                                                                          **/
+/******************************************************************************/
+/******************************************************************************/
+
+#line 922 "Cluster.c"
+#ifndef PERL_UNUSED_VAR
+#  define PERL_UNUSED_VAR(var) if (0) var = var
+#endif
+
+#ifndef dVAR
+#  define dVAR		dNOOP
+#endif
+
+
+/* This stuff is not part of the API! You have been warned. */
+#ifndef PERL_VERSION_DECIMAL
+#  define PERL_VERSION_DECIMAL(r,v,s) (r*1000000 + v*1000 + s)
+#endif
+#ifndef PERL_DECIMAL_VERSION
+#  define PERL_DECIMAL_VERSION \
+	  PERL_VERSION_DECIMAL(PERL_REVISION,PERL_VERSION,PERL_SUBVERSION)
+#endif
+#ifndef PERL_VERSION_GE
+#  define PERL_VERSION_GE(r,v,s) \
+	  (PERL_DECIMAL_VERSION >= PERL_VERSION_DECIMAL(r,v,s))
+#endif
+#ifndef PERL_VERSION_LE
+#  define PERL_VERSION_LE(r,v,s) \
+	  (PERL_DECIMAL_VERSION <= PERL_VERSION_DECIMAL(r,v,s))
+#endif
+
+/* XS_INTERNAL is the explicit static-linkage variant of the default
+ * XS macro.
+ *
+ * XS_EXTERNAL is the same as XS_INTERNAL except it does not include
+ * "STATIC", ie. it exports XSUB symbols. You probably don't want that
+ * for anything but the BOOT XSUB.
+ *
+ * See XSUB.h in core!
+ */
+
+
+/* TODO: This might be compatible further back than 5.10.0. */
+#if PERL_VERSION_GE(5, 10, 0) && PERL_VERSION_LE(5, 15, 1)
+#  undef XS_EXTERNAL
+#  undef XS_INTERNAL
+#  if defined(__CYGWIN__) && defined(USE_DYNAMIC_LOADING)
+#    define XS_EXTERNAL(name) __declspec(dllexport) XSPROTO(name)
+#    define XS_INTERNAL(name) STATIC XSPROTO(name)
+#  endif
+#  if defined(__SYMBIAN32__)
+#    define XS_EXTERNAL(name) EXPORT_C XSPROTO(name)
+#    define XS_INTERNAL(name) EXPORT_C STATIC XSPROTO(name)
+#  endif
+#  ifndef XS_EXTERNAL
+#    if defined(HASATTRIBUTE_UNUSED) && !defined(__cplusplus)
+#      define XS_EXTERNAL(name) void name(pTHX_ CV* cv __attribute__unused__)
+#      define XS_INTERNAL(name) STATIC void name(pTHX_ CV* cv __attribute__unused__)
+#    else
+#      ifdef __cplusplus
+#        define XS_EXTERNAL(name) extern "C" XSPROTO(name)
+#        define XS_INTERNAL(name) static XSPROTO(name)
+#      else
+#        define XS_EXTERNAL(name) XSPROTO(name)
+#        define XS_INTERNAL(name) STATIC XSPROTO(name)
+#      endif
+#    endif
+#  endif
+#endif
+
+/* perl >= 5.10.0 && perl <= 5.15.1 */
+
+
+/* The XS_EXTERNAL macro is used for functions that must not be static
+ * like the boot XSUB of a module. If perl didn't have an XS_EXTERNAL
+ * macro defined, the best we can do is assume XS is the same.
+ * Dito for XS_INTERNAL.
+ */
+#ifndef XS_EXTERNAL
+#  define XS_EXTERNAL(name) XS(name)
+#endif
+#ifndef XS_INTERNAL
+#  define XS_INTERNAL(name) XS(name)
+#endif
+
+/* Now, finally, after all this mess, we want an ExtUtils::ParseXS
+ * internal macro that we're free to redefine for varying linkage due
+ * to the EXPORT_XSUB_SYMBOLS XS keyword. This is internal, use
+ * XS_EXTERNAL(name) or XS_INTERNAL(name) in your code if you need to!
+ */
+
+#undef XS_EUPXS
+#if defined(PERL_EUPXS_ALWAYS_EXPORT)
+#  define XS_EUPXS(name) XS_EXTERNAL(name)
+#else
+   /* default to internal */
+#  define XS_EUPXS(name) XS_INTERNAL(name)
+#endif
+
+#ifndef PERL_ARGS_ASSERT_CROAK_XS_USAGE
+#define PERL_ARGS_ASSERT_CROAK_XS_USAGE assert(cv); assert(params)
+
+/* prototype to pass -Wmissing-prototypes */
+STATIC void
+S_croak_xs_usage(const CV *const cv, const char *const params);
+
+STATIC void
+S_croak_xs_usage(const CV *const cv, const char *const params)
+{
+    const GV *const gv = CvGV(cv);
+
+    PERL_ARGS_ASSERT_CROAK_XS_USAGE;
+
+    if (gv) {
+        const char *const gvname = GvNAME(gv);
+        const HV *const stash = GvSTASH(gv);
+        const char *const hvname = stash ? HvNAME(stash) : NULL;
+
+        if (hvname)
+	    Perl_croak_nocontext("Usage: %s::%s(%s)", hvname, gvname, params);
+        else
+	    Perl_croak_nocontext("Usage: %s(%s)", gvname, params);
+    } else {
+        /* Pants. I don't think that it should be possible to get here. */
+	Perl_croak_nocontext("Usage: CODE(0x%" UVxf ")(%s)", PTR2UV(cv), params);
+    }
+}
+#undef  PERL_ARGS_ASSERT_CROAK_XS_USAGE
+
+#define croak_xs_usage        S_croak_xs_usage
+
+#endif
+
+/* NOTE: the prototype of newXSproto() is different in versions of perls,
+ * so we define a portable version of newXSproto()
+ */
+#ifdef newXS_flags
+#define newXSproto_portable(name, c_impl, file, proto) newXS_flags(name, c_impl, file, proto, 0)
+#else
+#define newXSproto_portable(name, c_impl, file, proto) (PL_Sv=(SV*)newXS(name, c_impl, file), sv_setpv(PL_Sv, proto), (CV*)PL_Sv)
+#endif /* !defined(newXS_flags) */
+
+#if PERL_VERSION_LE(5, 21, 5)
+#  define newXS_deffile(a,b) Perl_newXS(aTHX_ a,b,file)
+#else
+#  define newXS_deffile(a,b) Perl_newXS_deffile(aTHX_ a,b)
+#endif
+
+#line 1066 "Cluster.c"
+
+XS_EUPXS(XS_Algorithm__Cluster__Node_new); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Node_new)
+{
+    dVAR; dXSARGS;
+    if (items != 4)
+       croak_xs_usage(cv,  "class, left, right, distance");
+    {
+	char*	class = (char *)SvPV_nolen(ST(0))
+;
+	int	left = (int)SvIV(ST(1))
+;
+	int	right = (int)SvIV(ST(2))
+;
+	double	distance = (double)SvNV(ST(3))
+;
+#line 922 "Cluster.xs"
+    Node* node;
+    SV* obj;
+#line 1086 "Cluster.c"
+	SV *	RETVAL;
+#line 925 "Cluster.xs"
+    node = malloc(sizeof(Node));
+    RETVAL = newSViv(0);
+    obj = newSVrv(RETVAL, class);
+    node->left = left;
+    node->right = right;
+    node->distance = distance;
+
+    sv_setiv(obj, PTR2IV(node));
+    SvREADONLY_on(obj);
+#line 1098 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Node_left); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Node_left)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV*	obj = ST(0)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 942 "Cluster.xs"
+    RETVAL = (INT2PTR(Node*,SvIV(SvRV(obj))))->left;
+#line 1119 "Cluster.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Node_right); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Node_right)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV*	obj = ST(0)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 950 "Cluster.xs"
+    RETVAL = (INT2PTR(Node*,SvIV(SvRV(obj))))->right;
+#line 1140 "Cluster.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Node_distance); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Node_distance)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV*	obj = ST(0)
+;
+	double	RETVAL;
+	dXSTARG;
+#line 958 "Cluster.xs"
+    RETVAL = (INT2PTR(Node*,SvIV(SvRV(obj))))->distance;
+#line 1161 "Cluster.c"
+	XSprePUSH;
+	PUSHn((double)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Node_set_left); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Node_set_left)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, left");
+    {
+	SV*	obj = ST(0)
+;
+	int	left = (int)SvIV(ST(1))
+;
+#line 967 "Cluster.xs"
+    Node* node;
+#line 1182 "Cluster.c"
+#line 969 "Cluster.xs"
+    if (!sv_isa(obj, "Algorithm::Cluster::Node")) {
+        croak("set_left should be applied to an Algorithm::Cluster::Node object");
+    }
+    node = INT2PTR(Node*,SvIV(SvRV(obj)));
+    node->left = left;
+#line 1189 "Cluster.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Node_set_right); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Node_set_right)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, right");
+    {
+	SV*	obj = ST(0)
+;
+	int	right = (int)SvIV(ST(1))
+;
+#line 980 "Cluster.xs"
+    Node* node;
+#line 1208 "Cluster.c"
+#line 982 "Cluster.xs"
+    if (!sv_isa(obj, "Algorithm::Cluster::Node")) {
+        croak("set_right should be applied to an Algorithm::Cluster::Node object");
+    }
+    node = INT2PTR(Node*,SvIV(SvRV(obj)));
+    node->right = right;
+#line 1215 "Cluster.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Node_set_distance); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Node_set_distance)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, distance");
+    {
+	SV*	obj = ST(0)
+;
+	double	distance = (double)SvNV(ST(1))
+;
+#line 993 "Cluster.xs"
+    Node* node;
+#line 1234 "Cluster.c"
+#line 995 "Cluster.xs"
+    if (!sv_isa(obj, "Algorithm::Cluster::Node")) {
+        croak("set_distance should be applied to an Algorithm::Cluster::Node object");
+    }
+    node = INT2PTR(Node*,SvIV(SvRV(obj)));
+    node->distance = distance;
+#line 1241 "Cluster.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Node_DESTROY); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Node_DESTROY)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV*	obj = ST(0)
+;
+#line 1004 "Cluster.xs"
+    I32* temp;
+    Node* node;
+#line 1261 "Cluster.c"
+#line 1007 "Cluster.xs"
+    temp = PL_markstack_ptr++;
+    node = INT2PTR(Node*, SvIV(SvRV(obj)));
+    free(node);
+    if (PL_markstack_ptr != temp) {
+        /* truly void, because dXSARGS not invoked */
+        PL_markstack_ptr = temp;
+        XSRETURN_EMPTY;
+        /* return empty stack */
+    }  /* must have used dXSARGS; list context implied */
+    return;  /* assume stack size is correct */
+#line 1273 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_new); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_new)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "class, nodes");
+    {
+	char*	class = (char *)SvPV_nolen(ST(0))
+;
+	SV*	nodes = ST(1)
+;
+#line 1028 "Cluster.xs"
+    Tree* tree;
+    SV* obj;
+        int i;
+    int n;
+    AV* array;
+    int* flag;
+
+#line 1299 "Cluster.c"
+	SV *	RETVAL;
+#line 1036 "Cluster.xs"
+    if(!SvROK(nodes) || SvTYPE(SvRV(nodes)) != SVt_PVAV) { 
+        croak("Algorithm::Cluster::Tree::new expects an array of nodes\n");
+    }
+    array = (AV *) SvRV(nodes);
+    n = (int) av_len(array) + 1;
+    tree = malloc(sizeof(Tree));
+    if (tree) {
+        tree->n = n;
+        tree->nodes = malloc(n*sizeof(Node));
+    }
+    if (! tree || !tree->nodes) {
+        if (tree) free(tree);
+        croak("Algorithm::Cluster::Tree::new memory error\n");
+    }
+
+        for (i = 0; i < n; i++) {
+        Node* node;
+        SV* node_ref = *(av_fetch(array, (I32) i, 0)); 
+        if (!sv_isa(node_ref, "Algorithm::Cluster::Node")) break;
+        node = INT2PTR(Node*,SvIV(SvRV(node_ref)));
+        tree->nodes[i].left = node->left;
+        tree->nodes[i].right = node->right;
+        tree->nodes[i].distance = node->distance;
+    }
+
+    if (i < n) {
+        /* break encountered */
+        free(tree->nodes);
+        free(tree);
+        croak("Algorithm::Cluster::Tree::new expects an array of nodes\n");
+    }
+
+    flag = malloc((2*n+1)*sizeof(int));
+    if(flag) {
+         int j;
+        for (i = 0; i < 2*n+1; i++) flag[i] = 0;
+        for (i = 0; i < n; i++) {
+            j = tree->nodes[i].left;
+            if (j < 0) {
+                j = -j-1;
+                if (j>=i) break;
+            }
+            else j+=n;
+            if (flag[j]) break;
+            flag[j] = 1;
+            j = tree->nodes[i].right;
+            if (j < 0) {
+                j = -j-1;
+                if (j>=i) break;
+            }
+            else j+=n;
+            if (flag[j]) break;
+            flag[j] = 1;
+        }
+        free(flag);
+    }
+
+    if (!flag || i < n) {
+        /* break encountered */
+        free(tree->nodes);
+        free(tree);
+        croak("the array of nodes passed to Algorithm::Cluster::Tree::new does not represent a valid tree\n");
+    }
+
+    RETVAL = newSViv(0);
+    obj = newSVrv(RETVAL, class);
+    sv_setiv(obj, PTR2IV(tree));
+    SvREADONLY_on(obj);
+
+#line 1371 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_length); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_length)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV*	obj = ST(0)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 1112 "Cluster.xs"
+    RETVAL = (INT2PTR(Tree*,SvIV(SvRV(obj))))->n;
+#line 1392 "Cluster.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_get); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_get)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, index");
+    {
+	SV*	obj = ST(0)
+;
+	int	index = (int)SvIV(ST(1))
+;
+#line 1122 "Cluster.xs"
+    Tree* tree;
+    Node* node;
+    SV* scalar;
+#line 1415 "Cluster.c"
+	SV *	RETVAL;
+#line 1126 "Cluster.xs"
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    if (index < 0 || index >= tree->n) {
+        croak("Index out of bounds in Algorithm::Cluster::Tree::get\n");
+    }
+    RETVAL = newSViv(0);
+    scalar = newSVrv(RETVAL, "Algorithm::Cluster::Node");
+    node = malloc(sizeof(Node));
+    if (!node) {
+        croak("Memory allocation failure in Algorithm::Cluster::Tree::get\n");
+    }
+    node->left = tree->nodes[index].left;
+    node->right = tree->nodes[index].right;
+    node->distance = tree->nodes[index].distance;
+    sv_setiv(scalar, PTR2IV(node));
+    SvREADONLY_on(scalar);
+#line 1433 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_node); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_node)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, index");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV*	obj = ST(0)
+;
+	int	index = (int)SvIV(ST(1))
+;
+#line 1149 "Cluster.xs"
+    Tree* tree;
+#line 1456 "Cluster.c"
+#line 1151 "Cluster.xs"
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    if (index < 0 || index >= tree->n) {
+        croak("Index out of bounds in Algorithm::Cluster::Tree::node\n");
+    }
+    EXTEND(SP, 3);
+    PUSHs(sv_2mortal(newSViv(tree->nodes[index].left)));
+    PUSHs(sv_2mortal(newSViv(tree->nodes[index].right)));
+    PUSHs(sv_2mortal(newSVnv(tree->nodes[index].distance)));
+#line 1466 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_lefts); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_lefts)
+{
+    dVAR; dXSARGS;
+    dXSI32;
+    if (items < 1 || items > 2)
+       croak_xs_usage(cv,  "obj, packed = 0");
+    {
+	SV*	obj = ST(0)
+;
+	int	packed;
+#line 1167 "Cluster.xs"
+    int i;
+    Tree* tree;
+#line 1487 "Cluster.c"
+	SV *	RETVAL;
+
+	if (items < 2)
+	    packed = 0;
+	else {
+	    packed = (int)SvIV(ST(1))
+;
+	}
+#line 1170 "Cluster.xs"
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    if (packed) {
+        int* values;
+        RETVAL = newSV(tree->n*sizeof(int)+1);
+        SvPOK_on(RETVAL);
+        SvCUR_set(RETVAL, tree->n*sizeof(int));
+        *SvEND(RETVAL) = '\0';
+        values = (int*) SvPVX(RETVAL);
+        if (ix==0) for (i = 0; i < tree->n; i++) values[i] = tree->nodes[i].left;
+        else for (i = 0; i < tree->n; i++) values[i] = tree->nodes[i].right;
+    }
+    else {
+        AV* values = newAV();
+        av_extend(values, tree->n);
+        if (ix==0) for (i = 0; i < tree->n; i++)
+            av_push(values, newSViv(tree->nodes[i].left));
+        else for (i = 0; i < tree->n; i++)
+            av_push(values, newSViv(tree->nodes[i].right));
+        RETVAL = newRV_noinc((SV*)values);
+    }
+#line 1517 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_distances); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_distances)
+{
+    dVAR; dXSARGS;
+    if (items < 1 || items > 2)
+       croak_xs_usage(cv,  "obj, packed = 0");
+    {
+	SV*	obj = ST(0)
+;
+	int	packed;
+#line 1198 "Cluster.xs"
+    int i;
+    Tree* tree;
+#line 1538 "Cluster.c"
+	SV *	RETVAL;
+
+	if (items < 2)
+	    packed = 0;
+	else {
+	    packed = (int)SvIV(ST(1))
+;
+	}
+#line 1201 "Cluster.xs"
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    if (packed) {
+        double* values;
+        RETVAL = newSV(tree->n*sizeof(double)+1);
+        SvPOK_on(RETVAL);
+        SvCUR_set(RETVAL, tree->n*sizeof(double));
+        *SvEND(RETVAL) = '\0';
+        values = (double*) SvPVX(RETVAL);
+        for (i = 0; i < tree->n; i++) values[i] = tree->nodes[i].distance;
+    }
+    else {
+        AV* values = newAV();
+        av_extend(values, tree->n);
+        for (i = 0; i < tree->n; i++)
+            av_push(values, newSVnv(tree->nodes[i].distance));
+        RETVAL = newRV_noinc((SV*)values);
+    }
+#line 1565 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_scale); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_scale)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV*	obj = ST(0)
+;
+#line 1225 "Cluster.xs"
+    int i;
+    int n;
+    Tree* tree;
+    Node* nodes;
+    double maximum;
+#line 1588 "Cluster.c"
+#line 1231 "Cluster.xs"
+    if (!sv_isa(obj, "Algorithm::Cluster::Tree")) {
+        croak("scale can only be applied to an Algorithm::Cluster::Tree object");
+    }
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    n = tree->n;
+    nodes = tree->nodes;
+    maximum = DBL_MIN;
+    for (i = 0; i < n; i++) {
+        double distance = nodes[i].distance;
+        if (distance > maximum) maximum = distance;
+    }
+    if (maximum!=0.0) {
+        for (i = 0; i < n; i++) nodes[i].distance /= maximum;
+    }
+#line 1604 "Cluster.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_cut); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_cut)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, nclusters");
+    {
+	SV*	obj = ST(0)
+;
+	int	nclusters = (int)SvIV(ST(1))
+;
+#line 1251 "Cluster.xs"
+    int i;
+    int n;
+    Tree* tree;
+    int* clusterid;
+#line 1626 "Cluster.c"
+	AV *	RETVAL;
+#line 1256 "Cluster.xs"
+    if (!sv_isa(obj, "Algorithm::Cluster::Tree")) {
+        croak("cut can only be applied to an Algorithm::Cluster::Tree object");
+    }
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    n = tree->n + 1;
+    if (nclusters < 1) {
+        croak("cut: Requested number of clusters should be positive");
+    }
+    if (nclusters > n) {
+        croak("cut: More clusters requested than items available");
+    }
+    clusterid = malloc(n*sizeof(int));
+    if (!clusterid) {
+        croak("cut: Insufficient memory");
+    }
+        /* --------------------------------------------------------------- */
+    cuttree(n, tree->nodes, nclusters, clusterid);
+    /* -- Check for errors flagged by the C routine ------------------ */
+    if (clusterid[0]==-1) {
+        free(clusterid);
+        croak("cut: Error in the cuttree routine");
+    }
+    RETVAL = newAV();
+    for(i=0; i<n; i++) {
+        av_push(RETVAL, newSVnv(clusterid[i]));
+    }
+    free(clusterid);
+    sv_2mortal((SV*)RETVAL);
+#line 1657 "Cluster.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_cuts); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_cuts)
+{
+    dVAR; dXSARGS;
+    if (items < 2 || items > 3)
+       croak_xs_usage(cv,  "obj, nclusters_ref, packed = 0");
+    {
+	SV*	obj = ST(0)
+;
+	SV*	nclusters_ref = ST(1)
+;
+	int	packed;
+#line 1294 "Cluster.xs"
+    int i;
+    int n;
+    int nlevels;
+    Tree* tree;
+    AV* nclusters_av;
+    int* nclusters;
+#line 1688 "Cluster.c"
+	AV *	RETVAL;
+
+	if (items < 3)
+	    packed = 0;
+	else {
+	    packed = (int)SvIV(ST(2))
+;
+	}
+#line 1301 "Cluster.xs"
+    if (!sv_isa(obj, "Algorithm::Cluster::Tree")) {
+        croak("cuts can only be applied to an Algorithm::Cluster::Tree object");
+    }
+    if (!SvROK(nclusters_ref) || SvTYPE(SvRV(nclusters_ref)) != SVt_PVAV) {
+        croak("cuts: Expected a reference to an array of numbers of clusters");
+    }
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    n = tree->n + 1;
+    nclusters_av = (AV*) SvRV(nclusters_ref);
+    nlevels = (int) av_len(nclusters_av) + 1;
+    nclusters = malloc((nlevels+1)*sizeof(int));
+    if (!nclusters) {
+        croak("cuts: Insufficient memory");
+    }
+    for (i = 0; i < nlevels; i++) {
+        const int k = (int) SvIV(*(av_fetch(nclusters_av, (I32) i, 0)));
+        if (k < 1 || k > n) {
+            free(nclusters);
+            if (k < 1)
+                croak("cuts: Requested number of clusters should be positive");
+            croak("cuts: More clusters requested than items available");
+        }
+        nclusters[i] = k;
+    }
+    RETVAL = cuts_c2perl(aTHX_ tree, nlevels, nclusters, packed);
+    free(nclusters);
+    sv_2mortal((SV*)RETVAL);
+#line 1725 "Cluster.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_cutthresholds); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_cutthresholds)
+{
+    dVAR; dXSARGS;
+    if (items < 2 || items > 3)
+       croak_xs_usage(cv,  "obj, thresholds_ref, packed = 0");
+    {
+	SV*	obj = ST(0)
+;
+	SV*	thresholds_ref = ST(1)
+;
+	int	packed;
+#line 1338 "Cluster.xs"
+    int i, j;
+    int n;
+    int nlevels;
+    Tree* tree;
+    AV* thresholds_av;
+    int* nclusters;
+#line 1756 "Cluster.c"
+	AV *	RETVAL;
+
+	if (items < 3)
+	    packed = 0;
+	else {
+	    packed = (int)SvIV(ST(2))
+;
+	}
+#line 1345 "Cluster.xs"
+    if (!sv_isa(obj, "Algorithm::Cluster::Tree")) {
+        croak("cutthresholds can only be applied to an Algorithm::Cluster::Tree object");
+    }
+    if (!SvROK(thresholds_ref) || SvTYPE(SvRV(thresholds_ref)) != SVt_PVAV) {
+        croak("cutthresholds: Expected a reference to an array of distances");
+    }
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    n = tree->n + 1;
+    thresholds_av = (AV*) SvRV(thresholds_ref);
+    nlevels = (int) av_len(thresholds_av) + 1;
+    nclusters = malloc((nlevels+1)*sizeof(int));
+    if (!nclusters) {
+        croak("cutthresholds: Insufficient memory");
+    }
+    /* Only the nodes joining subnodes at a distance larger than the
+     * threshold are cut. The number of clusters is then the number of
+     * nodes above the threshold plus one, provided that the distances do
+     * not decrease from one node to the next. This does not hold for
+     * centroid linkage, nor in general for approximate or sparse trees. */
+    for (j = 1; j < tree->n; j++) {
+        if (tree->nodes[j].distance < tree->nodes[j-1].distance) {
+            free(nclusters);
+            croak("cutthresholds: The node distances should not decrease; use cuts instead");
+        }
+    }
+    for (i = 0; i < nlevels; i++) {
+        const double threshold = SvNV(*(av_fetch(thresholds_av, (I32) i, 0)));
+        int k = n;
+        for (j = 0; j < tree->n; j++)
+            if (tree->nodes[j].distance <= threshold) k--;
+        nclusters[i] = k;
+    }
+    RETVAL = cuts_c2perl(aTHX_ tree, nlevels, nclusters, packed);
+    free(nclusters);
+    sv_2mortal((SV*)RETVAL);
+#line 1801 "Cluster.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_optimalorder); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_optimalorder)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, distances_ref");
+    {
+	SV*	obj = ST(0)
+;
+	SV*	distances_ref = ST(1)
+;
+#line 1388 "Cluster.xs"
+    int i;
+    int n;
+    int ok;
+    Tree* tree;
+    double** distances;
+    int* order;
+#line 1831 "Cluster.c"
+	AV *	RETVAL;
+#line 1395 "Cluster.xs"
+    if (!sv_isa(obj, "Algorithm::Cluster::Tree")) {
+        croak("optimalorder can only be applied to an Algorithm::Cluster::Tree object");
+    }
+    if (!SvROK(distances_ref) || SvTYPE(SvRV(distances_ref)) != SVt_PVAV) {
+        croak("optimalorder: Expected a reference to a distance matrix");
+    }
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    n = tree->n + 1;
+    if (av_len((AV*) SvRV(distances_ref)) + 1 != n) {
+        croak("optimalorder: Size of the distance matrix should be equal to the number of items");
+    }
+    distances = parse_distance(aTHX_ distances_ref, n);
+    if (!distances) {
+        croak("optimalorder: Error reading the distance matrix");
+    }
+    order = malloc(n*sizeof(int));
+    if (!order) {
+        free_ragged_matrix_dbl(distances, n);
+        croak("optimalorder: Insufficient memory");
+    }
+    ok = optimalleaforder(n, tree->nodes, distances, order);
+    free_ragged_matrix_dbl(distances, n);
+    if (!ok) {
+        free(order);
+        croak("optimalorder: Insufficient memory");
+    }
+    RETVAL = newAV();
+    for (i = 0; i < n; i++) {
+        av_push(RETVAL, newSViv(order[i]));
+    }
+    free(order);
+    sv_2mortal((SV*)RETVAL);
+#line 1866 "Cluster.c"
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__Tree_DESTROY); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__Tree_DESTROY)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV*	obj = ST(0)
+;
+#line 1433 "Cluster.xs"
+    I32* temp;
+    Tree* tree;
+#line 1892 "Cluster.c"
+#line 1436 "Cluster.xs"
+    temp = PL_markstack_ptr++;
+    tree = INT2PTR(Tree*, SvIV(SvRV(obj)));
+    free(tree->nodes);
+    free(tree);
+    if (PL_markstack_ptr != temp) {
+        /* truly void, because dXSARGS not invoked */
+        PL_markstack_ptr = temp;
+        XSRETURN_EMPTY;
+        /* return empty stack */
+    }  /* must have used dXSARGS; list context implied */
+    return;  /* assume stack size is correct */
+#line 1905 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__DataFile_DESTROY); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__DataFile_DESTROY)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV*	obj = ST(0)
+;
+#line 1455 "Cluster.xs"
+    I32* temp;
+    DataFile* datafile;
+#line 1926 "Cluster.c"
+#line 1458 "Cluster.xs"
+    temp = PL_markstack_ptr++;
+    datafile = INT2PTR(DataFile*, SvIV(SvRV(obj)));
+    closedatafile(datafile);
+    if (PL_markstack_ptr != temp) {
+        /* truly void, because dXSARGS not invoked */
+        PL_markstack_ptr = temp;
+        XSRETURN_EMPTY;
+        /* return empty stack */
+    }  /* must have used dXSARGS; list context implied */
+    return;  /* assume stack size is correct */
+#line 1938 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__version); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__version)
+{
+    dVAR; dXSARGS;
+    if (items != 0)
+       croak_xs_usage(cv,  "");
+    {
+	SV *	RETVAL;
+#line 1477 "Cluster.xs"
+    RETVAL = newSVpv( CLUSTERVERSION , 0);
+
+#line 1956 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__mean); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__mean)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "input");
+    {
+	SV *	input = ST(0)
+;
+#line 1489 "Cluster.xs"
+    int array_length;
+    double * data;  /* one-dimensional array of doubles */
+
+#line 1977 "Cluster.c"
+	SV *	RETVAL;
+#line 1493 "Cluster.xs"
+    if(SvTYPE(SvRV(input)) != SVt_PVAV) { 
+        XSRETURN_UNDEF;
+    }
+
+    data = malloc_row_perl2c_dbl (aTHX_ input, &array_length);
+    if (data) {
+        RETVAL = newSVnv( mean(array_length, data) );
+        free(data);
+    } else {
+        croak("memory allocation failure in _mean\n");
+    }
+
+#line 1992 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__median); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__median)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "input");
+    {
+	SV *	input = ST(0)
+;
+#line 1514 "Cluster.xs"
+    int array_length;
+    double * data;  /* one-dimensional array of doubles */
+
+#line 2013 "Cluster.c"
+	SV *	RETVAL;
+#line 1518 "Cluster.xs"
+    if(SvTYPE(SvRV(input)) != SVt_PVAV) { 
+        XSRETURN_UNDEF;
+    }
+
+    data = malloc_row_perl2c_dbl (aTHX_ input, &array_length);
+    if (data) {
+        RETVAL = newSVnv( median(array_length, data) );
+        free(data);
+    } else {
+        croak("memory allocation failure in _median\n");
+    }
+
+#line 2028 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__treecluster); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__treecluster)
+{
+    dVAR; dXSARGS;
+    if (items != 10)
+       croak_xs_usage(cv,  "nrows, ncols, data_ref, mask_ref, weight_ref, transpose, dist, method, nsummary, refine");
+    {
+	int	nrows = (int)SvIV(ST(0))
+;
+	int	ncols = (int)SvIV(ST(1))
+;
+	SV *	data_ref = ST(2)
+;
+	SV *	mask_ref = ST(3)
+;
+	SV *	weight_ref = ST(4)
+;
+	int	transpose = (int)SvIV(ST(5))
+;
+	char *	dist = (char *)SvPV_nolen(ST(6))
+;
+	char *	method = (char *)SvPV_nolen(ST(7))
+;
+	int	nsummary = (int)SvIV(ST(8))
+;
+	int	refine = (int)SvIV(ST(9))
+;
+#line 1548 "Cluster.xs"
+    Node*    nodes;
+
+    double  * weight = NULL;
+    double ** matrix = NULL;
+    int    ** mask   = NULL;
+    double ** distancematrix = NULL;
+    const int ndata = transpose ? nrows : ncols;
+    const int nelements = transpose ? ncols : nrows;
+
+#line 2073 "Cluster.c"
+	SV *	RETVAL;
+#line 1558 "Cluster.xs"
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most paramters.
+     */
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.  Also check for errors, and ignore the
+     * mask or the weight array if there are any errors. 
+     */
+    if (is_distance_matrix(aTHX_ data_ref)) {
+        distancematrix = parse_distance(aTHX_ data_ref, nelements);
+        if (!distancematrix) {
+                croak("memory allocation failure in _treecluster\n");
+        }
+    } else {
+        int ok;
+        ok = malloc_matrices(aTHX_ weight_ref, &weight, ndata, 
+                    data_ref,   &matrix,
+                    mask_ref,   &mask,  
+                    nrows,      ncols);
+        if (!ok) {
+            croak("failed to read input data for _treecluster\n");
+        }
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    if (matrix && nsummary > 0)
+        nodes = approxtreecluster(nrows, ncols, matrix, mask, weight,
+                    transpose, dist[0], method[0], nsummary, refine);
+    else
+        nodes = treecluster(nrows, ncols, matrix, mask, weight, transpose,
+                    dist[0], method[0], distancematrix);
+
+    /* ------------------------
+     * Check result to make sure we didn't run into memory problems
+     */
+    if(!nodes) {
+        /* treecluster failed due to insufficient memory */
+        if (matrix) {
+            free_matrix_int(mask,     nrows);
+            free_matrix_dbl(matrix,   nrows);
+            free(weight);
+        } else {
+            free_ragged_matrix_dbl(distancematrix, nelements);
+        }
+        croak("memory allocation failure in treecluster\n");
+    }
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    if (matrix) {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+    } else {
+        free_ragged_matrix_dbl(distancematrix, nelements);
+    }
+
+    /* ------------------------
+     * Convert the generated tree to a Perl object
+     */
+    RETVAL = tree_c2perl(aTHX_ nodes, nelements-1);
+    if (!RETVAL) {
+        free(nodes);
+        croak("Memory allocation failure in Algorithm::Cluster::Tree\n");
+    }
+
+    /* Finished _treecluster() */
+#line 2147 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__sparsetreecluster); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__sparsetreecluster)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "nelements, edges_ref, method");
+    {
+	int	nelements = (int)SvIV(ST(0))
+;
+	SV *	edges_ref = ST(1)
+;
+	char *	method = (char *)SvPV_nolen(ST(2))
+;
+#line 1640 "Cluster.xs"
+    Node*    nodes;
+    int      i;
+    int    * edgei;
+    int    * edgej;
+    double * edged;
+    AV     * edges_av = (AV *) SvRV(edges_ref);
+    const int nedges = (int) av_len(edges_av) + 1;
+
+#line 2177 "Cluster.c"
+	SV *	RETVAL;
+#line 1649 "Cluster.xs"
+    /* ------------------------
+     * Convert the edges from Perl to C. Each edge is a
+     * reference to an array [i, j, distance]; we rely on
+     * the Perl caller to check them.
+     */
+    edgei = malloc((nedges+1)*sizeof(int));
+    edgej = malloc((nedges+1)*sizeof(int));
+    edged = malloc((nedges+1)*sizeof(double));
+    if (!edgei || !edgej || !edged) {
+        if (edgei) free(edgei);
+        if (edgej) free(edgej);
+        if (edged) free(edged);
+        croak("memory allocation failure in _sparsetreecluster\n");
+    }
+    for (i = 0; i < nedges; i++) {
+        AV* edge_av = (AV *) SvRV(*(av_fetch(edges_av, (I32) i, 0)));
+        edgei[i] = (int) SvIV(*(av_fetch(edge_av, (I32) 0, 0)));
+        edgej[i] = (int) SvIV(*(av_fetch(edge_av, (I32) 1, 0)));
+        edged[i] = SvNV(*(av_fetch(edge_av, (I32) 2, 0)));
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    nodes = sparsetreecluster(nelements, nedges, edgei, edgej, edged,
+                method[0]);
+    free(edgei);
+    free(edgej);
+    free(edged);
+    if (!nodes) croak("memory allocation failure in sparsetreecluster\n");
+
+    /* ------------------------
+     * Convert the generated tree to a Perl object
+     */
+    RETVAL = tree_c2perl(aTHX_ nodes, nelements-1);
+    if (!RETVAL) {
+        free(nodes);
+        croak("Memory allocation failure in Algorithm::Cluster::Tree\n");
+    }
+
+    /* Finished _sparsetreecluster() */
+#line 2221 "Cluster.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__treeclusters); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__treeclusters)
+{
+    dVAR; dXSARGS;
+    if (items != 8)
+       croak_xs_usage(cv,  "nrows, ncols, data_ref, mask_ref, weight_ref, transpose, dist, methods");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nrows = (int)SvIV(ST(0))
+;
+	int	ncols = (int)SvIV(ST(1))
+;
+	SV *	data_ref = ST(2)
+;
+	SV *	mask_ref = ST(3)
+;
+	SV *	weight_ref = ST(4)
+;
+	int	transpose = (int)SvIV(ST(5))
+;
+	char *	dist = (char *)SvPV_nolen(ST(6))
+;
+	char *	methods = (char *)SvPV_nolen(ST(7))
+;
+#line 1705 "Cluster.xs"
+    Node**   trees;
+    int      ok;
+    int      i;
+
+    double  * weight = NULL;
+    double ** matrix = NULL;
+    int    ** mask   = NULL;
+    double ** distancematrix = NULL;
+    const int ndata = transpose ? nrows : ncols;
+    const int nelements = transpose ? ncols : nrows;
+    const int nmethods = strlen(methods);
+
+#line 2267 "Cluster.c"
+#line 1718 "Cluster.xs"
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl, as in _treecluster.
+     */
+    if (is_distance_matrix(aTHX_ data_ref)) {
+        distancematrix = parse_distance(aTHX_ data_ref, nelements);
+        if (!distancematrix) {
+                croak("memory allocation failure in _treeclusters\n");
+        }
+    } else {
+        ok = malloc_matrices(aTHX_ weight_ref, &weight, ndata, 
+                    data_ref,   &matrix,
+                    mask_ref,   &mask,  
+                    nrows,      ncols);
+        if (!ok) {
+            croak("failed to read input data for _treeclusters\n");
+        }
+    }
+
+    ok = 0;
+    trees = malloc(nmethods*sizeof(Node*));
+    if (trees) {
+        /* ------------------------
+         * Run the library function. The distance matrix is shared by
+         * all methods, and is not modified.
+         */
+        ok = treeclusters(nrows, ncols, matrix, mask, weight, transpose,
+                    dist[0], nmethods, methods, distancematrix, trees);
+    }
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    if (matrix) {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+    } else {
+        free_ragged_matrix_dbl(distancematrix, nelements);
+    }
+
+    if (!trees) croak("memory allocation failure in _treeclusters\n");
+    if (!ok) {
+        free(trees);
+        croak("memory allocation failure in treeclusters\n");
+    }
+
+    /* ------------------------
+     * Convert the generated trees to Perl objects
+     */
+    for (i = 0; i < nmethods; i++) {
+        SV* tree = tree_c2perl(aTHX_ trees[i], nelements-1);
+        if (!tree) {
+            while (i < nmethods) free(trees[i++]);
+            free(trees);
+            croak("Memory allocation failure in Algorithm::Cluster::Tree\n");
+        }
+        XPUSHs(sv_2mortal(tree));
+    }
+    free(trees);
+
+    /* Finished _treeclusters() */
+#line 2331 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__kcluster); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__kcluster)
+{
+    dVAR; dXSARGS;
+    if (items != 14)
+       croak_xs_usage(cv,  "nclusters, nrows, ncols, data_ref, mask_ref, weight_ref, transpose, npass, method, dist, init, initialid_ref, seed, callback_ref");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nclusters = (int)SvIV(ST(0))
+;
+	int	nrows = (int)SvIV(ST(1))
+;
+	int	ncols = (int)SvIV(ST(2))
+;
+	SV *	data_ref = ST(3)
+;
+	SV *	mask_ref = ST(4)
+;
+	SV *	weight_ref = ST(5)
+;
+	int	transpose = (int)SvIV(ST(6))
+;
+	int	npass = (int)SvIV(ST(7))
+;
+	char *	method = (char *)SvPV_nolen(ST(8))
+;
+	char *	dist = (char *)SvPV_nolen(ST(9))
+;
+	char *	init = (char *)SvPV_nolen(ST(10))
+;
+	SV *	initialid_ref = ST(11)
+;
+	unsigned long	seed = (unsigned long)SvUV(ST(12))
+;
+	SV *	callback_ref = ST(13)
+;
+#line 1800 "Cluster.xs"
+    SV  *    clusterid_ref;
+    int *    clusterid;
+    int      nobjects;
+    int      ndata;
+    double   error;
+    int      ifound;
+    int      ok;
+    ProgressCallback callback;
+
+    double  * weight;
+    double ** matrix;
+    int    ** mask;
+
+
+#line 2390 "Cluster.c"
+#line 1815 "Cluster.xs"
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most parameters.
+     */
+
+    /* ------------------------
+     * Malloc space for the return values from the library function
+     */
+    if (transpose==0) {
+        nobjects = nrows;
+        ndata = ncols;
+    } else {
+        nobjects = ncols;
+        ndata = nrows;
+    }
+    clusterid = malloc(nobjects * sizeof(int) );
+    if (!clusterid) {
+        croak("memory allocation failure in _kcluster\n");
+    }
+
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.  Also check for errors, and ignore the
+     * mask or the weight array if there are any errors. 
+     */
+    ok = malloc_matrices( aTHX_ weight_ref, &weight, ndata, 
+                data_ref,   &matrix,
+                mask_ref,   &mask,  
+                nrows,      ncols);
+    if (!ok) {
+        free(clusterid);
+        croak("failed to read input data for _kcluster\n");
+    }
+
+    /* ------------------------
+     * Copy initialid to clusterid, if needed
+     */
+
+    if (npass==0) {
+        copy_row_perl2c_int(aTHX_ initialid_ref, clusterid);
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
+    kcluster( 
+        nclusters, nrows, ncols, 
+        matrix, mask, weight, transpose,
+        npass, method[0], dist[0], init[0], seed, clusterid,  &error, &ifound,
+        callback.function ? call_perl_progress : NULL, &callback
+    );
+    SPAGAIN;
+    if (callback.error) {
+        free(clusterid);
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+
+    /* ------------------------
+     * Convert generated C matrices to Perl matrices
+     */
+    clusterid_ref =    row_c2perl_int(aTHX_ clusterid, nobjects);
+
+    /* ------------------------
+     * Push the new Perl matrices onto the return stack
+     */
+    XPUSHs(sv_2mortal( clusterid_ref   ));
+    XPUSHs(sv_2mortal( newSVnv(error) ));
+    XPUSHs(sv_2mortal( newSViv(ifound) ));
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    free(clusterid);
+    free_matrix_int(mask,     nrows);
+    free_matrix_dbl(matrix,   nrows);
+    free(weight);
+
+    /* Finished _kcluster() */
+#line 2477 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__kclustersweep); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__kclustersweep)
+{
+    dVAR; dXSARGS;
+    if (items != 13)
+       croak_xs_usage(cv,  "kmin, kmax, nrows, ncols, data_ref, mask_ref, weight_ref, transpose, npass, method, dist, init, seed");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	kmin = (int)SvIV(ST(0))
+;
+	int	kmax = (int)SvIV(ST(1))
+;
+	int	nrows = (int)SvIV(ST(2))
+;
+	int	ncols = (int)SvIV(ST(3))
+;
+	SV *	data_ref = ST(4)
+;
+	SV *	mask_ref = ST(5)
+;
+	SV *	weight_ref = ST(6)
+;
+	int	transpose = (int)SvIV(ST(7))
+;
+	int	npass = (int)SvIV(ST(8))
+;
+	char *	method = (char *)SvPV_nolen(ST(9))
+;
+	char *	dist = (char *)SvPV_nolen(ST(10))
+;
+	char *	init = (char *)SvPV_nolen(ST(11))
+;
+	unsigned long	seed = (unsigned long)SvUV(ST(12))
+;
+#line 1920 "Cluster.xs"
+    int **   clusterid;
+    double * error;
+    double * score;
+    int      nobjects;
+    int      ndata;
+    int      nk;
+    int      i;
+    int      ok;
+
+    double  * weight;
+    double ** matrix;
+    int    ** mask;
+
+
+#line 2534 "Cluster.c"
+#line 1935 "Cluster.xs"
+    /* ------------------------
+     * Malloc space for the return values from the library function
+     */
+    if (transpose==0) {
+        nobjects = nrows;
+        ndata = ncols;
+    } else {
+        nobjects = ncols;
+        ndata = nrows;
+    }
+    nk = kmax - kmin + 1;
+    clusterid = malloc(nk * sizeof(int*));
+    error = malloc(nk * sizeof(double));
+    score = malloc(nk * sizeof(double));
+    ok = clusterid && error && score;
+    if (clusterid) {
+        for (i = 0; i < nk; i++) {
+            clusterid[i] = ok ? malloc(nobjects * sizeof(int)) : NULL;
+            if (!clusterid[i]) ok = 0;
+        }
+    }
+    if (!ok) {
+        if (clusterid) {
+            for (i = 0; i < nk; i++) if (clusterid[i]) free(clusterid[i]);
+            free(clusterid);
+        }
+        if (error) free(error);
+        if (score) free(score);
+        croak("memory allocation failure in _kclustersweep\n");
+    }
+
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.
+     */
+    ok = malloc_matrices( aTHX_ weight_ref, &weight, ndata, 
+                data_ref,   &matrix,
+                mask_ref,   &mask,  
+                nrows,      ncols);
+    if (ok) {
+        /* ------------------------
+         * Run the library function
+         */
+        ok = kclustersweep(kmin, kmax, nrows, ncols, matrix, mask, weight,
+                           transpose, npass, method[0], dist[0], init[0],
+                           seed, clusterid, error, score);
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+    }
+
+    /* ------------------------
+     * Push the Perl matrices onto the return stack
+     */
+    if (ok) {
+        XPUSHs(sv_2mortal( matrix_c2perl_int(aTHX_ clusterid, nk, nobjects) ));
+        XPUSHs(sv_2mortal( row_c2perl_dbl(aTHX_ error, nk) ));
+        XPUSHs(sv_2mortal( row_c2perl_dbl(aTHX_ score, nk) ));
+    }
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    for (i = 0; i < nk; i++) free(clusterid[i]);
+    free(clusterid);
+    free(error);
+    free(score);
+    if (!ok) croak("kclustersweep failed\n");
+
+    /* Finished _kclustersweep() */
+#line 2606 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__minibatchkcluster); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__minibatchkcluster)
+{
+    dVAR; dXSARGS;
+    if (items != 14)
+       croak_xs_usage(cv,  "nclusters, nrows, ncols, data_ref, mask_ref, weight_ref, transpose, npass, dist, batchsize, niter, initialid_ref, seed, callback_ref");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nclusters = (int)SvIV(ST(0))
+;
+	int	nrows = (int)SvIV(ST(1))
+;
+	int	ncols = (int)SvIV(ST(2))
+;
+	SV *	data_ref = ST(3)
+;
+	SV *	mask_ref = ST(4)
+;
+	SV *	weight_ref = ST(5)
+;
+	int	transpose = (int)SvIV(ST(6))
+;
+	int	npass = (int)SvIV(ST(7))
+;
+	char *	dist = (char *)SvPV_nolen(ST(8))
+;
+	int	batchsize = (int)SvIV(ST(9))
+;
+	int	niter = (int)SvIV(ST(10))
+;
+	SV *	initialid_ref = ST(11)
+;
+	unsigned long	seed = (unsigned long)SvUV(ST(12))
+;
+	SV *	callback_ref = ST(13)
+;
+#line 2026 "Cluster.xs"
+    int *    clusterid;
+    int      nobjects;
+    int      ndata;
+    double   error;
+    int      ifound;
+    int      ok;
+    RowSource source;
+    ProgressCallback callback;
+    double  * weight = NULL;
+    double ** matrix = NULL;
+    int    ** mask = NULL;
+
+#line 2663 "Cluster.c"
+#line 2039 "Cluster.xs"
+    /* ------------------------
+     * The rows are either read from the data matrix, or obtained by
+     * calling the function passed by the Perl caller. The Perl caller
+     * checks the parameters.
+     */
+    if (transpose==0) {
+        nobjects = nrows;
+        ndata = ncols;
+    } else {
+        nobjects = ncols;
+        ndata = nrows;
+    }
+    clusterid = malloc(nobjects * sizeof(int) );
+    if (!clusterid) {
+        croak("memory allocation failure in _minibatchkcluster\n");
+    }
+    source.matrix.transpose = transpose;
+    source.matrix.ndata = ndata;
+    source.function = NULL;
+    source.error = NULL;
+    if (SvROK(data_ref) && SvTYPE(SvRV(data_ref)) == SVt_PVCV) {
+        source.function = data_ref;
+        if (SvROK(weight_ref) && SvTYPE(SvRV(weight_ref)) == SVt_PVAV) {
+            weight = malloc_row_perl2c_dbl(aTHX_ weight_ref, NULL);
+        } else {
+            weight = malloc_row_dbl(aTHX_ ndata, 1.0);
+        }
+        ok = (weight != NULL);
+    } else {
+        ok = malloc_matrices( aTHX_ weight_ref, &weight, ndata,
+                    data_ref,   &matrix,
+                    mask_ref,   &mask,
+                    nrows,      ncols);
+    }
+    if (!ok) {
+        free(clusterid);
+        croak("failed to read input data for _minibatchkcluster\n");
+    }
+    source.matrix.data = matrix;
+    source.matrix.mask = mask;
+
+    if (npass==0) {
+        copy_row_perl2c_int(aTHX_ initialid_ref, clusterid);
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl functions may be called, which use the Perl stack */
+    PUTBACK;
+    minibatchkcluster(nclusters, nobjects, ndata,
+                      source.function ? get_perl_rows : getdatarows,
+                      source.function ? (void*)&source : (void*)&source.matrix,
+                      weight, dist[0], batchsize, niter, npass,
+                      seed, clusterid, &error, &ifound,
+                      callback.function ? call_perl_progress : NULL,
+                      &callback);
+    SPAGAIN;
+
+    free(weight);
+    if (matrix) {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+    }
+    if (ifound < 0) {
+        free(clusterid);
+        if (source.error) {
+            sv_2mortal(source.error);
+            croak("%s", SvPV_nolen(source.error));
+        }
+        croak("memory allocation failure in _minibatchkcluster\n");
+    }
+    if (callback.error) {
+        free(clusterid);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+
+    XPUSHs(sv_2mortal( row_c2perl_int(aTHX_ clusterid, nobjects) ));
+    XPUSHs(sv_2mortal( newSVnv(error) ));
+    XPUSHs(sv_2mortal( newSViv(ifound) ));
+    free(clusterid);
+
+    /* Finished _minibatchkcluster() */
+#line 2750 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__opendatafile); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__opendatafile)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "filename, format");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	char *	filename = (char *)SvPV_nolen(ST(0))
+;
+	char *	format = (char *)SvPV_nolen(ST(1))
+;
+#line 2132 "Cluster.xs"
+    DataFile* datafile;
+    SV *     ref;
+    SV *     obj;
+    int      nrows;
+    int      ncols;
+
+#line 2777 "Cluster.c"
+#line 2139 "Cluster.xs"
+    /* ------------------------
+     * The file is scanned once when it is opened; the DataFile object is
+     * then passed to _streamkcluster, and closed when it goes out of scope.
+     */
+    datafile = opendatafile(filename, format[0]);
+    if (!datafile) {
+        croak("failed to read data file %s\n", filename);
+    }
+    datafileshape(datafile, &nrows, &ncols);
+    ref = newSViv(0);
+    obj = newSVrv(ref, "Algorithm::Cluster::DataFile");
+    sv_setiv(obj, PTR2IV(datafile));
+    SvREADONLY_on(obj);
+    XPUSHs(sv_2mortal( ref ));
+    XPUSHs(sv_2mortal( newSViv(nrows) ));
+    XPUSHs(sv_2mortal( newSViv(ncols) ));
+
+    /* Finished _opendatafile() */
+#line 2797 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__streamkcluster); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__streamkcluster)
+{
+    dVAR; dXSARGS;
+    if (items != 11)
+       croak_xs_usage(cv,  "datafile_ref, nclusters, npass, method, dist, batchsize, niter, weight_ref, initialid_ref, seed, callback_ref");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	datafile_ref = ST(0)
+;
+	int	nclusters = (int)SvIV(ST(1))
+;
+	int	npass = (int)SvIV(ST(2))
+;
+	char *	method = (char *)SvPV_nolen(ST(3))
+;
+	char *	dist = (char *)SvPV_nolen(ST(4))
+;
+	int	batchsize = (int)SvIV(ST(5))
+;
+	int	niter = (int)SvIV(ST(6))
+;
+	SV *	weight_ref = ST(7)
+;
+	SV *	initialid_ref = ST(8)
+;
+	unsigned long	seed = (unsigned long)SvUV(ST(9))
+;
+	SV *	callback_ref = ST(10)
+;
+#line 2174 "Cluster.xs"
+    DataFile* datafile;
+    const double* fileweight;
+    int *    clusterid;
+    int      nrows;
+    int      ncols;
+    int      i;
+    double   error;
+    int      ifound;
+    double * weight = NULL;
+    ProgressCallback callback;
+
+#line 2847 "Cluster.c"
+#line 2186 "Cluster.xs"
+    /* ------------------------
+     * The rows are read from the data file in batches; only the
+     * cluster assignments and the cluster centers are kept in memory.
+     * The Perl caller checks that the weights match the file.
+     */
+    if (!sv_isa(datafile_ref, "Algorithm::Cluster::DataFile")) {
+        croak("_streamkcluster can only be applied to an Algorithm::Cluster::DataFile object");
+    }
+    datafile = INT2PTR(DataFile*, SvIV(SvRV(datafile_ref)));
+    datafileshape(datafile, &nrows, &ncols);
+    clusterid = malloc(nrows * sizeof(int));
+    if (!clusterid) {
+        croak("memory allocation failure in _streamkcluster\n");
+    }
+    /* Use the weights passed by the caller, or the EWEIGHT line */
+    if (SvROK(weight_ref) && SvTYPE(SvRV(weight_ref)) == SVt_PVAV) {
+        weight = malloc_row_perl2c_dbl(aTHX_ weight_ref, NULL);
+    } else {
+        fileweight = datafileweight(datafile);
+        weight = malloc_row_dbl(aTHX_ ncols, 1.0);
+        if (weight && fileweight) {
+            for (i = 0; i < ncols; i++) weight[i] = fileweight[i];
+        }
+    }
+    if (!weight) {
+        free(clusterid);
+        croak("memory allocation failure in _streamkcluster\n");
+    }
+
+    if (npass==0) {
+        copy_row_perl2c_int(aTHX_ initialid_ref, clusterid);
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
+    if (method[0]=='b')
+        minibatchkcluster(nclusters, nrows, ncols, getdatafilerows, datafile,
+                          weight, dist[0], batchsize, niter, npass,
+                          seed, clusterid, &error, &ifound,
+                          callback.function ? call_perl_progress : NULL,
+                          &callback);
+    else
+        streamkcluster(nclusters, nrows, ncols, getdatafilerows, datafile,
+                       weight, dist[0], npass, seed, clusterid, &error,
+                       &ifound,
+                       callback.function ? call_perl_progress : NULL,
+                       &callback);
+    SPAGAIN;
+
+    free(weight);
+    if (ifound < 0) {
+        free(clusterid);
+        croak("failed to read data file, or memory allocation failure in _streamkcluster\n");
+    }
+    if (callback.error) {
+        free(clusterid);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+
+    XPUSHs(sv_2mortal( row_c2perl_int(aTHX_ clusterid, nrows) ));
+    XPUSHs(sv_2mortal( newSVnv(error) ));
+    XPUSHs(sv_2mortal( newSViv(ifound) ));
+    free(clusterid);
+
+    /* Finished _streamkcluster() */
+#line 2919 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__kmedoids); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__kmedoids)
+{
+    dVAR; dXSARGS;
+    if (items != 7)
+       croak_xs_usage(cv,  "nclusters, nobjects, distancematrix_ref, npass, initialid_ref, seed, callback_ref");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nclusters = (int)SvIV(ST(0))
+;
+	int	nobjects = (int)SvIV(ST(1))
+;
+	SV *	distancematrix_ref = ST(2)
+;
+	int	npass = (int)SvIV(ST(3))
+;
+	SV *	initialid_ref = ST(4)
+;
+	unsigned long	seed = (unsigned long)SvUV(ST(5))
+;
+	SV *	callback_ref = ST(6)
+;
+#line 2270 "Cluster.xs"
+    double** distancematrix;
+    SV  *    clusterid_ref;
+    int *    clusterid;
+    double   error;
+    int      ifound;
+    ProgressCallback callback;
+
+
+
+#line 2959 "Cluster.c"
+#line 2280 "Cluster.xs"
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most parameters.
+     */
+
+    /* ------------------------
+     * Malloc space for the return values from the library function
+     */
+    clusterid = malloc(nobjects * sizeof(int));
+    if (!clusterid) {
+        croak("memory allocation failure in _kmedoids\n");
+    }
+
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.  Also check for errors, and ignore the
+     * mask or the weight array if there are any errors. 
+     */
+    distancematrix = parse_distance(aTHX_ distancematrix_ref, nobjects);
+    if (!distancematrix) {
+        free(clusterid);
+            croak("failed to allocate memory for distance matrix in _kmedoids\n");
+    }
+
+    /* ------------------------
+     * Copy initialid to clusterid, if needed
+     */
+
+    if (npass==0) {
+        copy_row_perl2c_int(aTHX_ initialid_ref, clusterid);
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
+    kmedoids( 
+        nclusters, nobjects, 
+        distancematrix, npass, seed, clusterid, 
+        &error, &ifound,
+        callback.function ? call_perl_progress : NULL, &callback
+    );
+    SPAGAIN;
+    if (callback.error) {
+        free(clusterid);
+        free_ragged_matrix_dbl(distancematrix, nobjects);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+
+    if(ifound==-1) {
+        free(clusterid);
+        free_ragged_matrix_dbl(distancematrix, nobjects);
+            croak("memory allocation failure in _kmedoids\n");
+    }
+    else if(ifound==0) {
+        free(clusterid);
+        free_ragged_matrix_dbl(distancematrix, nobjects);
+            croak("error in input arguments in kmedoids\n");
+    }
+    else {
+
+        /* ------------------------
+         * Convert generated C matrices to Perl matrices
+         */
+        clusterid_ref =    row_c2perl_int(aTHX_ clusterid, nobjects);
+
+        /* ------------------------
+         * Push the new Perl matrices onto the return stack
+         */
+        XPUSHs(sv_2mortal( clusterid_ref   ));
+        XPUSHs(sv_2mortal( newSVnv(error) ));
+        XPUSHs(sv_2mortal( newSViv(ifound) ));
+
+    }
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    free(clusterid);
+    free_ragged_matrix_dbl(distancematrix, nobjects);
+
+    /* Finished _kmedoids() */
+#line 3045 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__pam); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__pam)
+{
+    dVAR; dXSARGS;
+    if (items != 4)
+       croak_xs_usage(cv,  "nclusters, nobjects, distancematrix_ref, callback_ref");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nclusters = (int)SvIV(ST(0))
+;
+	int	nobjects = (int)SvIV(ST(1))
+;
+	SV *	distancematrix_ref = ST(2)
+;
+	SV *	callback_ref = ST(3)
+;
+#line 2376 "Cluster.xs"
+    double** distancematrix;
+    SV  *    clusterid_ref;
+    int *    clusterid;
+    double   error;
+    int      ok;
+    ProgressCallback callback;
+
+
+
+#line 3079 "Cluster.c"
+#line 2386 "Cluster.xs"
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most parameters.
+     */
+
+    /* ------------------------
+     * Malloc space for the return values from the library function
+     */
+    clusterid = malloc(nobjects * sizeof(int));
+    if (!clusterid) {
+        croak("memory allocation failure in _pam\n");
+    }
+
+    distancematrix = parse_distance(aTHX_ distancematrix_ref, nobjects);
+    if (!distancematrix) {
+        free(clusterid);
+        croak("failed to allocate memory for distance matrix in _pam\n");
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
+    ok = pam(nclusters, nobjects, distancematrix, clusterid, &error,
+             callback.function ? call_perl_progress : NULL, &callback);
+    SPAGAIN;
+    free_ragged_matrix_dbl(distancematrix, nobjects);
+    if (callback.error) {
+        free(clusterid);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+    if (!ok) {
+        free(clusterid);
+        croak("memory allocation failure in _pam\n");
+    }
+
+    /* ------------------------
+     * Convert generated C matrices to Perl matrices
+     */
+    clusterid_ref = row_c2perl_int(aTHX_ clusterid, nobjects);
+    free(clusterid);
+
+    /* ------------------------
+     * Push the new Perl matrices onto the return stack
+     */
+    XPUSHs(sv_2mortal( clusterid_ref   ));
+    XPUSHs(sv_2mortal( newSVnv(error) ));
+
+    /* Finished _pam() */
+#line 3133 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__clusterdistance); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__clusterdistance)
+{
+    dVAR; dXSARGS;
+    if (items != 12)
+       croak_xs_usage(cv,  "nrows, ncols, data_ref, mask_ref, weight_ref, cluster1_len, cluster2_len, cluster1_ref, cluster2_ref, dist, method, transpose");
+    {
+	int	nrows = (int)SvIV(ST(0))
+;
+	int	ncols = (int)SvIV(ST(1))
+;
+	SV *	data_ref = ST(2)
+;
+	SV *	mask_ref = ST(3)
+;
+	SV *	weight_ref = ST(4)
+;
+	int	cluster1_len = (int)SvIV(ST(5))
+;
+	int	cluster2_len = (int)SvIV(ST(6))
+;
+	SV *	cluster1_ref = ST(7)
+;
+	SV *	cluster2_ref = ST(8)
+;
+	char *	dist = (char *)SvPV_nolen(ST(9))
+;
+	char *	method = (char *)SvPV_nolen(ST(10))
+;
+	int	transpose = (int)SvIV(ST(11))
+;
+#line 2457 "Cluster.xs"
+    int   nweights;
+
+    int     * cluster1;
+    int     * cluster2;
+
+    double  * weight;
+    double ** matrix;
+    int    ** mask;
+
+    double distance;
+
+    int ok;
+
+#line 3185 "Cluster.c"
+	double	RETVAL;
+	dXSTARG;
+#line 2472 "Cluster.xs"
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most paramters.
+     */
+
+    /* ------------------------
+     * Convert cluster index Perl arrays to C arrays
+     */
+    cluster1 = malloc_row_perl2c_int(aTHX_ cluster1_ref);
+    cluster2 = malloc_row_perl2c_int(aTHX_ cluster2_ref);
+    if (!cluster1 || !cluster2) {
+        if (cluster1) free(cluster1);
+        if (cluster2) free(cluster2);
+        croak("memory allocation failure in _clusterdistance\n");
+    }
+
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.  Also check for errors, and ignore the
+     * mask or the weight array if there are any errors. 
+     * Set nweights to the correct number of weights.
+     */
+    nweights = (transpose==0) ? ncols : nrows;
+    ok = malloc_matrices( aTHX_ weight_ref, &weight, nweights, 
+                data_ref,   &matrix,
+                mask_ref,   &mask,  
+                nrows,      ncols);
+    if (!ok) {
+        free(cluster1);
+        free(cluster2);
+            croak("failed to read input data for _clusterdistance\n");
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    distance = clusterdistance( 
+        nrows, ncols, 
+        matrix, mask, weight,
+        cluster1_len, cluster2_len, cluster1, cluster2,
+        dist[0], method[0], transpose
+    );
+
+    RETVAL = distance;
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    free_matrix_int(mask,     nrows);
+    free_matrix_dbl(matrix,   nrows);
+    free(weight);
+    free(cluster1);
+    free(cluster2);
+
+    /* Finished _clusterdistance() */
+
+#line 3245 "Cluster.c"
+	XSprePUSH;
+	PUSHn((double)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__clustercentroids); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__clustercentroids)
+{
+    dVAR; dXSARGS;
+    if (items != 8)
+       croak_xs_usage(cv,  "nclusters, nrows, ncols, data_ref, mask_ref, clusterid_ref, transpose, method");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nclusters = (int)SvIV(ST(0))
+;
+	int	nrows = (int)SvIV(ST(1))
+;
+	int	ncols = (int)SvIV(ST(2))
+;
+	SV *	data_ref = ST(3)
+;
+	SV *	mask_ref = ST(4)
+;
+	SV *	clusterid_ref = ST(5)
+;
+	int	transpose = (int)SvIV(ST(6))
+;
+	char *	method = (char *)SvPV_nolen(ST(7))
+;
+#line 2545 "Cluster.xs"
+    SV  *    cdata_ref;
+    SV  *    cmask_ref;
+    int     * clusterid;
+
+    double ** matrix;
+    int    ** mask;
+
+    double ** cdata;
+    int    ** cmask;
+    int       cnrows = 0; /* Initialize to make the compiler shut up */
+    int       cncols = 0; /* Initialize to make the compiler shut up */
+
+    int i;
+    int ok;
+
+#line 3294 "Cluster.c"
+#line 2562 "Cluster.xs"
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most paramters.
+     */
+        if (transpose==0)
+        {    cnrows = nclusters;
+             cncols = ncols;
+        }
+        else if (transpose==1)
+        {    cnrows = nrows;
+             cncols = nclusters;
+        }
+
+    /* ------------------------
+     * Convert cluster index Perl arrays to C arrays
+     */
+    clusterid = malloc_row_perl2c_int(aTHX_ clusterid_ref);
+    if (!clusterid) {
+        croak("memory allocation failure in _clustercentroids\n");
+    }
+
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.  Also check for errors, and ignore the
+     * mask or the weight array if there are any errors. 
+     * Set nweights to the correct number of weights.
+     */
+    ok = malloc_matrices( aTHX_ NULL, NULL, 0, 
+                data_ref,   &matrix,
+                mask_ref,   &mask,  
+                nrows,      ncols);
+    if (!ok) {
+        free(clusterid);
+            croak("failed to read input data for _clustercentroids\n");
+    }
+
+
+    /* ------------------------
+     * Create the output variables cdata and cmask.
+     */
+    i = 0;
+    cdata = malloc(cnrows * sizeof(double*));
+    cmask = malloc(cnrows * sizeof(int*));
+    if (cdata && cmask) {
+        for ( ; i < cnrows; i++) {
+            cdata[i] = malloc(cncols*sizeof(double));
+            cmask[i] = malloc(cncols*sizeof(int));
+            if (!cdata[i] || !cmask[i]) break;
+        }
+    }
+    if (i < cnrows)
+    {
+        if (cdata[i]) free(cdata[i]);
+        if (cmask[i]) free(cmask[i]);
+        while (--i >= 0) {
+            free(cdata[i]);
+            free(cmask[i]);
+        }
+        if (cdata) free(cdata);
+        if (cmask) free(cmask);
+        free(clusterid);
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        croak("memory allocation failure in _clustercentroids\n");
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    ok = getclustercentroids(
+               nclusters, nrows, ncols,
+               matrix, mask, clusterid,
+               cdata, cmask, transpose, method[0]);
+
+    if (ok) {
+            /* ------------------------
+             * Convert generated C matrices to Perl matrices
+             */
+            cdata_ref = matrix_c2perl_dbl(aTHX_ cdata, cnrows, cncols);
+            cmask_ref = matrix_c2perl_int(aTHX_ cmask, cnrows, cncols);
+
+            /* ------------------------
+             * Push the new Perl matrices onto the return stack
+             */
+            XPUSHs(sv_2mortal( cdata_ref   ));
+            XPUSHs(sv_2mortal( cmask_ref   ));
+    }
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    free_matrix_int(mask,     nrows);
+    free_matrix_dbl(matrix,   nrows);
+    free_matrix_int(cmask,    cnrows);
+    free_matrix_dbl(cdata,    cnrows);
+    free(clusterid);
+
+    if (!ok) {
+        croak("memory allocation failure in _clustercentroids\n");
+    }
+    /* Finished _clustercentroids() */
+#line 3397 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__distancematrix); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__distancematrix)
+{
+    dVAR; dXSARGS;
+    if (items != 7)
+       croak_xs_usage(cv,  "nrows, ncols, data_ref, mask_ref, weight_ref, transpose, dist");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nrows = (int)SvIV(ST(0))
+;
+	int	ncols = (int)SvIV(ST(1))
+;
+	SV *	data_ref = ST(2)
+;
+	SV *	mask_ref = ST(3)
+;
+	SV *	weight_ref = ST(4)
+;
+	int	transpose = (int)SvIV(ST(5))
+;
+	char *	dist = (char *)SvPV_nolen(ST(6))
+;
+#line 2675 "Cluster.xs"
+    SV  *    matrix_ref;
+    int      nobjects;
+    int      ndata;
+
+    double ** data;
+    int    ** mask;
+    double  * weight;
+    double ** matrix;
+
+    int       ok;
+
+
+#line 3440 "Cluster.c"
+#line 2688 "Cluster.xs"
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most parameters.
+     */
+
+    /* ------------------------
+     * Malloc space for the return values from the library function
+     */
+        if (transpose==0) {
+        nobjects = nrows;
+        ndata = ncols;
+    } else {
+        nobjects = ncols;
+        ndata = nrows;
+    }
+
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.  Also check for errors, and ignore the
+     * mask or the weight array if there are any errors. 
+     */
+    ok = malloc_matrices( aTHX_
+        weight_ref, &weight, ndata, 
+        data_ref,   &data,
+        mask_ref,   &mask,  
+        nrows,      ncols
+    );
+    if (!ok) {
+        croak("failed to read input data for _distancematrix");
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+        matrix = distancematrix (nrows,
+                                 ncols,
+                                 data,
+                                 mask,
+                                 weight,
+                                 dist[0],
+                                 transpose);
+
+    /* ------------------------
+     * Convert generated C matrices to Perl matrices
+     */
+    matrix_ref  = ragged_matrix_c2perl_dbl(aTHX_ matrix,  nobjects);
+
+    /* ------------------------
+     * Push the new Perl matrices onto the return stack
+     */
+    XPUSHs(sv_2mortal(matrix_ref));
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    free_ragged_matrix_dbl(matrix, nobjects);
+    free_matrix_int(mask, nrows);
+    free_matrix_dbl(data, nrows);
+    free(weight);
+
+    /* Finished _distancematrix() */
+#line 3503 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__silhouette); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__silhouette)
+{
+    dVAR; dXSARGS;
+    if (items != 10)
+       croak_xs_usage(cv,  "nclusters, nrows, ncols, data_ref, mask_ref, weight_ref, transpose, dist, distancematrix_ref, clusterid_ref");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nclusters = (int)SvIV(ST(0))
+;
+	int	nrows = (int)SvIV(ST(1))
+;
+	int	ncols = (int)SvIV(ST(2))
+;
+	SV *	data_ref = ST(3)
+;
+	SV *	mask_ref = ST(4)
+;
+	SV *	weight_ref = ST(5)
+;
+	int	transpose = (int)SvIV(ST(6))
+;
+	char *	dist = (char *)SvPV_nolen(ST(7))
+;
+	SV *	distancematrix_ref = ST(8)
+;
+	SV *	clusterid_ref = ST(9)
+;
+#line 2765 "Cluster.xs"
+    int *    clusterid;
+    double * widths;
+    double   average;
+    int      nobjects;
+    int      ndata;
+    int      ok;
+
+    double  * weight = NULL;
+    double ** matrix = NULL;
+    int    ** mask = NULL;
+    double ** distancematrix = NULL;
+
+
+#line 3553 "Cluster.c"
+#line 2779 "Cluster.xs"
+    /* ------------------------
+     * The distances are taken from the distance matrix if it is
+     * given, and calculated from the data otherwise.
+     */
+    if (SvROK(distancematrix_ref)) {
+        nobjects = nrows;
+        ndata = 0;
+    } else if (transpose==0) {
+        nobjects = nrows;
+        ndata = ncols;
+    } else {
+        nobjects = ncols;
+        ndata = nrows;
+    }
+    clusterid = malloc(nobjects * sizeof(int));
+    widths = malloc(nobjects * sizeof(double));
+    if (!clusterid || !widths) {
+        if (clusterid) free(clusterid);
+        if (widths) free(widths);
+        croak("memory allocation failure in _silhouette\n");
+    }
+    copy_row_perl2c_int(aTHX_ clusterid_ref, clusterid);
+
+    if (SvROK(distancematrix_ref)) {
+        distancematrix = parse_distance(aTHX_ distancematrix_ref, nobjects);
+        ok = distancematrix ? 1 : 0;
+    } else {
+        ok = malloc_matrices( aTHX_ weight_ref, &weight, ndata, 
+                    data_ref,   &matrix,
+                    mask_ref,   &mask,  
+                    nrows,      ncols);
+    }
+    if (!ok) {
+        free(clusterid);
+        free(widths);
+        croak("failed to read input data for _silhouette\n");
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    ok = silhouette(nclusters, nrows, ncols, matrix, mask, weight, transpose,
+                    dist[0], distancematrix, clusterid, widths, &average);
+
+    /* ------------------------
+     * Push the results onto the return stack
+     */
+    if (ok) {
+        XPUSHs(sv_2mortal( row_c2perl_dbl(aTHX_ widths, nobjects) ));
+        XPUSHs(sv_2mortal( newSVnv(average) ));
+    }
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    free(clusterid);
+    free(widths);
+    if (distancematrix) {
+        free_ragged_matrix_dbl(distancematrix, nobjects);
+    } else {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+    }
+    if (!ok) croak("memory allocation failure in _silhouette\n");
+
+    /* Finished _silhouette() */
+#line 3622 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__somcluster); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__somcluster)
+{
+    dVAR; dXSARGS;
+    if (items != 13)
+       croak_xs_usage(cv,  "nrows, ncols, data_ref, mask_ref, weight_ref, transpose, nxgrid, nygrid, inittau, niter, dist, seed, callback_ref");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nrows = (int)SvIV(ST(0))
+;
+	int	ncols = (int)SvIV(ST(1))
+;
+	SV *	data_ref = ST(2)
+;
+	SV *	mask_ref = ST(3)
+;
+	SV *	weight_ref = ST(4)
+;
+	int	transpose = (int)SvIV(ST(5))
+;
+	int	nxgrid = (int)SvIV(ST(6))
+;
+	int	nygrid = (int)SvIV(ST(7))
+;
+	double	inittau = (double)SvNV(ST(8))
+;
+	int	niter = (int)SvIV(ST(9))
+;
+	char *	dist = (char *)SvPV_nolen(ST(10))
+;
+	unsigned long	seed = (unsigned long)SvUV(ST(11))
+;
+	SV *	callback_ref = ST(12)
+;
+#line 2866 "Cluster.xs"
+    int      (*clusterid)[2];
+    SV *  clusterid_ref;
+    double*** celldata;
+
+    double  * weight;
+    double ** matrix;
+    int    ** mask;
+
+    int ok;
+    ProgressCallback callback;
+
+    int i;
+    AV * matrix_av;
+    const int ndata = transpose ? nrows : ncols;
+    const int nelements = transpose ? ncols : nrows;
+
+#line 3681 "Cluster.c"
+#line 2883 "Cluster.xs"
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most paramters.
+     */
+
+    /* ------------------------
+     * Allocate space for clusterid[][2]. 
+     */
+    clusterid = malloc(nelements*sizeof(int[2]));
+    if (!clusterid) {
+        croak("memory allocation failure in _somcluster\n");
+    }
+    celldata  =  0;
+    /* Don't return celldata, for now at least */
+
+
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.  Also check for errors, and ignore the
+     * mask or the weight array if there are any errors. 
+     * Set nweights to the correct number of weights.
+     */
+    ok = malloc_matrices( aTHX_ weight_ref, &weight, ndata, 
+                data_ref,   &matrix,
+                mask_ref,   &mask,  
+                nrows,      ncols);
+    if (!ok) {
+            croak("failed to read input data for _somcluster\n");
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
+    somcluster( 
+        nrows, ncols, 
+        matrix, mask, weight,
+        transpose, nxgrid, nygrid, inittau, niter,
+        dist[0], seed, celldata, clusterid,
+        callback.function ? call_perl_progress : NULL, &callback
+    );
+    SPAGAIN;
+    if (callback.error) {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+        free(clusterid);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+
+    /* ------------------------
+     * Convert generated C matrices to Perl matrices
+     */
+    matrix_av = newAV();
+    for(i=0; i<nelements; ++i) {
+        SV* row_ref;
+        AV* row_av = newAV();
+        av_push(row_av, newSViv(clusterid[i][0]));
+        av_push(row_av, newSViv(clusterid[i][1]));
+        row_ref = newRV((SV*)row_av);
+        av_push(matrix_av, row_ref);
+    }
+    clusterid_ref = newRV_noinc((SV*)matrix_av);
+
+    /* ------------------------
+     * Push the new Perl matrices onto the return stack
+     */
+    XPUSHs(sv_2mortal( clusterid_ref   ));
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    free_matrix_int(mask,     nrows);
+    free_matrix_dbl(matrix,   nrows);
+    free(weight);
+    free(clusterid);
+
+    /* Finished _somcluster() */
+#line 3764 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Algorithm__Cluster__pca); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Algorithm__Cluster__pca)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "nrows, ncols, data_ref");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	int	nrows = (int)SvIV(ST(0))
+;
+	int	ncols = (int)SvIV(ST(1))
+;
+	SV *	data_ref = ST(2)
+;
+#line 2973 "Cluster.xs"
+    double** u;
+    double** v;
+    double* w;
+    double* m;
+    int i;
+    int j;
+    int nmin;
+    int error;
+    SV * mean_ref;
+    SV * coordinates_ref;
+    SV * pc_ref;
+    SV * eigenvalues_ref;
+
+#line 3800 "Cluster.c"
+#line 2987 "Cluster.xs"
+    if(SvTYPE(SvRV(data_ref)) != SVt_PVAV) { 
+        croak("argument to _pca is not an array reference\n");
+    }
+    nmin = nrows < ncols ? nrows : ncols;
+    /* -- Create the output variables -------------------------------------- */
+    u = parse_data(aTHX_ data_ref, NULL);
+    w = malloc(nmin*sizeof(double));
+    v = malloc(nmin*sizeof(double*));
+    m = malloc(ncols*sizeof(double));
+    if (v) {
+        for (i = 0; i < nmin; i++) {
+            v[i] = malloc(nmin*sizeof(double));
+            if (!v[i]) break;
+        }
+        if (i < nmin) { /* then we encountered the break */
+            while (i-- > 0) free(v[i]);
+            free(v);
+            v = NULL;
+        }
+    }
+    if (!u || !v || !w || !m) {
+        if (u) free(u);
+        if (v) free(v);
+        if (w) free(w);
+        if (m) free(m);
+        croak("memory allocation failure in _pca\n");
+    }
+    /* -- Calculate the mean of each column ------------------------------ */
+    for (j = 0; j < ncols; j++) {
+        m[j] = 0.0;
+        for (i = 0; i < nrows; i++) m[j] += u[i][j];
+        m[j] /= nrows;
+    }
+    /* -- Subtract the mean of each column ------------------------------- */
+    for (i = 0; i < nrows; i++)
+        for (j = 0; j < ncols; j++)
+            u[i][j] -= m[j];
+    error = pca(nrows, ncols, u, v, w);
+    if (error==0) {
+        /* Convert the C variables to Perl variables */
+        mean_ref = row_c2perl_dbl(aTHX_ m, ncols);
+        if (nrows >= ncols) {
+            coordinates_ref = matrix_c2perl_dbl(aTHX_ u, nrows, ncols);
+            pc_ref = matrix_c2perl_dbl(aTHX_ v, nmin, nmin);
+        }
+        else /* nrows < ncols */ {
+            pc_ref = matrix_c2perl_dbl(aTHX_ u, nrows, ncols);
+            coordinates_ref = matrix_c2perl_dbl(aTHX_ v, nmin, nmin);
+        }
+        eigenvalues_ref = row_c2perl_dbl(aTHX_ w, nmin);
+    }
+    for (i = 0; i < nrows; i++) free(u[i]);
+    for (i = 0; i < nmin; i++) free(v[i]);
+    free(u);
+    free(v);
+    free(w);
+    free(m);
+    if (error==-1)
+        croak("Insufficient memory for principal components analysis");
+    if (error > 0)
+        croak("Singular value decomposition failed to converge");
+    /* ------------------------
+     * Push the new Perl matrices onto the return stack
+     */
+    XPUSHs(sv_2mortal(mean_ref));
+    XPUSHs(sv_2mortal(coordinates_ref));
+    XPUSHs(sv_2mortal(pc_ref));
+    XPUSHs(sv_2mortal(eigenvalues_ref));
+#line 3870 "Cluster.c"
+	PUTBACK;
+	return;
+    }
+}
+
+#ifdef __cplusplus
+extern "C"
+#endif
+XS_EXTERNAL(boot_Algorithm__Cluster); /* prototype to pass -Wmissing-prototypes */
+XS_EXTERNAL(boot_Algorithm__Cluster)
+{
+#if PERL_VERSION_LE(5, 21, 5)
+    dVAR; dXSARGS;
+#else
+    dVAR; dXSBOOTARGSXSAPIVERCHK;
+#endif
+#if PERL_VERSION_LE(5, 8, 999) /* PERL_VERSION_LT is 5.33+ */
+    char* file = __FILE__;
+#else
+    const char* file = __FILE__;
+#endif
+
+    PERL_UNUSED_VAR(file);
+
+    PERL_UNUSED_VAR(cv); /* -W */
+    PERL_UNUSED_VAR(items); /* -W */
+#if PERL_VERSION_LE(5, 21, 5)
+    XS_VERSION_BOOTCHECK;
+#  ifdef XS_APIVERSION_BOOTCHECK
+    XS_APIVERSION_BOOTCHECK;
+#  endif
+#endif
+
+        (void)newXSproto_portable("Algorithm::Cluster::Node::new", XS_Algorithm__Cluster__Node_new, file, "$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::Node::left", XS_Algorithm__Cluster__Node_left, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::Node::right", XS_Algorithm__Cluster__Node_right, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::Node::distance", XS_Algorithm__Cluster__Node_distance, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::Node::set_left", XS_Algorithm__Cluster__Node_set_left, file, "$$");
+        (void)newXSproto_portable("Algorithm::Cluster::Node::set_right", XS_Algorithm__Cluster__Node_set_right, file, "$$");
+        (void)newXSproto_portable("Algorithm::Cluster::Node::set_distance", XS_Algorithm__Cluster__Node_set_distance, file, "$$");
+        (void)newXSproto_portable("Algorithm::Cluster::Node::DESTROY", XS_Algorithm__Cluster__Node_DESTROY, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::new", XS_Algorithm__Cluster__Tree_new, file, "$$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::length", XS_Algorithm__Cluster__Tree_length, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::get", XS_Algorithm__Cluster__Tree_get, file, "$$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::node", XS_Algorithm__Cluster__Tree_node, file, "$$");
+        cv = newXSproto_portable("Algorithm::Cluster::Tree::lefts", XS_Algorithm__Cluster__Tree_lefts, file, "$;$");
+        XSANY.any_i32 = 0;
+        cv = newXSproto_portable("Algorithm::Cluster::Tree::rights", XS_Algorithm__Cluster__Tree_lefts, file, "$;$");
+        XSANY.any_i32 = 1;
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::distances", XS_Algorithm__Cluster__Tree_distances, file, "$;$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::scale", XS_Algorithm__Cluster__Tree_scale, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::cut", XS_Algorithm__Cluster__Tree_cut, file, "$$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::cuts", XS_Algorithm__Cluster__Tree_cuts, file, "$$;$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::cutthresholds", XS_Algorithm__Cluster__Tree_cutthresholds, file, "$$;$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::optimalorder", XS_Algorithm__Cluster__Tree_optimalorder, file, "$$");
+        (void)newXSproto_portable("Algorithm::Cluster::Tree::DESTROY", XS_Algorithm__Cluster__Tree_DESTROY, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::DataFile::DESTROY", XS_Algorithm__Cluster__DataFile_DESTROY, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::_version", XS_Algorithm__Cluster__version, file, "");
+        (void)newXSproto_portable("Algorithm::Cluster::_mean", XS_Algorithm__Cluster__mean, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::_median", XS_Algorithm__Cluster__median, file, "$");
+        (void)newXSproto_portable("Algorithm::Cluster::_treecluster", XS_Algorithm__Cluster__treecluster, file, "$$$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_sparsetreecluster", XS_Algorithm__Cluster__sparsetreecluster, file, "$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_treeclusters", XS_Algorithm__Cluster__treeclusters, file, "$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_kcluster", XS_Algorithm__Cluster__kcluster, file, "$$$$$$$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_kclustersweep", XS_Algorithm__Cluster__kclustersweep, file, "$$$$$$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_minibatchkcluster", XS_Algorithm__Cluster__minibatchkcluster, file, "$$$$$$$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_opendatafile", XS_Algorithm__Cluster__opendatafile, file, "$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_streamkcluster", XS_Algorithm__Cluster__streamkcluster, file, "$$$$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_kmedoids", XS_Algorithm__Cluster__kmedoids, file, "$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_pam", XS_Algorithm__Cluster__pam, file, "$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_clusterdistance", XS_Algorithm__Cluster__clusterdistance, file, "$$$$$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_clustercentroids", XS_Algorithm__Cluster__clustercentroids, file, "$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_distancematrix", XS_Algorithm__Cluster__distancematrix, file, "$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_silhouette", XS_Algorithm__Cluster__silhouette, file, "$$$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_somcluster", XS_Algorithm__Cluster__somcluster, file, "$$$$$$$$$$$$$");
+        (void)newXSproto_portable("Algorithm::Cluster::_pca", XS_Algorithm__Cluster__pca, file, "$$$");
+#if PERL_VERSION_LE(5, 21, 5)
+#  if PERL_VERSION_GE(5, 9, 0)
+    if (PL_unitcheckav)
+        call_list(PL_scopestack_ix, PL_unitcheckav);
+#  endif
+    XSRETURN_YES;
+#else
+    Perl_xs_boot_epilog(aTHX_ ax);
+#endif
+}
+
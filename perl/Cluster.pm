@@ -40,9 +40,12 @@ $DEBUG       = 1;
     mean 
     median 
     kcluster 
+    kclustersweep 
     kmedoids 
+    silhouette 
     somcluster 
     treecluster
+    treeclusters
     clusterdistance 
     clustercentroids 
     distancematrix 
@@ -322,7 +325,12 @@ sub kcluster {
         npass     =>     1,
         method    =>   'a',
         dist      =>   'e',
+        init      =>   'r',
         initialid =>    [],
+        batchsize =>     0,
+        niter     =>     0,
+        seed      =>     0,
+        callback  => undef,
     );
     #----------------------------------
     # Local variable
@@ -332,6 +340,24 @@ sub kcluster {
     # Accept parameters from caller
     #
     my %param = (%default, @_);
+    #----------------------------------
+    # Check the seed of the random number generator
+    #
+    return unless check_seed(\%param);
+    #----------------------------------
+    # Mini-batch k-means can read the rows from a function
+    #
+    if (defined $param{rows}) {
+        my %args = @_;
+        $param{method} = 'b' unless defined $args{method};
+        return minibatchkcluster(\%param, \%default);
+    }
+    #----------------------------------
+    # k-means and mini-batch k-means can read the rows from a file
+    #
+    if (defined $param{file}) {
+        return streamkcluster(\%param, \%default);
+    }
     my @data = @{$param{data}};
     #----------------------------------
     # Check the data, matrix and weight parameters
@@ -355,24 +381,257 @@ sub kcluster {
     #----------------------------------
     # Check the other parameters
     #
-    unless($param{method}    =~ /^[am]$/) {
-        module_warn("Parameter 'method' must be either 'a' or 'm' (got '$param{method}')");
+    unless($param{method}    =~ /^[ambs]$/) {
+        module_warn("Parameter 'method' must be one of: [ambs] (got '$param{method}')");
         return;
     }
     unless($param{dist}      =~ /^[cauxskeb]$/) {
         module_warn("Parameter 'dist' must be one of: [cauxskeb] (got '$param{dist}')");
         return;
     }
+    # Spherical k-means is defined for the uncentered correlation only
+    if ($param{method} eq 's' and $param{dist} !~ /^[ux]$/) {
+        module_warn("Method 's' requires dist 'u' or 'x' (got '$param{dist}')");
+        return;
+    }
+    unless($param{init}      =~ /^[rkp]$/) {
+        module_warn("Parameter 'init' must be one of: [rkp] (got '$param{init}')");
+        return;
+    }
+    return unless check_callback(\%param);
     #----------------------------------
     # Invoke the library function
     #
+    if ($param{method} eq 'b') {
+        return unless check_minibatch(\%param);
+        return _minibatchkcluster(@param{
+            qw/nclusters nrows ncols data mask weight transpose npass dist batchsize niter initialid seed callback/
+        });
+    }
     return _kcluster(@param{
-        qw/nclusters nrows ncols data mask weight transpose npass method dist initialid/
+        qw/nclusters nrows ncols data mask weight transpose npass method dist init initialid seed callback/
+    });
+}
+
+#-------------------------------------------------------------
+# Check the progress callback. The function is called after
+# each iteration with a reference to a hash containing pass,
+# iteration, total, nmoved, and elapsed; if it returns a true
+# value, the clustering stops early.
+#
+sub check_callback {
+    my $param = $_[0];
+    if (defined $param->{callback} and ref($param->{callback}) ne 'CODE') {
+        module_warn("Parameter 'callback' must be a reference to a function");
+        return;
+    }
+    return 1;
+}
+
+#-------------------------------------------------------------
+# Check the seed of the random number generator. The same seed
+# gives the same result; with seed 0, a seed is chosen based on
+# the current time.
+#
+sub check_seed {
+    my $param = $_[0];
+    unless($param->{seed} =~ /^\d+$/) {
+        module_warn("Parameter 'seed' must be a non-negative integer (got '$param->{seed}')");
+        return;
+    }
+    return 1;
+}
+
+#-------------------------------------------------------------
+# Check the batch size and number of iterations of mini-batch
+# k-means; zero selects the default values
+#
+sub check_minibatch {
+    my $param = $_[0];
+    unless($param->{batchsize} =~ /^\d+$/) {
+        module_warn("Parameter 'batchsize' must be a non-negative integer (got '$param->{batchsize}')");
+        return;
+    }
+    unless($param->{niter} =~ /^\d+$/) {
+        module_warn("Parameter 'niter' must be a non-negative integer (got '$param->{niter}')");
+        return;
+    }
+    return 1;
+}
+
+#-------------------------------------------------------------
+# Mini-batch k-means on rows that are obtained by calling the
+# function passed as 'rows' with a reference to an array of row
+# numbers. The function should return a reference to an array of
+# rows, with undef for missing values. The number of rows and
+# columns are passed as 'nrows' and 'ncols'.
+#
+sub minibatchkcluster {
+    my ($param, $default) = @_;
+    unless(ref($param->{rows}) eq 'CODE') {
+        module_warn("Parameter 'rows' must be a reference to a function");
+        return;
+    }
+    unless($param->{method} eq 'b') {
+        module_warn("Parameter 'rows' can only be used with method 'b' (got '$param->{method}')");
+        return;
+    }
+    foreach my $name ('nrows', 'ncols') {
+        unless(defined $param->{$name} and $param->{$name} =~ /^\d+$/ and $param->{$name} > 0) {
+            module_warn("Parameter '$name' must be a positive integer if 'rows' is used");
+            return;
+        }
+    }
+    unless(ref $param->{weight} eq 'ARRAY' and scalar @{$param->{weight}} == $param->{ncols}) {
+        $param->{weight} = $default->{weight};
+    }
+    unless($param->{dist}      =~ /^[cauxskeb]$/) {
+        module_warn("Parameter 'dist' must be one of: [cauxskeb] (got '$param->{dist}')");
+        return;
+    }
+    return unless check_initialid($param, $default, $param->{nrows});
+    return unless check_minibatch($param);
+    return unless check_callback($param);
+    return _minibatchkcluster(@{$param}{qw/nclusters nrows ncols rows/}, '',
+        @{$param}{qw/weight/}, 0,
+        @{$param}{qw/npass dist batchsize niter initialid seed callback/});
+}
+
+#-------------------------------------------------------------
+# k-means on a data file that is read in batches in each pass
+# through the data, instead of being loaded into memory. The
+# file is either a tab-delimited file in the Cluster format
+# (format 't'), or a binary file (format 'b') starting with the
+# number of rows and columns as two native ints, followed by the
+# data as native doubles, with NaN for missing values.
+#
+sub streamkcluster {
+    my ($param, $default) = @_;
+    $param->{format} = 't' unless defined $param->{format};
+    unless($param->{format}  =~ /^[tb]$/) {
+        module_warn("Parameter 'format' must be one of: [tb] (got '$param->{format}')");
+        return;
+    }
+    unless($param->{method}  =~ /^[ab]$/) {
+        module_warn("Parameter 'file' can only be used with methods 'a' and 'b' (got '$param->{method}')");
+        return;
+    }
+    unless($param->{transpose} == 0) {
+        module_warn("Parameter 'file' cannot be used with 'transpose'");
+        return;
+    }
+    unless($param->{dist}      =~ /^[cauxskeb]$/) {
+        module_warn("Parameter 'dist' must be one of: [cauxskeb] (got '$param->{dist}')");
+        return;
+    }
+    unless($param->{init}      eq 'r') {
+        module_warn("Parameter 'file' can only be used with init 'r' (got '$param->{init}')");
+        return;
+    }
+    my ($datafile, $nrows, $ncols) = _opendatafile(@{$param}{qw/file format/});
+    if (ref $param->{weight} eq 'ARRAY' and scalar @{$param->{weight}} != $ncols) {
+        module_warn("Parameter 'weight' must have $ncols values, one for each column in the file");
+        return;
+    }
+    return unless check_initialid($param, $default, $nrows);
+    return unless check_minibatch($param);
+    return unless check_callback($param);
+    return _streamkcluster($datafile, @{$param}{
+        qw/nclusters npass method dist batchsize niter weight initialid seed callback/
+    });
+}
+
+#-------------------------------------------------------------
+# Wrapper for the kclustersweep() function. Returns references
+# to the clustering solutions, the errors, and the
+# Calinski-Harabasz scores for each number of clusters from
+# kmin to kmax.
+#
+sub kclustersweep {
+    #----------------------------------
+    # Define default parameters
+    #
+    my %default = (
+        kmin      =>     2,
+        kmax      =>    -1,
+        data      =>  [[]],
+        mask      =>    '',
+        weight    =>    '',
+        transpose =>     0,
+        npass     =>     1,
+        method    =>   'a',
+        dist      =>   'e',
+        init      =>   'r',
+        seed      =>     0,
+    );
+    #----------------------------------
+    # Local variable
+    #
+    my $nobjects = 0;
+    #----------------------------------
+    # Accept parameters from caller
+    #
+    my %param = (%default, @_);
+    #----------------------------------
+    # Check the data, matrix and weight parameters
+    #
+    return unless check_matrix_dimensions(\%param, \%default);
+    #----------------------------------
+    # Check the transpose parameter
+    #
+    if ($param{transpose} == 0) {
+        $nobjects = $param{nrows};
+    } elsif ($param{transpose} == 1) {
+        $nobjects = $param{ncols};
+    } else {
+        module_warn("Parameter 'transpose' must be either 0 or 1 (got '$param{transpose}')");
+        return;
+    }
+    #----------------------------------
+    # Check the range of the number of clusters
+    #
+    unless($param{kmin} =~ /^\d+$/ and $param{kmin} > 0) {
+        module_warn("Parameter 'kmin' must be a positive integer (got '$param{kmin}')");
+        return;
+    }
+    unless($param{kmax} =~ /^\d+$/ and $param{kmax} >= $param{kmin} and $param{kmax} <= $nobjects) {
+        module_warn("Parameter 'kmax' must be an integer between kmin and the number of elements (got '$param{kmax}')");
+        return;
+    }
+    #----------------------------------
+    # Check the other parameters
+    #
+    unless($param{npass} =~ /^\d+$/) {
+        module_warn("Parameter 'npass' must be a non-negative integer (got '$param{npass}')");
+        return;
+    }
+    unless($param{method}    =~ /^[ams]$/) {
+        module_warn("Parameter 'method' must be one of: [ams] (got '$param{method}')");
+        return;
+    }
+    unless($param{dist}      =~ /^[cauxskeb]$/) {
+        module_warn("Parameter 'dist' must be one of: [cauxskeb] (got '$param{dist}')");
+        return;
+    }
+    if ($param{method} eq 's' and $param{dist} !~ /^[ux]$/) {
+        module_warn("Method 's' requires dist 'u' or 'x' (got '$param{dist}')");
+        return;
+    }
+    unless($param{init}      =~ /^[rkp]$/) {
+        module_warn("Parameter 'init' must be one of: [rkp] (got '$param{init}')");
+        return;
+    }
+    return unless check_seed(\%param);
+    #----------------------------------
+    # Invoke the library function
+    #
+    return _kclustersweep(@param{
+        qw/kmin kmax nrows ncols data mask weight transpose npass method dist init seed/
     });
 }
 
 #-------------------------------------------------------------
-# Wrapper for the kmedoids() function
+# Wrapper for the kmedoids() and pam() functions
 #
 
 sub kmedoids {
@@ -385,6 +644,9 @@ sub kmedoids {
         distances =>  [[]],
         npass     =>     1,
         initialid =>    [],
+        seed      =>     0,
+        method    =>   'v',
+        callback  => undef,
     );
     #----------------------------------
     # Accept parameters from caller
@@ -399,15 +661,35 @@ sub kmedoids {
         return;
     }
     $param{nobjects} = scalar @{ $param{distances} }; 
+    unless($param{method}    =~ /^[vp]$/) {
+        module_warn("Parameter 'method' must be one of: [vp] (got '$param{method}')");
+        return;
+    }
+    #----------------------------------
+    # PAM is deterministic, and ignores npass, initialid, and seed
+    #
+    if ($param{method} eq 'p') {
+        unless($param{nclusters} =~ /^\d+$/ and $param{nclusters} > 0 and $param{nclusters} <= $param{nobjects}) {
+            module_warn("Parameter 'nclusters' must be an integer between 1 and the number of elements (got '$param{nclusters}')");
+            return;
+        }
+        return unless check_callback(\%param);
+        my ($clusterid, $error) = _pam(@param{
+            qw/nclusters nobjects distances callback/
+        });
+        return ($clusterid, $error, 1);
+    }
     #----------------------------------
     # Check the initial clustering, if specified, and npass
     #
     return unless check_initialid(\%param, \%default, $param{nobjects});
+    return unless check_seed(\%param);
+    return unless check_callback(\%param);
     #----------------------------------
     # Invoke the library function
     #
     return _kmedoids(@param{
-        qw/nclusters nobjects distances npass initialid/
+        qw/nclusters nobjects distances npass initialid seed callback/
     });
 }
 
@@ -425,12 +707,18 @@ sub treecluster {
         transpose  =>     0,
         dist       =>   'e',
         method     =>   's',
+        nsummary   =>     0,
+        refine     =>     0,
     );
     #----------------------------------
     # Accept parameters from caller
     #
     my %param = (%default, @_);
     #----------------------------------
+    # Cluster a sparse graph if the edges are given
+    #
+    return sparsetreecluster(%param) if exists $param{edges};
+    #----------------------------------
     # Check the data, matrix and weight parameters
     #
     my $message = check_distance_matrix($param{data});
@@ -444,8 +732,12 @@ sub treecluster {
         #----------------------------------
         # Check the clustering method
         #
-        unless($param{method}    =~ /^[sma]$/) {
-            module_warn("Parameter 'method' must be one of [sma] (got '$param{method}')");
+        unless($param{method}    =~ /^[smaw]$/) {
+            module_warn("Parameter 'method' must be one of [smaw] (got '$param{method}')");
+            return;
+        }
+        if ($param{nsummary}) {
+            module_warn("Parameter 'nsummary' requires data instead of a distance matrix");
             return;
         }
     } else {
@@ -458,21 +750,137 @@ sub treecluster {
             module_warn("Parameter 'dist' must be one of: [cauxskeb] (got '$param{dist}')");
             return;
         }
-        unless($param{method}    =~ /^[smca]$/) {
-            module_warn("Parameter 'method' must be one of [smca] (got '$param{method}')");
+        unless($param{method}    =~ /^[smcaw]$/) {
+            module_warn("Parameter 'method' must be one of [smcaw] (got '$param{method}')");
+            return;
+        }
+        unless($param{nsummary}  =~ /^\d+$/) {
+            module_warn("Parameter 'nsummary' must be a nonnegative integer (got '$param{nsummary}')");
             return;
         }
     }
+    $param{refine} = $param{refine} ? 1 : 0;
     #----------------------------------
     # Invoke the library function
     #
     return _treecluster(@param{
-        qw/nrows ncols data mask weight transpose dist method/
+        qw/nrows ncols data mask weight transpose dist method nsummary refine/
     });
 }
 
 
 
+#-------------------------------------------------------------
+# Hierarchical clustering of a sparse graph, given as a list
+# of edges [i, j, distance]. Called by treecluster if the
+# edges parameter is given.
+#
+sub sparsetreecluster {
+    my %param = @_;
+    my $edges = $param{edges};
+    unless(ref($edges) eq 'ARRAY') {
+        module_warn("Parameter 'edges' must be a reference to an array of edges");
+        return;
+    }
+    my $nelements = 0;
+    foreach my $edge (@$edges) {
+        unless(ref($edge) eq 'ARRAY' and scalar(@$edge) == 3
+           and $edge->[0] =~ /^\d+$/ and $edge->[1] =~ /^\d+$/) {
+            module_warn("Each edge must be an array [i, j, distance] of two element numbers and a distance");
+            return;
+        }
+        $nelements = $edge->[0] + 1 if $edge->[0] >= $nelements;
+        $nelements = $edge->[1] + 1 if $edge->[1] >= $nelements;
+    }
+    #----------------------------------
+    # The number of elements defaults to the highest element
+    # number in the edges plus one
+    #
+    if (defined $param{nelements}) {
+        unless($param{nelements} =~ /^\d+$/ and $param{nelements} >= $nelements) {
+            module_warn("Parameter 'nelements' must be an integer larger than all element numbers (got '$param{nelements}')");
+            return;
+        }
+        $nelements = $param{nelements};
+    }
+    unless($nelements >= 2) {
+        module_warn("At least two elements are needed for sparse hierarchical clustering");
+        return;
+    }
+    unless($param{method}    =~ /^[sma]$/) {
+        module_warn("Parameter 'method' must be one of [sma] for sparse clustering (got '$param{method}')");
+        return;
+    }
+    return _sparsetreecluster($nelements, $edges, $param{method});
+}
+
+#-------------------------------------------------------------
+# treeclusters(): Wrapper for the treeclusters function, which
+# performs hierarchical clustering with several methods on the
+# same distance matrix, and returns a list of trees.
+#
+sub treeclusters {
+    #----------------------------------
+    # Define default parameters
+    #
+    my %default = (
+        data       =>  [[]],
+        mask       =>    '',
+        weight     =>    '',
+        transpose  =>     0,
+        dist       =>   'e',
+        methods    => 'sma',
+    );
+    #----------------------------------
+    # Accept parameters from caller
+    #
+    my %param = (%default, @_);
+    #----------------------------------
+    # Accept the methods either as a string or as a list
+    #
+    $param{methods} = join('', @{ $param{methods} })
+        if ref($param{methods}) eq 'ARRAY';
+    #----------------------------------
+    # Check the data, matrix and weight parameters
+    #
+    my $message = check_distance_matrix($param{data});
+    if ($message eq "OK") {
+        $param{nrows}     = scalar @{ $param{data} }; 
+        $param{ncols}     = scalar @{ $param{data} }; 
+        $param{mask}      = $default{mask};
+        $param{weight}    = $default{weight};
+        $param{transpose} = $default{transpose};
+        $param{dist}      = $default{dist};
+        #----------------------------------
+        # Check the clustering methods
+        #
+        unless($param{methods}   =~ /^[smaw]+$/) {
+            module_warn("Parameter 'methods' must consist of [smaw] (got '$param{methods}')");
+            return;
+        }
+    } else {
+        return unless check_matrix_dimensions(\%param, \%default);
+        unless($param{transpose} =~ /^[01]$/) {
+            module_warn("Parameter 'transpose' must be either 0 or 1 (got '$param{transpose}')");
+            return;
+        }
+        unless($param{dist}      =~ /^[cauxskeb]$/) {
+            module_warn("Parameter 'dist' must be one of: [cauxskeb] (got '$param{dist}')");
+            return;
+        }
+        unless($param{methods}   =~ /^[smcaw]+$/) {
+            module_warn("Parameter 'methods' must consist of [smcaw] (got '$param{methods}')");
+            return;
+        }
+    }
+    #----------------------------------
+    # Invoke the library function
+    #
+    return _treeclusters(@param{
+        qw/nrows ncols data mask weight transpose dist methods/
+    });
+}
+
 #-------------------------------------------------------------
 # Wrapper for the clusterdistance() function
 #
@@ -662,6 +1070,82 @@ sub distancematrix {
 }
 
 
+#-------------------------------------------------------------
+# Wrapper for the silhouette() function. The distances are taken
+# from the distance matrix if one is passed as 'distances', and
+# are calculated from the data otherwise. Returns a reference to
+# the silhouette widths of the elements, and their mean.
+#
+sub silhouette {
+    #----------------------------------
+    # Define default parameters
+    #
+    my %default = (
+        clusterid =>    [],
+        distances => undef,
+        data      =>  [[]],
+        mask      =>    '',
+        weight    =>    '',
+        transpose =>     0,
+        dist      =>   'e',
+    );
+    #----------------------------------
+    # Local variable
+    #
+    my $nobjects = 0;
+    #----------------------------------
+    # Accept parameters from caller
+    #
+    my %param = (%default, @_);
+    if (defined $param{distances}) {
+        my $message = check_distance_matrix($param{distances});
+        unless ($message eq "OK") {
+            module_warn($message); 
+            return;
+        }
+        $nobjects = scalar @{ $param{distances} }; 
+        @param{qw/nrows ncols transpose/} = ($nobjects, 0, 0);
+    }
+    else {
+        return unless check_matrix_dimensions(\%param, \%default);
+        if ($param{transpose} == 0) {
+            $nobjects = $param{nrows};
+        } elsif ($param{transpose} == 1) {
+            $nobjects = $param{ncols};
+        } else {
+            module_warn("Parameter 'transpose' must be either 0 or 1 (got '$param{transpose}')");
+            return;
+        }
+        unless($param{dist}      =~ /^[cauxskeb]$/) {
+            module_warn("Parameter 'dist' must be one of: [cauxskeb] (got '$param{dist}')");
+            return;
+        }
+        $param{distances} = '';
+    }
+    #----------------------------------
+    # Check the cluster assignments
+    #
+    unless(ref $param{clusterid} eq 'ARRAY' and scalar @{$param{clusterid}} == $nobjects) {
+        module_warn("Parameter 'clusterid' must contain one cluster number for each element");
+        return;
+    }
+    my $nclusters = 0;
+    foreach my $i (@{ $param{clusterid} }) {
+        unless(defined $i and $i =~ /^\d+$/) {
+            module_warn("Parameter 'clusterid' should only contain non-negative integers");
+            return;
+        }
+        $nclusters = $i + 1 if $i >= $nclusters;
+    }
+    #----------------------------------
+    # Invoke the library function
+    #
+    return _silhouette($nclusters, @param{
+        qw/nrows ncols data mask weight transpose dist distances clusterid/
+    });
+}
+
+
 #-------------------------------------------------------------
 # Wrapper for the somcluster() function
 #
@@ -679,6 +1163,8 @@ sub somcluster {
         inittau   =>  0.02,
         niter     =>   100,
         dist      =>   'e',
+        seed      =>     0,
+        callback  => undef,
     );
     #----------------------------------
     # Accept parameters from caller
@@ -716,11 +1202,13 @@ sub somcluster {
         module_warn("Parameter 'dist' must be one of: [cauxskeb] (got '$param{dist}')");
         return;
     }
+    return unless check_seed(\%param);
+    return unless check_callback(\%param);
     #----------------------------------
     # Invoke the library function
     #
     return _somcluster(@param{
-        qw/nrows ncols data mask weight transpose nxgrid nygrid inittau niter dist/
+        qw/nrows ncols data mask weight transpose nxgrid nygrid inittau niter dist seed callback/
     });
 }
 
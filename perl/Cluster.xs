@@ -573,6 +573,68 @@ ragged_matrix_c2perl_dbl(pTHX_ double ** matrix, int nobjects) {
     return ( newRV_noinc( (SV*) matrix_av ) );
 }
 
+/* -------------------------------------------------
+ * Create an Algorithm::Cluster::Tree object from the n nodes
+ * returned by the C library. The Tree object takes ownership
+ * of the nodes. Returns NULL if a memory error occurs.
+ */
+static SV*
+tree_c2perl(pTHX_ Node* nodes, int n) {
+
+    SV* ref;
+    SV* obj;
+    Tree* tree = malloc(sizeof(Tree));
+    if (!tree) return NULL;
+    tree->n = n;
+    tree->nodes = nodes;
+    ref = newSViv(0);
+    obj = newSVrv(ref, "Algorithm::Cluster::Tree");
+    sv_setiv(obj, PTR2IV(tree));
+    SvREADONLY_on(obj);
+    return ref;
+}
+
+/* -------------------------------------------------
+ * Cut the tree into nclusters[l] clusters for each level l,
+ * and return the cluster numbers as an array with one entry
+ * per level. Each entry is a reference to an array, or, if
+ * packed is true, a string of packed native integers.
+ */
+static AV*
+cuts_c2perl(pTHX_ Tree* tree, int nlevels, const int nclusters[], int packed)
+{
+    int i;
+    const int n = tree->n + 1;
+    AV* result;
+    int** clusterid = malloc(nlevels*sizeof(int*));
+    if (!clusterid) croak("cut: Insufficient memory");
+    for (i = 0; i < nlevels; i++) {
+        clusterid[i] = malloc(n*sizeof(int));
+        if (!clusterid[i]) break;
+    }
+    if (i < nlevels) {
+        while (--i >= 0) free(clusterid[i]);
+        free(clusterid);
+        croak("cut: Insufficient memory");
+    }
+    cuttrees(n, tree->nodes, nlevels, nclusters, clusterid);
+    if (nlevels > 0 && clusterid[0][0]==-1) {
+        for (i = 0; i < nlevels; i++) free(clusterid[i]);
+        free(clusterid);
+        croak("cut: Error in the cuttrees routine");
+    }
+    result = newAV();
+    for (i = 0; i < nlevels; i++) {
+        if (packed)
+            av_push(result, newSVpvn((char*)clusterid[i], n*sizeof(int)));
+        else
+            av_push(result, row_c2perl_int(aTHX_ clusterid[i], n));
+        free(clusterid[i]);
+    }
+    free(clusterid);
+    return result;
+}
+
 /* -------------------------------------------------
  * Check if the data matrix is a distance matrix, or
  * a raw distance matrix.
@@ -692,6 +754,154 @@ parse_distance(pTHX_ SV* matrix_ref, int nobjects)
     return matrix;
 }
 
+/* -------------------------------------------------
+ * Row sources for minibatchkcluster. The rows are copied either from a
+ * matrix of C doubles by the library function getdatarows, or from the array
+ * of rows returned by a Perl function that is called with a reference to an
+ * array of row numbers.
+ */
+typedef struct {
+    DataSource matrix;
+    SV* function;
+    SV* error;
+} RowSource;
+
+static int
+get_perl_rows(void* context, int n, const int index[], double** data,
+              int** mask)
+{
+    dTHX;
+    dSP;
+    int i, j;
+    int count;
+    int ok = 1;
+    SV* result;
+    AV* rows_av;
+    AV* index_av;
+    RowSource* source = context;
+
+    index_av = newAV();
+    av_extend(index_av, n);
+    for (i = 0; i < n; i++) av_push(index_av, newSViv(index[i]));
+
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    XPUSHs(sv_2mortal(newRV_noinc((SV*)index_av)));
+    PUTBACK;
+    count = call_sv(source->function, G_SCALAR | G_EVAL);
+    SPAGAIN;
+    if (SvTRUE(ERRSV)) {
+        source->error = newSVsv(ERRSV);
+        ok = 0;
+    }
+    else if (count != 1) {
+        source->error = newSVpv("function passed as 'rows' should return a single value", 0);
+        ok = 0;
+    }
+    else {
+        result = POPs;
+        if (!SvROK(result) || SvTYPE(SvRV(result)) != SVt_PVAV
+         || av_len((AV*) SvRV(result)) + 1 != n) {
+            source->error = newSVpvf("function passed as 'rows' should return a reference to an array of %d rows", n);
+            ok = 0;
+        }
+    }
+    if (ok) {
+        rows_av = (AV*) SvRV(result);
+        for (i = 0; i < n && ok; i++) {
+            AV* row_av;
+            SV* row_ref = *(av_fetch(rows_av, (I32) i, 0));
+            if (!SvROK(row_ref) || SvTYPE(SvRV(row_ref)) != SVt_PVAV
+             || av_len((AV*) SvRV(row_ref)) + 1 != source->matrix.ndata) {
+                source->error = newSVpvf("row %d returned by the function passed as 'rows' should be a reference to an array of %d values", index[i], source->matrix.ndata);
+                ok = 0;
+                break;
+            }
+            row_av = (AV*) SvRV(row_ref);
+            for (j = 0; j < source->matrix.ndata; j++) {
+                SV* cell = *(av_fetch(row_av, (I32) j, 0));
+                if (!SvOK(cell)) {
+                    /* Missing value */
+                    data[i][j] = 0.0;
+                    mask[i][j] = 0;
+                }
+                else if (extract_double_from_scalar(aTHX_ cell, &data[i][j]) > 0) {
+                    mask[i][j] = 1;
+                }
+                else {
+                    source->error = newSVpvf("row %d col %d returned by the function passed as 'rows' is not a number", index[i], j);
+                    ok = 0;
+                    break;
+                }
+            }
+        }
+    }
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+    return ok;
+}
+
+/* -------------------------------------------------
+ * Progress callback for kcluster, kmedoids, and somcluster. The Perl
+ * function is called with a reference to a hash with the fields of the
+ * ClusterProgress struct; if it returns a true value, clustering stops.
+ * If the Perl function dies, clustering stops and the error is saved.
+ */
+typedef struct {
+    SV* function;
+    SV* error;
+} ProgressCallback;
+
+static int
+call_perl_progress(const ClusterProgress* progress, void* context)
+{
+    dTHX;
+    dSP;
+    int count;
+    int stop = 0;
+    HV* progress_hv;
+    ProgressCallback* callback = context;
+
+    progress_hv = newHV();
+    hv_store(progress_hv, "pass",      4, newSViv(progress->pass), 0);
+    hv_store(progress_hv, "iteration", 9, newSViv(progress->iteration), 0);
+    hv_store(progress_hv, "total",     5, newSVnv(progress->total), 0);
+    hv_store(progress_hv, "nmoved",    6, newSViv(progress->nmoved), 0);
+    hv_store(progress_hv, "elapsed",   7, newSVnv(progress->elapsed), 0);
+
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    XPUSHs(sv_2mortal(newRV_noinc((SV*)progress_hv)));
+    PUTBACK;
+    count = call_sv(callback->function, G_SCALAR | G_EVAL);
+    SPAGAIN;
+    if (SvTRUE(ERRSV)) {
+        callback->error = newSVsv(ERRSV);
+        stop = 1;
+        if (count == 1) (void) POPs;
+    }
+    else if (count == 1) {
+        stop = SvTRUE(POPs) ? 1 : 0;
+    }
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+    return stop;
+}
+
+static void
+init_progress_callback(pTHX_ ProgressCallback* callback, SV* callback_ref)
+{
+    callback->error = NULL;
+    if (SvROK(callback_ref) && SvTYPE(SvRV(callback_ref)) == SVt_PVCV)
+        callback->function = callback_ref;
+    else
+        callback->function = NULL;
+}
+
 /******************************************************************************/
 /**                                                                          **/
 /** XS code begins here                                                      **/
@@ -931,6 +1141,83 @@ get (obj, index)
     OUTPUT:
     RETVAL
 
+void
+node (obj, index)
+    SV* obj
+    int index
+    PREINIT:
+    Tree* tree;
+    PPCODE:
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    if (index < 0 || index >= tree->n) {
+        croak("Index out of bounds in Algorithm::Cluster::Tree::node\n");
+    }
+    EXTEND(SP, 3);
+    PUSHs(sv_2mortal(newSViv(tree->nodes[index].left)));
+    PUSHs(sv_2mortal(newSViv(tree->nodes[index].right)));
+    PUSHs(sv_2mortal(newSVnv(tree->nodes[index].distance)));
+
+SV *
+lefts (obj, packed = 0)
+    SV* obj
+    int packed
+    ALIAS:
+    rights = 1
+    PREINIT:
+    int i;
+    Tree* tree;
+    CODE:
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    if (packed) {
+        int* values;
+        RETVAL = newSV(tree->n*sizeof(int)+1);
+        SvPOK_on(RETVAL);
+        SvCUR_set(RETVAL, tree->n*sizeof(int));
+        *SvEND(RETVAL) = '\0';
+        values = (int*) SvPVX(RETVAL);
+        if (ix==0) for (i = 0; i < tree->n; i++) values[i] = tree->nodes[i].left;
+        else for (i = 0; i < tree->n; i++) values[i] = tree->nodes[i].right;
+    }
+    else {
+        AV* values = newAV();
+        av_extend(values, tree->n);
+        if (ix==0) for (i = 0; i < tree->n; i++)
+            av_push(values, newSViv(tree->nodes[i].left));
+        else for (i = 0; i < tree->n; i++)
+            av_push(values, newSViv(tree->nodes[i].right));
+        RETVAL = newRV_noinc((SV*)values);
+    }
+    OUTPUT:
+    RETVAL
+
+SV *
+distances (obj, packed = 0)
+    SV* obj
+    int packed
+    PREINIT:
+    int i;
+    Tree* tree;
+    CODE:
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    if (packed) {
+        double* values;
+        RETVAL = newSV(tree->n*sizeof(double)+1);
+        SvPOK_on(RETVAL);
+        SvCUR_set(RETVAL, tree->n*sizeof(double));
+        *SvEND(RETVAL) = '\0';
+        values = (double*) SvPVX(RETVAL);
+        for (i = 0; i < tree->n; i++) values[i] = tree->nodes[i].distance;
+    }
+    else {
+        AV* values = newAV();
+        av_extend(values, tree->n);
+        for (i = 0; i < tree->n; i++)
+            av_push(values, newSVnv(tree->nodes[i].distance));
+        RETVAL = newRV_noinc((SV*)values);
+    }
+    OUTPUT:
+    RETVAL
+
 void
 scale(obj)
     SV* obj
@@ -998,6 +1285,148 @@ cut(obj, nclusters)
     RETVAL
 
 
+AV *
+cuts(obj, nclusters_ref, packed = 0)
+    SV* obj
+    SV* nclusters_ref
+    int packed
+    PREINIT:
+    int i;
+    int n;
+    int nlevels;
+    Tree* tree;
+    AV* nclusters_av;
+    int* nclusters;
+    CODE:
+    if (!sv_isa(obj, "Algorithm::Cluster::Tree")) {
+        croak("cuts can only be applied to an Algorithm::Cluster::Tree object");
+    }
+    if (!SvROK(nclusters_ref) || SvTYPE(SvRV(nclusters_ref)) != SVt_PVAV) {
+        croak("cuts: Expected a reference to an array of numbers of clusters");
+    }
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    n = tree->n + 1;
+    nclusters_av = (AV*) SvRV(nclusters_ref);
+    nlevels = (int) av_len(nclusters_av) + 1;
+    nclusters = malloc((nlevels+1)*sizeof(int));
+    if (!nclusters) {
+        croak("cuts: Insufficient memory");
+    }
+    for (i = 0; i < nlevels; i++) {
+        const int k = (int) SvIV(*(av_fetch(nclusters_av, (I32) i, 0)));
+        if (k < 1 || k > n) {
+            free(nclusters);
+            if (k < 1)
+                croak("cuts: Requested number of clusters should be positive");
+            croak("cuts: More clusters requested than items available");
+        }
+        nclusters[i] = k;
+    }
+    RETVAL = cuts_c2perl(aTHX_ tree, nlevels, nclusters, packed);
+    free(nclusters);
+    sv_2mortal((SV*)RETVAL);
+    OUTPUT:
+    RETVAL
+
+
+AV *
+cutthresholds(obj, thresholds_ref, packed = 0)
+    SV* obj
+    SV* thresholds_ref
+    int packed
+    PREINIT:
+    int i, j;
+    int n;
+    int nlevels;
+    Tree* tree;
+    AV* thresholds_av;
+    int* nclusters;
+    CODE:
+    if (!sv_isa(obj, "Algorithm::Cluster::Tree")) {
+        croak("cutthresholds can only be applied to an Algorithm::Cluster::Tree object");
+    }
+    if (!SvROK(thresholds_ref) || SvTYPE(SvRV(thresholds_ref)) != SVt_PVAV) {
+        croak("cutthresholds: Expected a reference to an array of distances");
+    }
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    n = tree->n + 1;
+    thresholds_av = (AV*) SvRV(thresholds_ref);
+    nlevels = (int) av_len(thresholds_av) + 1;
+    nclusters = malloc((nlevels+1)*sizeof(int));
+    if (!nclusters) {
+        croak("cutthresholds: Insufficient memory");
+    }
+    /* Only the nodes joining subnodes at a distance larger than the
+     * threshold are cut. The number of clusters is then the number of
+     * nodes above the threshold plus one, provided that the distances do
+     * not decrease from one node to the next. This does not hold for
+     * centroid linkage, nor in general for approximate or sparse trees. */
+    for (j = 1; j < tree->n; j++) {
+        if (tree->nodes[j].distance < tree->nodes[j-1].distance) {
+            free(nclusters);
+            croak("cutthresholds: The node distances should not decrease; use cuts instead");
+        }
+    }
+    for (i = 0; i < nlevels; i++) {
+        const double threshold = SvNV(*(av_fetch(thresholds_av, (I32) i, 0)));
+        int k = n;
+        for (j = 0; j < tree->n; j++)
+            if (tree->nodes[j].distance <= threshold) k--;
+        nclusters[i] = k;
+    }
+    RETVAL = cuts_c2perl(aTHX_ tree, nlevels, nclusters, packed);
+    free(nclusters);
+    sv_2mortal((SV*)RETVAL);
+    OUTPUT:
+    RETVAL
+
+AV *
+optimalorder(obj, distances_ref)
+    SV* obj
+    SV* distances_ref
+    PREINIT:
+    int i;
+    int n;
+    int ok;
+    Tree* tree;
+    double** distances;
+    int* order;
+    CODE:
+    if (!sv_isa(obj, "Algorithm::Cluster::Tree")) {
+        croak("optimalorder can only be applied to an Algorithm::Cluster::Tree object");
+    }
+    if (!SvROK(distances_ref) || SvTYPE(SvRV(distances_ref)) != SVt_PVAV) {
+        croak("optimalorder: Expected a reference to a distance matrix");
+    }
+    tree = INT2PTR(Tree*,SvIV(SvRV(obj)));
+    n = tree->n + 1;
+    if (av_len((AV*) SvRV(distances_ref)) + 1 != n) {
+        croak("optimalorder: Size of the distance matrix should be equal to the number of items");
+    }
+    distances = parse_distance(aTHX_ distances_ref, n);
+    if (!distances) {
+        croak("optimalorder: Error reading the distance matrix");
+    }
+    order = malloc(n*sizeof(int));
+    if (!order) {
+        free_ragged_matrix_dbl(distances, n);
+        croak("optimalorder: Insufficient memory");
+    }
+    ok = optimalleaforder(n, tree->nodes, distances, order);
+    free_ragged_matrix_dbl(distances, n);
+    if (!ok) {
+        free(order);
+        croak("optimalorder: Insufficient memory");
+    }
+    RETVAL = newAV();
+    for (i = 0; i < n; i++) {
+        av_push(RETVAL, newSViv(order[i]));
+    }
+    free(order);
+    sv_2mortal((SV*)RETVAL);
+    OUTPUT:
+    RETVAL
+
 void DESTROY (obj)
     SV* obj
     PREINIT:
@@ -1017,6 +1446,27 @@ void DESTROY (obj)
     return;  /* assume stack size is correct */
 
 
+MODULE = Algorithm::Cluster PACKAGE = Algorithm::Cluster::DataFile
+PROTOTYPES: ENABLE
+
+void DESTROY (obj)
+    SV* obj
+    PREINIT:
+    I32* temp;
+    DataFile* datafile;
+    PPCODE:
+    temp = PL_markstack_ptr++;
+    datafile = INT2PTR(DataFile*, SvIV(SvRV(obj)));
+    closedatafile(datafile);
+    if (PL_markstack_ptr != temp) {
+        /* truly void, because dXSARGS not invoked */
+        PL_markstack_ptr = temp;
+        XSRETURN_EMPTY;
+        /* return empty stack */
+    }  /* must have used dXSARGS; list context implied */
+    return;  /* assume stack size is correct */
+
+
 MODULE = Algorithm::Cluster    PACKAGE = Algorithm::Cluster
 PROTOTYPES: ENABLE
 
@@ -1082,7 +1532,7 @@ _median(input)
 
 
 SV *
-_treecluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist,method)
+_treecluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist,method,nsummary,refine)
     int      nrows;
     int      ncols;
     SV *     data_ref;
@@ -1091,6 +1541,8 @@ _treecluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist,method)
     int      transpose;
     char *   dist;
     char *   method;
+    int      nsummary;
+    int      refine;
 
     PREINIT:
     Node*    nodes;
@@ -1131,8 +1583,12 @@ _treecluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist,method)
     /* ------------------------
      * Run the library function
      */
-    nodes = treecluster(nrows, ncols, matrix, mask, weight, transpose,
-                dist[0], method[0], distancematrix);
+    if (matrix && nsummary > 0)
+        nodes = approxtreecluster(nrows, ncols, matrix, mask, weight,
+                    transpose, dist[0], method[0], nsummary, refine);
+    else
+        nodes = treecluster(nrows, ncols, matrix, mask, weight, transpose,
+                    dist[0], method[0], distancematrix);
 
     /* ------------------------
      * Check result to make sure we didn't run into memory problems
@@ -1148,35 +1604,6 @@ _treecluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist,method)
         }
         croak("memory allocation failure in treecluster\n");
     }
-    else {
-
-        /* ------------------------
-          * Convert generated C matrices to Perl matrices
-          */
-        const int n = nelements-1;
-        int i;
-        SV* obj;
-        Tree* tree;
-        RETVAL = newSViv(0);
-        obj = newSVrv(RETVAL, "Algorithm::Cluster::Tree");
-        tree = malloc(sizeof(Tree));
-        if (!tree)
-            croak("Memory allocation failure in Algorithm::Cluster::Tree\n");
-        tree->n = n;
-        tree->nodes = malloc(n*sizeof(Node));
-        if (!tree->nodes) {
-            free(tree);
-            croak("Memory allocation failure in Algorithm::Cluster::Tree\n");
-        }
-        sv_setiv(obj, PTR2IV(tree));
-        SvREADONLY_on(obj);
-        for(i=0; i<n; i++) {
-            tree->nodes[i].left = nodes[i].left;
-            tree->nodes[i].right = nodes[i].right;
-            tree->nodes[i].distance = nodes[i].distance;
-        }
-        free(nodes);
-    }
 
     /* ------------------------
      * Free what we've malloc'ed 
@@ -1189,50 +1616,212 @@ _treecluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist,method)
         free_ragged_matrix_dbl(distancematrix, nelements);
     }
 
+    /* ------------------------
+     * Convert the generated tree to a Perl object
+     */
+    RETVAL = tree_c2perl(aTHX_ nodes, nelements-1);
+    if (!RETVAL) {
+        free(nodes);
+        croak("Memory allocation failure in Algorithm::Cluster::Tree\n");
+    }
+
     /* Finished _treecluster() */
     OUTPUT:
     RETVAL
 
 
+SV *
+_sparsetreecluster(nelements,edges_ref,method)
+    int      nelements;
+    SV *     edges_ref;
+    char *   method;
+
+    PREINIT:
+    Node*    nodes;
+    int      i;
+    int    * edgei;
+    int    * edgej;
+    double * edged;
+    AV     * edges_av = (AV *) SvRV(edges_ref);
+    const int nedges = (int) av_len(edges_av) + 1;
+
+    CODE:
+    /* ------------------------
+     * Convert the edges from Perl to C. Each edge is a
+     * reference to an array [i, j, distance]; we rely on
+     * the Perl caller to check them.
+     */
+    edgei = malloc((nedges+1)*sizeof(int));
+    edgej = malloc((nedges+1)*sizeof(int));
+    edged = malloc((nedges+1)*sizeof(double));
+    if (!edgei || !edgej || !edged) {
+        if (edgei) free(edgei);
+        if (edgej) free(edgej);
+        if (edged) free(edged);
+        croak("memory allocation failure in _sparsetreecluster\n");
+    }
+    for (i = 0; i < nedges; i++) {
+        AV* edge_av = (AV *) SvRV(*(av_fetch(edges_av, (I32) i, 0)));
+        edgei[i] = (int) SvIV(*(av_fetch(edge_av, (I32) 0, 0)));
+        edgej[i] = (int) SvIV(*(av_fetch(edge_av, (I32) 1, 0)));
+        edged[i] = SvNV(*(av_fetch(edge_av, (I32) 2, 0)));
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    nodes = sparsetreecluster(nelements, nedges, edgei, edgej, edged,
+                method[0]);
+    free(edgei);
+    free(edgej);
+    free(edged);
+    if (!nodes) croak("memory allocation failure in sparsetreecluster\n");
+
+    /* ------------------------
+     * Convert the generated tree to a Perl object
+     */
+    RETVAL = tree_c2perl(aTHX_ nodes, nelements-1);
+    if (!RETVAL) {
+        free(nodes);
+        croak("Memory allocation failure in Algorithm::Cluster::Tree\n");
+    }
+
+    /* Finished _sparsetreecluster() */
+    OUTPUT:
+    RETVAL
+
 void
-_kcluster(nclusters,nrows,ncols,data_ref,mask_ref,weight_ref,transpose,npass,method,dist,initialid_ref)
-    int      nclusters;
+_treeclusters(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist,methods)
     int      nrows;
     int      ncols;
     SV *     data_ref;
     SV *     mask_ref;
     SV *     weight_ref;
     int      transpose;
-    int      npass;
-    char *   method;
     char *   dist;
-    SV *     initialid_ref;
+    char *   methods;
 
     PREINIT:
-    SV  *    clusterid_ref;
-    int *    clusterid;
-    int      nobjects;
-    int      ndata;
-    double   error;
-    int      ifound;
+    Node**   trees;
     int      ok;
+    int      i;
 
-    double  * weight;
-    double ** matrix;
-    int    ** mask;
-
+    double  * weight = NULL;
+    double ** matrix = NULL;
+    int    ** mask   = NULL;
+    double ** distancematrix = NULL;
+    const int ndata = transpose ? nrows : ncols;
+    const int nelements = transpose ? ncols : nrows;
+    const int nmethods = strlen(methods);
 
     PPCODE:
     /* ------------------------
-     * Don't check the parameters, because we rely on the Perl
-     * caller to check most parameters.
+     * Convert data and mask matrices and the weight array
+     * from C to Perl, as in _treecluster.
      */
+    if (is_distance_matrix(aTHX_ data_ref)) {
+        distancematrix = parse_distance(aTHX_ data_ref, nelements);
+        if (!distancematrix) {
+                croak("memory allocation failure in _treeclusters\n");
+        }
+    } else {
+        ok = malloc_matrices(aTHX_ weight_ref, &weight, ndata, 
+                    data_ref,   &matrix,
+                    mask_ref,   &mask,  
+                    nrows,      ncols);
+        if (!ok) {
+            croak("failed to read input data for _treeclusters\n");
+        }
+    }
+
+    ok = 0;
+    trees = malloc(nmethods*sizeof(Node*));
+    if (trees) {
+        /* ------------------------
+         * Run the library function. The distance matrix is shared by
+         * all methods, and is not modified.
+         */
+        ok = treeclusters(nrows, ncols, matrix, mask, weight, transpose,
+                    dist[0], nmethods, methods, distancematrix, trees);
+    }
 
     /* ------------------------
-     * Malloc space for the return values from the library function
+     * Free what we've malloc'ed 
      */
-    if (transpose==0) {
-        nobjects = nrows;
+    if (matrix) {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+    } else {
+        free_ragged_matrix_dbl(distancematrix, nelements);
+    }
+
+    if (!trees) croak("memory allocation failure in _treeclusters\n");
+    if (!ok) {
+        free(trees);
+        croak("memory allocation failure in treeclusters\n");
+    }
+
+    /* ------------------------
+     * Convert the generated trees to Perl objects
+     */
+    for (i = 0; i < nmethods; i++) {
+        SV* tree = tree_c2perl(aTHX_ trees[i], nelements-1);
+        if (!tree) {
+            while (i < nmethods) free(trees[i++]);
+            free(trees);
+            croak("Memory allocation failure in Algorithm::Cluster::Tree\n");
+        }
+        XPUSHs(sv_2mortal(tree));
+    }
+    free(trees);
+
+    /* Finished _treeclusters() */
+
+
+void
+_kcluster(nclusters,nrows,ncols,data_ref,mask_ref,weight_ref,transpose,npass,method,dist,init,initialid_ref,seed,callback_ref)
+    int      nclusters;
+    int      nrows;
+    int      ncols;
+    SV *     data_ref;
+    SV *     mask_ref;
+    SV *     weight_ref;
+    int      transpose;
+    int      npass;
+    char *   method;
+    char *   dist;
+    char *   init;
+    SV *     initialid_ref;
+    unsigned long seed;
+    SV *     callback_ref;
+
+    PREINIT:
+    SV  *    clusterid_ref;
+    int *    clusterid;
+    int      nobjects;
+    int      ndata;
+    double   error;
+    int      ifound;
+    int      ok;
+    ProgressCallback callback;
+
+    double  * weight;
+    double ** matrix;
+    int    ** mask;
+
+
+    PPCODE:
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most parameters.
+     */
+
+    /* ------------------------
+     * Malloc space for the return values from the library function
+     */
+    if (transpose==0) {
+        nobjects = nrows;
         ndata = ncols;
     } else {
         nobjects = ncols;
@@ -1268,12 +1857,24 @@ _kcluster(nclusters,nrows,ncols,data_ref,mask_ref,weight_ref,transpose,npass,met
     /* ------------------------
      * Run the library function
      */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
     kcluster( 
         nclusters, nrows, ncols, 
         matrix, mask, weight, transpose,
-        npass, method[0], dist[0], clusterid,  &error, &ifound
-        
+        npass, method[0], dist[0], init[0], seed, clusterid,  &error, &ifound,
+        callback.function ? call_perl_progress : NULL, &callback
     );
+    SPAGAIN;
+    if (callback.error) {
+        free(clusterid);
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
 
     /* ------------------------
      * Convert generated C matrices to Perl matrices
@@ -1300,12 +1901,369 @@ _kcluster(nclusters,nrows,ncols,data_ref,mask_ref,weight_ref,transpose,npass,met
 
 
 void
-_kmedoids(nclusters,nobjects,distancematrix_ref,npass,initialid_ref)
+_kclustersweep(kmin,kmax,nrows,ncols,data_ref,mask_ref,weight_ref,transpose,npass,method,dist,init,seed)
+    int      kmin;
+    int      kmax;
+    int      nrows;
+    int      ncols;
+    SV *     data_ref;
+    SV *     mask_ref;
+    SV *     weight_ref;
+    int      transpose;
+    int      npass;
+    char *   method;
+    char *   dist;
+    char *   init;
+    unsigned long seed;
+
+    PREINIT:
+    int **   clusterid;
+    double * error;
+    double * score;
+    int      nobjects;
+    int      ndata;
+    int      nk;
+    int      i;
+    int      ok;
+
+    double  * weight;
+    double ** matrix;
+    int    ** mask;
+
+
+    PPCODE:
+    /* ------------------------
+     * Malloc space for the return values from the library function
+     */
+    if (transpose==0) {
+        nobjects = nrows;
+        ndata = ncols;
+    } else {
+        nobjects = ncols;
+        ndata = nrows;
+    }
+    nk = kmax - kmin + 1;
+    clusterid = malloc(nk * sizeof(int*));
+    error = malloc(nk * sizeof(double));
+    score = malloc(nk * sizeof(double));
+    ok = clusterid && error && score;
+    if (clusterid) {
+        for (i = 0; i < nk; i++) {
+            clusterid[i] = ok ? malloc(nobjects * sizeof(int)) : NULL;
+            if (!clusterid[i]) ok = 0;
+        }
+    }
+    if (!ok) {
+        if (clusterid) {
+            for (i = 0; i < nk; i++) if (clusterid[i]) free(clusterid[i]);
+            free(clusterid);
+        }
+        if (error) free(error);
+        if (score) free(score);
+        croak("memory allocation failure in _kclustersweep\n");
+    }
+
+    /* ------------------------
+     * Convert data and mask matrices and the weight array
+     * from C to Perl.
+     */
+    ok = malloc_matrices( aTHX_ weight_ref, &weight, ndata, 
+                data_ref,   &matrix,
+                mask_ref,   &mask,  
+                nrows,      ncols);
+    if (ok) {
+        /* ------------------------
+         * Run the library function
+         */
+        ok = kclustersweep(kmin, kmax, nrows, ncols, matrix, mask, weight,
+                           transpose, npass, method[0], dist[0], init[0],
+                           seed, clusterid, error, score);
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+    }
+
+    /* ------------------------
+     * Push the Perl matrices onto the return stack
+     */
+    if (ok) {
+        XPUSHs(sv_2mortal( matrix_c2perl_int(aTHX_ clusterid, nk, nobjects) ));
+        XPUSHs(sv_2mortal( row_c2perl_dbl(aTHX_ error, nk) ));
+        XPUSHs(sv_2mortal( row_c2perl_dbl(aTHX_ score, nk) ));
+    }
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    for (i = 0; i < nk; i++) free(clusterid[i]);
+    free(clusterid);
+    free(error);
+    free(score);
+    if (!ok) croak("kclustersweep failed\n");
+
+    /* Finished _kclustersweep() */
+
+
+
+void
+_minibatchkcluster(nclusters,nrows,ncols,data_ref,mask_ref,weight_ref,transpose,npass,dist,batchsize,niter,initialid_ref,seed,callback_ref)
+    int      nclusters;
+    int      nrows;
+    int      ncols;
+    SV *     data_ref;
+    SV *     mask_ref;
+    SV *     weight_ref;
+    int      transpose;
+    int      npass;
+    char *   dist;
+    int      batchsize;
+    int      niter;
+    SV *     initialid_ref;
+    unsigned long seed;
+    SV *     callback_ref;
+
+    PREINIT:
+    int *    clusterid;
+    int      nobjects;
+    int      ndata;
+    double   error;
+    int      ifound;
+    int      ok;
+    RowSource source;
+    ProgressCallback callback;
+    double  * weight = NULL;
+    double ** matrix = NULL;
+    int    ** mask = NULL;
+
+    PPCODE:
+    /* ------------------------
+     * The rows are either read from the data matrix, or obtained by
+     * calling the function passed by the Perl caller. The Perl caller
+     * checks the parameters.
+     */
+    if (transpose==0) {
+        nobjects = nrows;
+        ndata = ncols;
+    } else {
+        nobjects = ncols;
+        ndata = nrows;
+    }
+    clusterid = malloc(nobjects * sizeof(int) );
+    if (!clusterid) {
+        croak("memory allocation failure in _minibatchkcluster\n");
+    }
+    source.matrix.transpose = transpose;
+    source.matrix.ndata = ndata;
+    source.function = NULL;
+    source.error = NULL;
+    if (SvROK(data_ref) && SvTYPE(SvRV(data_ref)) == SVt_PVCV) {
+        source.function = data_ref;
+        if (SvROK(weight_ref) && SvTYPE(SvRV(weight_ref)) == SVt_PVAV) {
+            weight = malloc_row_perl2c_dbl(aTHX_ weight_ref, NULL);
+        } else {
+            weight = malloc_row_dbl(aTHX_ ndata, 1.0);
+        }
+        ok = (weight != NULL);
+    } else {
+        ok = malloc_matrices( aTHX_ weight_ref, &weight, ndata,
+                    data_ref,   &matrix,
+                    mask_ref,   &mask,
+                    nrows,      ncols);
+    }
+    if (!ok) {
+        free(clusterid);
+        croak("failed to read input data for _minibatchkcluster\n");
+    }
+    source.matrix.data = matrix;
+    source.matrix.mask = mask;
+
+    if (npass==0) {
+        copy_row_perl2c_int(aTHX_ initialid_ref, clusterid);
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl functions may be called, which use the Perl stack */
+    PUTBACK;
+    minibatchkcluster(nclusters, nobjects, ndata,
+                      source.function ? get_perl_rows : getdatarows,
+                      source.function ? (void*)&source : (void*)&source.matrix,
+                      weight, dist[0], batchsize, niter, npass,
+                      seed, clusterid, &error, &ifound,
+                      callback.function ? call_perl_progress : NULL,
+                      &callback);
+    SPAGAIN;
+
+    free(weight);
+    if (matrix) {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+    }
+    if (ifound < 0) {
+        free(clusterid);
+        if (source.error) {
+            sv_2mortal(source.error);
+            croak("%s", SvPV_nolen(source.error));
+        }
+        croak("memory allocation failure in _minibatchkcluster\n");
+    }
+    if (callback.error) {
+        free(clusterid);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+
+    XPUSHs(sv_2mortal( row_c2perl_int(aTHX_ clusterid, nobjects) ));
+    XPUSHs(sv_2mortal( newSVnv(error) ));
+    XPUSHs(sv_2mortal( newSViv(ifound) ));
+    free(clusterid);
+
+    /* Finished _minibatchkcluster() */
+
+
+void
+_opendatafile(filename,format)
+    char *   filename;
+    char *   format;
+
+    PREINIT:
+    DataFile* datafile;
+    SV *     ref;
+    SV *     obj;
+    int      nrows;
+    int      ncols;
+
+    PPCODE:
+    /* ------------------------
+     * The file is scanned once when it is opened; the DataFile object is
+     * then passed to _streamkcluster, and closed when it goes out of scope.
+     */
+    datafile = opendatafile(filename, format[0]);
+    if (!datafile) {
+        croak("failed to read data file %s\n", filename);
+    }
+    datafileshape(datafile, &nrows, &ncols);
+    ref = newSViv(0);
+    obj = newSVrv(ref, "Algorithm::Cluster::DataFile");
+    sv_setiv(obj, PTR2IV(datafile));
+    SvREADONLY_on(obj);
+    XPUSHs(sv_2mortal( ref ));
+    XPUSHs(sv_2mortal( newSViv(nrows) ));
+    XPUSHs(sv_2mortal( newSViv(ncols) ));
+
+    /* Finished _opendatafile() */
+
+
+void
+_streamkcluster(datafile_ref,nclusters,npass,method,dist,batchsize,niter,weight_ref,initialid_ref,seed,callback_ref)
+    SV *     datafile_ref;
+    int      nclusters;
+    int      npass;
+    char *   method;
+    char *   dist;
+    int      batchsize;
+    int      niter;
+    SV *     weight_ref;
+    SV *     initialid_ref;
+    unsigned long seed;
+    SV *     callback_ref;
+
+    PREINIT:
+    DataFile* datafile;
+    const double* fileweight;
+    int *    clusterid;
+    int      nrows;
+    int      ncols;
+    int      i;
+    double   error;
+    int      ifound;
+    double * weight = NULL;
+    ProgressCallback callback;
+
+    PPCODE:
+    /* ------------------------
+     * The rows are read from the data file in batches; only the
+     * cluster assignments and the cluster centers are kept in memory.
+     * The Perl caller checks that the weights match the file.
+     */
+    if (!sv_isa(datafile_ref, "Algorithm::Cluster::DataFile")) {
+        croak("_streamkcluster can only be applied to an Algorithm::Cluster::DataFile object");
+    }
+    datafile = INT2PTR(DataFile*, SvIV(SvRV(datafile_ref)));
+    datafileshape(datafile, &nrows, &ncols);
+    clusterid = malloc(nrows * sizeof(int));
+    if (!clusterid) {
+        croak("memory allocation failure in _streamkcluster\n");
+    }
+    /* Use the weights passed by the caller, or the EWEIGHT line */
+    if (SvROK(weight_ref) && SvTYPE(SvRV(weight_ref)) == SVt_PVAV) {
+        weight = malloc_row_perl2c_dbl(aTHX_ weight_ref, NULL);
+    } else {
+        fileweight = datafileweight(datafile);
+        weight = malloc_row_dbl(aTHX_ ncols, 1.0);
+        if (weight && fileweight) {
+            for (i = 0; i < ncols; i++) weight[i] = fileweight[i];
+        }
+    }
+    if (!weight) {
+        free(clusterid);
+        croak("memory allocation failure in _streamkcluster\n");
+    }
+
+    if (npass==0) {
+        copy_row_perl2c_int(aTHX_ initialid_ref, clusterid);
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
+    if (method[0]=='b')
+        minibatchkcluster(nclusters, nrows, ncols, getdatafilerows, datafile,
+                          weight, dist[0], batchsize, niter, npass,
+                          seed, clusterid, &error, &ifound,
+                          callback.function ? call_perl_progress : NULL,
+                          &callback);
+    else
+        streamkcluster(nclusters, nrows, ncols, getdatafilerows, datafile,
+                       weight, dist[0], npass, seed, clusterid, &error,
+                       &ifound,
+                       callback.function ? call_perl_progress : NULL,
+                       &callback);
+    SPAGAIN;
+
+    free(weight);
+    if (ifound < 0) {
+        free(clusterid);
+        croak("failed to read data file, or memory allocation failure in _streamkcluster\n");
+    }
+    if (callback.error) {
+        free(clusterid);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+
+    XPUSHs(sv_2mortal( row_c2perl_int(aTHX_ clusterid, nrows) ));
+    XPUSHs(sv_2mortal( newSVnv(error) ));
+    XPUSHs(sv_2mortal( newSViv(ifound) ));
+    free(clusterid);
+
+    /* Finished _streamkcluster() */
+
+
+void
+_kmedoids(nclusters,nobjects,distancematrix_ref,npass,initialid_ref,seed,callback_ref)
     int      nclusters;
     int      nobjects;
     SV *     distancematrix_ref;
     int      npass;
     SV *     initialid_ref;
+    unsigned long seed;
+    SV *     callback_ref;
 
 
     PREINIT:
@@ -1314,6 +2272,7 @@ _kmedoids(nclusters,nobjects,distancematrix_ref,npass,initialid_ref)
     int *    clusterid;
     double   error;
     int      ifound;
+    ProgressCallback callback;
 
 
 
@@ -1353,11 +2312,22 @@ _kmedoids(nclusters,nobjects,distancematrix_ref,npass,initialid_ref)
     /* ------------------------
      * Run the library function
      */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
     kmedoids( 
         nclusters, nobjects, 
-        distancematrix, npass, clusterid, 
-        &error, &ifound
+        distancematrix, npass, seed, clusterid, 
+        &error, &ifound,
+        callback.function ? call_perl_progress : NULL, &callback
     );
+    SPAGAIN;
+    if (callback.error) {
+        free(clusterid);
+        free_ragged_matrix_dbl(distancematrix, nobjects);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
 
     if(ifound==-1) {
         free(clusterid);
@@ -1394,6 +2364,80 @@ _kmedoids(nclusters,nobjects,distancematrix_ref,npass,initialid_ref)
 
 
 
+void
+_pam(nclusters,nobjects,distancematrix_ref,callback_ref)
+    int      nclusters;
+    int      nobjects;
+    SV *     distancematrix_ref;
+    SV *     callback_ref;
+
+
+    PREINIT:
+    double** distancematrix;
+    SV  *    clusterid_ref;
+    int *    clusterid;
+    double   error;
+    int      ok;
+    ProgressCallback callback;
+
+
+
+    PPCODE:
+    /* ------------------------
+     * Don't check the parameters, because we rely on the Perl
+     * caller to check most parameters.
+     */
+
+    /* ------------------------
+     * Malloc space for the return values from the library function
+     */
+    clusterid = malloc(nobjects * sizeof(int));
+    if (!clusterid) {
+        croak("memory allocation failure in _pam\n");
+    }
+
+    distancematrix = parse_distance(aTHX_ distancematrix_ref, nobjects);
+    if (!distancematrix) {
+        free(clusterid);
+        croak("failed to allocate memory for distance matrix in _pam\n");
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
+    ok = pam(nclusters, nobjects, distancematrix, clusterid, &error,
+             callback.function ? call_perl_progress : NULL, &callback);
+    SPAGAIN;
+    free_ragged_matrix_dbl(distancematrix, nobjects);
+    if (callback.error) {
+        free(clusterid);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
+    if (!ok) {
+        free(clusterid);
+        croak("memory allocation failure in _pam\n");
+    }
+
+    /* ------------------------
+     * Convert generated C matrices to Perl matrices
+     */
+    clusterid_ref = row_c2perl_int(aTHX_ clusterid, nobjects);
+    free(clusterid);
+
+    /* ------------------------
+     * Push the new Perl matrices onto the return stack
+     */
+    XPUSHs(sv_2mortal( clusterid_ref   ));
+    XPUSHs(sv_2mortal( newSVnv(error) ));
+
+    /* Finished _pam() */
+
+
+
 double
 _clusterdistance(nrows,ncols,data_ref,mask_ref,weight_ref,cluster1_len,cluster2_len,cluster1_ref,cluster2_ref,dist,method,transpose)
     int      nrows;
@@ -1705,7 +2749,105 @@ _distancematrix(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist)
 
 
 void
-_somcluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,nxgrid,nygrid,inittau,niter,dist)
+_silhouette(nclusters,nrows,ncols,data_ref,mask_ref,weight_ref,transpose,dist,distancematrix_ref,clusterid_ref)
+    int      nclusters;
+    int      nrows;
+    int      ncols;
+    SV *     data_ref;
+    SV *     mask_ref;
+    SV *     weight_ref;
+    int      transpose;
+    char *   dist;
+    SV *     distancematrix_ref;
+    SV *     clusterid_ref;
+
+    PREINIT:
+    int *    clusterid;
+    double * widths;
+    double   average;
+    int      nobjects;
+    int      ndata;
+    int      ok;
+
+    double  * weight = NULL;
+    double ** matrix = NULL;
+    int    ** mask = NULL;
+    double ** distancematrix = NULL;
+
+
+    PPCODE:
+    /* ------------------------
+     * The distances are taken from the distance matrix if it is
+     * given, and calculated from the data otherwise.
+     */
+    if (SvROK(distancematrix_ref)) {
+        nobjects = nrows;
+        ndata = 0;
+    } else if (transpose==0) {
+        nobjects = nrows;
+        ndata = ncols;
+    } else {
+        nobjects = ncols;
+        ndata = nrows;
+    }
+    clusterid = malloc(nobjects * sizeof(int));
+    widths = malloc(nobjects * sizeof(double));
+    if (!clusterid || !widths) {
+        if (clusterid) free(clusterid);
+        if (widths) free(widths);
+        croak("memory allocation failure in _silhouette\n");
+    }
+    copy_row_perl2c_int(aTHX_ clusterid_ref, clusterid);
+
+    if (SvROK(distancematrix_ref)) {
+        distancematrix = parse_distance(aTHX_ distancematrix_ref, nobjects);
+        ok = distancematrix ? 1 : 0;
+    } else {
+        ok = malloc_matrices( aTHX_ weight_ref, &weight, ndata, 
+                    data_ref,   &matrix,
+                    mask_ref,   &mask,  
+                    nrows,      ncols);
+    }
+    if (!ok) {
+        free(clusterid);
+        free(widths);
+        croak("failed to read input data for _silhouette\n");
+    }
+
+    /* ------------------------
+     * Run the library function
+     */
+    ok = silhouette(nclusters, nrows, ncols, matrix, mask, weight, transpose,
+                    dist[0], distancematrix, clusterid, widths, &average);
+
+    /* ------------------------
+     * Push the results onto the return stack
+     */
+    if (ok) {
+        XPUSHs(sv_2mortal( row_c2perl_dbl(aTHX_ widths, nobjects) ));
+        XPUSHs(sv_2mortal( newSVnv(average) ));
+    }
+
+    /* ------------------------
+     * Free what we've malloc'ed 
+     */
+    free(clusterid);
+    free(widths);
+    if (distancematrix) {
+        free_ragged_matrix_dbl(distancematrix, nobjects);
+    } else {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+    }
+    if (!ok) croak("memory allocation failure in _silhouette\n");
+
+    /* Finished _silhouette() */
+
+
+
+void
+_somcluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,nxgrid,nygrid,inittau,niter,dist,seed,callback_ref)
     int      nrows;
     int      ncols;
     SV *     data_ref;
@@ -1717,6 +2859,8 @@ _somcluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,nxgrid,nygrid,ini
     double   inittau;
     int      niter;
     char *   dist;
+    unsigned long seed;
+    SV *     callback_ref;
 
     PREINIT:
     int      (*clusterid)[2];
@@ -1728,6 +2872,7 @@ _somcluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,nxgrid,nygrid,ini
     int    ** mask;
 
     int ok;
+    ProgressCallback callback;
 
     int i;
     AV * matrix_av;
@@ -1768,12 +2913,25 @@ _somcluster(nrows,ncols,data_ref,mask_ref,weight_ref,transpose,nxgrid,nygrid,ini
     /* ------------------------
      * Run the library function
      */
+    init_progress_callback(aTHX_ &callback, callback_ref);
+    /* The Perl callback may be called, which uses the Perl stack */
+    PUTBACK;
     somcluster( 
         nrows, ncols, 
         matrix, mask, weight,
         transpose, nxgrid, nygrid, inittau, niter,
-        dist[0], celldata, clusterid
+        dist[0], seed, celldata, clusterid,
+        callback.function ? call_perl_progress : NULL, &callback
     );
+    SPAGAIN;
+    if (callback.error) {
+        free_matrix_int(mask,     nrows);
+        free_matrix_dbl(matrix,   nrows);
+        free(weight);
+        free(clusterid);
+        sv_2mortal(callback.error);
+        croak("%s", SvPV_nolen(callback.error));
+    }
 
     /* ------------------------
      * Convert generated C matrices to Perl matrices
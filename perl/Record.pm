@@ -244,6 +244,8 @@ sub save {
     my %default = (
         geneclusters => undef,
         expclusters  => undef,
+        geneorder    => undef,
+        exporder     => undef,
     );
     my %param = (%default, %args);
     $param{data} = $self->{data};
@@ -294,15 +296,27 @@ sub save {
         }
     }
     my @gorder;
-    if (defined $self->{gorder}) {
-        @gorder = $self->{gorder};
+    if (defined $param{geneorder}) {
+        @gorder = @{$param{geneorder}};
+        if (scalar @gorder != $ngenes) {
+            die "Size of the gene order should be equal to the number of genes";
+        }
+    }
+    elsif (defined $self->{gorder}) {
+        @gorder = @{$self->{gorder}};
     }
     else {
         @gorder = (0..$ngenes-1);
     }
     my @eorder;
-    if (defined $self->{eorder}) {
-        @eorder = $self->{eorder};
+    if (defined $param{exporder}) {
+        @eorder = @{$param{exporder}};
+        if (scalar @eorder != $nexps) {
+            die "Size of the experiment order should be equal to the number of experiments";
+        }
+    }
+    elsif (defined $self->{eorder}) {
+        @eorder = @{$self->{eorder}};
     }
     else {
         @eorder = (0..$nexps-1);
@@ -390,11 +404,13 @@ sub _treesort {
     my $tree = $param{tree};
     my $nNodes = $tree->length;
     my $nElements = $nNodes + 1;
+    my @left = @{$tree->lefts};
+    my @right = @{$tree->rights};
     my @neworder = (0.0) x $nElements;
     my @clusterids = (0..$nElements-1);
     for (my $i = 0; $i < $nNodes; $i++) {
-        my $i1 = $tree->get($i)->left;
-        my $i2 = $tree->get($i)->right;
+        my $i1 = $left[$i];
+        my $i2 = $right[$i];
         my ($order1, $order2, $count1, $count2);
         if ($i1 < 0) {
             $order1 = $nodeorder[-$i1-1];
@@ -480,15 +496,12 @@ sub _savetree {
     my @nodeID = ('') x $nnodes;
     my @nodecounts = (0) x $nnodes;
     my @nodeorder = (0.0) x $nnodes;
-    my @nodedist;
-    my $i;
-    for ($i = 0; $i < $nnodes; $i++) {
-        my $node = $tree->get($i);
-        push (@nodedist, $node->distance);
-    }
+    my @nodedist = @{$tree->distances};
+    my @left = @{$tree->lefts};
+    my @right = @{$tree->rights};
     for (my $nodeindex = 0; $nodeindex < $nnodes; $nodeindex++) {
-        my $min1 = $tree->get($nodeindex)->left;
-        my $min2 = $tree->get($nodeindex)->right;
+        my $min1 = $left[$nodeindex];
+        my $min2 = $right[$nodeindex];
         my $order1;
         my $order2;
         my $counts1;
@@ -1,4 +1,4 @@
-use Test::More tests => 15;
+use Test::More tests => 26;
 
 use lib '../blib/lib','../blib/arch';
 
@@ -42,3 +42,56 @@ $node = $tree->get(3);
 is ($node->left, -2);
 is ($node->right, -3);
 is (sprintf ("%7.4f", $node->distance), ' 7.8000');
+
+#------------------------------------------------------
+# Bulk access to the nodes
+#
+
+is_deeply ($tree->lefts, [1, -1, 4, -2]);
+is_deeply ($tree->rights, [2, 3, 0, -3]);
+is_deeply ($tree->distances, [3.1, 5.3, 5.9, 7.8]);
+is_deeply ([unpack("i*", $tree->rights(1)), unpack("d*", $tree->distances(1))],
+           [2, 3, 0, -3, 3.1, 5.3, 5.9, 7.8]);
+is_deeply ([$tree->node(1)], [-1, 3, 5.3]);
+
+#------------------------------------------------------
+# Cutting the tree into several numbers of clusters at once
+#
+
+my $clusterids = $tree->cuts([1, 2, 3, 4, 5]);
+is_deeply ($clusterids, [[0, 0, 0, 0, 0],
+                         [0, 1, 1, 1, 0],
+                         [1, 2, 2, 2, 0],
+                         [1, 3, 3, 2, 0],
+                         [1, 3, 4, 2, 0]]);
+
+$clusterids = $tree->cuts([3], 1);
+is_deeply ([unpack("i*", $clusterids->[0])], [1, 2, 2, 2, 0]);
+
+$clusterids = $tree->cutthresholds([3.0, 5.5, 6.0]);
+is_deeply ($clusterids, [[1, 3, 4, 2, 0],
+                         [1, 2, 2, 2, 0],
+                         [0, 1, 1, 1, 0]]);
+
+# Cutting at a threshold requires the node distances to be sorted
+my $unsorted = Algorithm::Cluster::Tree->new([$node1, $node3, $node2, $node4]);
+eval { $unsorted->cutthresholds([5.5]) };
+like ($@, qr/node distances should not decrease/);
+
+#------------------------------------------------------
+# Optimal leaf ordering
+#
+
+# Distances between the points 8, 3, 1, 5, 12 on a line
+my @x = (8, 3, 1, 5, 12);
+my @distances;
+foreach my $i (0..4) {
+    $distances[$i] = [map { abs($x[$i] - $x[$_]) } (0..$i-1)];
+}
+my $order = $tree->optimalorder(\@distances);
+# An order and its reverse have the same cost
+$order = [map { 4 - $_ } @$order] if $order->[2] != 0;
+is_deeply ($order, [3, 1, 0, 2, 4]);
+
+eval { $tree->optimalorder([[], [1]]) };
+like ($@, qr/Size of the distance matrix/);
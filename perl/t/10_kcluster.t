@@ -1,4 +1,4 @@
-use Test::More tests => 28;
+use Test::More tests => 57;
 
 use lib '../blib/lib','../blib/arch';
 
@@ -170,5 +170,233 @@ ok ( $clusters->[12] == 1 );
 ok ( sprintf ("%7.3f", $error) == '  3.036' );
    
 ok ($found == 1 );
-                 
+
+#----------
+# test kcluster with k-means++ and k-means|| seeding
+#
+my $data3 = [
+    [   0.1,   0.3 ], [   0.4,   0.0 ], [   0.2,   0.5 ], [   0.0,   0.1 ],
+    [ 100.2,   0.1 ], [ 100.0,   0.4 ], [ 100.5,   0.3 ], [ 100.1,   0.0 ],
+    [   0.3, 100.0 ], [   0.1, 100.2 ], [   0.0, 100.4 ], [   0.2, 100.1 ],
+];
+
+foreach my $init ('k', 'p') {
+    ($clusters, $error, $found) = Algorithm::Cluster::kcluster(
+        nclusters =>         3,
+        data      =>    $data3,
+        mask      =>        '',
+        weight    =>    [1, 1],
+        npass     =>         1,
+        init      =>     $init,
+    );
+    my @groups = map { join(',', @{$clusters}[4*$_..4*$_+3]) } (0..2);
+    my %labels = map { $clusters->[4*$_] => 1 } (0..2);
+    is_deeply (\@groups, [map { join(',', ($clusters->[4*$_]) x 4) } (0..2)]);
+    is (scalar keys %labels, 3);
+}
+
+#----------
+# test mini-batch k-means, on the data matrix and on rows obtained
+# from a function
+#
+my $calls = 0;
+my $rows = sub {
+    my ($index) = @_;
+    $calls++;
+    return [map { $data3->[$_] } @$index];
+};
+foreach my $source ('data', 'rows') {
+    my %source = ($source eq 'data') ? (data => $data3)
+                                     : (rows => $rows, nrows => 12, ncols => 2);
+    ($clusters, $error, $found) = Algorithm::Cluster::kcluster(
+        %source,
+        nclusters =>         3,
+        method    =>       'b',
+        npass     =>         3,
+        batchsize =>        10,
+        niter     =>        20,
+    );
+    my @groups = map { join(',', @{$clusters}[4*$_..4*$_+3]) } (0..2);
+    my %labels = map { $clusters->[4*$_] => 1 } (0..2);
+    is_deeply (\@groups, [map { join(',', ($clusters->[4*$_]) x 4) } (0..2)]);
+    is (scalar keys %labels, 3);
+}
+# Each pass reads one batch to seed the centers, 20 batches, and the 12 rows
+# in two chunks of 10
+is ($calls, 3*(1+20+2));
+
+#----------
+# test the progress callback
+#
+my @progress;
+($clusters, $error, $found) = Algorithm::Cluster::kcluster(
+    nclusters =>         3,
+    data      =>    $data3,
+    npass     =>         2,
+    callback  => sub { push @progress, $_[0]; return 0; },
+);
+is ($progress[0]{pass}, 0);
+is ($progress[-1]{pass}, 1);
+# The error is the smallest total at the end of a pass
+my %last = map { $_->{pass} => $_->{total} } @progress;
+my ($smallest) = sort { $a <=> $b } values %last;
+is (sprintf("%.6f", $smallest), sprintf("%.6f", $error));
+
+# Stop after the first iteration
+@progress = ();
+($clusters, $error, $found) = Algorithm::Cluster::kcluster(
+    nclusters =>         3,
+    data      =>    $data3,
+    npass     =>         5,
+    callback  => sub { push @progress, $_[0]; return 1; },
+);
+is (scalar @progress, 1);
+
+# An error in the callback is passed on
+eval {
+    Algorithm::Cluster::kcluster(
+        nclusters =>         3,
+        data      =>    $data3,
+        callback  => sub { die "stopped\n"; },
+    );
+};
+is ($@, "stopped\n");
+
+#----------
+# test k-means on the rows read from a data file
+#
+use File::Temp qw(tempfile);
+my $mask3 = [map { [1, 1] } @$data3];
+$mask3->[5][1] = 0;
+my $initialid3 = [0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2];
+($clusters, $error, $found) = Algorithm::Cluster::kcluster(
+    nclusters =>         3,
+    data      =>    $data3,
+    mask      =>    $mask3,
+    initialid => $initialid3,
+);
+my ($text_fh, $text_file) = tempfile(UNLINK => 1);
+print $text_fh "GENE\tNAME\tX\tY\n";
+print $text_fh "EWEIGHT\t\t1\t1\n";
+foreach my $i (0..$#$data3) {
+    my @values = map { $mask3->[$i][$_] ? $data3->[$i][$_] : '' } (0, 1);
+    print $text_fh join("\t", "G$i", "gene $i", @values), "\n";
+}
+close($text_fh);
+my ($binary_fh, $binary_file) = tempfile(UNLINK => 1);
+binmode($binary_fh);
+print $binary_fh pack("i2", 12, 2);
+foreach my $i (0..$#$data3) {
+    print $binary_fh pack("d2", map { $mask3->[$i][$_] ? $data3->[$i][$_] : 9**9**9/9**9**9 } (0, 1));
+}
+close($binary_fh);
+foreach my $file ([$text_file, 't'], [$binary_file, 'b']) {
+    my ($fclusters, $ferror, $ffound) = Algorithm::Cluster::kcluster(
+        nclusters =>          3,
+        file      =>  $file->[0],
+        format    =>  $file->[1],
+        initialid => $initialid3,
+    );
+    is_deeply ($fclusters, $clusters);
+    is (sprintf("%.6f", $ferror), sprintf("%.6f", $error));
+}
+# Options that cannot be used with a data file are rejected
+ok (!defined Algorithm::Cluster::kcluster(
+    nclusters => 3, file => $text_file, init => 'k'));
+ok (!defined Algorithm::Cluster::kcluster(
+    nclusters => 3, file => $text_file, weight => [1, 2, 3]));
+
+#----------
+# test spherical k-means; the rows are grouped by direction, not by length
+#
+my $data4 = [
+    [  1.0,  0.1,  0.0 ], [ 10.0,  0.0,  0.2 ], [  0.1,  0.0,  0.0 ], [  5.0,  0.3,  0.1 ],
+    [  0.0,  2.0,  0.1 ], [  0.2, 20.0,  0.0 ], [  0.0,  0.3,  0.0 ], [  0.1,  8.0,  0.3 ],
+    [  0.1,  0.0,  3.0 ], [  0.0,  0.2, 30.0 ], [  0.0,  0.0,  0.4 ], [  0.3,  0.1,  9.0 ],
+];
+my $groups4 = sub {
+    my ($clusters) = @_;
+    my @groups = map { join(',', @{$clusters}[4*$_..4*$_+3]) } (0..2);
+    my %labels = map { $clusters->[4*$_] => 1 } (0..2);
+    return (scalar keys %labels == 3)
+        && (join(';', @groups) eq join(';', map { join(',', ($clusters->[4*$_]) x 4) } (0..2)));
+};
+($clusters, $error, $found) = Algorithm::Cluster::kcluster(
+    nclusters =>         3,
+    data      =>    $data4,
+    method    =>       's',
+    dist      =>       'u',
+    npass     =>        10,
+);
+ok ($groups4->($clusters));
+# The error is the sum of the distances to the normalized sums of the rows
+my @unit;
+foreach my $row (@$data4) {
+    my $norm = 0;
+    $norm += $_*$_ foreach @$row;
+    push @unit, [map { $_/sqrt($norm) } @$row];
+}
+my @center = map { [0, 0, 0] } (0..2);
+foreach my $i (0..11) {
+    $center[$clusters->[$i]][$_] += $unit[$i][$_] foreach (0..2);
+}
+my $expected = 0;
+foreach my $i (0..11) {
+    my $c = $center[$clusters->[$i]];
+    my ($dot, $norm) = (0, 0);
+    foreach (0..2) { $dot += $unit[$i][$_]*$c->[$_]; $norm += $c->[$_]**2; }
+    $expected += 1 - $dot/sqrt($norm);
+}
+is (sprintf("%.6f", $error), sprintf("%.6f", $expected));
+
+# With the absolute uncentered correlation, the sign of a row is ignored
+my $data5 = [map { my $i = $_; [map { ($i % 2) ? -$_ : $_ } @{$data4->[$i]}] } (0..11)];
+($clusters, $error, $found) = Algorithm::Cluster::kcluster(
+    nclusters =>         3,
+    data      =>    $data5,
+    method    =>       's',
+    dist      =>       'x',
+    npass     =>        10,
+);
+ok ($groups4->($clusters));
+
+# Spherical k-means requires the uncentered correlation
+($clusters) = Algorithm::Cluster::kcluster(
+    nclusters =>         3,
+    data      =>    $data4,
+    method    =>       's',
+    dist      =>       'e',
+);
+ok (!defined $clusters);
+
+#----------
+# The same seed gives the same result, also with k-means++ seeding
+foreach my $init ('r', 'k') {
+    my @runs = map {
+        [Algorithm::Cluster::kcluster(
+            nclusters =>         3,
+            data      =>    $data2,
+            npass     =>         4,
+            init      =>     $init,
+            seed      =>        17,
+        )]
+    } (1, 2);
+    is_deeply ($runs[0], $runs[1]);
+}
+
+#----------
+# test the sweep over the number of clusters; the Calinski-Harabasz score
+# is largest for the three groups in dataset 3
+#
+my ($sweep, $errors, $scores) = Algorithm::Cluster::kclustersweep(
+    kmin      =>         2,
+    kmax      =>         5,
+    data      =>    $data3,
+    npass     =>         2,
+    seed      =>         1,
+);
+is (scalar @$errors, 4);
+my ($best) = sort { $scores->[$b] <=> $scores->[$a] } (0..3);
+is ($best + 2, 3);
+ok ($groups4->($sweep->[1]));
 __END__
@@ -1,4 +1,4 @@
-use Test::More tests => 224;
+use Test::More tests => 317;
 
 use lib '../blib/lib','../blib/arch';
 
@@ -182,6 +182,29 @@ is ($node->left, 3);
 is ($node->right, -2);
 is (sprintf("%7.3f", $node->distance), " 32.508");
 
+#--------------[PWLcluster]-------
+$params{method} = 'w';
+
+$tree = Algorithm::Cluster::treecluster(%params);
+
+# Make sure that @clusters and @centroids are the right length
+is (scalar(@$data1) - 1, $tree->length );
+
+$node = $tree->get(0);
+is ($node->left, 2);
+is ($node->right, 1);
+is (sprintf("%7.3f", $node->distance), "  2.600");
+
+$node = $tree->get(1);
+is ($node->left, -1);
+is ($node->right, 0);
+is (sprintf("%7.3f", $node->distance), "  8.867");
+
+$node = $tree->get(2);
+is ($node->left, 3);
+is ($node->right, -2);
+is (sprintf("%7.3f", $node->distance), " 29.155");
+
 
 
 #----------
@@ -558,3 +581,234 @@ $node = $tree->get(10);
 is ($node->left, -10);
 is ($node->right, -3);
 is (sprintf("%7.3f", $node->distance), "  2.200");
+
+
+#-------[Ward's linkage on a distance matrix]------------
+$params{method} = 'w';
+
+$tree = Algorithm::Cluster::treecluster(%params);
+
+# Make sure that @clusters and @centroids are the right length
+is ( scalar(@$matrix) - 1, $tree->length );
+
+$node = $tree->get(0);
+is ($node->left, 3);
+is ($node->right, 2);
+is (sprintf("%7.3f", $node->distance), "  1.000");
+
+$node = $tree->get(1);
+is ($node->left, 6);
+is ($node->right, 4);
+is (sprintf("%7.3f", $node->distance), "  1.100");
+
+$node = $tree->get(2);
+is ($node->left, 11);
+is ($node->right, 5);
+is (sprintf("%7.3f", $node->distance), "  1.200");
+
+$node = $tree->get(3);
+is ($node->left, 9);
+is ($node->right, 7);
+is (sprintf("%7.3f", $node->distance), "  1.300");
+
+$node = $tree->get(4);
+is ($node->left, 8);
+is ($node->right, 0);
+is (sprintf("%7.3f", $node->distance), "  2.100");
+
+$node = $tree->get(5);
+is ($node->left, -4);
+is ($node->right, 1);
+is (sprintf("%7.3f", $node->distance), "  2.167");
+
+$node = $tree->get(6);
+is ($node->left, 10);
+is ($node->right, -2);
+is (sprintf("%7.3f", $node->distance), "  2.233");
+
+$node = $tree->get(7);
+is ($node->left, -7);
+is ($node->right, -5);
+is (sprintf("%7.3f", $node->distance), "  3.047");
+
+$node = $tree->get(8);
+is ($node->left, -3);
+is ($node->right, -1);
+is (sprintf("%7.3f", $node->distance), "  4.450");
+
+$node = $tree->get(9);
+is ($node->left, -6);
+is ($node->right, -8);
+is (sprintf("%7.3f", $node->distance), "  8.603");
+
+$node = $tree->get(10);
+is ($node->left, -9);
+is ($node->right, -10);
+is (sprintf("%7.3f", $node->distance), " 37.450");
+
+
+#-------[several methods on the same data]------------
+
+sub nodes {
+    my $tree = shift;
+    my @nodes;
+    for (my $i = 0; $i < $tree->length; $i++) {
+        my $node = $tree->get($i);
+        push @nodes, [$node->left, $node->right,
+                      sprintf("%7.3f", $node->distance)];
+    }
+    return \@nodes;
+}
+
+%params = (
+    transpose  =>         0,
+    dist       =>       'e',
+    data       =>    $data2,
+    mask       =>    $mask2,
+    weight     =>  $weight2,
+);
+
+my @trees = Algorithm::Cluster::treeclusters(%params, methods => 'smcaw');
+is (scalar(@trees), 5);
+foreach my $method ('s', 'm', 'c', 'a', 'w') {
+    $tree = Algorithm::Cluster::treecluster(%params, method => $method);
+    is_deeply (nodes(shift @trees), nodes($tree));
+}
+
+# Clustering columns, with more columns than rows
+my %columns = (
+    transpose  =>         1,
+    dist       =>       'e',
+    data       =>    $data1,
+    mask       =>    $mask1,
+    weight     =>  [ 1,1,1,1 ],
+);
+
+@trees = Algorithm::Cluster::treeclusters(%columns, methods => 'smcaw');
+is (scalar(@trees), 5);
+foreach my $method ('s', 'm', 'c', 'a', 'w') {
+    $tree = Algorithm::Cluster::treecluster(%columns, method => $method);
+    is_deeply (nodes(shift @trees), nodes($tree));
+}
+
+@trees = Algorithm::Cluster::treeclusters(data => $matrix,
+                                          methods => ['s', 'm', 'a', 'w']);
+is (scalar(@trees), 4);
+foreach my $method ('s', 'm', 'a', 'w') {
+    $tree = Algorithm::Cluster::treecluster(data => $matrix, method => $method);
+    is_deeply (nodes(shift @trees), nodes($tree));
+}
+
+#-------[centroid linkage from the distance matrix]------------
+
+# Without missing data, the Euclidean distances to a new node are found from
+# the distance matrix. Masking an extra column leaves the distances unchanged,
+# but makes treecluster recalculate them from the data instead; both should
+# give the same trees.
+my $data2x   = [map { [@$_, 0.0] } @$data2];
+my $mask2x   = [map { [@$_, 0] } @$mask2];
+my $weight2x = [@$weight2, 1];
+
+foreach my $method ('a', 'm', 'c') {
+    my $lw = Algorithm::Cluster::treecluster(
+        dist => 'e', method => $method,
+        data => $data2, mask => $mask2, weight => $weight2,
+    );
+    $tree = Algorithm::Cluster::treecluster(
+        dist => 'e', method => $method,
+        data => $data2x, mask => $mask2x, weight => $weight2x,
+    );
+    is_deeply (nodes($lw), nodes($tree));
+}
+
+
+#-------[approximate clustering using micro-clusters]------------
+
+%params = (
+    transpose  =>         0,
+    method     =>       'a',
+    dist       =>       'e',
+    data       =>    $data2,
+    mask       =>    $mask2,
+    weight     =>  $weight2,
+    nsummary   =>         3,
+);
+
+$tree = Algorithm::Cluster::treecluster(%params);
+
+is ( scalar(@$data2) - 1, $tree->length );
+
+$node = $tree->get(10);
+is ($node->left, -5);
+is ($node->right, 6);
+is (sprintf("%7.3f", $node->distance), "  3.879");
+
+$node = $tree->get(11);
+is ($node->left, -10);
+is ($node->right, -11);
+is (sprintf("%7.3f", $node->distance), " 11.248");
+
+is_deeply ($tree->cut(3), [1, 1, 1, 1, 1, 1, 0, 2, 2, 2, 2, 2, 2]);
+
+$params{refine} = 1;
+$tree = Algorithm::Cluster::treecluster(%params);
+
+$node = $tree->get(0);
+is ($node->left, 12);
+is ($node->right, 9);
+is (sprintf("%7.3f", $node->distance), "  0.029");
+
+is_deeply ($tree->cut(3), [1, 1, 1, 1, 1, 1, 0, 2, 2, 2, 2, 2, 2]);
+
+# A single micro-cluster with refinement gives the exact solution
+$params{nsummary} = 1;
+$tree = Algorithm::Cluster::treecluster(%params);
+delete $params{nsummary};
+delete $params{refine};
+is_deeply (nodes($tree), nodes(Algorithm::Cluster::treecluster(%params)));
+
+
+#-------[sparse graph given as a list of edges]------------
+
+my @edges;
+for (my $i = 1; $i < scalar(@$matrix); $i++) {
+    for (my $j = 0; $j < $i; $j++) {
+        push @edges, [$i, $j, $matrix->[$i][$j]];
+    }
+}
+
+# The complete graph gives the same distances as the distance matrix
+foreach my $method ('s', 'm', 'a') {
+    $tree = Algorithm::Cluster::treecluster(edges => \@edges, method => $method);
+    my $exact = Algorithm::Cluster::treecluster(data => $matrix, method => $method);
+    is_deeply ([map {$_->[2]} @{nodes($tree)}], [map {$_->[2]} @{nodes($exact)}]);
+}
+
+# Clusters that are not connected are joined at an infinite distance
+$tree = Algorithm::Cluster::treecluster(
+    edges     => [[0, 1, 0.5], [2, 3, 0.25], [1, 0, 1.5]],
+    nelements => 5,
+    method    => 'a',
+);
+
+is ($tree->length, 4);
+
+$node = $tree->get(0);
+is ($node->left, 2);
+is ($node->right, 3);
+is (sprintf("%7.3f", $node->distance), "  0.250");
+
+$node = $tree->get(1);
+is ($node->left, 0);
+is ($node->right, 1);
+is (sprintf("%7.3f", $node->distance), "  1.000");
+
+$node = $tree->get(2);
+is ($node->left, 4);
+is ($node->right, -1);
+ok ($node->distance > 1.e300);
+
+$node = $tree->get(3);
+is ($node->left, -3);
+is ($node->right, -2);
+ok ($node->distance > 1.e300);
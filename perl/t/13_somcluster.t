@@ -1,4 +1,4 @@
-use Test::More tests => 6;
+use Test::More tests => 8;
 
 use lib '../blib/lib','../blib/arch';
 
@@ -104,3 +104,18 @@ $clusterid = Algorithm::Cluster::somcluster(%params);
 
 is (scalar(@$data2), scalar(@$clusterid) );
 is (scalar(@{$clusterid->[0]}), 2 );
+
+#----------
+# The callback is called after each sweep through the data
+my @progress;
+$clusterid = Algorithm::Cluster::somcluster(
+    %params,
+    callback  => sub { push @progress, $_[0]{iteration}; return 0; },
+);
+my $nsweeps = int((100 + @$data2 - 1) / @$data2);
+is_deeply (\@progress, [1..$nsweeps]);
+
+#----------
+# The same seed gives the same result
+my @runs = map { Algorithm::Cluster::somcluster(%params, seed => 11) } (1, 2);
+is_deeply ($runs[0], $runs[1]);
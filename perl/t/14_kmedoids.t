@@ -1,4 +1,4 @@
-use Test::More tests => 30;
+use Test::More tests => 44;
 
 use lib '../blib/lib','../blib/arch';
 
@@ -108,3 +108,66 @@ is ($clusters->[11], 2);
 
 # Test the within-cluster sum of errors
 is (sprintf ("%7.3f", $error), " 13.000");
+
+#----------
+# Test the progress callback
+my @progress;
+($clusters, $error, $found) = Algorithm::Cluster::kmedoids(
+    %params2,
+    callback  => sub { push @progress, $_[0]; return 0; },
+);
+is ($progress[-1]{iteration}, scalar @progress);
+is (sprintf ("%7.3f", $progress[-1]{total}), " 13.000");
+
+#----------
+# The same seed gives the same result
+my @runs = map {
+    [Algorithm::Cluster::kmedoids(%params1, npass => 3, seed => 5)]
+} (1, 2);
+is_deeply ($runs[0], $runs[1]);
+
+#------------------------------------------------------
+# Test the PAM algorithm, which should find the optimal solution
+# without random restarts
+# 
+
+my %params3 = (
+        nclusters =>         4,
+        distances =>   $matrix,
+        method    =>       'p',
+);
+
+my @pam = Algorithm::Cluster::kmedoids(%params3);
+my @best = Algorithm::Cluster::kmedoids(%params1);
+is_deeply ($pam[0], $best[0]);
+is (sprintf ("%7.3f", $pam[1]), ' 11.600');
+is ($pam[2], 1);
+
+#----------
+# Each swap decreases the within-cluster sum of errors. For these points on
+# a line, the medoids chosen initially are not optimal.
+my @x = (8, 28, 6, 24, 10, 17, 28, 19);
+my $line = [map { my $i = $_; [map { abs($x[$i] - $x[$_]) } (0..$i-1)] } (0..$#x)];
+@progress = ();
+($clusters, $error, $found) = Algorithm::Cluster::kmedoids(
+    nclusters =>         2,
+    distances =>     $line,
+    method    =>       'p',
+    callback  => sub { push @progress, $_[0]; return 0; },
+);
+ok (scalar @progress > 0);
+is_deeply ([map { $_->{iteration} } @progress], [1..scalar @progress]);
+ok (!grep { $progress[$_]{total} >= $progress[$_-1]{total} } (1..$#progress));
+is ($progress[-1]{total}, $error);
+is ($error, 24);
+
+#----------
+# A single cluster has the element with the smallest sum of distances
+# as its medoid
+($clusters, $error) = Algorithm::Cluster::kmedoids(%params3, nclusters => 1);
+is_deeply ($clusters, [(4) x 12]);
+
+#----------
+# Invalid parameters
+ok (!defined Algorithm::Cluster::kmedoids(%params3, method => 'x'));
+ok (!defined Algorithm::Cluster::kmedoids(%params3, nclusters => 13));
@@ -0,0 +1,93 @@
+use Test::More tests => 9;
+
+use lib '../blib/lib','../blib/arch';
+
+use_ok ("Algorithm::Cluster");
+require_ok ("Algorithm::Cluster");
+
+
+#########################
+
+
+#------------------------------------------------------
+# Data for Tests
+# 
+my $data = [
+    [ 1.1, 1.2 ],
+    [ 1.4, 1.3 ],
+    [ 1.1, 1.5 ],
+    [ 2.0, 1.5 ],
+    [ 1.7, 1.9 ],
+    [ 5.7, 5.9 ],
+    [ 5.7, 5.9 ],
+    [ 3.1, 3.3 ],
+    [ 5.4, 5.3 ],
+    [ 5.1, 5.5 ],
+    [ 9.0, 1.0 ],
+];
+my $clusterid = [ 0, 0, 0, 0, 0, 1, 1, 0, 1, 1, 2 ];
+
+
+#------------------------------------------------------
+# Tests
+# 
+my $distances = Algorithm::Cluster::distancematrix(data => $data, dist => 'c');
+
+#----------
+# Calculate the silhouette widths directly from the distance matrix
+#
+my @expected;
+foreach my $i (0..$#$data) {
+    my (@sums, @counts);
+    foreach my $j (0..$#$data) {
+        next if $i == $j;
+        my $distance = ($j < $i) ? $distances->[$i][$j] : $distances->[$j][$i];
+        $sums[$clusterid->[$j]] += $distance;
+        $counts[$clusterid->[$j]]++;
+    }
+    my $own = $clusterid->[$i];
+    unless ($counts[$own]) {
+        push @expected, 0;
+        next;
+    }
+    my $a = $sums[$own] / $counts[$own];
+    my ($b) = sort { $a <=> $b }
+              map { $sums[$_] / $counts[$_] }
+              grep { $_ != $own and $counts[$_] } (0..$#counts);
+    push @expected, ($b - $a) / ($a > $b ? $a : $b);
+}
+my $expected = 0;
+$expected += $_ foreach @expected;
+$expected /= scalar @expected;
+
+foreach my $source ('data', 'distances') {
+    my %source = ($source eq 'data') ? (data => $data, dist => 'c')
+                                     : (distances => $distances);
+    my ($widths, $average) = Algorithm::Cluster::silhouette(
+        %source,
+        clusterid => $clusterid,
+    );
+    is_deeply ([map { sprintf("%.6f", $_) } @$widths],
+               [map { sprintf("%.6f", $_) } @expected]);
+    is (sprintf("%.6f", $average), sprintf("%.6f", $expected));
+}
+
+#----------
+# An element that is alone in its cluster has width 0
+#
+my ($widths, $average) = Algorithm::Cluster::silhouette(
+    data      => $data,
+    clusterid => $clusterid,
+);
+is ($widths->[10], 0);
+
+# The outlying element of the first cluster has the smallest width
+my ($smallest) = sort { $widths->[$a] <=> $widths->[$b] } (0..9);
+is ($smallest, 7);
+
+# The cluster assignments should match the data
+($widths) = Algorithm::Cluster::silhouette(
+    data      => $data,
+    clusterid => [ 0, 1 ],
+);
+ok (!defined $widths);
@@ -27,6 +27,7 @@
  */
 
 #include <time.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
@@ -36,6 +37,9 @@
 #ifdef WINDOWS
 #  include <windows.h>
 #endif
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
 
 /* ************************************************************************ */
 
@@ -281,6 +285,18 @@ freedatamask(int n, double** data, int** mask)
 
 /* ---------------------------------------------------------------------- */
 
+static int
+nomissing(int nrows, int ncolumns, int** mask)
+/* Returns 1 if none of the data values are missing, and 0 otherwise. */
+{ int i, j;
+  for (i = 0; i < nrows; i++)
+    for (j = 0; j < ncolumns; j++)
+      if (!mask[i][j]) return 0;
+  return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
 static
 double find_closest_pair(int n, double** distmatrix, int* ip, int* jp)
 /*
@@ -302,22 +318,46 @@ the shortest distance.
 jp         (output) int*
 A pointer to the integer that is to receive the second index of the pair with
 the shortest distance.
+
+If OpenMP is available, the rows are divided over the threads. Each thread
+finds the closest pair in its rows, after which the pair with the shortest
+distance is selected. If several pairs have the same shortest distance, the
+pair with the lowest (i,j) is returned, as in the single-threaded case.
 */
-{ int i, j;
-  double temp;
+{ int i;
   double distance = distmatrix[1][0];
-  *ip = 1;
-  *jp = 0;
-  for (i = 1; i < n; i++)
-  { for (j = 0; j < i; j++)
-    { temp = distmatrix[i][j];
-      if (temp<distance)
-      { distance = temp;
-        *ip = i;
-        *jp = j;
+  int ibest = 1;
+  int jbest = 0;
+  #pragma omp parallel if (n > 256)
+  { int j;
+    double temp;
+    double threaddistance = distmatrix[1][0];
+    int ithread = 1;
+    int jthread = 0;
+    #pragma omp for schedule(dynamic, 16) nowait
+    for (i = 1; i < n; i++)
+    { for (j = 0; j < i; j++)
+      { temp = distmatrix[i][j];
+        if (temp < threaddistance ||
+           (temp==threaddistance && (i < ithread || (i==ithread && j < jthread))))
+        { threaddistance = temp;
+          ithread = i;
+          jthread = j;
+        }
+      }
+    }
+    #pragma omp critical
+    { if (threaddistance < distance ||
+         (threaddistance==distance &&
+            (ithread < ibest || (ithread==ibest && jthread < jbest))))
+      { distance = threaddistance;
+        ibest = ithread;
+        jbest = jthread;
       }
     }
   }
+  *ip = ibest;
+  *jp = jbest;
   return distance;
 }
 
@@ -1726,29 +1766,95 @@ static double(*setmetric(char dist))
 
 /* *********************************************************************  */
 
-static double uniform(void)
+typedef struct
+{ unsigned long key[2];
+  unsigned long counter[4];
+  unsigned long block[4];
+  int next;
+} RandomState;
+/* A RandomState holds a stream of random numbers drawn by nextuniform. Each
+ * value is a 32-bit unsigned integer stored in an unsigned long, so that no
+ * 64-bit integer type is needed. */
+
+/* ********************************************************************* */
+
+static unsigned long
+mulhilo(unsigned long a, unsigned long b, unsigned long* hi)
+/* Returns the lower 32 bits of the product of the 32-bit integers a and b, and
+ * stores the upper 32 bits in hi. The product is built from 16-bit halves. */
+{ const unsigned long alo = a & 0xFFFFUL;
+  const unsigned long ahi = a >> 16;
+  const unsigned long blo = b & 0xFFFFUL;
+  const unsigned long bhi = b >> 16;
+  const unsigned long lolo = alo*blo;
+  const unsigned long lohi = alo*bhi;
+  const unsigned long hilo = ahi*blo;
+  const unsigned long middle = (lolo >> 16) + (lohi & 0xFFFFUL)
+                             + (hilo & 0xFFFFUL);
+  *hi = (ahi*bhi + (lohi >> 16) + (hilo >> 16) + (middle >> 16))
+      & 0xFFFFFFFFUL;
+  return ((middle << 16) | (lolo & 0xFFFFUL)) & 0xFFFFFFFFUL;
+}
+
+/* ********************************************************************* */
+
+static void
+philox(const unsigned long counter[4], const unsigned long key[2],
+  unsigned long block[4])
+/* Applies the ten rounds of the Philox4x32 bijection to counter, using key,
+ * and stores the four resulting 32-bit random numbers in block. */
+{ int round;
+  unsigned long k0 = key[0];
+  unsigned long k1 = key[1];
+  unsigned long x0 = counter[0];
+  unsigned long x1 = counter[1];
+  unsigned long x2 = counter[2];
+  unsigned long x3 = counter[3];
+  for (round = 0; round < 10; round++)
+  { unsigned long hi0, hi1;
+    const unsigned long lo0 = mulhilo(0xD2511F53UL, x0, &hi0);
+    const unsigned long lo1 = mulhilo(0xCD9E8D57UL, x2, &hi1);
+    x0 = hi1 ^ x1 ^ k0;
+    x1 = lo1;
+    x2 = hi0 ^ x3 ^ k1;
+    x3 = lo0;
+    k0 = (k0 + 0x9E3779B9UL) & 0xFFFFFFFFUL;
+    k1 = (k1 + 0xBB67AE85UL) & 0xFFFFFFFFUL;
+  }
+  block[0] = x0;
+  block[1] = x1;
+  block[2] = x2;
+  block[3] = x3;
+}
+
+/* ********************************************************************* */
+
+static double nextuniform(RandomState* state)
 /*
 Purpose
 =======
 
 This routine returns a uniform random number between 0.0 and 1.0. Both 0.0
-and 1.0 are excluded. This random number generator is described in:
+and 1.0 are excluded. The random numbers are generated by the counter-based
+generator Philox4x32-10, described in:
 
-Pierre l'Ecuyer
-Efficient and Portable Combined Random Number Generators
-Communications of the ACM, Volume 31, Number 6, June 1988, pages 742-749,774.
+John K. Salmon, Mark A. Moraes, Ron O. Dror, and David E. Shaw
+Parallel Random Numbers: As Easy as 1, 2, 3
+Proceedings of the International Conference for High Performance Computing,
+Networking, Storage and Analysis (SC11), 2011.
 
-The first time this routine is called, it initializes the random number
-generator using the current time. First, the current epoch time in seconds is
-used as a seed for the random number generator in the C library. The first two
-random numbers generated by this generator are used to initialize the random
-number generator implemented in this routine.
+Each block of four random numbers is obtained by encrypting a counter with the
+seed as the key. As the state of the generator is passed explicitly, and the
+streams set up by seedstream do not overlap, independent streams of random
+numbers can be drawn in different threads.
 
 
 Arguments
 =========
 
-None.
+state      (input/output) RandomState*
+The state of the generator, as set up by seedstream. On exit, the state is
+advanced to the next random number.
 
 
 Return value
@@ -1757,39 +1863,49 @@ Return value
 A double-precison number between 0.0 and 1.0.
 ============================================================================
 */
-{ int z;
-  static const int m1 = 2147483563;
-  static const int m2 = 2147483399;
-  const double scale = 1.0/m1;
+{ if (state->next==4)
+  { philox(state->counter, state->key, state->block);
+    /* The lower two words count the blocks within the stream */
+    state->counter[0] = (state->counter[0] + 1) & 0xFFFFFFFFUL;
+    if (state->counter[0]==0)
+      state->counter[1] = (state->counter[1] + 1) & 0xFFFFFFFFUL;
+    state->next = 0;
+  }
+  return (state->block[state->next++] + 0.5) / 4294967296.0;
+}
+
+/* ************************************************************************ */
 
-  static int s1 = 0;
-  static int s2 = 0;
+static unsigned long randomseed(void)
+/* Returns a seed based on the current time, for use if no seed was given.
+ * The number of calls is added, so that the seeds differ between calls made
+ * within the resolution of the clock. */
+{ static unsigned long calls = 0;
+  unsigned long n;
+  #pragma omp atomic capture
+  n = ++calls;
+  return (unsigned long) time(0) + 0x9E3779B9UL * (n + (unsigned long) clock());
+}
 
-  if (s1==0 || s2==0) /* initialize */
-  { unsigned int initseed = (unsigned int) time(0);
-    srand(initseed);
-    s1 = rand();
-    s2 = rand();
-  }
+/* ************************************************************************ */
 
-  do
-  { int k;
-    k = s1/53668;
-    s1 = 40014*(s1-k*53668)-k*12211;
-    if (s1 < 0) s1+=m1;
-    k = s2/52774;
-    s2 = 40692*(s2-k*52774)-k*3791;
-    if(s2 < 0) s2+=m2;
-    z = s1-s2;
-    if(z < 1) z+=(m1-1);
-  } while (z==m1); /* To avoid returning 1.0 */
-
-  return z*scale;
+static void
+seedstream(RandomState* state, unsigned long seed, unsigned long stream)
+/* Sets up stream number stream of random numbers for the given seed. The
+ * stream number is stored in the upper two words of the counter, so that
+ * streams with different numbers, or with different seeds, do not overlap. */
+{ state->key[0] = seed & 0xFFFFFFFFUL;
+  state->key[1] = (seed >> 16 >> 16) & 0xFFFFFFFFUL;
+  state->counter[0] = 0;
+  state->counter[1] = 0;
+  state->counter[2] = stream & 0xFFFFFFFFUL;
+  state->counter[3] = (stream >> 16 >> 16) & 0xFFFFFFFFUL;
+  state->next = 4;
 }
 
 /* ************************************************************************ */
 
-static int binomial(int n, double p)
+static int binomial(int n, double p, RandomState* state)
 /*
 Purpose
 =======
@@ -1813,6 +1929,9 @@ equal to 0.5.
 n          (input) int
 The number of trials.
 
+state      (input/output) RandomState*
+The state of the random number generator; see nextuniform.
+
 
 Return value
 ============
@@ -1827,7 +1946,7 @@ An integer drawn from a binomial distribution with parameters (p, n).
     const double a = (n+1)*s;
     double r = exp(n*log(q)); /* pow() causes a crash on AIX */
     int x = 0;
-    double u = uniform();
+    double u = nextuniform(state);
     while(1)
     { if (u < r) return x;
       u-=r;
@@ -1855,8 +1974,8 @@ An integer drawn from a binomial distribution with parameters (p, n).
     { /* Step 1 */
       int y;
       int k;
-      double u = uniform();
-      double v = uniform();
+      double u = nextuniform(state);
+      double v = nextuniform(state);
       u *= p4;
       if (u <= p1) return (int)(xm-p1*v+u);
       /* Step 2 */
@@ -1932,7 +2051,8 @@ An integer drawn from a binomial distribution with parameters (p, n).
 
 /* ************************************************************************ */
 
-static void randomassign (int nclusters, int nelements, int clusterid[])
+static void randomassign (int nclusters, int nelements, int clusterid[],
+  RandomState* state)
 /*
 Purpose
 =======
@@ -1956,6 +2076,9 @@ to be clustered).
 clusterid  (output) int[nelements]
 The cluster number to which an element was assigned.
 
+state      (input/output) RandomState*
+The state of the random number generator; see nextuniform.
+
 ============================================================================
 */
 { int i, j;
@@ -1968,7 +2091,7 @@ The cluster number to which an element was assigned.
    */
   for (i = 0; i < nclusters-1; i++)
   { p = 1.0/(nclusters-i);
-    j = binomial(n, p);
+    j = binomial(n, p, state);
     n -= j;
     j += k+1; /* Assign at least one element to cluster i */
     for ( ; k < j; k++) clusterid[k] = i;
@@ -1978,7 +2101,7 @@ The cluster number to which an element was assigned.
 
   /* Create a random permutation of the cluster assignments */
   for (i = 0; i < nelements; i++)
-  { j = (int) (i + (nelements-i)*uniform());
+  { j = (int) (i + (nelements-i)*nextuniform(state));
     k = clusterid[j];
     clusterid[j] = clusterid[i];
     clusterid[i] = k;
@@ -1989,6 +2112,214 @@ The cluster number to which an element was assigned.
 
 /* ********************************************************************* */
 
+static int
+sampleindex(int n, const double closest[], const double weight[],
+  RandomState* state)
+/* Draws an index between 0 and n-1 with a probability proportional to
+ * closest[i], multiplied by weight[i] if weight is not NULL. Returns -1 if
+ * all of these are zero. */
+{ int i;
+  int last = -1;
+  double total = 0.0;
+  double r;
+  for (i = 0; i < n; i++)
+  { double term = closest[i];
+    if (term <= 0.0) continue;
+    if (weight) term *= weight[i];
+    total += term;
+  }
+  if (total <= 0.0) return -1;
+  r = total*nextuniform(state);
+  for (i = 0; i < n; i++)
+  { double term = closest[i];
+    if (term <= 0.0) continue;
+    if (weight) term *= weight[i];
+    last = i;
+    r -= term;
+    if (r < 0.0) break;
+  }
+  return last; /* Also in case of roundoff error */
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void
+updateclosest(int nelements, int ndata, double** data, int** mask,
+  double weight[], int transpose,
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int),
+  int first, int ncenters, const int centers[], double closest[],
+  int nearest[])
+/* Updates the distance from each element to the closest of the centers
+ * first..ncenters-1, which are element numbers, and stores the index of the
+ * closest center in nearest. */
+{ int i;
+  #pragma omp parallel for if (nelements > 1000)
+  for (i = 0; i < nelements; i++)
+  { int j;
+    for (j = first; j < ncenters; j++)
+    { const double distance = metric(ndata, data, data, mask, mask, weight,
+                                     i, centers[j], transpose);
+      if (distance < closest[i])
+      { closest[i] = distance;
+        nearest[i] = j;
+      }
+    }
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+static int
+seedclusters(int nclusters, int nrows, int ncolumns, double** data,
+  int** mask, double weight[], int transpose, char dist, char init,
+  int clusterid[], RandomState* state)
+/*
+Purpose
+=======
+
+The seedclusters routine chooses nclusters elements as the initial cluster
+centers, and assigns each element to the closest of them. The first center is
+chosen at random. With init=='k', each next center is chosen with a
+probability proportional to the distance of an element to the closest center
+chosen so far (k-means++; Arthur and Vassilvitskii, Proceedings of the ACM-SIAM
+Symposium on Discrete Algorithms, 1027 (2007)). For the Euclidean distance,
+this distance is already squared.
+With init=='p', 2*nclusters candidates are sampled independently in each of
+five rounds, with the same probability (k-means||; Bahmani et al., Proceedings
+of the VLDB Endowment 5, 622 (2012)). The candidates are weighted by the number
+of elements closest to them, and the centers are chosen among the candidates
+as in k-means++. Only a few passes through the data are needed, each of which
+is run in parallel.
+
+Arguments
+=========
+
+As in kcluster, and
+
+init       (input) char
+The seeding method, either 'k' or 'p'.
+
+clusterid  (output) int[nelements]
+The initial cluster number of each element. None of the clusters is empty.
+
+state      (input/output) RandomState*
+The state of the random number generator; see nextuniform.
+
+Return value
+============
+
+1 if successful, and 0 if a memory error occurs.
+========================================================================
+*/
+{ int i, j;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  int ncenters = 1;
+  int* centers = malloc(nelements*sizeof(int));
+  double* closest = malloc(nelements*sizeof(double));
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int) =
+       setmetric(dist);
+
+  if (!centers || !closest)
+  { if (centers) free(centers);
+    if (closest) free(closest);
+    return 0;
+  }
+
+  for (i = 0; i < nelements; i++) closest[i] = DBL_MAX;
+  centers[0] = (int)(nelements*nextuniform(state));
+  updateclosest(nelements, ndata, data, mask, weight, transpose, metric,
+                0, 1, centers, closest, clusterid);
+
+  if (init=='p')
+  { const double oversampling = 2.0*nclusters;
+    int round;
+    for (round = 0; round < 5 && ncenters < nelements; round++)
+    { const int first = ncenters;
+      double total = 0.0;
+      for (i = 0; i < nelements; i++)
+        if (closest[i] > 0.0) total += closest[i];
+      if (total <= 0.0) break;
+      for (i = 0; i < nelements && ncenters < nelements; i++)
+      { if (closest[i] <= 0.0) continue;
+        if (nextuniform(state)*total < oversampling*closest[i])
+          centers[ncenters++] = i;
+      }
+      updateclosest(nelements, ndata, data, mask, weight, transpose, metric,
+                    first, ncenters, centers, closest, clusterid);
+    }
+    /* Weigh each candidate by the number of elements closest to it, and
+     * choose the cluster centers among the candidates. */
+    if (ncenters > nclusters)
+    { const int ncandidates = ncenters;
+      int* chosen = malloc(nclusters*sizeof(int));
+      double* weights = calloc(ncandidates, sizeof(double));
+      double* candidateclosest = malloc(ncandidates*sizeof(double));
+      if (!chosen || !weights || !candidateclosest)
+      { if (chosen) free(chosen);
+        if (weights) free(weights);
+        if (candidateclosest) free(candidateclosest);
+        free(centers);
+        free(closest);
+        return 0;
+      }
+      for (i = 0; i < nelements; i++) weights[clusterid[i]]++;
+      j = sampleindex(ncandidates, weights, NULL, state);
+      chosen[0] = centers[j];
+      for (j = 0; j < ncandidates; j++) candidateclosest[j] = DBL_MAX;
+      for (ncenters = 1; ncenters < nclusters; ncenters++)
+      { for (j = 0; j < ncandidates; j++)
+        { const double distance = metric(ndata, data, data, mask, mask,
+                                         weight, centers[j],
+                                         chosen[ncenters-1], transpose);
+          if (distance < candidateclosest[j]) candidateclosest[j] = distance;
+        }
+        j = sampleindex(ncandidates, candidateclosest, weights, state);
+        if (j < 0) /* All candidates coincide with a center */
+        { for (j = 0; j < ncandidates; j++)
+          { for (i = 0; i < ncenters; i++) if (chosen[i]==centers[j]) break;
+            if (i==ncenters) break;
+          }
+        }
+        chosen[ncenters] = centers[j];
+      }
+      for (j = 0; j < nclusters; j++) centers[j] = chosen[j];
+      for (i = 0; i < nelements; i++) closest[i] = DBL_MAX;
+      updateclosest(nelements, ndata, data, mask, weight, transpose, metric,
+                    0, nclusters, centers, closest, clusterid);
+      free(chosen);
+      free(weights);
+      free(candidateclosest);
+    }
+  }
+
+  /* Choose the remaining centers as in k-means++ */
+  for ( ; ncenters < nclusters; ncenters++)
+  { j = sampleindex(nelements, closest, NULL, state);
+    if (j < 0) /* All elements coincide with a center */
+    { for (j = 0; j < nelements; j++)
+      { for (i = 0; i < ncenters; i++) if (centers[i]==j) break;
+        if (i==ncenters) break;
+      }
+    }
+    centers[ncenters] = j;
+    updateclosest(nelements, ndata, data, mask, weight, transpose, metric,
+                  ncenters, ncenters+1, centers, closest, clusterid);
+  }
+
+  /* Each center belongs to its own cluster, even if other centers coincide
+   * with it, so that none of the clusters is empty. */
+  for (j = 0; j < nclusters; j++) clusterid[centers[j]] = j;
+
+  free(centers);
+  free(closest);
+  return 1;
+}
+
+/* ********************************************************************* */
+
 static void getclustermeans(int nclusters, int nrows, int ncolumns,
   double** data, int** mask, int clusterid[], double** cdata, int** cmask,
   int transpose)
@@ -2108,7 +2439,10 @@ Purpose
 
 The getclustermedians routine calculates the cluster centroids, given to which
 cluster each element belongs. The centroid is defined as the median over all
-elements for each dimension.
+elements for each dimension. The elements are first sorted into buckets by
+cluster; the medians for each cluster and dimension are then calculated
+independently of each other, in parallel if the library was compiled with
+OpenMP.
 
 Arguments
 =========
@@ -2155,11 +2489,82 @@ cache      (input) double[nrows] if transpose==0
                    double[ncolumns] if transpose==1
 This array should be allocated before calling getclustermedians; its contents
 on input is not relevant. This array is used as a temporary storage space when
-calculating the medians.
+calculating the medians if no memory can be allocated for the buckets.
 
 ========================================================================
 */
 { int i, j, k;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  int ok = 0;
+  int* index = malloc(nelements*sizeof(int));
+  int* start = malloc((nclusters+1)*sizeof(int));
+  if (index && start)
+  { int largest = 1;
+    /* Sort the element indices by cluster; the elements in cluster i are
+     * index[start[i]], ..., index[start[i+1]-1], in their original order. */
+    for (i = 0; i <= nclusters; i++) start[i] = 0;
+    for (k = 0; k < nelements; k++) start[clusterid[k]+1]++;
+    for (i = 0; i < nclusters; i++)
+    { if (start[i+1] > largest) largest = start[i+1];
+      start[i+1] += start[i];
+    }
+    for (k = 0; k < nelements; k++) index[start[clusterid[k]]++] = k;
+    for (i = nclusters; i > 0; i--) start[i] = start[i-1];
+    start[0] = 0;
+    ok = 1;
+    #pragma omp parallel if (nelements > 1000) private(i, j, k)
+    { int task;
+      double* buffer = malloc(largest*sizeof(double));
+      if (!buffer)
+      {
+        #pragma omp atomic write
+        ok = 0;
+      }
+      #pragma omp for schedule(dynamic, 16)
+      for (task = 0; task < nclusters*ndata; task++)
+      { int count = 0;
+        if (!buffer) continue;
+        i = task / ndata;
+        j = task % ndata;
+        if (transpose==0)
+        { for (k = start[i]; k < start[i+1]; k++)
+          { const int m = index[k];
+            if (mask[m][j]) buffer[count++] = data[m][j];
+          }
+          if (count>0)
+          { cdata[i][j] = median(count,buffer);
+            cmask[i][j] = 1;
+          }
+          else
+          { cdata[i][j] = 0.;
+            cmask[i][j] = 0;
+          }
+        }
+        else
+        { for (k = start[i]; k < start[i+1]; k++)
+          { const int m = index[k];
+            if (mask[j][m]) buffer[count++] = data[j][m];
+          }
+          if (count>0)
+          { cdata[j][i] = median(count,buffer);
+            cmask[j][i] = 1;
+          }
+          else
+          { cdata[j][i] = 0.;
+            cmask[j][i] = 0;
+          }
+        }
+      }
+      if (buffer) free(buffer);
+    }
+  }
+  if (index) free(index);
+  if (start) free(start);
+  if (ok) return;
+
+  /* Not enough memory; collect the values for each cluster by going through
+   * all elements. */
   if (transpose==0)
   { for (i = 0; i < nclusters; i++)
     { for (j = 0; j < ncolumns; j++)
@@ -2302,7 +2707,9 @@ Purpose
 
 The getclustermedoids routine calculates the cluster centroids, given to which
 cluster each element belongs. The centroid is defined as the element with the
-smallest sum of distances to the other elements.
+smallest sum of distances to the other elements. Only distances between
+elements in the same cluster are visited, and the clusters are divided over
+the threads if the library was compiled with OpenMP.
 
 Arguments
 =========
@@ -2332,247 +2739,839 @@ centroid.
 ========================================================================
 */
 { int i, j, k;
+  int* start = calloc(nclusters+1, sizeof(int));
+  int* members = malloc(nelements*sizeof(int));
+
   for (j = 0; j < nclusters; j++) errors[j] = DBL_MAX;
-  for (i = 0; i < nelements; i++)
-  { double d = 0.0;
-    j = clusterid[i];
-    for (k = 0; k < nelements; k++)
-    { if (i==k || clusterid[k]!=j) continue;
-      d += (i < k ? distance[k][i] : distance[i][k]);
-      if (d > errors[j]) break;
+
+  if (!start || !members)
+  /* Not enough memory for the member lists; scan all pairs of elements */
+  { if (start) free(start);
+    if (members) free(members);
+    for (i = 0; i < nelements; i++)
+    { double d = 0.0;
+      j = clusterid[i];
+      for (k = 0; k < nelements; k++)
+      { if (i==k || clusterid[k]!=j) continue;
+        d += (i < k ? distance[k][i] : distance[i][k]);
+        if (d > errors[j]) break;
+      }
+      if (d < errors[j])
+      { errors[j] = d;
+        centroids[j] = i;
+      }
     }
-    if (d < errors[j])
-    { errors[j] = d;
-      centroids[j] = i;
+    return;
+  }
+
+  /* Collect the members of each cluster in increasing order, so that only
+   * pairs within a cluster are visited. Cluster j has the members
+   * members[start[j]] to members[start[j+1]-1]. */
+  for (i = 0; i < nelements; i++) start[clusterid[i]+1]++;
+  for (j = 0; j < nclusters; j++) start[j+1] += start[j];
+  for (i = 0; i < nelements; i++) members[start[clusterid[i]]++] = i;
+  for (j = nclusters; j > 0; j--) start[j] = start[j-1];
+  start[0] = 0;
+
+  /* The clusters are independent, and the members of each cluster are
+   * visited in the same order as before, so the medoids do not depend on
+   * the number of threads. */
+  #pragma omp parallel for if (nelements > 1000) private(i, k) schedule(dynamic)
+  for (j = 0; j < nclusters; j++)
+  { const int first = start[j];
+    const int last = start[j+1];
+    for (i = first; i < last; i++)
+    { const int m = members[i];
+      const double* row = distance[m];
+      double d = 0.0;
+      /* Members before m are found in row m of the distance matrix, and
+       * members after m in column m. */
+      for (k = first; k < i; k++)
+      { d += row[members[k]];
+        if (d > errors[j]) break;
+      }
+      if (k==i)
+      { for (k = i+1; k < last; k++)
+        { d += distance[members[k]][m];
+          if (d > errors[j]) break;
+        }
+      }
+      if (d < errors[j])
+      { errors[j] = d;
+        centroids[j] = m;
+      }
     }
   }
+
+  free(start);
+  free(members);
 }
 
 /* ********************************************************************* */
 
+typedef struct
+{ ClusterCallback callback;
+  void* context;
+  ClusterProgress progress;
+  double start;
+  int stop;
+} Monitor;
+/* A Monitor keeps track of the progress reported to the callback passed to
+ * kcluster, minibatchkcluster, kmedoids, or somcluster. */
+
+static double walltime(void)
+/* Returns the elapsed (wall-clock) time in seconds from a fixed origin. Without
+ * OpenMP, the time is only available in whole seconds. */
+{
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return difftime(time(NULL), (time_t)0);
+#endif
+}
+
+static void
+initmonitor(Monitor* monitor, ClusterCallback callback, void* context)
+{ monitor->callback = callback;
+  monitor->context = context;
+  monitor->progress.pass = 0;
+  monitor->start = walltime();
+  monitor->stop = 0;
+}
+
+static int
+report(Monitor* monitor, int iteration, double total, int nmoved)
+/* Reports the progress to the callback; returns 1 if the callback asked to
+ * stop. The monitor may be NULL if no callback was given. */
+{ if (!monitor) return 0;
+  monitor->progress.iteration = iteration;
+  monitor->progress.total = total;
+  monitor->progress.nmoved = nmoved;
+  monitor->progress.elapsed = walltime() - monitor->start;
+  if (monitor->callback(&monitor->progress, monitor->context))
+    monitor->stop = 1;
+  return monitor->stop;
+}
+
+/* ---------------------------------------------------------------------- */
+
 static int
+boundedkmeans(int nrows, int ncolumns, int** mask, const double weight[],
+  int transpose, char dist)
+/* Returns 1 if the square root of the distance measure is a metric, so that
+ * the triangle inequality can be used to skip distance calculations. This is
+ * the case for the Euclidean distance if no data are missing and none of the
+ * weights is negative. */
+{ int i;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  double tweight = 0.0;
+  if (dist!='e') return 0;
+  for (i = 0; i < ndata; i++)
+  { if (weight[i] < 0) return 0;
+    tweight += weight[i];
+  }
+  if (tweight==0) return 0;
+  return nomissing(nrows, ncolumns, mask);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void
+getclustersums(int nclusters, int nrows, int ncolumns, double** data,
+  int** mask, const int clusterid[], double** sdata, int** scount,
+  int transpose)
+/* Calculates the sum of the data values, and the number of values that are
+ * not missing, for each cluster and each dimension. The arrays sdata and
+ * scount have the same layout as cdata and cmask in getclustermeans. The
+ * dimensions are divided over the threads, so that each sum is accumulated
+ * in the same order regardless of the number of threads. */
+{ int i, j, k;
+  if (transpose==0)
+  {
+    #pragma omp parallel for if (nrows*ncolumns > 100000) private(i, k)
+    for (j = 0; j < ncolumns; j++)
+    { for (i = 0; i < nclusters; i++)
+      { sdata[i][j] = 0.;
+        scount[i][j] = 0;
+      }
+      for (k = 0; k < nrows; k++)
+      { if (mask[k][j] != 0)
+        { i = clusterid[k];
+          sdata[i][j] += data[k][j];
+          scount[i][j]++;
+        }
+      }
+    }
+  }
+  else
+  {
+    #pragma omp parallel for if (nrows*ncolumns > 100000) private(j, k)
+    for (i = 0; i < nrows; i++)
+    { for (j = 0; j < nclusters; j++)
+      { sdata[i][j] = 0.;
+        scount[i][j] = 0;
+      }
+      for (k = 0; k < ncolumns; k++)
+      { if (mask[i][k] != 0)
+        { j = clusterid[k];
+          sdata[i][j] += data[i][k];
+          scount[i][j]++;
+        }
+      }
+    }
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void
+moveelement(int ndata, double** data, int** mask, int k, int from, int to,
+  double** sdata, int** scount, int transpose)
+/* Moves element k from cluster from to cluster to in the cluster sums. If no
+ * values are left in a sum, it is reset to zero to discard roundoff error. */
+{ int i;
+  if (transpose==0)
+  { for (i = 0; i < ndata; i++)
+    { if (mask[k][i] != 0)
+      { sdata[from][i] -= data[k][i];
+        if (--scount[from][i]==0) sdata[from][i] = 0.;
+        sdata[to][i] += data[k][i];
+        scount[to][i]++;
+      }
+    }
+  }
+  else
+  { for (i = 0; i < ndata; i++)
+    { if (mask[i][k] != 0)
+      { sdata[i][from] -= data[i][k];
+        if (--scount[i][from]==0) sdata[i][from] = 0.;
+        sdata[i][to] += data[i][k];
+        scount[i][to]++;
+      }
+    }
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void
+getclustermean(int ndata, int j, double** sdata, int** scount,
+  double** cdata, int** cmask, int transpose)
+/* Calculates the centroid of cluster j from the cluster sums. */
+{ int i;
+  if (transpose==0)
+  { for (i = 0; i < ndata; i++)
+    { if (scount[j][i] > 0)
+      { cdata[j][i] = sdata[j][i] / scount[j][i];
+        cmask[j][i] = 1;
+      }
+      else
+      { cdata[j][i] = 0.;
+        cmask[j][i] = 0;
+      }
+    }
+  }
+  else
+  { for (i = 0; i < ndata; i++)
+    { if (scount[i][j] > 0)
+      { cdata[i][j] = sdata[i][j] / scount[i][j];
+        cmask[i][j] = 1;
+      }
+      else
+      { cdata[i][j] = 0.;
+        cmask[i][j] = 0;
+      }
+    }
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+static double
 kmeans(int nclusters, int nrows, int ncolumns, double** data, int** mask,
-  double weight[], int transpose, int npass, char dist,
-  double** cdata, int** cmask, int clusterid[], double* error,
-  int tclusterid[], int counts[], int mapping[])
+  double weight[], int transpose, char dist, double** cdata, int** cmask,
+  int clusterid[], int counts[], int saved[], int assigned[],
+  double distances[], Monitor* monitor)
+/* Performs a single pass of the EM algorithm, starting from the cluster
+ * assignments in clusterid, and returns the within-cluster sum of distances.
+ * The arrays cdata, cmask, counts, saved, assigned, and distances are
+ * workspace. The progress is reported after each iteration if monitor is not
+ * NULL.
+ *
+ * In each iteration, the closest cluster center is found for all elements in
+ * parallel. The elements are then moved in order, as long as this does not
+ * leave a cluster empty, so that the result does not depend on the number of
+ * threads.
+ *
+ * For the Euclidean distance without missing data, the algorithm of Hamerly
+ * (Proceedings of the SIAM International Conference on Data Mining, 130 (2010))
+ * is used to skip most distance calculations. For each element, a lower bound
+ * on the distance to all but its own cluster center is kept, and decreased by
+ * the largest distance a center moved in each iteration. If the distance to
+ * its own center is less than this bound, or less than half the distance from
+ * its own center to the closest other center, the element cannot move and the
+ * other distances are not calculated. The distance to its own center is still
+ * needed for the within-cluster sum of distances, so that the result is
+ * identical to that of the plain algorithm. The bounds are kept on the square
+ * root of the distance, which satisfies the triangle inequality.
+ *
+ * The sum of the data values in each cluster is kept between iterations. An
+ * element that changes cluster is subtracted from the sum of its previous
+ * cluster and added to that of its new cluster, and only the centroids of
+ * these clusters are recalculated. If more than a quarter of the elements
+ * changed cluster, the sums are recalculated from scratch instead. */
 { int i, j, k;
   const int nelements = (transpose==0) ? nrows : ncolumns;
   const int ndata = (transpose==0) ? ncolumns : nrows;
-  int ifound = 1;
-  int ipass = 0;
+  /* Guards against roundoff error in the bounds */
+  const double slack = 1.0 - 1.e-10;
+  double total = DBL_MAX;
+  int counter = 0;
+  int period = 10;
+  int nmoved = 0;
+  int* owner = NULL;
+  int* changed = NULL;
+  double** sdata = NULL;
+  int** scount = NULL;
+  double* lower = NULL;
+  double* half = NULL;
+  double* drift = NULL;
+  double** pdata = NULL;
+  int** pmask = NULL;
   /* Set the metric function as indicated by dist */
   double (*metric)
     (int, double**, double**, int**, int**, const double[], int, int, int) =
        setmetric(dist);
 
-  /* We save the clustering solution periodically and check if it reappears */
-  int* saved = malloc(nelements*sizeof(int));
-  if (saved==NULL) return -1;
-
-  *error = DBL_MAX;
-
-  do
-  { double total = DBL_MAX;
-    int counter = 0;
-    int period = 10;
+  /* If the workspace for the bounds cannot be allocated, the distances to all
+   * centers are calculated. */
+  if (boundedkmeans(nrows, ncolumns, mask, weight, transpose, dist))
+  { int ok;
+    lower = malloc(nelements*sizeof(double));
+    half = malloc(nclusters*sizeof(double));
+    drift = malloc(nclusters*sizeof(double));
+    if (transpose==0) ok = makedatamask(nclusters, ndata, &pdata, &pmask);
+    else ok = makedatamask(ndata, nclusters, &pdata, &pmask);
+    if (!lower || !half || !drift || !ok)
+    { if (lower) free(lower);
+      if (half) free(half);
+      if (drift) free(drift);
+      if (ok)
+      { if (transpose==0) freedatamask(nclusters, pdata, pmask);
+        else freedatamask(ndata, pdata, pmask);
+      }
+      lower = NULL;
+    }
+    else for (i = 0; i < nelements; i++) lower[i] = 0.0;
+  }
 
-    /* Perform the EM algorithm. First, randomly assign elements to clusters. */
-    if (npass!=0) randomassign (nclusters, nelements, tclusterid);
+  /* If the workspace for the cluster sums cannot be allocated, the centroids
+   * are recalculated from all elements in each iteration. */
+  { int ok;
+    owner = malloc(nelements*sizeof(int));
+    changed = malloc(nclusters*sizeof(int));
+    if (transpose==0) ok = makedatamask(nclusters, ndata, &sdata, &scount);
+    else ok = makedatamask(ndata, nclusters, &sdata, &scount);
+    if (!owner || !changed || !ok)
+    { if (owner) free(owner);
+      if (changed) free(changed);
+      if (ok)
+      { if (transpose==0) freedatamask(nclusters, sdata, scount);
+        else freedatamask(ndata, sdata, scount);
+      }
+      owner = NULL;
+    }
+  }
 
-    for (i = 0; i < nclusters; i++) counts[i] = 0;
-    for (i = 0; i < nelements; i++) counts[tclusterid[i]]++;
+  for (i = 0; i < nclusters; i++) counts[i] = 0;
+  for (i = 0; i < nelements; i++) counts[clusterid[i]]++;
 
-    /* Start the loop */
-    while(1)
-    { double previous = total;
-      total = 0.0;
+  /* Start the loop */
+  while(1)
+  { double previous = total;
+    total = 0.0;
 
-      if (counter % period == 0) /* Save the current cluster assignments */
-      { for (i = 0; i < nelements; i++) saved[i] = tclusterid[i];
-        if (period < INT_MAX / 2) period *= 2;
-      }
-      counter++;
+    if (counter % period == 0) /* Save the current cluster assignments */
+    { for (i = 0; i < nelements; i++) saved[i] = clusterid[i];
+      if (period < INT_MAX / 2) period *= 2;
+    }
+    counter++;
 
-      /* Find the center */
-      getclustermeans(nclusters, nrows, ncolumns, data, mask, tclusterid,
+    /* Find the center */
+    if (!owner)
+      getclustermeans(nclusters, nrows, ncolumns, data, mask, clusterid,
                       cdata, cmask, transpose);
-
+    else if (counter==1 || 4*nmoved > nelements)
+    { getclustersums(nclusters, nrows, ncolumns, data, mask, clusterid,
+                     sdata, scount, transpose);
+      for (i = 0; i < nelements; i++) owner[i] = clusterid[i];
+      for (j = 0; j < nclusters; j++)
+        getclustermean(ndata, j, sdata, scount, cdata, cmask, transpose);
+    }
+    else
+    { for (j = 0; j < nclusters; j++) changed[j] = 0;
       for (i = 0; i < nelements; i++)
-      /* Calculate the distances */
-      { double distance;
-        k = tclusterid[i];
-        if (counts[k]==1) continue;
-        /* No reassignment if that would lead to an empty cluster */
-        /* Treat the present cluster as a special case */
-        distance = metric(ndata,data,cdata,mask,cmask,weight,i,k,transpose);
-        for (j = 0; j < nclusters; j++)
-        { double tdistance;
-          if (j==k) continue;
-          tdistance = metric(ndata,data,cdata,mask,cmask,weight,i,j,transpose);
-          if (tdistance < distance)
-          { distance = tdistance;
-            counts[tclusterid[i]]--;
-            tclusterid[i] = j;
-            counts[j]++;
+      { if (owner[i]==clusterid[i]) continue;
+        moveelement(ndata, data, mask, i, owner[i], clusterid[i],
+                    sdata, scount, transpose);
+        changed[owner[i]] = 1;
+        changed[clusterid[i]] = 1;
+        owner[i] = clusterid[i];
+      }
+      for (j = 0; j < nclusters; j++)
+        if (changed[j])
+          getclustermean(ndata, j, sdata, scount, cdata, cmask, transpose);
+    }
+    nmoved = 0;
+
+    if (lower)
+    { /* Update the bounds for the distance the centers moved */
+      int first = 0;
+      double largest = 0.0;
+      double second = 0.0;
+      if (counter > 1)
+      { for (j = 0; j < nclusters; j++)
+        { drift[j] = sqrt(metric(ndata,cdata,pdata,cmask,cmask,weight,j,j,
+                                 transpose));
+          if (drift[j] > largest)
+          { second = largest;
+            largest = drift[j];
+            first = j;
           }
+          else if (drift[j] > second) second = drift[j];
         }
-        total += distance;
+        for (i = 0; i < nelements; i++)
+          lower[i] -= (clusterid[i]==first) ? second : largest;
+      }
+      for (j = 0; j < nclusters; j++)
+      { half[j] = DBL_MAX;
+        for (k = 0; k < j; k++)
+        { const double distance =
+            0.5*sqrt(metric(ndata,cdata,cdata,cmask,cmask,weight,j,k,
+                            transpose));
+          if (distance < half[j]) half[j] = distance;
+          if (distance < half[k]) half[k] = distance;
+        }
+      }
+      if (transpose==0)
+      { for (j = 0; j < nclusters; j++)
+          for (k = 0; k < ndata; k++) pdata[j][k] = cdata[j][k];
+      }
+      else
+      { for (k = 0; k < ndata; k++)
+          for (j = 0; j < nclusters; j++) pdata[k][j] = cdata[k][j];
       }
-      if (total>=previous) break;
-      /* total>=previous is FALSE on some machines even if total and previous
-       * are bitwise identical. */
-      for (i = 0; i < nelements; i++)
-        if (saved[i]!=tclusterid[i]) break;
-      if (i==nelements)
-        break; /* Identical solution found; break out of this loop */
-    }
-
-    if (npass<=1) 
-    { *error = total;
-      break;
     }
 
-    for (i = 0; i < nclusters; i++) mapping[i] = -1;
+    #pragma omp parallel for if (nelements*nclusters > 10000) private(j, k)
     for (i = 0; i < nelements; i++)
-    { j = tclusterid[i];
+    /* Calculate the distances */
+    { double distance;
+      double closest = DBL_MAX;
+      double next = DBL_MAX;
       k = clusterid[i];
-      if (mapping[k] == -1) mapping[k] = j;
-      else if (mapping[k] != j)
-      { if (total < *error)
-        { ifound = 1;
-          *error = total;
-          for (j = 0; j < nelements; j++) clusterid[j] = tclusterid[j];
+      assigned[i] = k;
+      /* Treat the present cluster as a special case */
+      distance = metric(ndata,data,cdata,mask,cmask,weight,i,k,transpose);
+      if (lower)
+      { const double bound = max(half[k], lower[i]);
+        if (sqrt(distance) < slack*bound)
+        { distances[i] = distance;
+          continue;
         }
-        break;
+        closest = distance;
+      }
+      for (j = 0; j < nclusters; j++)
+      { double tdistance;
+        if (j==k) continue;
+        tdistance = metric(ndata,data,cdata,mask,cmask,weight,i,j,transpose);
+        if (tdistance < distance)
+        { distance = tdistance;
+          assigned[i] = j;
+        }
+        if (tdistance < closest)
+        { next = closest;
+          closest = tdistance;
+        }
+        else if (tdistance < next) next = tdistance;
+      }
+      /* The distance to the second closest center */
+      if (lower) lower[i] = sqrt(next);
+      distances[i] = distance;
+    }
+
+    for (i = 0; i < nelements; i++)
+    /* Move the elements in order */
+    { k = clusterid[i];
+      if (counts[k]==1)
+      /* No reassignment if that would lead to an empty cluster. The bound
+       * was calculated assuming the element moves; reset it. */
+      { if (lower) lower[i] = 0.0;
+        continue;
+      }
+      if (assigned[i]!=k)
+      { counts[k]--;
+        clusterid[i] = assigned[i];
+        counts[assigned[i]]++;
+        nmoved++;
       }
+      total += distances[i];
     }
-    if (i==nelements) ifound++; /* break statement not encountered */
-  } while (++ipass < npass);
+    if (report(monitor, counter, total, nmoved)) break;
+    if (total>=previous) break;
+    /* total>=previous is FALSE on some machines even if total and previous
+     * are bitwise identical. */
+    for (i = 0; i < nelements; i++)
+      if (saved[i]!=clusterid[i]) break;
+    if (i==nelements)
+      break; /* Identical solution found; break out of this loop */
+  }
 
-  free(saved);
-  return ifound;
+  if (lower)
+  { free(lower);
+    free(half);
+    free(drift);
+    if (transpose==0) freedatamask(nclusters, pdata, pmask);
+    else freedatamask(ndata, pdata, pmask);
+  }
+  if (owner)
+  { free(owner);
+    free(changed);
+    if (transpose==0) freedatamask(nclusters, sdata, scount);
+    else freedatamask(ndata, sdata, scount);
+  }
+  return total;
 }
 
 /* ---------------------------------------------------------------------- */
 
-static int
+static double
 kmedians(int nclusters, int nrows, int ncolumns, double** data, int** mask,
-  double weight[], int transpose, int npass, char dist,
-  double** cdata, int** cmask, int clusterid[], double* error,
-  int tclusterid[], int counts[], int mapping[], double cache[])
+  double weight[], int transpose, char dist, double** cdata, int** cmask,
+  int clusterid[], int counts[], int saved[], int assigned[],
+  double distances[], double cache[], Monitor* monitor)
+/* Performs a single pass of the EM algorithm, starting from the cluster
+ * assignments in clusterid, and returns the within-cluster sum of distances.
+ * The arrays cdata, cmask, counts, saved, assigned, distances, and cache are
+ * workspace. The closest cluster centers are found in parallel, and the
+ * progress is reported, as in kmeans.
+ */
 { int i, j, k;
   const int nelements = (transpose==0) ? nrows : ncolumns;
   const int ndata = (transpose==0) ? ncolumns : nrows;
-  int ifound = 1;
-  int ipass = 0;
+  double total = DBL_MAX;
+  int counter = 0;
+  int period = 10;
+  int nmoved;
   /* Set the metric function as indicated by dist */
   double (*metric)
     (int, double**, double**, int**, int**, const double[], int, int, int) =
        setmetric(dist);
 
-  /* We save the clustering solution periodically and check if it reappears */
-  int* saved = malloc(nelements*sizeof(int));
-  if (saved==NULL) return -1;
-
-  *error = DBL_MAX;
+  for (i = 0; i < nclusters; i++) counts[i] = 0;
+  for (i = 0; i < nelements; i++) counts[clusterid[i]]++;
 
-  do
-  { double total = DBL_MAX;
-    int counter = 0;
-    int period = 10;
+  /* Start the loop */
+  while(1)
+  { double previous = total;
+    total = 0.0;
 
-    /* Perform the EM algorithm. First, randomly assign elements to clusters. */
-    if (npass!=0) randomassign (nclusters, nelements, tclusterid);
+    if (counter % period == 0) /* Save the current cluster assignments */
+    { for (i = 0; i < nelements; i++) saved[i] = clusterid[i];
+      if (period < INT_MAX / 2) period *= 2;
+    }
+    counter++;
 
-    for (i = 0; i < nclusters; i++) counts[i]=0;
-    for (i = 0; i < nelements; i++) counts[tclusterid[i]]++;
+    /* Find the center */
+    getclustermedians(nclusters, nrows, ncolumns, data, mask, clusterid,
+                      cdata, cmask, transpose, cache);
+    nmoved = 0;
 
-    /* Start the loop */
-    while(1)
-    { double previous = total;
-      total = 0.0;
+    #pragma omp parallel for if (nelements*nclusters > 10000) private(j, k)
+    for (i = 0; i < nelements; i++)
+    /* Calculate the distances */
+    { double distance;
+      k = clusterid[i];
+      assigned[i] = k;
+      /* Treat the present cluster as a special case */
+      distance = metric(ndata,data,cdata,mask,cmask,weight,i,k,transpose);
+      for (j = 0; j < nclusters; j++)
+      { double tdistance;
+        if (j==k) continue;
+        tdistance = metric(ndata,data,cdata,mask,cmask,weight,i,j,transpose);
+        if (tdistance < distance)
+        { distance = tdistance;
+          assigned[i] = j;
+        }
+      }
+      distances[i] = distance;
+    }
 
-      if (counter % period == 0) /* Save the current cluster assignments */
-      { for (i = 0; i < nelements; i++) saved[i] = tclusterid[i];
-        if (period < INT_MAX / 2) period *= 2;
+    for (i = 0; i < nelements; i++)
+    /* Move the elements in order */
+    { k = clusterid[i];
+      /* No reassignment if that would lead to an empty cluster */
+      if (counts[k]==1) continue;
+      if (assigned[i]!=k)
+      { counts[k]--;
+        clusterid[i] = assigned[i];
+        counts[assigned[i]]++;
+        nmoved++;
       }
-      counter++;
+      total += distances[i];
+    }
+    if (report(monitor, counter, total, nmoved)) break;
+    if (total>=previous) break;
+    /* total>=previous is FALSE on some machines even if total and previous
+     * are bitwise identical. */
+    for (i = 0; i < nelements; i++)
+      if (saved[i]!=clusterid[i]) break;
+    if (i==nelements)
+      break; /* Identical solution found; break out of this loop */
+  }
+  return total;
+}
 
-      /* Find the center */
-      getclustermedians(nclusters, nrows, ncolumns, data, mask, tclusterid,
-                        cdata, cmask, transpose, cache);
+/* ---------------------------------------------------------------------- */
 
-      for (i = 0; i < nelements; i++)
-      /* Calculate the distances */
-      { double distance;
-        k = tclusterid[i];
-        if (counts[k]==1) continue;
-        /* No reassignment if that would lead to an empty cluster */
-        /* Treat the present cluster as a special case */
-        distance = metric(ndata,data,cdata,mask,cmask,weight,i,k,transpose);
-        for (j = 0; j < nclusters; j++)
-        { double tdistance;
-          if (j==k) continue;
-          tdistance = metric(ndata,data,cdata,mask,cmask,weight,i,j,transpose);
-          if (tdistance < distance)
-          { distance = tdistance;
-            counts[tclusterid[i]]--;
-            tclusterid[i] = j;
-            counts[j]++;
-          }
-        }
-        total += distance;
-      }
-      if (total>=previous) break;
-      /* total>=previous is FALSE on some machines even if total and previous
-       * are bitwise identical. */
-      for (i = 0; i < nelements; i++)
-        if (saved[i]!=tclusterid[i]) break;
-      if (i==nelements)
-        break; /* Identical solution found; break out of this loop */
+static double**
+normalizerows(int nrows, int ncolumns, double** data, int** mask,
+  const double weight[], int transpose)
+/* Returns the elements to be clustered as rows of unit length, with each value
+ * multiplied by the square root of its weight and missing values set to zero.
+ * The dot product of two such rows is then one minus their uncentered
+ * correlation if no data are missing. Elements of length zero are stored as
+ * rows of zeros. The weights should not be negative. Returns NULL if a memory
+ * allocation error occurs. */
+{ int i, k;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  double** unit = malloc(nelements*sizeof(double*));
+  if (!unit) return NULL;
+  unit[0] = malloc((size_t)nelements*ndata*sizeof(double));
+  if (!unit[0])
+  { free(unit);
+    return NULL;
+  }
+  for (i = 1; i < nelements; i++) unit[i] = unit[0] + (size_t)i*ndata;
+
+  #pragma omp parallel for if ((size_t)nelements*ndata > 100000) private(k)
+  for (i = 0; i < nelements; i++)
+  { double* row = unit[i];
+    double norm = 0.0;
+    for (k = 0; k < ndata; k++)
+    { const int present = (transpose==0) ? mask[i][k] : mask[k][i];
+      const double value = (transpose==0) ? data[i][k] : data[k][i];
+      row[k] = present ? sqrt(weight[k])*value : 0.0;
+      norm += row[k]*row[k];
+    }
+    if (norm > 0)
+    { norm = 1.0/sqrt(norm);
+      for (k = 0; k < ndata; k++) row[k] *= norm;
     }
+  }
+  return unit;
+}
 
-    if (npass<=1) 
-    { *error = total;
-      break;
+/* ---------------------------------------------------------------------- */
+
+static double
+dotproduct(int n, const double x[], const double y[])
+{ int i;
+  double result = 0.0;
+  for (i = 0; i < n; i++) result += x[i]*y[i];
+  return result;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static double
+sphericalkmeans(int nclusters, int nelements, int ndata, double** unit,
+  int absolute, double** cdata, int clusterid[], int counts[], int saved[],
+  int assigned[], double distances[], int sign[], Monitor* monitor)
+/* Performs a single pass of spherical k-means (Dhillon and Modha, Machine
+ * Learning 42, 143 (2001)) on the rows of unit length returned by
+ * normalizerows, starting from the cluster assignments in clusterid, and
+ * returns the within-cluster sum of distances. Each cluster center is the sum
+ * of the rows in the cluster, scaled to unit length, and each element is
+ * assigned to the center with the largest dot product; the distance is one
+ * minus the dot product. If absolute is nonzero, the absolute value of the dot
+ * product is used instead, and each row is added to the sum of its cluster
+ * with the sign of its dot product with the center. The arrays cdata
+ * (nclusters rows of length ndata), counts, saved, assigned, distances, and
+ * sign are workspace. The elements are moved in order, and the progress is
+ * reported, as in kmeans. */
+{ int i, j, k;
+  double total = DBL_MAX;
+  int counter = 0;
+  int period = 10;
+  int nmoved;
+
+  for (i = 0; i < nclusters; i++) counts[i] = 0;
+  for (i = 0; i < nelements; i++)
+  { counts[clusterid[i]]++;
+    sign[i] = 1;
+  }
+
+  /* Start the loop */
+  while(1)
+  { double previous = total;
+    total = 0.0;
+
+    if (counter % period == 0) /* Save the current cluster assignments */
+    { for (i = 0; i < nelements; i++) saved[i] = clusterid[i];
+      if (period < INT_MAX / 2) period *= 2;
+    }
+    counter++;
+
+    /* Find the center. The clusters are divided over the threads, and the
+     * rows are added in order. */
+    #pragma omp parallel for if ((size_t)nelements*ndata > 100000) private(i, k)
+    for (j = 0; j < nclusters; j++)
+    { double* center = cdata[j];
+      double norm;
+      for (k = 0; k < ndata; k++) center[k] = 0.0;
+      for (i = 0; i < nelements; i++)
+      { const double* row = unit[i];
+        if (clusterid[i]!=j) continue;
+        if (sign[i] > 0) for (k = 0; k < ndata; k++) center[k] += row[k];
+        else for (k = 0; k < ndata; k++) center[k] -= row[k];
+      }
+      norm = dotproduct(ndata, center, center);
+      if (norm > 0)
+      { norm = 1.0/sqrt(norm);
+        for (k = 0; k < ndata; k++) center[k] *= norm;
+      }
     }
+    nmoved = 0;
 
-    for (i = 0; i < nclusters; i++) mapping[i] = -1;
+    #pragma omp parallel for if (nelements*nclusters > 10000) private(j, k)
     for (i = 0; i < nelements; i++)
-    { j = tclusterid[i];
+    /* Find the center with the largest dot product */
+    { double product;
+      double largest;
       k = clusterid[i];
-      if (mapping[k] == -1) mapping[k] = j;
-      else if (mapping[k] != j)
-      { if (total < *error)
-        { ifound = 1;
-          *error = total;
-          for (j = 0; j < nelements; j++) clusterid[j] = tclusterid[j];
+      assigned[i] = k;
+      /* Treat the present cluster as a special case */
+      product = dotproduct(ndata, unit[i], cdata[k]);
+      sign[i] = (absolute && product < 0) ? -1 : 1;
+      largest = sign[i]*product;
+      for (j = 0; j < nclusters; j++)
+      { double tproduct;
+        if (j==k) continue;
+        tproduct = dotproduct(ndata, unit[i], cdata[j]);
+        if (absolute ? fabs(tproduct) > largest : tproduct > largest)
+        { largest = absolute ? fabs(tproduct) : tproduct;
+          sign[i] = (absolute && tproduct < 0) ? -1 : 1;
+          assigned[i] = j;
         }
-        break;
       }
+      distances[i] = 1.0 - largest;
     }
-    if (i==nelements) ifound++; /* break statement not encountered */
-  } while (++ipass < npass);
 
-  free(saved);
-  return ifound;
+    for (i = 0; i < nelements; i++)
+    /* Move the elements in order */
+    { k = clusterid[i];
+      if (counts[k]==1)
+      /* No reassignment if that would lead to an empty cluster. The sign
+       * was found for the new cluster; find it for the present one. */
+      { if (absolute && assigned[i]!=k)
+          sign[i] = (dotproduct(ndata, unit[i], cdata[k]) < 0) ? -1 : 1;
+        continue;
+      }
+      if (assigned[i]!=k)
+      { counts[k]--;
+        clusterid[i] = assigned[i];
+        counts[assigned[i]]++;
+        nmoved++;
+      }
+      total += distances[i];
+    }
+    if (report(monitor, counter, total, nmoved)) break;
+    if (total>=previous) break;
+    /* total>=previous is FALSE on some machines even if total and previous
+     * are bitwise identical. */
+    for (i = 0; i < nelements; i++)
+      if (saved[i]!=clusterid[i]) break;
+    if (i==nelements)
+      break; /* Identical solution found; break out of this loop */
+  }
+  return total;
 }
 
 /* ********************************************************************* */
 
-void kcluster (int nclusters, int nrows, int ncolumns,
-  double** data, int** mask, double weight[], int transpose,
-  int npass, char method, char dist,
-  int clusterid[], double* error, int* ifound)
+int getdatarows(void* context, int n, const int index[], double** data,
+  int** mask)
+/* Copies the rows or columns of a data matrix, described by a DataSource, for
+ * use by minibatchkcluster. */
+{ int i, j;
+  const DataSource* source = context;
+  for (i = 0; i < n; i++)
+  { const int k = index[i];
+    if (source->transpose==0)
+    { for (j = 0; j < source->ndata; j++)
+      { data[i][j] = source->data[k][j];
+        mask[i][j] = source->mask[k][j];
+      }
+    }
+    else
+    { for (j = 0; j < source->ndata; j++)
+      { data[i][j] = source->data[j][k];
+        mask[i][j] = source->mask[j][k];
+      }
+    }
+  }
+  return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void
+assignrows(int n, int ndata, double** rows, int** rowmask, int nclusters,
+  double** cdata, int** cmask, double weight[],
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int),
+  int assigned[], double distances[])
+/* Finds the closest cluster center for each of the n rows. */
+{ int i;
+  #pragma omp parallel for if (n*nclusters > 10000)
+  for (i = 0; i < n; i++)
+  { int j;
+    double distance = DBL_MAX;
+    for (j = 0; j < nclusters; j++)
+    { const double tdistance = metric(ndata, rows, cdata, rowmask, cmask,
+                                      weight, i, j, 0);
+      if (tdistance < distance)
+      { distance = tdistance;
+        assigned[i] = j;
+      }
+    }
+    distances[i] = distance;
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+void minibatchkcluster (int nclusters, int nelements, int ndata,
+  int (*getrows)(void* context, int n, const int index[], double** data,
+                 int** mask),
+  void* context, double weight[], char dist, int batchsize, int niter,
+  int npass, unsigned long seed, int clusterid[], double* error, int* ifound,
+  ClusterCallback callback, void* callbackcontext)
 /*
 Purpose
 =======
 
-The kcluster routine performs k-means or k-median clustering on a given set of
-elements, using the specified distance measure. The number of clusters is given
-by the user. Multiple passes are being made to find the optimal clustering
-solution, each time starting from a different initial clustering.
-
+The minibatchkcluster routine performs mini-batch k-means clustering (Sculley,
+Proceedings of the International Conference on World Wide Web, 1177 (2010)).
+Instead of the whole data set, each iteration uses a small batch of elements
+drawn at random. Each element in the batch moves the closest cluster center
+towards it, with a learning rate equal to one over the number of elements
+assigned to that center so far. After the last iteration, each element is
+assigned to the closest cluster center in a single pass through the data.
+The data are not accessed directly, but are requested in batches through the
+getrows function. Only a batch of elements is kept in memory at any time.
 
 Arguments
 =========
@@ -2580,81 +3579,97 @@ Arguments
 nclusters  (input) int
 The number of clusters to be found.
 
-data       (input) double[nrows][ncolumns]
-The array containing the data of the elements to be clustered (i.e., the gene
-expression data).
+nelements  (input) int
+The number of elements to be clustered.
 
-mask       (input) int[nrows][ncolumns]
-This array shows which data values are missing. If
-mask[i][j] == 0, then data[i][j] is missing.
+ndata      (input) int
+The number of data values of each element.
 
-nrows     (input) int
-The number of rows in the data matrix, equal to the number of genes.
+getrows    (input) function
+A function that copies the data values of n elements, numbered index[0] to
+index[n-1], into data[0..n-1][0..ndata-1]. For missing data values, it should
+set mask[i][j] to 0; otherwise mask[i][j] should be 1. The function is called
+from the calling thread only, and should return 1 if successful and 0 if an
+error occurs.
 
-ncolumns  (input) int
-The number of columns in the data matrix, equal to the number of microarrays.
+context    (input) void*
+Passed unchanged to getrows.
 
-weight (input) double[n]
+weight     (input) double[ndata]
 The weights that are used to calculate the distance.
 
-transpose  (input) int
-If transpose==0, the rows of the matrix are clustered. Otherwise, columns
-of the matrix are clustered.
+dist       (input) char
+Defines which distance measure is used, as in kcluster.
 
-npass      (input) int
-The number of times clustering is performed. Clustering is performed npass
-times, each time starting from a different (random) initial assignment of 
-genes to clusters. The clustering solution with the lowest within-cluster sum
-of distances is chosen.
-If npass==0, then the clustering algorithm will be run once, where the initial
-assignment of elements to clusters is taken from the clusterid array.
+batchsize  (input) int
+The number of elements in each batch. If batchsize <= 0, the larger of 1024
+and ten times the number of clusters is used.
 
-method     (input) char
-Defines whether the arithmetic mean (method=='a') or the median
-(method=='m') is used to calculate the cluster center.
+niter      (input) int
+The number of batches. If niter <= 0, 100 batches are used.
 
-dist       (input) char
-Defines which distance measure is used, as given by the table:
-dist=='e': Euclidean distance
-dist=='b': City-block distance
-dist=='c': correlation
-dist=='a': absolute value of the correlation
-dist=='u': uncentered correlation
-dist=='x': absolute uncentered correlation
-dist=='s': Spearman's rank correlation
-dist=='k': Kendall's tau
-For other values of dist, the default (Euclidean distance) is used.
+npass      (input) int
+The number of times clustering is performed, as in kcluster. In each pass,
+the initial cluster centers are chosen among a random batch of elements by
+k-means++ seeding. If npass==0, the initial cluster centers are the means of
+the clusters given in clusterid. The passes are run one after the other, as
+getrows may not be called from different threads; the distance calculations
+within each pass are run in parallel.
 
-clusterid  (output; input) int[nrows] if transpose==0
-                           int[ncolumns] if transpose==1
-The cluster number to which a gene or microarray was assigned. If npass==0,
-then on input clusterid contains the initial clustering assignment from which
-the clustering algorithm starts. On output, it contains the clustering solution
-that was found.
+seed       (input) unsigned long
+The seed of the random number generator, as in kcluster.
+
+clusterid  (output; input) int[nelements]
+The cluster number to which each element was assigned. If npass==0, then on
+input clusterid contains the initial clustering assignment. As each element is
+assigned to the closest cluster center in the last pass through the data, a
+cluster may be empty.
 
 error      (output) double*
-The sum of distances to the cluster center of each item in the optimal k-means
+The sum of distances to the cluster center of each element in the best
 clustering solution that was found.
 
 ifound     (output) int*
-The number of times the optimal clustering solution was
-found. The value of ifound is at least 1; its maximum value is npass. If the
-number of clusters is larger than the number of elements being clustered,
-*ifound is set to 0 as an error code. If a memory allocation error occurs,
-*ifound is set to -1.
+The number of times the best clustering solution was found, as in kcluster.
+If the number of clusters is larger than the number of elements, *ifound is
+set to 0. If a memory allocation error occurs, or if getrows fails, *ifound is
+set to -1.
+
+callback   (input) ClusterCallback
+If callback is not NULL, it is called after each batch, as described for
+kcluster. The total reported is the sum of distances of the elements in the
+batch to their closest cluster center; the number of elements that changed
+cluster is not known and is reported as -1. If the callback returns a nonzero
+value, the elements are assigned to the present cluster centers, and the
+remaining passes are skipped.
+
+callbackcontext (input) void*
+A pointer that is passed unchanged to the callback.
 
 ========================================================================
 */
-{ const int nelements = (transpose==0) ? nrows : ncolumns;
-  const int ndata = (transpose==0) ? ncolumns : nrows;
-
-  int i;
+{ int i, j;
+  int ipass;
+  int found = 0;
   int ok;
-  int* tclusterid;
-  int* mapping = NULL;
+  const int nrun = (npass > 1) ? npass : 1;
+  int nbuffer;
+  RandomState state;
+  double** rows;
+  int** rowmask;
   double** cdata;
   int** cmask;
-  int* counts;
+  int* index;
+  int* assigned;
+  double* distances;
+  double* counts;
+  int* tclusterid;
+  int* mapping = NULL;
+  Monitor monitor;
+  Monitor* pmonitor = callback ? &monitor : NULL;
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int) =
+       setmetric(dist);
 
   if (nelements < nclusters)
   { *ifound = 0;
@@ -2664,79 +3679,535 @@ number of clusters is larger than the number of elements being clustered,
 
   *ifound = -1;
 
-  /* This will contain the number of elements in each cluster, which is
-   * needed to check for empty clusters. */
-  counts = malloc(nclusters*sizeof(int));
-  if(!counts) return;
-
-  /* Find out if the user specified an initial clustering */
-  if (npass<=1) tclusterid = clusterid;
-  else
-  { tclusterid = malloc(nelements*sizeof(int));
-    if (!tclusterid)
-    { free(counts);
-      return;
-    }
-    mapping = malloc(nclusters*sizeof(int));
-    if (!mapping)
-    { free(counts);
-      free(tclusterid);
-      return;
-    }
-    for (i = 0; i < nelements; i++) clusterid[i] = 0;
-  }
+  if (callback) initmonitor(&monitor, callback, callbackcontext);
+  if (seed==0) seed = randomseed();
 
-  /* Allocate space to store the centroid data */
-  if (transpose==0) ok = makedatamask(nclusters, ndata, &cdata, &cmask);
-  else ok = makedatamask(ndata, nclusters, &cdata, &cmask);
-  if(!ok)
-  { free(counts);
-    if(npass>1)
-    { free(tclusterid);
-      free(mapping);
-      return;
-    }
-  }
-  
-  if (method=='m')
-  { double* cache = malloc(nelements*sizeof(double));
-    if(cache)
-    { *ifound = kmedians(nclusters, nrows, ncolumns, data, mask, weight,
-                         transpose, npass, dist, cdata, cmask, clusterid, error,
-                         tclusterid, counts, mapping, cache);
-      free(cache);
-    }
-  }
-  else
-    *ifound = kmeans(nclusters, nrows, ncolumns, data, mask, weight,
-                     transpose, npass, dist, cdata, cmask, clusterid, error,
-                     tclusterid, counts, mapping);
+  if (batchsize <= 0) batchsize = max(1024, 10*nclusters);
+  if (niter <= 0) niter = 100;
+  /* The initial cluster centers are chosen among at least three elements per
+   * cluster */
+  nbuffer = max(batchsize, 3*nclusters);
 
-  /* Deallocate temporarily used space */
-  if (npass > 1)
-  { free(mapping);
-    free(tclusterid);
+  if (!makedatamask(nbuffer, ndata, &rows, &rowmask)) return;
+  if (!makedatamask(nclusters, ndata, &cdata, &cmask))
+  { freedatamask(nbuffer, rows, rowmask);
+    return;
   }
+  index = malloc(nbuffer*sizeof(int));
+  assigned = malloc(nbuffer*sizeof(int));
+  distances = malloc(nbuffer*sizeof(double));
+  counts = malloc(nclusters*sizeof(double));
+  tclusterid = (npass > 1) ? malloc(nelements*sizeof(int)) : clusterid;
+  if (npass > 1) mapping = malloc(nclusters*sizeof(int));
+  ok = index && assigned && distances && counts && tclusterid
+    && (npass <= 1 || mapping);
 
-  if (transpose==0) freedatamask(nclusters, cdata, cmask);
-  else freedatamask(ndata, cdata, cmask);
-
-  free(counts);
-}
-
-/* *********************************************************************** */
+  *error = DBL_MAX;
 
-void kmedoids (int nclusters, int nelements, double** distmatrix,
-  int npass, int clusterid[], double* error, int* ifound)
-/*
-Purpose
-=======
+  for (ipass = 0; ipass < nrun && ok; ipass++)
+  { int iter;
+    int start;
+    double total = 0.0;
 
-The kmedoids routine performs k-medoids clustering on a given set of elements,
-using the distance matrix and the number of clusters passed by the user.
-Multiple passes are being made to find the optimal clustering solution, each
-time starting from a different initial clustering.
+    if (pmonitor)
+    { if (pmonitor->stop) break;
+      pmonitor->progress.pass = ipass;
+    }
 
+    /* Choose the initial cluster centers */
+    if (npass==0)
+    { for (i = 0; i < nclusters; i++)
+      { counts[i] = 0;
+        for (j = 0; j < ndata; j++)
+        { cdata[i][j] = 0.0;
+          cmask[i][j] = 0;
+        }
+      }
+      for (start = 0; start < nelements && ok; start += nbuffer)
+      { const int n = min(nbuffer, nelements - start);
+        int r;
+        for (r = 0; r < n; r++) index[r] = start + r;
+        if (!getrows(context, n, index, rows, rowmask))
+        { ok = 0;
+          break;
+        }
+        for (r = 0; r < n; r++)
+        { const int k = clusterid[start+r];
+          counts[k]++;
+          for (j = 0; j < ndata; j++)
+          { if (rowmask[r][j])
+            { cdata[k][j] += rows[r][j];
+              cmask[k][j]++;
+            }
+          }
+        }
+      }
+      if (!ok) break;
+      for (i = 0; i < nclusters; i++)
+      { for (j = 0; j < ndata; j++)
+        { if (cmask[i][j] > 0)
+          { cdata[i][j] /= cmask[i][j];
+            cmask[i][j] = 1;
+          }
+        }
+      }
+    }
+    else
+    { seedstream(&state, seed, ipass);
+      for (i = 0; i < nbuffer; i++)
+        index[i] = (int)(nelements*nextuniform(&state));
+      if (!getrows(context, nbuffer, index, rows, rowmask))
+      { ok = 0;
+        break;
+      }
+      if (!seedclusters(nclusters, nbuffer, ndata, rows, rowmask, weight, 0,
+                        dist, 'k', assigned, &state))
+      { ok = 0;
+        break;
+      }
+      getclustermeans(nclusters, nbuffer, ndata, rows, rowmask, assigned,
+                      cdata, cmask, 0);
+      for (i = 0; i < nclusters; i++) counts[i] = 0;
+      for (i = 0; i < nbuffer; i++) counts[assigned[i]]++;
+    }
+
+    /* Move the cluster centers towards the elements in each batch */
+    if (npass==0) seedstream(&state, seed, 0);
+    for (iter = 0; iter < niter; iter++)
+    { int r;
+      for (r = 0; r < batchsize; r++)
+        index[r] = (int)(nelements*nextuniform(&state));
+      if (!getrows(context, batchsize, index, rows, rowmask))
+      { ok = 0;
+        break;
+      }
+      assignrows(batchsize, ndata, rows, rowmask, nclusters, cdata, cmask,
+                 weight, metric, assigned, distances);
+      total = 0.0;
+      for (r = 0; r < batchsize; r++)
+      { const int k = assigned[r];
+        double rate;
+        total += distances[r];
+        counts[k]++;
+        rate = 1.0/counts[k];
+        for (j = 0; j < ndata; j++)
+        { if (!rowmask[r][j]) continue;
+          if (cmask[k][j]) cdata[k][j] += rate*(rows[r][j]-cdata[k][j]);
+          else
+          { cdata[k][j] = rows[r][j];
+            cmask[k][j] = 1;
+          }
+        }
+      }
+      if (report(pmonitor, iter+1, total, -1)) break;
+    }
+    if (!ok) break;
+
+    /* Assign each element to the closest cluster center */
+    total = 0.0;
+    for (start = 0; start < nelements; start += nbuffer)
+    { const int n = min(nbuffer, nelements - start);
+      int r;
+      for (r = 0; r < n; r++) index[r] = start + r;
+      if (!getrows(context, n, index, rows, rowmask))
+      { ok = 0;
+        break;
+      }
+      assignrows(n, ndata, rows, rowmask, nclusters, cdata, cmask, weight,
+                 metric, assigned, distances);
+      for (r = 0; r < n; r++)
+      { tclusterid[start+r] = assigned[r];
+        total += distances[r];
+      }
+    }
+    if (!ok) break;
+
+    if (npass <= 1)
+    { found = 1;
+      *error = total;
+      break;
+    }
+    if (found==0)
+    { found = 1;
+      *error = total;
+      for (i = 0; i < nelements; i++) clusterid[i] = tclusterid[i];
+      continue;
+    }
+    for (i = 0; i < nclusters; i++) mapping[i] = -1;
+    for (i = 0; i < nelements; i++)
+    { const int jj = tclusterid[i];
+      const int k = clusterid[i];
+      if (mapping[k] == -1) mapping[k] = jj;
+      else if (mapping[k] != jj)
+      { if (total < *error)
+        { found = 1;
+          *error = total;
+          for (j = 0; j < nelements; j++) clusterid[j] = tclusterid[j];
+        }
+        break;
+      }
+    }
+    if (i==nelements) found++; /* break statement not encountered */
+  }
+
+  freedatamask(nbuffer, rows, rowmask);
+  freedatamask(nclusters, cdata, cmask);
+  if (index) free(index);
+  if (assigned) free(assigned);
+  if (distances) free(distances);
+  if (counts) free(counts);
+  if (npass > 1 && tclusterid) free(tclusterid);
+  if (mapping) free(mapping);
+  if (ok) *ifound = found;
+}
+
+/* ********************************************************************* */
+
+struct datafile
+{ FILE* file;
+  char format;
+  int nrows;
+  int ncolumns;
+  int nfields;
+  int* columns;
+  long* offsets;
+  int contiguous;
+  double* weight;
+  char* line;
+  size_t size;
+  int next;
+};
+/* For files in the Cluster text format, nfields is the number of fields on
+ * each line, and columns[i] is the data column stored in field i, or -1 for
+ * the gene identifier, NAME, GWEIGHT, and GORDER fields. The file offset of
+ * each data row is stored in offsets; contiguous is 1 if the data rows are
+ * consecutive lines in the file. The row that can be read without seeking is
+ * stored in next. */
+
+static char*
+readdataline(FILE* file, char** buffer, size_t* size)
+/* Reads a line of arbitrary length into *buffer, which is enlarged as needed,
+ * and removes the line terminator. Returns NULL at the end of the file, or if
+ * memory cannot be allocated. */
+{ size_t length = 0;
+  if (!*buffer)
+  { *size = 1024;
+    *buffer = malloc(*size);
+    if (!*buffer) return NULL;
+  }
+  while (fgets(*buffer + length, (int)(*size - length), file))
+  { char* p;
+    length += strlen(*buffer + length);
+    if ((*buffer)[length-1]=='\n' || length + 1 < *size) break;
+    p = realloc(*buffer, 2*(*size));
+    if (!p) return NULL;
+    *buffer = p;
+    *size *= 2;
+  }
+  if (length==0) return NULL;
+  while (length > 0 &&
+         ((*buffer)[length-1]=='\n' || (*buffer)[length-1]=='\r'))
+    (*buffer)[--length] = '\0';
+  return *buffer;
+}
+
+static int
+parsedataline(const DataFile* datafile, char* line, double data[], int mask[])
+/* Stores the data values on a line of a file in the Cluster text format in
+ * data and mask. Empty fields are missing values. Returns 0 if the line does
+ * not have the expected number of fields, or if a value is not a number. */
+{ int i = 0;
+  char* field = line;
+  while (1)
+  { char* end = strchr(field, '\t');
+    if (end) *end = '\0';
+    if (i >= datafile->nfields) return 0;
+    if (datafile->columns[i] >= 0)
+    { const int j = datafile->columns[i];
+      char* stop;
+      field += strspn(field, " ");
+      if (*field=='\0')
+      { data[j] = 0.0;
+        mask[j] = 0;
+      }
+      else
+      { data[j] = strtod(field, &stop);
+        stop += strspn(stop, " ");
+        if (stop==field || *stop!='\0') return 0;
+        mask[j] = 1;
+      }
+    }
+    i++;
+    if (!end) break;
+    field = end + 1;
+  }
+  return (i==datafile->nfields);
+}
+
+static int
+scandatafile(DataFile* datafile)
+/* Reads the header line of a file in the Cluster text format, and finds the
+ * data rows and the EWEIGHT row. Returns 0 if the file cannot be read or if
+ * memory cannot be allocated. */
+{ int i;
+  int n = 0;
+  int previous = 1;
+  int* mask;
+  char* field;
+  char* line = readdataline(datafile->file, &datafile->line, &datafile->size);
+  if (!line) return 0;
+  datafile->nfields = 1;
+  for (field = line; *field; field++) if (*field=='\t') datafile->nfields++;
+  datafile->columns = malloc(datafile->nfields*sizeof(int));
+  if (!datafile->columns) return 0;
+  datafile->ncolumns = 0;
+  field = line;
+  for (i = 0; i < datafile->nfields; i++)
+  { char* end = strchr(field, '\t');
+    if (end) *end = '\0';
+    if (i==0 || !strcmp(field, "NAME") || !strcmp(field, "GWEIGHT")
+             || !strcmp(field, "GORDER")) datafile->columns[i] = -1;
+    else datafile->columns[i] = datafile->ncolumns++;
+    if (end) field = end + 1;
+  }
+  if (datafile->ncolumns==0) return 0;
+
+  datafile->nrows = 0;
+  datafile->contiguous = 1;
+  while (1)
+  { const long offset = ftell(datafile->file);
+    line = readdataline(datafile->file, &datafile->line, &datafile->size);
+    if (!line) break;
+    if (!strncmp(line, "EWEIGHT\t", 8))
+    { if (!datafile->weight)
+      { datafile->weight = malloc(datafile->ncolumns*sizeof(double));
+        mask = malloc(datafile->ncolumns*sizeof(int));
+        if (!datafile->weight || !mask)
+        { if (mask) free(mask);
+          return 0;
+        }
+        i = parsedataline(datafile, line, datafile->weight, mask);
+        free(mask);
+        if (!i) return 0;
+      }
+      previous = 0;
+    }
+    else if (!strncmp(line, "EORDER\t", 7) || line[0]=='\0') previous = 0;
+    else
+    { if (datafile->nrows==n)
+      { long* offsets;
+        n = (n==0) ? 1024 : 2*n;
+        offsets = realloc(datafile->offsets, n*sizeof(long));
+        if (!offsets) return 0;
+        datafile->offsets = offsets;
+      }
+      if (!previous && datafile->nrows > 0) datafile->contiguous = 0;
+      datafile->offsets[datafile->nrows++] = offset;
+      previous = 1;
+    }
+  }
+  if (datafile->nrows==0) return 0;
+  datafile->next = -1;
+  return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+DataFile* opendatafile(const char filename[], char format)
+/*
+Purpose
+=======
+
+The opendatafile routine opens a data file, so that its rows can be read in
+batches by getdatafilerows without reading the whole file into memory. Only the
+position of each row in the file is kept in memory.
+
+Arguments
+=========
+
+filename   (input) char[]
+The name of the data file.
+
+format     (input) char
+The format of the data file. If format=='t', the file is a tab-delimited file
+in the Cluster format: the first line contains the column names, and each
+following line contains a gene identifier followed by the data values. The
+NAME, GWEIGHT, and GORDER columns are skipped. An EWEIGHT line, if present,
+gives the weight of each data column, and an EORDER line is skipped. Missing
+values are represented by empty fields.
+If format=='b', the file is a binary file consisting of the number of rows and
+the number of columns as two values of type int, followed by the data values
+row by row as values of type double, in the byte order of this computer.
+Missing values are represented by NaN.
+
+Return value
+============
+
+A pointer to the opened data file, which should be closed by closedatafile. If
+the file cannot be opened or read, if its format is not recognized, or if a
+memory allocation error occurs, opendatafile returns NULL.
+========================================================================
+*/
+{ int ok = 0;
+  DataFile* datafile = malloc(sizeof(DataFile));
+  if (!datafile) return NULL;
+  datafile->format = format;
+  datafile->nrows = 0;
+  datafile->ncolumns = 0;
+  datafile->columns = NULL;
+  datafile->offsets = NULL;
+  datafile->weight = NULL;
+  datafile->line = NULL;
+  datafile->size = 0;
+  datafile->next = 0;
+  datafile->file = fopen(filename, "rb");
+  if (datafile->file)
+  { switch (format)
+    { case 't':
+        ok = scandatafile(datafile);
+        break;
+      case 'b':
+      { int shape[2];
+        if (fread(shape, sizeof(int), 2, datafile->file)==2
+         && shape[0] > 0 && shape[1] > 0)
+        { datafile->nrows = shape[0];
+          datafile->ncolumns = shape[1];
+          ok = 1;
+        }
+        break;
+      }
+    }
+  }
+  if (!ok)
+  { closedatafile(datafile);
+    return NULL;
+  }
+  return datafile;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void closedatafile(DataFile* datafile)
+/* Closes a data file opened by opendatafile, and frees the memory used. */
+{ if (datafile->file) fclose(datafile->file);
+  if (datafile->columns) free(datafile->columns);
+  if (datafile->offsets) free(datafile->offsets);
+  if (datafile->weight) free(datafile->weight);
+  if (datafile->line) free(datafile->line);
+  free(datafile);
+}
+
+/* ---------------------------------------------------------------------- */
+
+void datafileshape(const DataFile* datafile, int* nrows, int* ncolumns)
+/* Stores the number of data rows and data columns of a data file. */
+{ *nrows = datafile->nrows;
+  *ncolumns = datafile->ncolumns;
+}
+
+/* ---------------------------------------------------------------------- */
+
+const double* datafileweight(const DataFile* datafile)
+/* Returns the column weights given in the EWEIGHT line of a data file in the
+ * Cluster text format, or NULL if the file does not contain column weights. */
+{ return datafile->weight;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int getdatafilerows(void* datafile, int n, const int index[], double** data,
+  int** mask)
+/*
+Purpose
+=======
+
+The getdatafilerows routine reads rows from a data file opened by
+opendatafile. It can be passed as the getrows argument of streamkcluster and
+minibatchkcluster, with the data file as the context. Rows that are read in
+order do not require a seek in the file.
+
+Arguments
+=========
+
+datafile   (input) DataFile*
+The data file, as returned by opendatafile.
+
+n          (input) int
+The number of rows to be read.
+
+index      (input) int[n]
+The row numbers of the rows to be read.
+
+data       (output) double[n][ncolumns]
+On exit, the data values of the rows.
+
+mask       (output) int[n][ncolumns]
+On exit, mask[i][j]==0 if data[i][j] is missing, and 1 otherwise.
+
+Return value
+============
+
+getdatafilerows returns 1 if successful, and 0 if a row number is out of
+range, or if a row cannot be read or does not have the expected format.
+========================================================================
+*/
+{ int i, j;
+  DataFile* file = datafile;
+  for (i = 0; i < n; i++)
+  { const int k = index[i];
+    if (k < 0 || k >= file->nrows) return 0;
+    if (file->format=='t')
+    { char* line;
+      if (k!=file->next && fseek(file->file, file->offsets[k], SEEK_SET))
+        return 0;
+      file->next = -1;
+      line = readdataline(file->file, &file->line, &file->size);
+      if (!line || !parsedataline(file, line, data[i], mask[i])) return 0;
+      if (file->contiguous) file->next = k + 1;
+    }
+    else
+    { if (k!=file->next)
+      { const long offset = 2*sizeof(int)
+                          + (long)k*file->ncolumns*sizeof(double);
+        if (fseek(file->file, offset, SEEK_SET)) return 0;
+      }
+      file->next = -1;
+      if (fread(data[i], sizeof(double), file->ncolumns, file->file)
+          != (size_t)file->ncolumns) return 0;
+      for (j = 0; j < file->ncolumns; j++)
+      { if (data[i][j]==data[i][j]) mask[i][j] = 1;
+        else
+        { /* NaN */
+          data[i][j] = 0.0;
+          mask[i][j] = 0;
+        }
+      }
+      file->next = k + 1;
+    }
+  }
+  return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void streamkcluster (int nclusters, int nelements, int ndata,
+  int (*getrows)(void* context, int n, const int index[], double** data,
+                 int** mask),
+  void* context, double weight[], char dist, int npass, unsigned long seed,
+  int clusterid[], double* error, int* ifound, ClusterCallback callback,
+  void* callbackcontext)
+/*
+Purpose
+=======
+
+The streamkcluster routine performs k-means clustering like kcluster with
+method=='a', but without keeping the data in memory. In each iteration, the
+data are read in order in batches through the getrows function; each element
+is assigned to the closest cluster center, and added to the sums from which
+the cluster centers for the next iteration are calculated. Only the cluster
+centers, the cluster assignments, and one batch of elements are kept in
+memory. As the elements are moved in order, and no cluster is left empty, the
+result is the same as for kcluster, apart from roundoff error.
 
 Arguments
 =========
@@ -2747,125 +4218,216 @@ The number of clusters to be found.
 nelements  (input) int
 The number of elements to be clustered.
 
-distmatrix (input) double array, ragged
-  (number of rows is nelements, number of columns is equal to the row number)
-The distance matrix. To save space, the distance matrix is given in the
-form of a ragged array. The distance matrix is symmetric and has zeros
-on the diagonal. See distancematrix for a description of the content.
+ndata      (input) int
+The number of dimensions of each element.
+
+getrows    (input) function
+The function that provides the data, as in minibatchkcluster. The rows are
+requested in order in each pass through the data. getdatafilerows can be used
+to read the rows from a data file.
+
+context    (input) void*
+A pointer that is passed unchanged to getrows.
+
+weight     (input) double[ndata]
+The weights that are used to calculate the distance.
+
+dist       (input) char
+Defines which distance measure is used, as in kcluster.
 
 npass      (input) int
-The number of times clustering is performed. Clustering is performed npass
-times, each time starting from a different (random) initial assignment of genes
-to clusters. The clustering solution with the lowest within-cluster sum of
-distances is chosen.
-If npass==0, then the clustering algorithm will be run once, where the initial
-assignment of elements to clusters is taken from the clusterid array.
+The number of times clustering is performed, as in kcluster. The initial
+clustering of each pass is chosen at random; if npass==0, the initial
+clustering is taken from clusterid. The passes are run one after the other.
+
+seed       (input) unsigned long
+The seed of the random number generator, as in kcluster.
 
 clusterid  (output; input) int[nelements]
-On input, if npass==0, then clusterid contains the initial clustering assignment
-from which the clustering algorithm starts; all numbers in clusterid should be
-between zero and nelements-1 inclusive. If npass!=0, clusterid is ignored on
-input.
-On output, clusterid contains the clustering solution that was found: clusterid
-contains the number of the cluster to which each item was assigned. On output,
-the number of a cluster is defined as the item number of the centroid of the
-cluster.
+The cluster number to which each element was assigned. If npass==0, then on
+input clusterid contains the initial clustering assignment.
 
-error      (output) double
-The sum of distances to the cluster center of each item in the optimal k-medoids
+error      (output) double*
+The sum of distances to the cluster center of each element in the best
 clustering solution that was found.
 
-ifound     (output) int
-If kmedoids is successful: the number of times the optimal clustering solution
-was found. The value of ifound is at least 1; its maximum value is npass.
-If the user requested more clusters than elements available, ifound is set
-to 0. If kmedoids fails due to a memory allocation error, ifound is set to -1.
+ifound     (output) int*
+The number of times the best clustering solution was found, as in kcluster.
+If the number of clusters is larger than the number of elements, *ifound is
+set to 0. If a memory allocation error occurs, or if getrows fails, *ifound is
+set to -1.
+
+callback   (input) ClusterCallback
+If callback is not NULL, it is called after each pass through the data, as
+described for kcluster.
+
+callbackcontext (input) void*
+A pointer that is passed unchanged to the callback.
 
 ========================================================================
 */
-{ int i, j, icluster;
-  int* tclusterid;
+{ int i, j;
+  int ipass;
+  int found = 0;
+  int ok;
+  const int nrun = (npass > 1) ? npass : 1;
+  const int nbuffer = min(nelements, 1024);
+  RandomState state;
+  double** rows;
+  int** rowmask;
+  double** cdata;
+  int** cmask;
+  double** sdata;
+  int** scount;
+  int* index;
+  int* assigned;
+  double* distances;
+  int* counts;
   int* saved;
-  int* centroids;
-  double* errors;
-  int ipass = 0;
+  int* tclusterid;
+  int* mapping = NULL;
+  Monitor monitor;
+  Monitor* pmonitor = callback ? &monitor : NULL;
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int) =
+       setmetric(dist);
 
   if (nelements < nclusters)
   { *ifound = 0;
     return;
-  } /* More clusters asked for than elements available */
+  }
+  /* More clusters asked for than elements available */
 
   *ifound = -1;
 
-  /* We save the clustering solution periodically and check if it reappears */
-  saved = malloc(nelements*sizeof(int));
-  if (saved==NULL) return;
+  if (callback) initmonitor(&monitor, callback, callbackcontext);
+  if (seed==0) seed = randomseed();
 
-  centroids = malloc(nclusters*sizeof(int));
-  if(!centroids)
-  { free(saved);
+  if (!makedatamask(nbuffer, ndata, &rows, &rowmask)) return;
+  if (!makedatamask(nclusters, ndata, &cdata, &cmask))
+  { freedatamask(nbuffer, rows, rowmask);
     return;
   }
-
-  errors = malloc(nclusters*sizeof(double));
-  if(!errors)
-  { free(saved);
-    free(centroids);
+  if (!makedatamask(nclusters, ndata, &sdata, &scount))
+  { freedatamask(nbuffer, rows, rowmask);
+    freedatamask(nclusters, cdata, cmask);
     return;
   }
-
-  /* Find out if the user specified an initial clustering */
-  if (npass<=1) tclusterid = clusterid;
-  else
-  { tclusterid = malloc(nelements*sizeof(int));
-    if(!tclusterid)
-    { free(saved);
-      free(centroids);
-      free(errors);
-      return;
-    }
-  }
+  index = malloc(nbuffer*sizeof(int));
+  assigned = malloc(nbuffer*sizeof(int));
+  distances = malloc(nbuffer*sizeof(double));
+  counts = malloc(nclusters*sizeof(int));
+  saved = malloc(nelements*sizeof(int));
+  tclusterid = (npass > 1) ? malloc(nelements*sizeof(int)) : clusterid;
+  if (npass > 1) mapping = malloc(nclusters*sizeof(int));
+  ok = index && assigned && distances && counts && saved && tclusterid
+    && (npass <= 1 || mapping);
 
   *error = DBL_MAX;
-  do /* Start the loop */
+
+  for (ipass = 0; ipass < nrun && ok; ipass++)
   { double total = DBL_MAX;
-    int counter = 0;
+    int iteration = 0;
     int period = 10;
 
-    if (npass!=0) randomassign (nclusters, nelements, tclusterid);
-    while(1)
-    { double previous = total;
-      total = 0.0;
+    if (pmonitor)
+    { if (pmonitor->stop) break;
+      pmonitor->progress.pass = ipass;
+    }
 
-      if (counter % period == 0) /* Save the current cluster assignments */
-      { for (i = 0; i < nelements; i++) saved[i] = tclusterid[i];
-        if (period < INT_MAX / 2) period *= 2;
-      }
-      counter++;
+    /* Choose the initial clustering */
+    if (npass==0)
+    { if (tclusterid!=clusterid)
+        for (i = 0; i < nelements; i++) tclusterid[i] = clusterid[i];
+    }
+    else
+    { seedstream(&state, seed, ipass);
+      randomassign(nclusters, nelements, tclusterid, &state);
+    }
+    for (i = 0; i < nclusters; i++) counts[i] = 0;
+    for (i = 0; i < nelements; i++) counts[tclusterid[i]]++;
 
-      /* Find the center */
-      getclustermedoids(nclusters, nelements, distmatrix, tclusterid,
-                        centroids, errors);
+    /* The first pass through the data only calculates the cluster centers */
+    while (1)
+    { double previous = total;
+      int nmoved = 0;
+      int start;
+
+      if (iteration > 0)
+      { if ((iteration-1) % period == 0)
+        /* Save the current cluster assignments */
+        { for (i = 0; i < nelements; i++) saved[i] = tclusterid[i];
+          if (period < INT_MAX / 2) period *= 2;
+        }
+        for (j = 0; j < nclusters; j++)
+          getclustermean(ndata, j, sdata, scount, cdata, cmask, 0);
+        total = 0.0;
+      }
+      for (i = 0; i < nclusters; i++)
+      { for (j = 0; j < ndata; j++)
+        { sdata[i][j] = 0.0;
+          scount[i][j] = 0;
+        }
+      }
 
-      for (i = 0; i < nelements; i++)
-      /* Find the closest cluster */
-      { double distance = DBL_MAX;
-        for (icluster = 0; icluster < nclusters; icluster++)
-        { double tdistance;
-          j = centroids[icluster];
-          if (i==j)
-          { distance = 0.0;
-            tclusterid[i] = icluster;
-            break;
+      for (start = 0; start < nelements; start += nbuffer)
+      { const int n = min(nbuffer, nelements - start);
+        int r;
+        for (r = 0; r < n; r++) index[r] = start + r;
+        if (!getrows(context, n, index, rows, rowmask))
+        { ok = 0;
+          break;
+        }
+        if (iteration > 0)
+        { /* Find the closest cluster center in parallel, then move the
+           * elements in order, as in kmeans */
+          #pragma omp parallel for if (n*nclusters > 10000) private(j)
+          for (r = 0; r < n; r++)
+          { const int k = tclusterid[start+r];
+            double distance = metric(ndata, rows, cdata, rowmask, cmask,
+                                     weight, r, k, 0);
+            assigned[r] = k;
+            for (j = 0; j < nclusters; j++)
+            { double tdistance;
+              if (j==k) continue;
+              tdistance = metric(ndata, rows, cdata, rowmask, cmask, weight,
+                                 r, j, 0);
+              if (tdistance < distance)
+              { distance = tdistance;
+                assigned[r] = j;
+              }
+            }
+            distances[r] = distance;
           }
-          tdistance = (i > j) ? distmatrix[i][j] : distmatrix[j][i];
-          if (tdistance < distance)
-          { distance = tdistance;
-            tclusterid[i] = icluster;
+          for (r = 0; r < n; r++)
+          { const int k = tclusterid[start+r];
+            /* No reassignment if that would lead to an empty cluster */
+            if (counts[k]==1) continue;
+            if (assigned[r]!=k)
+            { counts[k]--;
+              tclusterid[start+r] = assigned[r];
+              counts[assigned[r]]++;
+              nmoved++;
+            }
+            total += distances[r];
+          }
+        }
+        /* Add the elements to the sums of their clusters */
+        for (r = 0; r < n; r++)
+        { const int k = tclusterid[start+r];
+          for (j = 0; j < ndata; j++)
+          { if (rowmask[r][j])
+            { sdata[k][j] += rows[r][j];
+              scount[k][j]++;
+            }
           }
         }
-        total += distance;
       }
+      if (!ok) break;
+
+      iteration++;
+      if (iteration==1) continue;
+      if (report(pmonitor, iteration-1, total, nmoved)) break;
       if (total>=previous) break;
       /* total>=previous is FALSE on some machines even if total and previous
        * are bitwise identical. */
@@ -2874,76 +4436,261 @@ to 0. If kmedoids fails due to a memory allocation error, ifound is set to -1.
       if (i==nelements)
         break; /* Identical solution found; break out of this loop */
     }
+    if (!ok) break;
 
+    if (npass <= 1)
+    { found = 1;
+      *error = total;
+      break;
+    }
+    if (found==0)
+    { found = 1;
+      *error = total;
+      for (i = 0; i < nelements; i++) clusterid[i] = tclusterid[i];
+      continue;
+    }
+    for (i = 0; i < nclusters; i++) mapping[i] = -1;
     for (i = 0; i < nelements; i++)
-    { if (clusterid[i]!=centroids[tclusterid[i]])
+    { const int jj = tclusterid[i];
+      const int k = clusterid[i];
+      if (mapping[k] == -1) mapping[k] = jj;
+      else if (mapping[k] != jj)
       { if (total < *error)
-        { *ifound = 1;
+        { found = 1;
           *error = total;
-          /* Replace by the centroid in each cluster. */
-          for (j = 0; j < nelements; j++)
-            clusterid[j] = centroids[tclusterid[j]];
+          for (j = 0; j < nelements; j++) clusterid[j] = tclusterid[j];
         }
         break;
       }
     }
-    if (i==nelements) (*ifound)++; /* break statement not encountered */
-  } while (++ipass < npass);
+    if (i==nelements) found++; /* break statement not encountered */
+  }
 
-  /* Deallocate temporarily used space */
-  if (npass > 1) free(tclusterid);
+  freedatamask(nbuffer, rows, rowmask);
+  freedatamask(nclusters, cdata, cmask);
+  freedatamask(nclusters, sdata, scount);
+  if (index) free(index);
+  if (assigned) free(assigned);
+  if (distances) free(distances);
+  if (counts) free(counts);
+  if (saved) free(saved);
+  if (npass > 1 && tclusterid) free(tclusterid);
+  if (mapping) free(mapping);
+  if (ok) *ifound = found;
+}
 
-  free(saved);
-  free(centroids);
-  free(errors);
+/* ********************************************************************* */
 
-  return;
-}
+static int
+kclusterpasses(int nclusters, int nrows, int ncolumns, double** data,
+  int** mask, double weight[], int transpose, int npass, char method,
+  char dist, char init, unsigned long seed, unsigned long stream,
+  double** unit, int clusterid[], double* error, Monitor* monitor)
+/* Performs the passes of kcluster, and returns the number of times the best
+ * solution was found, or -1 if a memory allocation error occurs. Pass ipass
+ * draws its random numbers from stream number stream+ipass for the seed. For
+ * method=='s', unit contains the rows returned by normalizerows. */
+{ const int nelements = (transpose==0) ? nrows : ncolumns;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  const int nrun = (npass > 1) ? npass : 1;
+  int i;
+  int ipass;
+  int ok = 1;
+  int found = 0;
+  int* mapping = NULL;
 
-/* ******************************************************************** */
+  /* This will be used to compare the solutions found in different passes */
+  if (npass > 1)
+  { mapping = malloc(nclusters*sizeof(int));
+    if (!mapping) return -1;
+  }
 
-double** distancematrix (int nrows, int ncolumns, double** data,
-  int** mask, double weights[], char dist, int transpose)
-/*
-Purpose
-=======
+  *error = DBL_MAX;
 
-The distancematrix routine calculates the distance matrix between genes or
-microarrays using their measured gene expression data. Several distance measures
-can be used. The routine returns a pointer to a ragged array containing the
-distances between the genes. As the distance matrix is symmetric, with zeros on
-the diagonal, only the lower triangular half of the distance matrix is saved.
-The distancematrix routine allocates space for the distance matrix. If the
-parameter transpose is set to a nonzero value, the distances between the columns
-(microarrays) are calculated, otherwise distances between the rows (genes) are
-calculated.
-If sufficient space in memory cannot be allocated to store the distance matrix,
-the routine returns a NULL pointer, and all memory allocated so far for the
-distance matrix is freed.
+  /* The passes are independent of each other. Each thread allocates its own
+   * workspace; the solutions are compared in the order of the passes, so the
+   * result does not depend on the number of threads. The callback is called
+   * from one thread only. */
+  #pragma omp parallel if (npass > 1 && !monitor) private(i)
+  { double** cdata = NULL;
+    int** cmask = NULL;
+    int* tclusterid = malloc(nelements*sizeof(int));
+    int* counts = malloc(nclusters*sizeof(int));
+    int* saved = malloc(nelements*sizeof(int));
+    int* assigned = malloc(nelements*sizeof(int));
+    double* distances = malloc(nelements*sizeof(double));
+    double* cache = (method=='m') ? malloc(nelements*sizeof(double)) : NULL;
+    int* sign = (method=='s') ? malloc(nelements*sizeof(int)) : NULL;
+    int tok = tclusterid && counts && saved && assigned && distances
+           && (method!='m' || cache) && (method!='s' || sign);
+    /* Allocate space to store the centroid data. The centers of spherical
+     * k-means are stored as rows. */
+    if (tok)
+    { if (transpose==0 || method=='s')
+        tok = makedatamask(nclusters, ndata, &cdata, &cmask);
+      else tok = makedatamask(ndata, nclusters, &cdata, &cmask);
+    }
+    if (!tok)
+    {
+      #pragma omp atomic write
+      ok = 0;
+    }
+
+    #pragma omp for ordered schedule(static, 1)
+    for (ipass = 0; ipass < nrun; ipass++)
+    { double total = DBL_MAX;
+      int done = 0;
+      if (tok && !(monitor && monitor->stop))
+      { /* Perform the EM algorithm. First, assign elements to clusters.
+         * Each pass draws its random initial clustering from its own stream
+         * of random numbers, so that the passes can run in parallel. */
+        RandomState state;
+        seedstream(&state, seed, stream+ipass);
+        if (monitor) monitor->progress.pass = ipass;
+        if (npass==0)
+        { for (i = 0; i < nelements; i++) tclusterid[i] = clusterid[i];
+          done = 1;
+        }
+        else if (init=='k' || init=='p')
+          done = seedclusters(nclusters, nrows, ncolumns, data, mask, weight,
+                              transpose, dist, init, tclusterid, &state);
+        else
+        { randomassign(nclusters, nelements, tclusterid, &state);
+          done = 1;
+        }
+        if (!done)
+        {
+          #pragma omp atomic write
+          ok = 0;
+        }
+      }
+      if (done)
+      { if (method=='s')
+          total = sphericalkmeans(nclusters, nelements, ndata, unit, dist=='x',
+                                  cdata, tclusterid, counts, saved, assigned,
+                                  distances, sign, monitor);
+        else if (method=='m')
+          total = kmedians(nclusters, nrows, ncolumns, data, mask, weight,
+                           transpose, dist, cdata, cmask, tclusterid, counts,
+                           saved, assigned, distances, cache, monitor);
+        else
+          total = kmeans(nclusters, nrows, ncolumns, data, mask, weight,
+                         transpose, dist, cdata, cmask, tclusterid, counts,
+                         saved, assigned, distances, monitor);
+      }
+      #pragma omp ordered
+      if (done)
+      { if (found==0)
+        { found = 1;
+          *error = total;
+          for (i = 0; i < nelements; i++) clusterid[i] = tclusterid[i];
+        }
+        else
+        { for (i = 0; i < nclusters; i++) mapping[i] = -1;
+          for (i = 0; i < nelements; i++)
+          { const int j = tclusterid[i];
+            const int k = clusterid[i];
+            if (mapping[k] == -1) mapping[k] = j;
+            else if (mapping[k] != j)
+            { if (total < *error)
+              { int m;
+                found = 1;
+                *error = total;
+                for (m = 0; m < nelements; m++) clusterid[m] = tclusterid[m];
+              }
+              break;
+            }
+          }
+          if (i==nelements) found++; /* break statement not encountered */
+        }
+      }
+    }
+
+    /* Deallocate temporarily used space */
+    if (cdata)
+    { if (transpose==0 || method=='s') freedatamask(nclusters, cdata, cmask);
+      else freedatamask(ndata, cdata, cmask);
+    }
+    if (tclusterid) free(tclusterid);
+    if (counts) free(counts);
+    if (saved) free(saved);
+    if (assigned) free(assigned);
+    if (distances) free(distances);
+    if (cache) free(cache);
+    if (sign) free(sign);
+  }
+
+  if (mapping) free(mapping);
+  if (!ok) return -1;
+  return found;
+}
+
+/* ********************************************************************* */
+
+void kcluster (int nclusters, int nrows, int ncolumns,
+  double** data, int** mask, double weight[], int transpose,
+  int npass, char method, char dist, char init, unsigned long seed,
+  int clusterid[], double* error, int* ifound,
+  ClusterCallback callback, void* context)
+/*
+Purpose
+=======
+
+The kcluster routine performs k-means or k-median clustering on a given set of
+elements, using the specified distance measure. The number of clusters is given
+by the user. Multiple passes are being made to find the optimal clustering
+solution, each time starting from a different initial clustering.
 
 
 Arguments
 =========
 
-nrows      (input) int
-The number of rows in the gene expression data matrix (i.e., the number of
-genes)
-
-ncolumns   (input) int
-The number of columns in the gene expression data matrix (i.e., the number of
-microarrays)
+nclusters  (input) int
+The number of clusters to be found.
 
 data       (input) double[nrows][ncolumns]
-The array containing the gene expression data.
+The array containing the data of the elements to be clustered (i.e., the gene
+expression data).
 
 mask       (input) int[nrows][ncolumns]
-This array shows which data values are missing. If mask[i][j]==0, then
-data[i][j] is missing.
+This array shows which data values are missing. If
+mask[i][j] == 0, then data[i][j] is missing.
+
+nrows     (input) int
+The number of rows in the data matrix, equal to the number of genes.
+
+ncolumns  (input) int
+The number of columns in the data matrix, equal to the number of microarrays.
 
 weight (input) double[n]
-The weights that are used to calculate the distance. The length of this vector
-is equal to the number of columns if the distances between genes are calculated,
-or the number of rows if the distances between microarrays are calculated.
+The weights that are used to calculate the distance.
+
+transpose  (input) int
+If transpose==0, the rows of the matrix are clustered. Otherwise, columns
+of the matrix are clustered.
+
+npass      (input) int
+The number of times clustering is performed. Clustering is performed npass
+times, each time starting from a different (random) initial assignment of 
+genes to clusters. The clustering solution with the lowest within-cluster sum
+of distances is chosen.
+If npass==0, then the clustering algorithm will be run once, where the initial
+assignment of elements to clusters is taken from the clusterid array.
+If the library was compiled with OpenMP, the passes are run in parallel; with
+a single pass, or if a callback is given, the elements are assigned to clusters
+in parallel instead. The result does not depend on the number of threads.
+
+method     (input) char
+Defines whether the arithmetic mean (method=='a') or the median
+(method=='m') is used to calculate the cluster center. If method=='b',
+mini-batch k-means is used, with the default batch size and number of
+iterations; see minibatchkcluster. In that case init is ignored.
+If method=='s', spherical k-means is used for the uncentered correlation
+(dist=='u') or its absolute value (dist=='x'). The elements are scaled to unit
+length once, with missing values set to zero, and the cluster center is the
+normalized sum of the elements in the cluster. Elements are then assigned to
+clusters by a single dot product with each center. For other distance
+measures, or if any weight is negative, method=='a' is used instead.
 
 dist       (input) char
 Defines which distance measure is used, as given by the table:
@@ -2957,261 +4704,2405 @@ dist=='s': Spearman's rank correlation
 dist=='k': Kendall's tau
 For other values of dist, the default (Euclidean distance) is used.
 
-transpose  (input) int
-If transpose is equal to zero, the distances between the rows is
-calculated. Otherwise, the distances between the columns is calculated.
-The former is needed when genes are being clustered; the latter is used
-when microarrays are being clustered.
+init       (input) char
+Defines how the initial clustering of each pass is chosen:
+init=='r': Elements are assigned to clusters at random
+init=='k': k-means++ seeding; the cluster centers are chosen among the elements
+           such that they are likely to be far apart
+init=='p': k-means|| seeding; similar to k-means++, but requiring only a few
+           passes through the data, which are run in parallel
+For other values of init, elements are assigned to clusters at random. If
+npass==0, init is ignored. See seedclusters for details.
+
+seed       (input) unsigned long
+The seed of the random number generator. Each pass draws its random numbers
+from its own stream for this seed, so that the result can be reproduced by
+passing the same seed. If seed==0, a seed is chosen based on the current time.
+
+clusterid  (output; input) int[nrows] if transpose==0
+                           int[ncolumns] if transpose==1
+The cluster number to which a gene or microarray was assigned. If npass==0,
+then on input clusterid contains the initial clustering assignment from which
+the clustering algorithm starts. On output, it contains the clustering solution
+that was found.
+
+error      (output) double*
+The sum of distances to the cluster center of each item in the optimal k-means
+clustering solution that was found.
+
+ifound     (output) int*
+The number of times the optimal clustering solution was
+found. The value of ifound is at least 1; its maximum value is npass. If the
+number of clusters is larger than the number of elements being clustered,
+*ifound is set to 0 as an error code. If a memory allocation error occurs,
+*ifound is set to -1.
+
+callback   (input) ClusterCallback
+If callback is not NULL, it is called after each iteration of each pass with
+the current progress, as described for the ClusterProgress struct in
+cluster.h, and with context as its second argument. If the callback returns a
+nonzero value, the current pass is ended with its present solution, and the
+remaining passes are skipped. The solution is then chosen among the passes
+performed so far.
+
+context    (input) void*
+A pointer that is passed unchanged to the callback.
 
 ========================================================================
 */
-{ /* First determine the size of the distance matrix */
-  const int n = (transpose==0) ? nrows : ncolumns;
+{ const int nelements = (transpose==0) ? nrows : ncolumns;
   const int ndata = (transpose==0) ? ncolumns : nrows;
-  int i,j;
-  double** matrix;
 
-  /* Set the metric function as indicated by dist */
+  int i;
+  Monitor monitor;
+  Monitor* pmonitor = callback ? &monitor : NULL;
+  double** unit = NULL;
+
+  if (nelements < nclusters)
+  { *ifound = 0;
+    return;
+  }
+  /* More clusters asked for than elements available */
+
+  if (method=='b')
+  { DataSource source;
+    source.data = data;
+    source.mask = mask;
+    source.transpose = transpose;
+    source.ndata = ndata;
+    minibatchkcluster(nclusters, nelements, ndata, getdatarows, &source,
+                      weight, dist, 0, 0, npass, seed, clusterid, error,
+                      ifound, callback, context);
+    return;
+  }
+
+  if (callback) initmonitor(&monitor, callback, context);
+  if (seed==0) seed = randomseed();
+
+  *ifound = -1;
+
+  if (method=='s')
+  { if (dist!='u' && dist!='x') method = 'a';
+    for (i = 0; i < ndata; i++) if (weight[i] < 0) method = 'a';
+  }
+  if (method=='s')
+  { unit = normalizerows(nrows, ncolumns, data, mask, weight, transpose);
+    if (!unit) return;
+  }
+
+  *ifound = kclusterpasses(nclusters, nrows, ncolumns, data, mask, weight,
+                           transpose, npass, method, dist, init, seed, 0, unit,
+                           clusterid, error, pmonitor);
+
+  if (unit)
+  { free(unit[0]);
+    free(unit);
+  }
+}
+
+/* ********************************************************************* */
+
+static int
+splitcluster(int nclusters, int nrows, int ncolumns, double** data,
+  int** mask, double weight[], int transpose, char method, char dist,
+  int clusterid[], double** cdata, int** cmask, double distances[])
+/* Adds cluster number nclusters to the clustering solution in clusterid by
+ * splitting the cluster with the largest sum of distances of its elements to
+ * its center. The element of that cluster farthest from the center starts the
+ * new cluster, and takes the elements of the cluster that are closer to it
+ * than to the center. The centers are the means, or the medians for
+ * method=='m'. The arrays cdata, cmask, and distances are workspace. Returns
+ * 0 if a memory allocation error occurs, and 1 otherwise. */
+{ int i, j;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  int worst = -1;
+  int farthest = -1;
+  int nold = 0;
+  int closest = -1;
+  double largest = -1.0;
   double (*metric)
     (int, double**, double**, int**, int**, const double[], int, int, int) =
        setmetric(dist);
 
-  if (n < 2) return NULL;
+  if (!getclustercentroids(nclusters, nrows, ncolumns, data, mask, clusterid,
+                           cdata, cmask, transpose, method=='m' ? 'm' : 'a'))
+    return 0;
 
-  /* Set up the ragged array */
-  matrix = malloc(n*sizeof(double*));
-  if(matrix==NULL) return NULL; /* Not enough memory available */
-  matrix[0] = NULL;
-  /* The zeroth row has zero columns. We allocate it anyway for convenience.*/
-  for (i = 1; i < n; i++)
-  { matrix[i] = malloc(i*sizeof(double));
-    if (matrix[i]==NULL) break; /* Not enough memory available */
+  #pragma omp parallel for if (nelements*ndata > 100000)
+  for (i = 0; i < nelements; i++)
+    distances[i] = metric(ndata, data, cdata, mask, cmask, weight, i,
+                          clusterid[i], transpose);
+
+  /* Only clusters with at least two elements can be split */
+  { double* cerror = calloc(nclusters, sizeof(double));
+    int* counts = calloc(nclusters, sizeof(int));
+    if (!cerror || !counts)
+    { if (cerror) free(cerror);
+      if (counts) free(counts);
+      return 0;
+    }
+    for (i = 0; i < nelements; i++)
+    { j = clusterid[i];
+      cerror[j] += distances[i];
+      counts[j]++;
+    }
+    for (j = 0; j < nclusters; j++)
+    { if (counts[j] > 1 && cerror[j] > largest)
+      { largest = cerror[j];
+        worst = j;
+      }
+    }
+    free(cerror);
+    free(counts);
   }
-  if (i < n) /* break condition encountered */
-  { j = i;
-    for (i = 1; i < j; i++) free(matrix[i]);
-    return NULL;
+  if (worst < 0) return 1; /* Not reached if nclusters < nelements */
+
+  largest = -1.0;
+  for (i = 0; i < nelements; i++)
+  { if (clusterid[i]==worst && distances[i] > largest)
+    { largest = distances[i];
+      farthest = i;
+    }
+  }
+  for (i = 0; i < nelements; i++)
+  { if (clusterid[i]!=worst) continue;
+    if (i==farthest ||
+        metric(ndata, data, data, mask, mask, weight, i, farthest, transpose)
+          < distances[i])
+      clusterid[i] = nclusters;
+    else nold++;
+  }
+  /* Keep the element closest to the center in the old cluster if all
+   * elements moved */
+  if (nold==0)
+  { largest = DBL_MAX;
+    for (i = 0; i < nelements; i++)
+    { if (clusterid[i]==nclusters && i!=farthest && distances[i] < largest)
+      { largest = distances[i];
+        closest = i;
+      }
+    }
+    clusterid[closest] = worst;
   }
+  return 1;
+}
 
-  /* Calculate the distances and save them in the ragged array */
-  for (i = 1; i < n; i++)
-    for (j = 0; j < i; j++)
-      matrix[i][j]=metric(ndata,data,data,mask,mask,weights,i,j,transpose);
+/* ---------------------------------------------------------------------- */
 
-  return matrix;
+static double
+sumofsquares(int nclusters, int nrows, int ncolumns, double** data,
+  int** mask, double weight[], int transpose, int clusterid[],
+  double** cdata, int** cmask)
+/* Returns the weighted sum of the squared Euclidean distances of the elements
+ * to the mean of their cluster, skipping missing values. The arrays cdata and
+ * cmask are workspace. */
+{ int i, j;
+  double result = 0.0;
+  getclustermeans(nclusters, nrows, ncolumns, data, mask, clusterid,
+                  cdata, cmask, transpose);
+  if (transpose==0)
+  { for (i = 0; i < nrows; i++)
+    { const int k = clusterid[i];
+      for (j = 0; j < ncolumns; j++)
+      { if (mask[i][j] && cmask[k][j])
+        { const double term = data[i][j] - cdata[k][j];
+          result += weight[j]*term*term;
+        }
+      }
+    }
+  }
+  else
+  { for (i = 0; i < nrows; i++)
+    { for (j = 0; j < ncolumns; j++)
+      { const int k = clusterid[j];
+        if (mask[i][j] && cmask[i][k])
+        { const double term = data[i][j] - cdata[i][k];
+          result += weight[i]*term*term;
+        }
+      }
+    }
+  }
+  return result;
 }
 
-/* ******************************************************************** */
-
-double* calculate_weights(int nrows, int ncolumns, double** data, int** mask,
-  double weights[], int transpose, char dist, double cutoff, double exponent)
+/* ---------------------------------------------------------------------- */
 
+int kclustersweep (int kmin, int kmax, int nrows, int ncolumns,
+  double** data, int** mask, double weight[], int transpose, int npass,
+  char method, char dist, char init, unsigned long seed, int** clusterid,
+  double error[], double score[])
 /*
 Purpose
 =======
 
-This function calculates the weights using the weighting scheme proposed by
-Michael Eisen:
-w[i] = 1.0 / sum_{j where d[i][j]<cutoff} (1 - d[i][j]/cutoff)^exponent
-where the cutoff and the exponent are specified by the user.
-
+The kclustersweep routine performs k-means or k-medians clustering for each
+number of clusters k from kmin to kmax, as if kcluster were called for each k,
+to help choosing the number of clusters. The workspace, the total sum of
+squares, and for spherical k-means the rows scaled to unit length, are shared
+between the values of k. In addition to the passes from a random initial
+clustering, the solution for k clusters is refined starting from the solution
+found for k-1 clusters, in which the cluster with the largest sum of distances
+to its center is split in two (see splitcluster). The best solution found for
+each k is returned, with its within-cluster sum of distances and optionally
+the Calinski-Harabasz score.
 
 Arguments
 =========
 
-nrows      (input) int
-The number of rows in the gene expression data matrix, equal to the number of
-genes.
+kmin       (input) int
+The smallest number of clusters; kmin should be at least 1.
 
-ncolumns   (input) int
-The number of columns in the gene expression data matrix, equal to the number of
-microarrays.
+kmax       (input) int
+The largest number of clusters; kmax should be at least kmin, and not larger
+than the number of elements.
 
-data       (input) double[nrows][ncolumns]
-The array containing the gene expression data.
+nrows, ncolumns, data, mask, weight, transpose
+As in kcluster.
 
-mask       (input) int[nrows][ncolumns]
-This array shows which data values are missing. If mask[i][j]==0, then
-data[i][j] is missing.
+npass      (input) int
+The number of passes from a random initial clustering for each k. For k > kmin,
+the solution started from the split solution for k-1 clusters is used as well.
+If npass==0, a single random pass is performed for kmin, and the split
+solution is used for the other values of k.
 
-weight     (input) int[ncolumns] if transpose==0,
-                   int[nrows]    if transpose==1
-The weights that are used to calculate the distance. The length of this vector
-is ncolumns if gene weights are being clustered, and nrows if microarrays
-weights are being clustered.
+method     (input) char
+As in kcluster; method=='b' is not supported, and method=='a' is used instead.
 
-transpose (input) int
-If transpose==0, the weights of the rows of the data matrix are calculated.
-Otherwise, the weights of the columns of the data matrix are calculated.
+dist, init (input) char
+As in kcluster.
 
-dist      (input) char
-Defines which distance measure is used, as given by the table:
-dist=='e': Euclidean distance
-dist=='b': City-block distance
-dist=='c': correlation
-dist=='a': absolute value of the correlation
-dist=='u': uncentered correlation
-dist=='x': absolute uncentered correlation
-dist=='s': Spearman's rank correlation
-dist=='k': Kendall's tau
-For other values of dist, the default (Euclidean distance) is used.
+seed       (input) unsigned long
+The seed of the random number generator, as in kcluster. The passes for the
+different values of k draw from different streams of random numbers.
 
-cutoff    (input) double
-The cutoff to be used to calculate the weights.
+clusterid  (output) int[kmax-kmin+1][nelements]
+The cluster number of each element in the best solution found for each k,
+where clusterid[0] corresponds to kmin.
 
-exponent  (input) double
-The exponent to be used to calculate the weights.
+error      (output) double[kmax-kmin+1]
+The within-cluster sum of distances of the best solution for each k.
 
+score      (output) double[kmax-kmin+1]
+The Calinski-Harabasz score of the best solution for each k, calculated from
+the weighted squared Euclidean distances to the cluster means:
+(B/(k-1)) / (W/(n-k)), where W is the within-cluster sum of squares, B is the
+total sum of squares minus W, and n is the number of elements. Larger scores
+indicate a better separation between the clusters. The score is 0 for k==1,
+and DBL_MAX if W==0. If score is NULL, the scores are not calculated.
 
 Return value
 ============
 
-The function returns a pointer to a newly allocated array containing the
-calculated weights for the rows (if transpose==0) or columns (if
-transpose==1). If not enough memory could be allocated to store the
-weights array, the function returns NULL.
-
+1 if successful, and 0 if the arguments are invalid or if a memory error
+occurs.
 ========================================================================
 */
-{ int i,j;
-  const int ndata = (transpose==0) ? ncolumns : nrows;
+{ int i, k;
   const int nelements = (transpose==0) ? nrows : ncolumns;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  const int nrun = (npass > 0) ? npass : 1;
+  int ok = 1;
+  double total = 0.0;
+  double** unit = NULL;
+  double** cdata = NULL;
+  int** cmask = NULL;
+  double* distances;
+  int* tclusterid;
 
-  /* Set the metric function as indicated by dist */
-  double (*metric)
-    (int, double**, double**, int**, int**, const double[], int, int, int) =
-       setmetric(dist);
+  if (kmin < 1 || kmax < kmin || nelements < kmax) return 0;
+  if (seed==0) seed = randomseed();
+  if (method!='m' && method!='s') method = 'a';
+  if (method=='s')
+  { if (dist!='u' && dist!='x') method = 'a';
+    for (i = 0; i < ndata; i++) if (weight[i] < 0) method = 'a';
+  }
+  if (method=='s')
+  { unit = normalizerows(nrows, ncolumns, data, mask, weight, transpose);
+    if (!unit) return 0;
+  }
+
+  if (transpose==0) ok = makedatamask(kmax, ndata, &cdata, &cmask);
+  else ok = makedatamask(ndata, kmax, &cdata, &cmask);
+  distances = malloc(nelements*sizeof(double));
+  tclusterid = malloc(nelements*sizeof(int));
+  ok = ok && distances && tclusterid;
+
+  /* The total sum of squares is the sum of squares with a single cluster */
+  if (ok && score)
+  { for (i = 0; i < nelements; i++) tclusterid[i] = 0;
+    total = sumofsquares(1, nrows, ncolumns, data, mask, weight, transpose,
+                         tclusterid, cdata, cmask);
+  }
+
+  for (k = kmin; k <= kmax && ok; k++)
+  { const int m = k - kmin;
+    int found;
+    error[m] = DBL_MAX;
+    if (k==kmin || npass > 0)
+    { found = kclusterpasses(k, nrows, ncolumns, data, mask, weight,
+                             transpose, nrun, method, dist, init, seed,
+                             (unsigned long)m*nrun, unit, clusterid[m],
+                             &error[m], NULL);
+      if (found < 0)
+      { ok = 0;
+        break;
+      }
+    }
+    if (k > kmin)
+    /* Refine the solution for k-1 clusters with its worst cluster split */
+    { double terror;
+      for (i = 0; i < nelements; i++) tclusterid[i] = clusterid[m-1][i];
+      if (!splitcluster(k-1, nrows, ncolumns, data, mask, weight, transpose,
+                        method, dist, tclusterid, cdata, cmask, distances))
+      { ok = 0;
+        break;
+      }
+      found = kclusterpasses(k, nrows, ncolumns, data, mask, weight,
+                             transpose, 0, method, dist, init, seed, 0, unit,
+                             tclusterid, &terror, NULL);
+      if (found < 0)
+      { ok = 0;
+        break;
+      }
+      if (terror < error[m])
+      { error[m] = terror;
+        for (i = 0; i < nelements; i++) clusterid[m][i] = tclusterid[i];
+      }
+    }
+    if (score)
+    { double within;
+      if (k==1) score[m] = 0.0;
+      else
+      { within = sumofsquares(k, nrows, ncolumns, data, mask, weight,
+                              transpose, clusterid[m], cdata, cmask);
+        if (within > 0)
+          score[m] = ((total-within)/(k-1)) / (within/(nelements-k));
+        else score[m] = DBL_MAX;
+      }
+    }
+  }
+
+  if (cdata)
+  { if (transpose==0) freedatamask(kmax, cdata, cmask);
+    else freedatamask(ndata, cdata, cmask);
+  }
+  if (distances) free(distances);
+  if (tclusterid) free(tclusterid);
+  if (unit)
+  { free(unit[0]);
+    free(unit);
+  }
+  return ok;
+}
+
+/* *********************************************************************** */
+
+static double
+kmedoidspass(int nclusters, int nelements, double** distmatrix,
+  int clusterid[], int centroids[], double errors[], int saved[],
+  Monitor* monitor)
+/* Performs a single pass of the k-medoids algorithm, starting from the cluster
+ * assignments in clusterid, and returns the within-cluster sum of distances.
+ * On exit, centroids contains the medoid of each cluster. The arrays errors
+ * and saved are workspace. The progress is reported after each iteration if
+ * monitor is not NULL. */
+{ int i, j, icluster;
+  double total = DBL_MAX;
+  int counter = 0;
+  int period = 10;
+  int nmoved;
+
+  while(1)
+  { double previous = total;
+    total = 0.0;
+
+    if (counter % period == 0) /* Save the current cluster assignments */
+    { for (i = 0; i < nelements; i++) saved[i] = clusterid[i];
+      if (period < INT_MAX / 2) period *= 2;
+    }
+    counter++;
+
+    /* Find the center */
+    getclustermedoids(nclusters, nelements, distmatrix, clusterid,
+                      centroids, errors);
+
+    nmoved = 0;
+    for (i = 0; i < nelements; i++)
+    /* Find the closest cluster */
+    { double distance = DBL_MAX;
+      const int k = clusterid[i];
+      for (icluster = 0; icluster < nclusters; icluster++)
+      { double tdistance;
+        j = centroids[icluster];
+        if (i==j)
+        { distance = 0.0;
+          clusterid[i] = icluster;
+          break;
+        }
+        tdistance = (i > j) ? distmatrix[i][j] : distmatrix[j][i];
+        if (tdistance < distance)
+        { distance = tdistance;
+          clusterid[i] = icluster;
+        }
+      }
+      if (clusterid[i]!=k) nmoved++;
+      total += distance;
+    }
+    if (report(monitor, counter, total, nmoved)) break;
+    if (total>=previous) break;
+    /* total>=previous is FALSE on some machines even if total and previous
+     * are bitwise identical. */
+    for (i = 0; i < nelements; i++)
+      if (saved[i]!=clusterid[i]) break;
+    if (i==nelements)
+      break; /* Identical solution found; break out of this loop */
+  }
+  return total;
+}
+
+/* *********************************************************************** */
+
+void kmedoids (int nclusters, int nelements, double** distmatrix,
+  int npass, unsigned long seed, int clusterid[], double* error, int* ifound,
+  ClusterCallback callback, void* context)
+/*
+Purpose
+=======
+
+The kmedoids routine performs k-medoids clustering on a given set of elements,
+using the distance matrix and the number of clusters passed by the user.
+Multiple passes are being made to find the optimal clustering solution, each
+time starting from a different initial clustering.
+
+
+Arguments
+=========
+
+nclusters  (input) int
+The number of clusters to be found.
+
+nelements  (input) int
+The number of elements to be clustered.
+
+distmatrix (input) double array, ragged
+  (number of rows is nelements, number of columns is equal to the row number)
+The distance matrix. To save space, the distance matrix is given in the
+form of a ragged array. The distance matrix is symmetric and has zeros
+on the diagonal. See distancematrix for a description of the content.
+
+npass      (input) int
+The number of times clustering is performed. Clustering is performed npass
+times, each time starting from a different (random) initial assignment of genes
+to clusters. The clustering solution with the lowest within-cluster sum of
+distances is chosen.
+If npass==0, then the clustering algorithm will be run once, where the initial
+assignment of elements to clusters is taken from the clusterid array.
+As in kcluster, the passes are run in parallel if the library was compiled
+with OpenMP, unless a callback is given.
+
+seed       (input) unsigned long
+The seed of the random number generator, as in kcluster.
+
+clusterid  (output; input) int[nelements]
+On input, if npass==0, then clusterid contains the initial clustering assignment
+from which the clustering algorithm starts; all numbers in clusterid should be
+between zero and nelements-1 inclusive. If npass!=0, clusterid is ignored on
+input.
+On output, clusterid contains the clustering solution that was found: clusterid
+contains the number of the cluster to which each item was assigned. On output,
+the number of a cluster is defined as the item number of the centroid of the
+cluster.
+
+error      (output) double
+The sum of distances to the cluster center of each item in the optimal k-medoids
+clustering solution that was found.
+
+ifound     (output) int
+If kmedoids is successful: the number of times the optimal clustering solution
+was found. The value of ifound is at least 1; its maximum value is npass.
+If the user requested more clusters than elements available, ifound is set
+to 0. If kmedoids fails due to a memory allocation error, ifound is set to -1.
+
+callback   (input) ClusterCallback
+If callback is not NULL, it is called after each iteration of each pass, as
+described for kcluster.
+
+context    (input) void*
+A pointer that is passed unchanged to the callback.
+
+========================================================================
+*/
+{ const int nrun = (npass > 1) ? npass : 1;
+  int i;
+  int ipass;
+  int ok = 1;
+  int found = 0;
+  Monitor monitor;
+  Monitor* pmonitor = callback ? &monitor : NULL;
+
+  if (nelements < nclusters)
+  { *ifound = 0;
+    return;
+  } /* More clusters asked for than elements available */
+
+  *ifound = -1;
+
+  if (callback) initmonitor(&monitor, callback, context);
+  if (seed==0) seed = randomseed();
+
+  *error = DBL_MAX;
+
+  /* As in kcluster, each thread has its own workspace, and the solutions are
+   * compared in the order of the passes. */
+  #pragma omp parallel if (npass > 1 && !callback) private(i)
+  { int* tclusterid = malloc(nelements*sizeof(int));
+    int* saved = malloc(nelements*sizeof(int));
+    int* centroids = malloc(nclusters*sizeof(int));
+    double* errors = malloc(nclusters*sizeof(double));
+    const int tok = tclusterid && saved && centroids && errors;
+    if (!tok)
+    {
+      #pragma omp atomic write
+      ok = 0;
+    }
+
+    #pragma omp for ordered schedule(static, 1)
+    for (ipass = 0; ipass < nrun; ipass++)
+    { double total = DBL_MAX;
+      const int done = tok && !(pmonitor && pmonitor->stop);
+      if (done)
+      { if (pmonitor) pmonitor->progress.pass = ipass;
+        if (npass==0)
+          for (i = 0; i < nelements; i++) tclusterid[i] = clusterid[i];
+        else
+        /* Each pass draws its random initial clustering from its own stream
+         * of random numbers, so that the passes can run in parallel. */
+        { RandomState state;
+          seedstream(&state, seed, ipass);
+          randomassign(nclusters, nelements, tclusterid, &state);
+        }
+        total = kmedoidspass(nclusters, nelements, distmatrix, tclusterid,
+                             centroids, errors, saved, pmonitor);
+      }
+      #pragma omp ordered
+      if (done)
+      { if (found==0)
+        { found = 1;
+          *error = total;
+          /* Replace by the centroid in each cluster. */
+          for (i = 0; i < nelements; i++)
+            clusterid[i] = centroids[tclusterid[i]];
+        }
+        else
+        { for (i = 0; i < nelements; i++)
+          { if (clusterid[i]!=centroids[tclusterid[i]])
+            { if (total < *error)
+              { int j;
+                found = 1;
+                *error = total;
+                for (j = 0; j < nelements; j++)
+                  clusterid[j] = centroids[tclusterid[j]];
+              }
+              break;
+            }
+          }
+          if (i==nelements) found++; /* break statement not encountered */
+        }
+      }
+    }
+
+    /* Deallocate temporarily used space */
+    if (tclusterid) free(tclusterid);
+    if (saved) free(saved);
+    if (centroids) free(centroids);
+    if (errors) free(errors);
+  }
+
+  if (ok) *ifound = found;
+}
+
+/* ******************************************************************** */
+
+static double
+assignmedoids(int nclusters, int nelements, double** distmatrix,
+  const int medoids[], int nearest[], double dnearest[], double dsecond[])
+/* Finds the nearest and the second-nearest medoid of each element, and
+ * returns the sum of the distances of each element to its nearest medoid.
+ * A medoid is always assigned to itself, also if another medoid is at
+ * distance zero. */
+{ int i;
+  double total = 0.0;
+  #pragma omp parallel for if (nelements > 1000)
+  for (i = 0; i < nelements; i++)
+  { int j;
+    dnearest[i] = DBL_MAX;
+    dsecond[i] = DBL_MAX;
+    for (j = 0; j < nclusters; j++)
+    { const int m = medoids[j];
+      const double d = (i > m) ? distmatrix[i][m]
+                     : (i < m) ? distmatrix[m][i] : 0.0;
+      if (d < dnearest[i] || m==i)
+      { dsecond[i] = dnearest[i];
+        dnearest[i] = d;
+        nearest[i] = j;
+      }
+      else if (d < dsecond[i]) dsecond[i] = d;
+    }
+  }
+  for (i = 0; i < nelements; i++) total += dnearest[i];
+  return total;
+}
+
+/* ******************************************************************** */
+
+static void
+pambuild(int nclusters, int nelements, double** distmatrix, int medoids[],
+  double dnearest[], double gain[])
+/* Performs the BUILD phase of PAM, choosing the medoids one by one. The array
+ * gain is workspace. On exit, dnearest contains the distance of each element
+ * to its nearest medoid. */
+{ int k, c;
+
+  /* The first medoid is the element with the smallest sum of distances to all
+   * other elements; its sum is stored as a negative gain. */
+  #pragma omp parallel for if (nelements > 1000) schedule(dynamic, 16)
+  for (c = 0; c < nelements; c++)
+  { int i;
+    double sum = 0.0;
+    for (i = 0; i < c; i++) sum += distmatrix[c][i];
+    for (i = c+1; i < nelements; i++) sum += distmatrix[i][c];
+    gain[c] = -sum;
+  }
+
+  for (k = 0; k < nclusters; k++)
+  { int best = -1;
+    if (k > 0)
+    /* The next medoid is the element that decreases the sum of distances the
+     * most. Elements that are medoids already get a gain of -1, as any other
+     * element has a gain of at least 0. */
+    {
+      #pragma omp parallel for if (nelements > 1000) schedule(dynamic, 16)
+      for (c = 0; c < nelements; c++)
+      { int i, j;
+        double sum = 0.0;
+        for (j = 0; j < k; j++) if (medoids[j]==c) break;
+        if (j < k)
+        { gain[c] = -1.0;
+          continue;
+        }
+        for (i = 0; i < nelements; i++)
+        { const double d = (i > c) ? distmatrix[i][c]
+                         : (i < c) ? distmatrix[c][i] : 0.0;
+          if (d < dnearest[i]) sum += dnearest[i] - d;
+        }
+        gain[c] = sum;
+      }
+    }
+    for (c = 0; c < nelements; c++)
+      if (best < 0 || gain[c] > gain[best]) best = c;
+    medoids[k] = best;
+    for (c = 0; c < nelements; c++)
+    { const double d = (c > best) ? distmatrix[c][best]
+                     : (c < best) ? distmatrix[best][c] : 0.0;
+      if (k==0 || d < dnearest[c]) dnearest[c] = d;
+    }
+  }
+}
+
+/* ******************************************************************** */
+
+static int
+pamswap(int nclusters, int nelements, double** distmatrix, int medoids[],
+  int nearest[], double dnearest[], double dsecond[], double* total,
+  int saved[], double change[], double removal[], Monitor* monitor)
+/* Performs the SWAP phase of PAM, starting from the medoids found by
+ * pambuild, with nearest, dnearest, and dsecond as calculated by
+ * assignmedoids. The sum of distances is updated in total. The arrays saved,
+ * change, and removal are workspace. Returns 1 if successful, and 0 if a
+ * memory error occurs. */
+{ int i, j, c;
+  int ok = 1;
+  int iteration = 0;
+
+  while (1)
+  { const double previous = *total;
+    int best = -1;
+    int old;
+    int nmoved = 0;
+
+    /* The loss in removing each medoid, if the elements assigned to it move
+     * to their second-nearest medoid. */
+    for (j = 0; j < nclusters; j++) removal[j] = 0.0;
+    for (i = 0; i < nelements; i++)
+      removal[nearest[i]] += dsecond[i] - dnearest[i];
+
+    /* For each non-medoid, find the change in the sum of distances for
+     * swapping it with each of the medoids together; the best medoid to swap
+     * with is stored in saved. */
+    #pragma omp parallel if (nelements > 1000) private(i, j)
+    { double* delta = malloc(nclusters*sizeof(double));
+      if (!delta)
+      {
+        #pragma omp atomic write
+        ok = 0;
+      }
+
+      #pragma omp for schedule(dynamic, 16)
+      for (c = 0; c < nelements; c++)
+      { double shared = 0.0;
+        saved[c] = -1;
+        if (!delta || medoids[nearest[c]]==c) continue;
+        for (j = 0; j < nclusters; j++) delta[j] = removal[j];
+        for (i = 0; i < nelements; i++)
+        { const double d = (i > c) ? distmatrix[i][c]
+                         : (i < c) ? distmatrix[c][i] : 0.0;
+          if (d < dnearest[i])
+          /* Element i moves to c, whichever medoid is removed */
+          { shared += d - dnearest[i];
+            delta[nearest[i]] += dnearest[i] - dsecond[i];
+          }
+          else if (d < dsecond[i])
+          /* Element i moves to c if its nearest medoid is removed */
+            delta[nearest[i]] += d - dsecond[i];
+        }
+        saved[c] = 0;
+        for (j = 1; j < nclusters; j++)
+          if (delta[j] < delta[saved[c]]) saved[c] = j;
+        change[c] = shared + delta[saved[c]];
+      }
+
+      if (delta) free(delta);
+    }
+    if (!ok) break;
+
+    for (c = 0; c < nelements; c++)
+    { if (saved[c] < 0 || change[c] >= 0) continue;
+      if (best < 0 || change[c] < change[best]) best = c;
+    }
+    if (best < 0) break; /* No swap improves the solution */
+
+    j = saved[best];
+    for (i = 0; i < nelements; i++) saved[i] = medoids[nearest[i]];
+    old = medoids[j];
+    medoids[j] = best;
+    *total = assignmedoids(nclusters, nelements, distmatrix, medoids, nearest,
+                           dnearest, dsecond);
+    if (!(*total < previous))
+    /* The improvement was lost to rounding errors */
+    { medoids[j] = old;
+      *total = assignmedoids(nclusters, nelements, distmatrix, medoids,
+                             nearest, dnearest, dsecond);
+      break;
+    }
+    iteration++;
+    for (i = 0; i < nelements; i++)
+      if (medoids[nearest[i]]!=saved[i]) nmoved++;
+    if (report(monitor, iteration, *total, nmoved)) break;
+  }
+  return ok;
+}
+
+/* ******************************************************************** */
+
+int pam (int nclusters, int nelements, double** distmatrix, int clusterid[],
+  double* error, ClusterCallback callback, void* context)
+/*
+Purpose
+=======
+
+The pam routine performs k-medoids clustering using the Partitioning Around
+Medoids algorithm (Kaufman and Rousseeuw, Finding Groups in Data, 1990). In
+the BUILD phase, the medoids are chosen one by one, each time taking the
+element that decreases the sum of distances the most. In the SWAP phase, the
+swap of a medoid and a non-medoid that decreases the sum of distances the most
+is carried out, until no swap improves the solution. Each non-medoid is
+evaluated against all medoids together in a single loop over the elements, by
+keeping the distances to the nearest and second-nearest medoid of each element
+(FastPAM1; Schubert and Rousseeuw, Information Systems 101, 101804 (2021)).
+This gives the same result as the original PAM algorithm in O(nclusters)
+times less time.
+
+Unlike kmedoids, pam does not depend on a random initial clustering, and
+usually finds a better solution than kmedoids does in a single pass. The
+elements are divided over the threads if the library was compiled with
+OpenMP; the result does not depend on the number of threads.
+
+Arguments
+=========
+
+nclusters  (input) int
+The number of clusters to be found.
+
+nelements  (input) int
+The number of elements to be clustered.
+
+distmatrix (input) double array, ragged
+  (number of rows is nelements, number of columns is equal to the row number)
+The distance matrix. To save space, the distance matrix is given in the
+form of a ragged array. The distance matrix is symmetric and has zeros
+on the diagonal. See distancematrix for a description of the content.
+
+clusterid  (output) int[nelements]
+As in kmedoids, the number of a cluster is defined as the item number of the
+medoid of the cluster.
+
+error      (output) double
+The sum of distances of each item to the medoid of its cluster.
+
+callback   (input) ClusterCallback
+If callback is not NULL, it is called after each swap, as described for
+kcluster. The number of elements that changed cluster is counted by their
+medoid.
+
+context    (input) void*
+A pointer that is passed unchanged to the callback.
+
+Return value
+============
+
+1 if successful, and 0 if nclusters is not between 1 and nelements or if a
+memory error occurs.
+========================================================================
+*/
+{ int i;
+  int ok = 0;
+  double total;
+  Monitor monitor;
+  Monitor* pmonitor = callback ? &monitor : NULL;
+  int* medoids;
+  int* nearest;
+  int* saved;
+  double* dnearest;
+  double* dsecond;
+  double* change;
+  double* removal;
+
+  if (nclusters < 1 || nelements < nclusters) return 0;
+
+  medoids = malloc(nclusters*sizeof(int));
+  nearest = malloc(nelements*sizeof(int));
+  saved = malloc(nelements*sizeof(int));
+  dnearest = malloc(nelements*sizeof(double));
+  dsecond = malloc(nelements*sizeof(double));
+  change = malloc(nelements*sizeof(double));
+  removal = malloc(nclusters*sizeof(double));
+
+  if (medoids && nearest && saved && dnearest && dsecond && change && removal)
+  { if (callback) initmonitor(&monitor, callback, context);
+    pambuild(nclusters, nelements, distmatrix, medoids, dnearest, change);
+    total = assignmedoids(nclusters, nelements, distmatrix, medoids, nearest,
+                          dnearest, dsecond);
+    /* With a single cluster, the medoid found by BUILD is optimal. */
+    if (nclusters==1) ok = 1;
+    else ok = pamswap(nclusters, nelements, distmatrix, medoids, nearest,
+                      dnearest, dsecond, &total, saved, change, removal,
+                      pmonitor);
+  }
+  if (ok)
+  { for (i = 0; i < nelements; i++) clusterid[i] = medoids[nearest[i]];
+    *error = total;
+  }
+
+  /* Deallocate temporarily used space */
+  if (medoids) free(medoids);
+  if (nearest) free(nearest);
+  if (saved) free(saved);
+  if (dnearest) free(dnearest);
+  if (dsecond) free(dsecond);
+  if (change) free(change);
+  if (removal) free(removal);
+  return ok;
+}
+
+/* ******************************************************************** */
+
+int silhouette (int nclusters, int nrows, int ncolumns, double** data,
+  int** mask, double weight[], int transpose, char dist, double** distmatrix,
+  const int clusterid[], double widths[], double* average)
+/*
+Purpose
+=======
+
+The silhouette routine calculates the silhouette width of each element in a
+clustering solution (Rousseeuw, Journal of Computational and Applied
+Mathematics 20, 53 (1987)). For element i, with a the mean distance to the
+other elements in its cluster, and b the smallest mean distance to the
+elements of any other cluster, the silhouette width is (b-a)/max(a,b). The
+width is between -1 and 1; it is close to 1 if the element lies well inside
+its cluster, and negative if it is closer to another cluster. The width of an
+element that is alone in its cluster is 0.
+
+The distances are taken from the distance matrix if it is given, and are
+otherwise calculated from the data as needed, without storing the distance
+matrix. The elements are divided over the threads if the library was compiled
+with OpenMP; the result does not depend on the number of threads.
+
+Arguments
+=========
+
+nclusters  (input) int
+The number of clusters.
+
+nrows     (input) int
+The number of rows in the data matrix, equal to the number of genes.
+
+ncolumns  (input) int
+The number of columns in the data matrix, equal to the number of microarrays.
+
+data       (input) double[nrows][ncolumns]
+The data of the elements. Ignored if distmatrix is not NULL.
+
+mask       (input) int[nrows][ncolumns]
+This array shows which data values are missing. If mask[i][j]==0, then
+data[i][j] is missing. Ignored if distmatrix is not NULL.
+
+weight     (input) double[n]
+The weights that are used to calculate the distance. Ignored if distmatrix is
+not NULL.
+
+transpose  (input) int
+If transpose==0, the rows of the matrix are the elements; otherwise, the
+columns are. If distmatrix is not NULL, nrows is the number of elements, and
+ncolumns and transpose are ignored.
+
+dist       (input) char
+Defines which distance measure is used, as in kcluster. Ignored if distmatrix
+is not NULL.
+
+distmatrix (input) double**
+The distance matrix, as a ragged array as returned by distancematrix, or NULL
+if the distances should be calculated from the data.
+
+clusterid  (input) int[nelements]
+The cluster number of each element, between 0 and nclusters-1.
+
+widths     (output) double[nelements]
+The silhouette width of each element.
+
+average    (output) double*
+The mean silhouette width of all elements.
+
+Return value
+============
+
+1 if successful, and 0 if a memory allocation error occurs.
+========================================================================
+*/
+{ int i;
+  int ok = 1;
+  const int nelements = distmatrix ? nrows
+                                   : ((transpose==0) ? nrows : ncolumns);
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  double total = 0.0;
+  int* counts = calloc(nclusters, sizeof(int));
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int) =
+       setmetric(dist);
+
+  if (!counts) return 0;
+  for (i = 0; i < nelements; i++) counts[clusterid[i]]++;
+
+  #pragma omp parallel if (nelements > 100)
+  { int j, k;
+    double* sums = malloc(nclusters*sizeof(double));
+    if (!sums)
+    {
+      #pragma omp atomic write
+      ok = 0;
+    }
+
+    #pragma omp for schedule(dynamic, 16)
+    for (i = 0; i < nelements; i++)
+    { const int own = clusterid[i];
+      double a, b;
+      if (!sums) continue;
+      if (counts[own] < 2)
+      { widths[i] = 0.0;
+        continue;
+      }
+      for (k = 0; k < nclusters; k++) sums[k] = 0.0;
+      for (j = 0; j < nelements; j++)
+      { double distance;
+        if (j==i) continue;
+        if (distmatrix)
+          distance = (j < i) ? distmatrix[i][j] : distmatrix[j][i];
+        else
+          distance = metric(ndata, data, data, mask, mask, weight, i, j,
+                            transpose);
+        sums[clusterid[j]] += distance;
+      }
+      a = sums[own] / (counts[own]-1);
+      b = DBL_MAX;
+      for (k = 0; k < nclusters; k++)
+      { double mean;
+        if (k==own || counts[k]==0) continue;
+        mean = sums[k] / counts[k];
+        if (mean < b) b = mean;
+      }
+      if (b==DBL_MAX) widths[i] = 0.0; /* No other clusters */
+      else if (a < b) widths[i] = 1.0 - a/b;
+      else if (a > b) widths[i] = b/a - 1.0;
+      else widths[i] = 0.0;
+    }
+
+    if (sums) free(sums);
+  }
+
+  free(counts);
+  if (!ok) return 0;
+  for (i = 0; i < nelements; i++) total += widths[i];
+  *average = total / nelements;
+  return 1;
+}
+
+/* ******************************************************************** */
+
+double** distancematrix (int nrows, int ncolumns, double** data,
+  int** mask, double weights[], char dist, int transpose)
+/*
+Purpose
+=======
+
+The distancematrix routine calculates the distance matrix between genes or
+microarrays using their measured gene expression data. Several distance measures
+can be used. The routine returns a pointer to a ragged array containing the
+distances between the genes. As the distance matrix is symmetric, with zeros on
+the diagonal, only the lower triangular half of the distance matrix is saved.
+The distancematrix routine allocates space for the distance matrix. If the
+parameter transpose is set to a nonzero value, the distances between the columns
+(microarrays) are calculated, otherwise distances between the rows (genes) are
+calculated.
+If sufficient space in memory cannot be allocated to store the distance matrix,
+the routine returns a NULL pointer, and all memory allocated so far for the
+distance matrix is freed.
+
+
+Arguments
+=========
+
+nrows      (input) int
+The number of rows in the gene expression data matrix (i.e., the number of
+genes)
+
+ncolumns   (input) int
+The number of columns in the gene expression data matrix (i.e., the number of
+microarrays)
+
+data       (input) double[nrows][ncolumns]
+The array containing the gene expression data.
+
+mask       (input) int[nrows][ncolumns]
+This array shows which data values are missing. If mask[i][j]==0, then
+data[i][j] is missing.
+
+weight (input) double[n]
+The weights that are used to calculate the distance. The length of this vector
+is equal to the number of columns if the distances between genes are calculated,
+or the number of rows if the distances between microarrays are calculated.
+
+dist       (input) char
+Defines which distance measure is used, as given by the table:
+dist=='e': Euclidean distance
+dist=='b': City-block distance
+dist=='c': correlation
+dist=='a': absolute value of the correlation
+dist=='u': uncentered correlation
+dist=='x': absolute uncentered correlation
+dist=='s': Spearman's rank correlation
+dist=='k': Kendall's tau
+For other values of dist, the default (Euclidean distance) is used.
+
+transpose  (input) int
+If transpose is equal to zero, the distances between the rows is
+calculated. Otherwise, the distances between the columns is calculated.
+The former is needed when genes are being clustered; the latter is used
+when microarrays are being clustered.
+
+========================================================================
+*/
+{ /* First determine the size of the distance matrix */
+  const int n = (transpose==0) ? nrows : ncolumns;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  int i,j;
+  double** matrix;
+
+  /* Set the metric function as indicated by dist */
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int) =
+       setmetric(dist);
+
+  if (n < 2) return NULL;
+
+  /* Set up the ragged array */
+  matrix = malloc(n*sizeof(double*));
+  if(matrix==NULL) return NULL; /* Not enough memory available */
+  matrix[0] = NULL;
+  /* The zeroth row has zero columns. We allocate it anyway for convenience.*/
+  for (i = 1; i < n; i++)
+  { matrix[i] = malloc(i*sizeof(double));
+    if (matrix[i]==NULL) break; /* Not enough memory available */
+  }
+  if (i < n) /* break condition encountered */
+  { j = i;
+    for (i = 1; i < j; i++) free(matrix[i]);
+    return NULL;
+  }
+
+  /* Calculate the distances and save them in the ragged array */
+  for (i = 1; i < n; i++)
+    for (j = 0; j < i; j++)
+      matrix[i][j]=metric(ndata,data,data,mask,mask,weights,i,j,transpose);
+
+  return matrix;
+}
+
+/* ******************************************************************** */
+
+double* calculate_weights(int nrows, int ncolumns, double** data, int** mask,
+  double weights[], int transpose, char dist, double cutoff, double exponent)
+
+/*
+Purpose
+=======
+
+This function calculates the weights using the weighting scheme proposed by
+Michael Eisen:
+w[i] = 1.0 / sum_{j where d[i][j]<cutoff} (1 - d[i][j]/cutoff)^exponent
+where the cutoff and the exponent are specified by the user.
+
+
+Arguments
+=========
+
+nrows      (input) int
+The number of rows in the gene expression data matrix, equal to the number of
+genes.
+
+ncolumns   (input) int
+The number of columns in the gene expression data matrix, equal to the number of
+microarrays.
+
+data       (input) double[nrows][ncolumns]
+The array containing the gene expression data.
+
+mask       (input) int[nrows][ncolumns]
+This array shows which data values are missing. If mask[i][j]==0, then
+data[i][j] is missing.
+
+weight     (input) int[ncolumns] if transpose==0,
+                   int[nrows]    if transpose==1
+The weights that are used to calculate the distance. The length of this vector
+is ncolumns if gene weights are being clustered, and nrows if microarrays
+weights are being clustered.
+
+transpose (input) int
+If transpose==0, the weights of the rows of the data matrix are calculated.
+Otherwise, the weights of the columns of the data matrix are calculated.
+
+dist      (input) char
+Defines which distance measure is used, as given by the table:
+dist=='e': Euclidean distance
+dist=='b': City-block distance
+dist=='c': correlation
+dist=='a': absolute value of the correlation
+dist=='u': uncentered correlation
+dist=='x': absolute uncentered correlation
+dist=='s': Spearman's rank correlation
+dist=='k': Kendall's tau
+For other values of dist, the default (Euclidean distance) is used.
+
+cutoff    (input) double
+The cutoff to be used to calculate the weights.
+
+exponent  (input) double
+The exponent to be used to calculate the weights.
+
+
+Return value
+============
+
+The function returns a pointer to a newly allocated array containing the
+calculated weights for the rows (if transpose==0) or columns (if
+transpose==1). If not enough memory could be allocated to store the
+weights array, the function returns NULL.
+
+========================================================================
+*/
+{ int i,j;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+
+  /* Set the metric function as indicated by dist */
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int) =
+       setmetric(dist);
+
+  double* result = malloc(nelements*sizeof(double));
+  if (!result) return NULL;
+  memset(result, 0, nelements*sizeof(double));
+
+  for (i = 0; i < nelements; i++)
+  { result[i] += 1.0;
+    for (j = 0; j < i; j++)
+    { const double distance = metric(ndata, data, data, mask, mask, weights,
+                                     i, j, transpose);
+      if (distance < cutoff)
+      { const double dweight = exp(exponent*log(1-distance/cutoff));
+        /* pow() causes a crash on AIX */
+        result[i] += dweight;
+        result[j] += dweight;
+      }
+    }
+  }
+  for (i = 0; i < nelements; i++) result[i] = 1.0/result[i];
+  return result;
+}
+
+/* ******************************************************************** */
+
+void cuttree (int nelements, Node* tree, int nclusters, int clusterid[]) 
+
+/*
+Purpose
+=======
+
+The cuttree routine takes the output of a hierarchical clustering routine, and
+divides the elements in the tree structure into clusters based on the
+hierarchical clustering result. The number of clusters is specified by the user.
+
+Arguments
+=========
+
+nelements      (input) int
+The number of elements that were clustered.
+
+tree           (input) Node[nelements-1]
+The clustering solution. Each node in the array describes one linking event,
+with tree[i].left and tree[i].right representig the elements that were joined.
+The original elements are numbered 0..nelements-1, nodes are numbered
+-1..-(nelements-1).
+
+nclusters      (input) int
+The number of clusters to be formed.
+
+clusterid      (output) int[nelements]
+The number of the cluster to which each element was assigned. Space for this
+array should be allocated before calling the cuttree routine. If a memory
+error occured, all elements in clusterid are set to -1.
+
+========================================================================
+*/
+{ int i, j, k;
+  int icluster = 0;
+  const int n = nelements-nclusters; /* number of nodes to join */
+  int* nodeid;
+  for (i = nelements-2; i >= n; i--)
+  { k = tree[i].left;
+    if (k>=0)
+    { clusterid[k] = icluster;
+      icluster++;
+    }
+    k = tree[i].right;
+    if (k>=0)
+    { clusterid[k] = icluster;
+      icluster++;
+    }
+  }
+  nodeid = malloc(n*sizeof(int));
+  if(!nodeid)
+  { for (i = 0; i < nelements; i++) clusterid[i] = -1;
+    return;
+  }
+  for (i = 0; i < n; i++) nodeid[i] = -1;
+  for (i = n-1; i >= 0; i--)
+  { if(nodeid[i]<0) 
+    { j = icluster;
+      nodeid[i] = j;
+      icluster++;
+    }
+    else j = nodeid[i];
+    k = tree[i].left;
+    if (k<0) nodeid[-k-1] = j; else clusterid[k] = j;
+    k = tree[i].right;
+    if (k<0) nodeid[-k-1] = j; else clusterid[k] = j;
+  }
+  free(nodeid);
+  return;
+}
+
+/* ******************************************************************** */
+
+void cuttrees (int nelements, Node* tree, int nlevels, const int nclusters[],
+  int** clusterid)
+/*
+Purpose
+=======
+
+The cuttrees routine divides the elements in the tree structure into clusters
+for several numbers of clusters at once. For each number of clusters, the
+result is identical to the result of cuttree. The tree is traversed only once,
+from the top node down.
+
+Arguments
+=========
+
+nelements      (input) int
+The number of elements that were clustered.
+
+tree           (input) Node[nelements-1]
+The clustering solution. Each node in the array describes one linking event,
+with tree[i].left and tree[i].right representig the elements that were joined.
+The original elements are numbered 0..nelements-1, nodes are numbered
+-1..-(nelements-1).
+
+nlevels        (input) int
+The number of different numbers of clusters.
+
+nclusters      (input) int[nlevels]
+The numbers of clusters to be formed. Each should be between 1 and nelements.
+
+clusterid      (output) int[nlevels][nelements]
+For each level l, clusterid[l][i] is the number of the cluster to which element
+i was assigned if the tree is cut into nclusters[l] clusters. Space for this
+array should be allocated before calling the cuttrees routine. If a memory
+error occured, all elements in clusterid are set to -1.
+
+========================================================================
+*/
+{ int i, j, l;
+  const int nnodes = nelements - 1;
+  int* parent;
+  int* leaf;
+  int* count;
+
+  if (nnodes < 1)
+  { for (l = 0; l < nlevels; l++)
+      for (i = 0; i < nelements; i++) clusterid[l][i] = 0;
+    return;
+  }
+
+  parent = malloc(nnodes*sizeof(int));
+  leaf = malloc(nnodes*sizeof(int));
+  count = malloc(nlevels*sizeof(int));
+  if (!parent || !leaf || !count)
+  { if (parent) free(parent);
+    if (leaf) free(leaf);
+    if (count) free(count);
+    for (l = 0; l < nlevels; l++)
+      for (i = 0; i < nelements; i++) clusterid[l][i] = -1;
+    return;
+  }
+
+  /* For each node, find its parent node and one of the elements below it. As
+   * all elements below a node are in the same cluster if the node is kept,
+   * the cluster number of a node is stored in clusterid at that element. */
+  for (i = 0; i < nnodes; i++)
+  { j = tree[i].left;
+    leaf[i] = (j >= 0) ? j : leaf[-j-1];
+    if (j < 0) parent[-j-1] = i;
+    j = tree[i].right;
+    if (j < 0) parent[-j-1] = i;
+  }
+  parent[nnodes-1] = nnodes;
+
+  for (l = 0; l < nlevels; l++) count[l] = 0;
+
+  /* The clusters are numbered in the same order as in cuttree: first the
+   * elements joined by the nodes that are cut, then the clusters below the
+   * remaining nodes in order of decreasing node number. */
+  for (i = nnodes-1; i >= 0; i--)
+  { const int left = tree[i].left;
+    const int right = tree[i].right;
+    for (l = 0; l < nlevels; l++)
+    { int* id = clusterid[l];
+      const int n = nelements - nclusters[l]; /* number of nodes kept */
+      if (i >= n)
+      { if (left >= 0) id[left] = count[l]++;
+        if (right >= 0) id[right] = count[l]++;
+      }
+      else
+      { const int k = parent[i];
+        j = (k >= n) ? count[l]++ : id[leaf[k]];
+        id[leaf[i]] = j;
+        if (left >= 0) id[left] = j;
+        if (right >= 0) id[right] = j;
+      }
+    }
+  }
+
+  free(parent);
+  free(leaf);
+  free(count);
+}
+
+/* ******************************************************************** */
+
+static
+Node* pclcluster (int nrows, int ncolumns, double** data, int** mask,
+  double weight[], double** distmatrix, char dist, int transpose)
+
+/*
+
+Purpose
+=======
+
+The pclcluster routine performs clustering using pairwise centroid-linking
+on a given set of gene expression data, using the distance metric given by dist.
+
+Arguments
+=========
+
+nrows     (input) int
+The number of rows in the gene expression data matrix, equal to the number of
+genes.
+
+ncolumns  (input) int
+The number of columns in the gene expression data matrix, equal to the number of
+microarrays.
+
+data       (input) double[nrows][ncolumns]
+The array containing the gene expression data.
+
+mask       (input) int[nrows][ncolumns]
+This array shows which data values are missing. If
+mask[i][j] == 0, then data[i][j] is missing.
+
+weight     (input) double[ncolumns] if transpose==0;
+                   double[nrows]    if transpose==1
+The weights that are used to calculate the distance. The length of this vector
+is ncolumns if genes are being clustered, and nrows if microarrays are being
+clustered.
+
+transpose  (input) int
+If transpose==0, the rows of the matrix are clustered. Otherwise, columns
+of the matrix are clustered.
+
+dist       (input) char
+Defines which distance measure is used, as given by the table:
+dist=='e': Euclidean distance
+dist=='b': City-block distance
+dist=='c': correlation
+dist=='a': absolute value of the correlation
+dist=='u': uncentered correlation
+dist=='x': absolute uncentered correlation
+dist=='s': Spearman's rank correlation
+dist=='k': Kendall's tau
+For other values of dist, the default (Euclidean distance) is used.
+
+distmatrix (input) double**
+The distance matrix. This matrix is precalculated by the calling routine
+treecluster. The pclcluster routine modifies the contents of distmatrix, but
+does not deallocate it.
+
+Return value
+============
+
+A pointer to a newly allocated array of Node structs, describing the
+hierarchical clustering solution consisting of nelements-1 nodes. Depending on
+whether genes (rows) or microarrays (columns) were clustered, nelements is
+equal to nrows or ncolumns. See src/cluster.h for a description of the Node
+structure.
+If a memory error occurs, pclcluster returns NULL.
+========================================================================
+*/
+{ int i, j;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+  int inode;
+  const int ndata = transpose ? nrows : ncolumns;
+  const int nnodes = nelements - 1;
+
+  /* Set the metric function as indicated by dist */
+  double (*metric)
+    (int, double**, double**, int**, int**, const double[], int, int, int) =
+       setmetric(dist);
+
+  Node* result;
+  double** newdata;
+  int** newmask;
+  int* distid = malloc(nelements*sizeof(int));
+  if(!distid) return NULL;
+  result = malloc(nnodes*sizeof(Node));
+  if(!result)
+  { free(distid);
+    return NULL;
+  }
+  if(!makedatamask(nelements, ndata, &newdata, &newmask))
+  { free(result);
+    free(distid);
+    return NULL; 
+  }
+
+  for (i = 0; i < nelements; i++) distid[i] = i;
+  /* To remember which row/column in the distance matrix contains what */
+
+  /* Storage for node data */
+  if (transpose)
+  { for (i = 0; i < nelements; i++)
+    { for (j = 0; j < ndata; j++)
+      { newdata[i][j] = data[j][i];
+        newmask[i][j] = mask[j][i];
+      }
+    }
+    data = newdata;
+    mask = newmask;
+  }
+  else
+  { for (i = 0; i < nelements; i++)
+    { memcpy(newdata[i], data[i], ndata*sizeof(double));
+      memcpy(newmask[i], mask[i], ndata*sizeof(int));
+    }
+    data = newdata;
+    mask = newmask;
+  }
+
+  for (inode = 0; inode < nnodes; inode++)
+  { /* Find the pair with the shortest distance */
+    int is = 1;
+    int js = 0;
+    result[inode].distance = find_closest_pair(nelements-inode, distmatrix, &is, &js);
+    result[inode].left = distid[js];
+    result[inode].right = distid[is];
+
+    /* Make node js the new node */
+    for (i = 0; i < ndata; i++)
+    { data[js][i] = data[js][i]*mask[js][i] + data[is][i]*mask[is][i];
+      mask[js][i] += mask[is][i];
+      if (mask[js][i]) data[js][i] /= mask[js][i];
+    }
+    free(data[is]);
+    free(mask[is]);
+    data[is] = data[nnodes-inode];
+    mask[is] = mask[nnodes-inode];
+  
+    /* Fix the distances */
+    distid[is] = distid[nnodes-inode];
+    for (i = 0; i < is; i++)
+      distmatrix[is][i] = distmatrix[nnodes-inode][i];
+    for (i = is + 1; i < nnodes-inode; i++)
+      distmatrix[i][is] = distmatrix[nnodes-inode][i];
+
+    distid[js] = -inode-1;
+    for (i = 0; i < js; i++)
+      distmatrix[js][i] = metric(ndata,data,data,mask,mask,weight,js,i,0);
+    for (i = js + 1; i < nnodes-inode; i++)
+      distmatrix[i][js] = metric(ndata,data,data,mask,mask,weight,js,i,0);
+  }
+
+  /* Free temporarily allocated space */
+  free(data[0]);
+  free(mask[0]);
+  free(data);
+  free(mask);
+  free(distid);
+ 
+  return result;
+}
+
+/* ******************************************************************** */
+
+static
+Node* pclclusterlw (int nelements, double** distmatrix)
+
+/*
+
+Purpose
+=======
+
+The pclclusterlw routine performs pairwise centroid-linkage clustering on the
+given distance matrix, which should contain the Euclidean distances (as
+calculated by distancematrix with dist=='e') between elements without missing
+data. The distances between a newly formed node and the remaining nodes are
+found from the Lance-Williams update formula
+
+d(k, i+j) = [n_i d(k,i) + n_j d(k,j)] / (n_i+n_j)
+          - n_i n_j d(i,j) / (n_i+n_j)^2,
+
+which is exact for the (weighted, squared) Euclidean distance between the
+cluster centroids. In contrast to pclcluster, the gene expression data are
+therefore not needed.
+
+Arguments
+=========
+
+nelements     (input) int
+The number of elements to be clustered.
+
+distmatrix (input) double**
+The distance matrix, with nelements rows, each row being filled up to the
+diagonal. The elements on the diagonal are not used, as they are assumed to be
+zero. The distance matrix will be modified by this routine.
+
+Return value
+============
+
+A pointer to a newly allocated array of Node structs, describing the
+hierarchical clustering solution consisting of nelements-1 nodes. The nodes
+are numbered in the same way as by pclcluster.
+If a memory error occurs, pclclusterlw returns NULL.
+========================================================================
+*/
+{ int j;
+  int n;
+  int* distid;
+  int* number;
+  Node* result;
+
+  distid = malloc(nelements*sizeof(int));
+  if(!distid) return NULL;
+  number = malloc(nelements*sizeof(int));
+  if(!number)
+  { free(distid);
+    return NULL;
+  }
+  result = malloc((nelements-1)*sizeof(Node));
+  if (!result)
+  { free(distid);
+    free(number);
+    return NULL;
+  }
+
+  for (j = 0; j < nelements; j++)
+  { number[j] = 1;
+    distid[j] = j;
+  }
+
+  for (n = nelements; n > 1; n--)
+  { int is = 1;
+    int js = 0;
+    double dij, fi, fj, fij;
+    const int inode = nelements-n;
+    dij = find_closest_pair(n, distmatrix, &is, &js);
+    result[inode].distance = dij;
+    result[inode].left = distid[js];
+    result[inode].right = distid[is];
+
+    /* Fix the distances */
+    fi = ((double)number[is]) / (number[is] + number[js]);
+    fj = ((double)number[js]) / (number[is] + number[js]);
+    fij = fi * fj * dij;
+    #pragma omp parallel if (n > 4096)
+    {
+      #pragma omp for nowait
+      for (j = 0; j < js; j++)
+        distmatrix[js][j] = fi*distmatrix[is][j] + fj*distmatrix[js][j] - fij;
+      #pragma omp for nowait
+      for (j = js+1; j < is; j++)
+        distmatrix[j][js] = fi*distmatrix[is][j] + fj*distmatrix[j][js] - fij;
+      #pragma omp for
+      for (j = is+1; j < n; j++)
+        distmatrix[j][js] = fi*distmatrix[j][is] + fj*distmatrix[j][js] - fij;
+
+      #pragma omp for nowait
+      for (j = 0; j < is; j++) distmatrix[is][j] = distmatrix[n-1][j];
+      #pragma omp for nowait
+      for (j = is+1; j < n-1; j++) distmatrix[j][is] = distmatrix[n-1][j];
+    }
+
+    /* Update number of elements in the clusters */
+    number[js] += number[is];
+    number[is] = number[n-1];
+
+    /* Update the node numbers */
+    distid[js] = -inode-1;
+    distid[is] = distid[n-1];
+  }
+  free(distid);
+  free(number);
+
+  return result;
+}
+
+/* ******************************************************************** */
+
+static
+int nodecompare(const void* a, const void* b)
+/* Helper function for qsort. */
+{ const Node* node1 = (const Node*)a;
+  const Node* node2 = (const Node*)b;
+  const double term1 = node1->distance;
+  const double term2 = node2->distance;
+  if (term1 < term2) return -1;
+  if (term1 > term2) return +1;
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static
+Node* pslcluster (int nrows, int ncolumns, double** data, int** mask,
+  double weight[], double** distmatrix, char dist, int transpose)
+
+/*
+
+Purpose
+=======
+
+The pslcluster routine performs single-linkage hierarchical clustering, using
+either the distance matrix directly, if available, or by calculating the
+distances from the data array. This implementation is based on the SLINK
+algorithm, described in:
+Sibson, R. (1973). SLINK: An optimally efficient algorithm for the single-link
+cluster method. The Computer Journal, 16(1): 30-34.
+The output of this algorithm is identical to conventional single-linkage
+hierarchical clustering, but is much more memory-efficient and faster. Hence,
+it can be applied to large data sets, for which the conventional single-
+linkage algorithm fails due to lack of memory. If the distance matrix is not
+available, the distances are calculated from the data for a block of rows at a
+time; if the library was compiled with OpenMP, this is done in parallel.
+
+
+Arguments
+=========
+
+nrows     (input) int
+The number of rows in the gene expression data matrix, equal to the number of
+genes.
+
+ncolumns  (input) int
+The number of columns in the gene expression data matrix, equal to the number of
+microarrays.
+
+data       (input) double[nrows][ncolumns]
+The array containing the gene expression data.
+
+mask       (input) int[nrows][ncolumns]
+This array shows which data values are missing. If
+mask[i][j] == 0, then data[i][j] is missing.
+
+weight (input) double[n]
+The weights that are used to calculate the distance. The length of this vector
+is ncolumns if genes are being clustered, and nrows if microarrays are being
+clustered.
+
+transpose  (input) int
+If transpose==0, the rows of the matrix are clustered. Otherwise, columns
+of the matrix are clustered.
+
+dist       (input) char
+Defines which distance measure is used, as given by the table:
+dist=='e': Euclidean distance
+dist=='b': City-block distance
+dist=='c': correlation
+dist=='a': absolute value of the correlation
+dist=='u': uncentered correlation
+dist=='x': absolute uncentered correlation
+dist=='s': Spearman's rank correlation
+dist=='k': Kendall's tau
+For other values of dist, the default (Euclidean distance) is used.
+
+distmatrix (input) double**
+The distance matrix. If the distance matrix is passed by the calling routine
+treecluster, it is used by pslcluster to speed up the clustering calculation.
+The pslcluster routine does not modify the contents of distmatrix, and does
+not deallocate it. If distmatrix is NULL, the pairwise distances are calculated
+by the pslcluster routine from the gene expression data (the data and mask
+arrays) and stored in temporary arrays. If distmatrix is passed, the original
+gene expression data (specified by the data and mask arguments) are not needed
+and are therefore ignored.
+
+
+Return value
+============
+
+A pointer to a newly allocated array of Node structs, describing the
+hierarchical clustering solution consisting of nelements-1 nodes. Depending on
+whether genes (rows) or microarrays (columns) were clustered, nelements is
+equal to nrows or ncolumns. See src/cluster.h for a description of the Node
+structure.
+If a memory error occurs, pslcluster returns NULL.
+
+========================================================================
+*/
+{ int i, j, k;
+  const int nelements = transpose ? ncolumns : nrows;
+  const int nnodes = nelements - 1;
+  int* vector;
+  double* temp;
+  int* index;
+  Node* result;
+  temp = malloc(nnodes*sizeof(double));
+  if(!temp) return NULL;
+  index = malloc(nelements*sizeof(int));
+  if(!index)
+  { free(temp);
+    return NULL;
+  }
+  vector = malloc(nnodes*sizeof(int));
+  if(!vector)
+  { free(index);
+    free(temp);
+    return NULL;
+  }
+  result = malloc(nelements*sizeof(Node));
+  if(!result)
+  { free(vector);
+    free(index);
+    free(temp);
+    return NULL;
+  }
+
+  for (i = 0; i < nnodes; i++) vector[i] = i;
+
+  if(distmatrix)
+  { for (i = 0; i < nelements; i++)
+    { result[i].distance = DBL_MAX;
+      for (j = 0; j < i; j++) temp[j] = distmatrix[i][j];
+      for (j = 0; j < i; j++)
+      { k = vector[j];
+        if (result[j].distance >= temp[j])
+        { if (result[j].distance < temp[k]) temp[k] = result[j].distance;
+          result[j].distance = temp[j];
+          vector[j] = i;
+        }
+        else if (temp[j] < temp[k]) temp[k] = temp[j];
+      }
+      for (j = 0; j < i; j++)
+      {
+        if (result[j].distance >= result[vector[j]].distance) vector[j] = i;
+      }
+    }
+  }
+  else
+  { const int ndata = transpose ? nrows : ncolumns;
+    /* Set the metric function as indicated by dist */
+    double (*metric)
+      (int, double**, double**, int**, int**, const double[], int, int, int) =
+         setmetric(dist);
+
+    /* The distances of a block of consecutive rows are calculated first, in
+     * parallel if OpenMP is available, and then fed one row at a time into
+     * the (sequential) SLINK update. The block size is limited by the number
+     * of distances that fit in the buffer; if the buffer cannot be allocated,
+     * we fall back to one row at a time using temp. */
+    size_t nbuffer = (size_t)nelements * 64;
+    double* buffer;
+    if (nbuffer < 1048576) nbuffer = 1048576;
+    buffer = malloc(nbuffer*sizeof(double));
+    if (!buffer)
+    { buffer = temp;
+      nbuffer = nnodes;
+    }
+
+    i = 0;
+    while (i < nelements)
+    { const int first = i;
+      double* row = buffer;
+      size_t used = 0;
+      while (i < nelements && used + i <= nbuffer)
+      { used += i;
+        i++;
+      }
+
+      #pragma omp parallel
+      { int irow;
+        double* p = buffer;
+        for (irow = first; irow < i; p += irow, irow++)
+        { int icol;
+          #pragma omp for schedule(static) nowait
+          for (icol = 0; icol < irow; icol++) p[icol] =
+            metric(ndata, data, data, mask, mask, weight, irow, icol, transpose);
+        }
+      }
+
+      for (k = first; k < i; row += k, k++)
+      { int n;
+        result[k].distance = DBL_MAX;
+        for (j = 0; j < k; j++)
+        { n = vector[j];
+          if (result[j].distance >= row[j])
+          { if (result[j].distance < row[n]) row[n] = result[j].distance;
+            result[j].distance = row[j];
+            vector[j] = k;
+          }
+          else if (row[j] < row[n]) row[n] = row[j];
+        }
+        for (j = 0; j < k; j++)
+          if (result[j].distance >= result[vector[j]].distance) vector[j] = k;
+      }
+    }
+    if (buffer != temp) free(buffer);
+  }
+  free(temp);
+
+  for (i = 0; i < nnodes; i++) result[i].left = i;
+  qsort(result, nnodes, sizeof(Node), nodecompare);
 
-  double* result = malloc(nelements*sizeof(double));
-  if (!result) return NULL;
-  memset(result, 0, nelements*sizeof(double));
+  for (i = 0; i < nelements; i++) index[i] = i;
+  for (i = 0; i < nnodes; i++)
+  { j = result[i].left;
+    k = vector[j];
+    result[i].left = index[j];
+    result[i].right = index[k];
+    index[k] = -i-1;
+  }
+  free(vector);
+  free(index);
 
-  for (i = 0; i < nelements; i++)
-  { result[i] += 1.0;
-    for (j = 0; j < i; j++)
-    { const double distance = metric(ndata, data, data, mask, mask, weights,
-                                     i, j, transpose);
-      if (distance < cutoff)
-      { const double dweight = exp(exponent*log(1-distance/cutoff));
-        /* pow() causes a crash on AIX */
-        result[i] += dweight;
-        result[j] += dweight;
+  result = realloc(result, nnodes*sizeof(Node));
+
+  return result;
+}
+/* ******************************************************************** */
+
+static Node* pmlcluster (int nelements, double** distmatrix)
+/*
+
+Purpose
+=======
+
+The pmlcluster routine performs clustering using pairwise maximum- (complete-)
+linking on the given distance matrix.
+
+Arguments
+=========
+
+nelements     (input) int
+The number of elements to be clustered.
+
+distmatrix (input) double**
+The distance matrix, with nelements rows, each row being filled up to the
+diagonal. The elements on the diagonal are not used, as they are assumed to be
+zero. The distance matrix will be modified by this routine.
+
+Return value
+============
+
+A pointer to a newly allocated array of Node structs, describing the
+hierarchical clustering solution consisting of nelements-1 nodes. Depending on
+whether genes (rows) or microarrays (columns) were clustered, nelements is
+equal to nrows or ncolumns. See src/cluster.h for a description of the Node
+structure.
+If a memory error occurs, pmlcluster returns NULL.
+========================================================================
+*/
+{ int j;
+  int n;
+  int* clusterid;
+  Node* result;
+
+  clusterid = malloc(nelements*sizeof(int));
+  if(!clusterid) return NULL;
+  result = malloc((nelements-1)*sizeof(Node));
+  if (!result)
+  { free(clusterid);
+    return NULL;
+  }
+
+  /* Setup a list specifying to which cluster a gene belongs */
+  for (j = 0; j < nelements; j++) clusterid[j] = j;
+
+  for (n = nelements; n > 1; n--)
+  { int is = 1;
+    int js = 0;
+    result[nelements-n].distance = find_closest_pair(n, distmatrix, &is, &js);
+
+    /* Fix the distances. The three update loops write to different elements
+     * of the distance matrix; the last row is moved into row is only after
+     * all updates have finished. */
+    #pragma omp parallel if (n > 4096)
+    {
+      #pragma omp for nowait
+      for (j = 0; j < js; j++)
+        distmatrix[js][j] = max(distmatrix[is][j],distmatrix[js][j]);
+      #pragma omp for nowait
+      for (j = js+1; j < is; j++)
+        distmatrix[j][js] = max(distmatrix[is][j],distmatrix[j][js]);
+      #pragma omp for
+      for (j = is+1; j < n; j++)
+        distmatrix[j][js] = max(distmatrix[j][is],distmatrix[j][js]);
+
+      #pragma omp for nowait
+      for (j = 0; j < is; j++) distmatrix[is][j] = distmatrix[n-1][j];
+      #pragma omp for nowait
+      for (j = is+1; j < n-1; j++) distmatrix[j][is] = distmatrix[n-1][j];
+    }
+
+    /* Update clusterids */
+    result[nelements-n].left = clusterid[is];
+    result[nelements-n].right = clusterid[js];
+    clusterid[js] = n-nelements-1;
+    clusterid[is] = clusterid[n-1];
+  }
+  free(clusterid);
+
+  return result;
+}
+
+/* ******************************************************************* */
+
+static Node* palcluster (int nelements, double** distmatrix)
+/*
+Purpose
+=======
+
+The palcluster routine performs clustering using pairwise average
+linking on the given distance matrix.
+
+Arguments
+=========
+
+nelements     (input) int
+The number of elements to be clustered.
+
+distmatrix (input) double**
+The distance matrix, with nelements rows, each row being filled up to the
+diagonal. The elements on the diagonal are not used, as they are assumed to be
+zero. The distance matrix will be modified by this routine.
+
+Return value
+============
+
+A pointer to a newly allocated array of Node structs, describing the
+hierarchical clustering solution consisting of nelements-1 nodes. Depending on
+whether genes (rows) or microarrays (columns) were clustered, nelements is
+equal to nrows or ncolumns. See src/cluster.h for a description of the Node
+structure.
+If a memory error occurs, palcluster returns NULL.
+========================================================================
+*/
+{ int j;
+  int n;
+  int* clusterid;
+  int* number;
+  Node* result;
+
+  clusterid = malloc(nelements*sizeof(int));
+  if(!clusterid) return NULL;
+  number = malloc(nelements*sizeof(int));
+  if(!number)
+  { free(clusterid);
+    return NULL;
+  }
+  result = malloc((nelements-1)*sizeof(Node));
+  if (!result)
+  { free(clusterid);
+    free(number);
+    return NULL;
+  }
+
+  /* Setup a list specifying to which cluster a gene belongs, and keep track
+   * of the number of elements in each cluster (needed to calculate the
+   * average). */
+  for (j = 0; j < nelements; j++)
+  { number[j] = 1;
+    clusterid[j] = j;
+  }
+
+  for (n = nelements; n > 1; n--)
+  { int sum;
+    int is = 1;
+    int js = 0;
+    result[nelements-n].distance = find_closest_pair(n, distmatrix, &is, &js);
+
+    /* Save result */
+    result[nelements-n].left = clusterid[is];
+    result[nelements-n].right = clusterid[js];
+
+    /* Fix the distances (see pmlcluster) */
+    sum = number[is] + number[js];
+    #pragma omp parallel if (n > 4096)
+    {
+      #pragma omp for nowait
+      for (j = 0; j < js; j++)
+      { distmatrix[js][j] = distmatrix[is][j]*number[is]
+                          + distmatrix[js][j]*number[js];
+        distmatrix[js][j] /= sum;
+      }
+      #pragma omp for nowait
+      for (j = js+1; j < is; j++)
+      { distmatrix[j][js] = distmatrix[is][j]*number[is]
+                          + distmatrix[j][js]*number[js];
+        distmatrix[j][js] /= sum;
       }
+      #pragma omp for
+      for (j = is+1; j < n; j++)
+      { distmatrix[j][js] = distmatrix[j][is]*number[is]
+                          + distmatrix[j][js]*number[js];
+        distmatrix[j][js] /= sum;
+      }
+
+      #pragma omp for nowait
+      for (j = 0; j < is; j++) distmatrix[is][j] = distmatrix[n-1][j];
+      #pragma omp for nowait
+      for (j = is+1; j < n-1; j++) distmatrix[j][is] = distmatrix[n-1][j];
     }
+
+    /* Update number of elements in the clusters */
+    number[js] = sum;
+    number[is] = number[n-1];
+
+    /* Update clusterids */
+    clusterid[js] = n-nelements-1;
+    clusterid[is] = clusterid[n-1];
   }
-  for (i = 0; i < nelements; i++) result[i] = 1.0/result[i];
+  free(clusterid);
+  free(number);
+
   return result;
 }
 
-/* ******************************************************************** */
+/* ******************************************************************* */
 
-void cuttree (int nelements, Node* tree, int nclusters, int clusterid[]) 
+typedef struct {int left; int right; double distance; int step;} Merge;
+/* A merge between the clusters containing elements left and right, found in
+ * the given step of the nearest-neighbor chain algorithm. */
+
+static
+int mergecompare(const void* a, const void* b)
+/* Helper function for qsort. Merges at the same distance are kept in the
+ * order in which they were found. */
+{ const Merge* merge1 = (const Merge*)a;
+  const Merge* merge2 = (const Merge*)b;
+  if (merge1->distance < merge2->distance) return -1;
+  if (merge1->distance > merge2->distance) return +1;
+  return merge1->step - merge2->step;
+}
 
+/* ---------------------------------------------------------------------- */
+
+static Node* pwlcluster (int nelements, double** distmatrix)
 /*
 Purpose
 =======
 
-The cuttree routine takes the output of a hierarchical clustering routine, and
-divides the elements in the tree structure into clusters based on the
-hierarchical clustering result. The number of clusters is specified by the user.
+The pwlcluster routine performs hierarchical clustering using Ward's
+minimum-variance linkage on the given distance matrix, which should contain
+Euclidean distances (dist=='e'). The distances between a newly formed node and
+the remaining nodes are found from the Lance-Williams update formula
+
+d(k, i+j) = [(n_k+n_i) d(k,i) + (n_k+n_j) d(k,j) - n_k d(i,j)] / (n_k+n_i+n_j).
+
+As Ward's linkage is reducible, the nodes can be found with the nearest-neighbor
+chain algorithm, which needs O(nelements^2) time instead of the O(nelements^3)
+time needed when searching for the closest pair after each merge. The nodes
+are sorted by distance afterwards.
 
 Arguments
 =========
 
-nelements      (input) int
-The number of elements that were clustered.
-
-tree           (input) Node[nelements-1]
-The clustering solution. Each node in the array describes one linking event,
-with tree[i].left and tree[i].right representig the elements that were joined.
-The original elements are numbered 0..nelements-1, nodes are numbered
--1..-(nelements-1).
+nelements     (input) int
+The number of elements to be clustered.
 
-nclusters      (input) int
-The number of clusters to be formed.
+distmatrix (input) double**
+The distance matrix, with nelements rows, each row being filled up to the
+diagonal. The elements on the diagonal are not used, as they are assumed to be
+zero. The distance matrix will be modified by this routine.
 
-clusterid      (output) int[nelements]
-The number of the cluster to which each element was assigned. Space for this
-array should be allocated before calling the cuttree routine. If a memory
-error occured, all elements in clusterid are set to -1.
+Return value
+============
 
+A pointer to a newly allocated array of Node structs, describing the
+hierarchical clustering solution consisting of nelements-1 nodes. Depending on
+whether genes (rows) or microarrays (columns) were clustered, nelements is
+equal to nrows or ncolumns. See src/cluster.h for a description of the Node
+structure.
+If a memory error occurs, pwlcluster returns NULL.
 ========================================================================
 */
 { int i, j, k;
-  int icluster = 0;
-  const int n = nelements-nclusters; /* number of nodes to join */
+  int inode;
+  int nchain = 0;
+  int first = 0;
+  int* number;
+  int* chain;
+  int* parent;
   int* nodeid;
-  for (i = nelements-2; i >= n; i--)
-  { k = tree[i].left;
-    if (k>=0)
-    { clusterid[k] = icluster;
-      icluster++;
+  Merge* merges;
+  Node* result;
+
+  number = malloc(nelements*sizeof(int));
+  chain = malloc(nelements*sizeof(int));
+  parent = malloc(nelements*sizeof(int));
+  nodeid = malloc(nelements*sizeof(int));
+  merges = malloc((nelements-1)*sizeof(Merge));
+  result = malloc((nelements-1)*sizeof(Node));
+  if (!number || !chain || !parent || !nodeid || !merges || !result)
+  { if (number) free(number);
+    if (chain) free(chain);
+    if (parent) free(parent);
+    if (nodeid) free(nodeid);
+    if (merges) free(merges);
+    if (result) free(result);
+    return NULL;
+  }
+
+  /* number[i]==0 for elements that have been merged into another cluster */
+  for (i = 0; i < nelements; i++) number[i] = 1;
+
+  for (inode = 0; inode < nelements-1; inode++)
+  { double distance;
+    int ni, nj;
+    if (nchain==0)
+    { while (number[first]==0) first++;
+      chain[nchain++] = first;
     }
-    k = tree[i].right;
-    if (k>=0)
-    { clusterid[k] = icluster;
-      icluster++;
+    /* Grow the chain until two elements are each other's nearest neighbor */
+    while (1)
+    { i = chain[nchain-1];
+      if (nchain > 1)
+      { j = chain[nchain-2];
+        distance = (i > j) ? distmatrix[i][j] : distmatrix[j][i];
+      }
+      else
+      { j = -1;
+        distance = DBL_MAX;
+      }
+      for (k = 0; k < i; k++)
+      { if (number[k] && distmatrix[i][k] < distance)
+        { distance = distmatrix[i][k];
+          j = k;
+        }
+      }
+      for (k = i+1; k < nelements; k++)
+      { if (number[k] && distmatrix[k][i] < distance)
+        { distance = distmatrix[k][i];
+          j = k;
+        }
+      }
+      if (nchain > 1 && j==chain[nchain-2]) break;
+      chain[nchain++] = j;
+    }
+    nchain -= 2;
+
+    /* Store the new node in element min(i,j) */
+    if (i < j)
+    { k = i;
+      i = j;
+      j = k;
+    }
+    merges[inode].left = i;
+    merges[inode].right = j;
+    merges[inode].distance = distance;
+    merges[inode].step = inode;
+
+    /* Fix the distances */
+    ni = number[i];
+    nj = number[j];
+    for (k = 0; k < nelements; k++)
+    { double* dkj;
+      double dki;
+      int nk = number[k];
+      if (nk==0 || k==i || k==j) continue;
+      dki = (i > k) ? distmatrix[i][k] : distmatrix[k][i];
+      dkj = (j > k) ? &distmatrix[j][k] : &distmatrix[k][j];
+      *dkj = ((nk+ni)*dki + (nk+nj)*(*dkj) - nk*distance) / (nk+ni+nj);
     }
+    number[j] = ni + nj;
+    number[i] = 0;
   }
-  nodeid = malloc(n*sizeof(int));
-  if(!nodeid)
-  { for (i = 0; i < nelements; i++) clusterid[i] = -1;
-    return;
+
+  /* Sort the nodes by distance, and number them accordingly */
+  qsort(merges, nelements-1, sizeof(Merge), mergecompare);
+  for (i = 0; i < nelements; i++)
+  { parent[i] = i;
+    nodeid[i] = i;
   }
-  for (i = 0; i < n; i++) nodeid[i] = -1;
-  for (i = n-1; i >= 0; i--)
-  { if(nodeid[i]<0) 
-    { j = icluster;
-      nodeid[i] = j;
-      icluster++;
+  for (inode = 0; inode < nelements-1; inode++)
+  { i = merges[inode].left;
+    while (parent[i]!=i) i = parent[i];
+    j = merges[inode].right;
+    while (parent[j]!=j) j = parent[j];
+    result[inode].left = nodeid[i];
+    result[inode].right = nodeid[j];
+    result[inode].distance = merges[inode].distance;
+    /* Path compression */
+    k = merges[inode].left;
+    while (parent[k]!=i)
+    { int next = parent[k];
+      parent[k] = i;
+      k = next;
     }
-    else j = nodeid[i];
-    k = tree[i].left;
-    if (k<0) nodeid[-k-1] = j; else clusterid[k] = j;
-    k = tree[i].right;
-    if (k<0) nodeid[-k-1] = j; else clusterid[k] = j;
+    k = merges[inode].right;
+    while (parent[k]!=j)
+    { int next = parent[k];
+      parent[k] = j;
+      k = next;
+    }
+    parent[j] = i;
+    nodeid[i] = -inode-1;
   }
+
+  free(number);
+  free(chain);
+  free(parent);
   free(nodeid);
-  return;
+  free(merges);
+
+  return result;
 }
 
-/* ******************************************************************** */
+/* ******************************************************************* */
 
 static
-Node* pclcluster (int nrows, int ncolumns, double** data, int** mask,
-  double weight[], double** distmatrix, char dist, int transpose)
+Node* treeworker (int nrows, int ncolumns, double** data, int** mask,
+  double weight[], int transpose, char dist, char method, double** distmatrix)
+/* Runs the hierarchical clustering routine for the given method. The distance
+ * matrix is modified, except for single-linkage clustering. Returns NULL if a
+ * memory error occurs. */
+{ Node* result = NULL;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+  switch(method)
+  { case 's':
+      result = pslcluster(nrows, ncolumns, data, mask, weight, distmatrix,
+                          dist, transpose);
+      break;
+    case 'm':
+      result = pmlcluster(nelements, distmatrix);
+      break;
+    case 'a':
+      result = palcluster(nelements, distmatrix);
+      break;
+    case 'w':
+      result = pwlcluster(nelements, distmatrix);
+      break;
+    case 'c':
+      /* For the Euclidean distance, the distances to a new node follow from
+       * the distance matrix itself, provided that no data are missing. */
+      if (dist=='e' && nomissing(nrows, ncolumns, mask))
+        result = pclclusterlw(nelements, distmatrix);
+      else
+        result = pclcluster(nrows, ncolumns, data, mask, weight, distmatrix,
+                            dist, transpose);
+      break;
+  }
+  return result;
+}
 
-/*
+/* ******************************************************************* */
 
+Node* treecluster (int nrows, int ncolumns, double** data, int** mask,
+  double weight[], int transpose, char dist, char method, double** distmatrix)
+/*
 Purpose
 =======
 
-The pclcluster routine performs clustering using pairwise centroid-linking
+The treecluster routine performs hierarchical clustering using pairwise
+single-, maximum-, centroid-, average-, or Ward's linkage, as defined by method,
 on a given set of gene expression data, using the distance metric given by dist.
+If successful, the function returns a pointer to a newly allocated Tree struct
+containing the hierarchical clustering solution, and NULL if a memory error
+occurs. The pointer should be freed by the calling routine to prevent memory
+leaks.
 
 Arguments
 =========
 
 nrows     (input) int
-The number of rows in the gene expression data matrix, equal to the number of
-genes.
+The number of rows in the data matrix, equal to the number of genes.
 
 ncolumns  (input) int
-The number of columns in the gene expression data matrix, equal to the number of
-microarrays.
+The number of columns in the data matrix, equal to the number of microarrays.
 
 data       (input) double[nrows][ncolumns]
-The array containing the gene expression data.
+The array containing the data of the vectors to be clustered.
 
 mask       (input) int[nrows][ncolumns]
-This array shows which data values are missing. If
-mask[i][j] == 0, then data[i][j] is missing.
+This array shows which data values are missing. If mask[i][j]==0, then
+data[i][j] is missing.
 
-weight     (input) double[ncolumns] if transpose==0;
-                   double[nrows]    if transpose==1
-The weights that are used to calculate the distance. The length of this vector
-is ncolumns if genes are being clustered, and nrows if microarrays are being
-clustered.
+weight (input) double array[n]
+The weights that are used to calculate the distance.
 
 transpose  (input) int
 If transpose==0, the rows of the matrix are clustered. Otherwise, columns
@@ -3229,10 +7120,28 @@ dist=='s': Spearman's rank correlation
 dist=='k': Kendall's tau
 For other values of dist, the default (Euclidean distance) is used.
 
+method     (input) char
+Defines which hierarchical clustering method is used:
+method=='s': pairwise single-linkage clustering
+method=='m': pairwise maximum- (or complete-) linkage clustering
+method=='a': pairwise average-linkage clustering
+method=='c': pairwise centroid-linkage clustering
+method=='w': Ward's minimum-variance linkage clustering
+Ward's linkage assumes that the distances are Euclidean (dist=='e').
+For all methods except centroid-linkage, either the distance matrix or the gene
+expression data is sufficient to perform the clustering algorithm. For pairwise centroid-linkage
+clustering, however, the gene expression data are always needed, even if the
+distance matrix itself is available. If dist=='e' and no data are missing, the
+centroid distances are updated from the distance matrix alone; otherwise, they
+are recalculated from the centroid data after each merge.
+
 distmatrix (input) double**
-The distance matrix. This matrix is precalculated by the calling routine
-treecluster. The pclcluster routine modifies the contents of distmatrix, but
-does not deallocate it.
+The distance matrix. If the distance matrix is zero initially, the distance
+matrix will be allocated and calculated from the data by treecluster, and
+deallocated before treecluster returns. If the distance matrix is passed by the
+calling routine, treecluster will modify the contents of the distance matrix as
+part of the clustering algorithm, but will not deallocate it. The calling
+routine should deallocate the distance matrix after the return from treecluster.
 
 Return value
 ============
@@ -3242,595 +7151,1234 @@ hierarchical clustering solution consisting of nelements-1 nodes. Depending on
 whether genes (rows) or microarrays (columns) were clustered, nelements is
 equal to nrows or ncolumns. See src/cluster.h for a description of the Node
 structure.
-If a memory error occurs, pclcluster returns NULL.
+If a memory error occurs, treecluster returns NULL.
+
 ========================================================================
 */
-{ int i, j;
+{ Node* result = NULL;
   const int nelements = (transpose==0) ? nrows : ncolumns;
-  int inode;
-  const int ndata = transpose ? nrows : ncolumns;
-  const int nnodes = nelements - 1;
+  const int ldistmatrix = (distmatrix==NULL && method!='s') ? 1 : 0;
 
-  /* Set the metric function as indicated by dist */
-  double (*metric)
-    (int, double**, double**, int**, int**, const double[], int, int, int) =
-       setmetric(dist);
+  if (nelements < 2) return NULL;
 
-  Node* result;
-  double** newdata;
-  int** newmask;
-  int* distid = malloc(nelements*sizeof(int));
-  if(!distid) return NULL;
-  result = malloc(nnodes*sizeof(Node));
-  if(!result)
-  { free(distid);
-    return NULL;
+  /* Calculate the distance matrix if the user didn't give it */
+  if(ldistmatrix)
+  { distmatrix =
+      distancematrix(nrows, ncolumns, data, mask, weight, dist, transpose);
+    if (!distmatrix) return NULL; /* Insufficient memory */
   }
-  if(!makedatamask(nelements, ndata, &newdata, &newmask))
-  { free(result);
-    free(distid);
-    return NULL; 
+
+  result = treeworker(nrows, ncolumns, data, mask, weight, transpose, dist,
+                      method, distmatrix);
+
+  /* Deallocate space for distance matrix, if it was allocated by treecluster */
+  if(ldistmatrix)
+  { int i;
+    for (i = 1; i < nelements; i++) free(distmatrix[i]);
+    free (distmatrix);
   }
+ 
+  return result;
+}
 
-  for (i = 0; i < nelements; i++) distid[i] = i;
-  /* To remember which row/column in the distance matrix contains what */
+/* ******************************************************************* */
 
-  /* Storage for node data */
-  if (transpose)
-  { for (i = 0; i < nelements; i++)
-    { for (j = 0; j < ndata; j++)
-      { newdata[i][j] = data[j][i];
-        newmask[i][j] = mask[j][i];
-      }
-    }
-    data = newdata;
-    mask = newmask;
+static
+double** copydistancematrix (int n, double** distmatrix)
+/* Returns a newly allocated copy of the ragged distance matrix, or NULL if a
+ * memory error occurs. */
+{ int i;
+  double** copy = malloc(n*sizeof(double*));
+  if (!copy) return NULL;
+  copy[0] = NULL;
+  for (i = 1; i < n; i++)
+  { copy[i] = malloc(i*sizeof(double));
+    if (!copy[i]) break;
+    memcpy(copy[i], distmatrix[i], i*sizeof(double));
   }
-  else
-  { for (i = 0; i < nelements; i++)
-    { memcpy(newdata[i], data[i], ndata*sizeof(double));
-      memcpy(newmask[i], mask[i], ndata*sizeof(int));
-    }
-    data = newdata;
-    mask = newmask;
+  if (i < n)
+  { while (--i > 0) free(copy[i]);
+    free(copy);
+    return NULL;
   }
+  return copy;
+}
 
-  for (inode = 0; inode < nnodes; inode++)
-  { /* Find the pair with the shortest distance */
-    int is = 1;
-    int js = 0;
-    result[inode].distance = find_closest_pair(nelements-inode, distmatrix, &is, &js);
-    result[inode].left = distid[js];
-    result[inode].right = distid[is];
+/* ******************************************************************* */
 
-    /* Make node js the new node */
-    for (i = 0; i < ndata; i++)
-    { data[js][i] = data[js][i]*mask[js][i] + data[is][i]*mask[is][i];
-      mask[js][i] += mask[is][i];
-      if (mask[js][i]) data[js][i] /= mask[js][i];
+int treeclusters (int nrows, int ncolumns, double** data, int** mask,
+  double weight[], int transpose, char dist, int nmethods, const char methods[],
+  double** distmatrix, Node* trees[])
+/*
+Purpose
+=======
+
+The treeclusters routine performs hierarchical clustering with several
+methods on the same data, as if treecluster were called once for each method.
+The distance matrix is calculated (or passed by the caller) only once, and is
+not modified. The methods that need to modify the distance matrix each work on
+a private copy, which is created just before the clustering starts and
+deallocated as soon as it has finished. If OpenMP is available, the methods are
+run concurrently.
+
+Arguments
+=========
+
+nrows     (input) int
+The number of rows in the data matrix, equal to the number of genes.
+
+ncolumns  (input) int
+The number of columns in the data matrix, equal to the number of microarrays.
+
+data       (input) double[nrows][ncolumns]
+The array containing the data of the vectors to be clustered.
+
+mask       (input) int[nrows][ncolumns]
+This array shows which data values are missing. If mask[i][j]==0, then
+data[i][j] is missing.
+
+weight (input) double array[n]
+The weights that are used to calculate the distance.
+
+transpose  (input) int
+If transpose==0, the rows of the matrix are clustered. Otherwise, columns
+of the matrix are clustered.
+
+dist       (input) char
+Defines which distance measure is used; see treecluster.
+
+nmethods   (input) int
+The number of hierarchical clustering methods.
+
+methods    (input) char[nmethods]
+The hierarchical clustering methods to be used. Each method is one of the
+characters 's', 'm', 'a', 'c', and 'w'; see treecluster.
+
+distmatrix (input) double**
+The distance matrix. If the distance matrix is zero, the distance matrix is
+allocated and calculated from the data by treeclusters, and deallocated before
+treeclusters returns. If the distance matrix is passed by the calling routine,
+its contents are not modified.
+
+trees      (output) Node*[nmethods]
+On return, trees[i] points to a newly allocated array of nelements-1 Node
+structs describing the hierarchical clustering solution found with methods[i].
+The arrays should be freed by the calling routine.
+
+Return value
+============
+
+1 if successful, and 0 if a memory error occurs. In the latter case, all
+elements of trees are set to NULL.
+========================================================================
+*/
+{ int i;
+  int ok = 1;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+  int ldistmatrix = 0;
+
+  for (i = 0; i < nmethods; i++) trees[i] = NULL;
+  if (nelements < 2) return 0;
+
+  /* Calculate the distance matrix if the user didn't give it */
+  if (!distmatrix)
+  { for (i = 0; i < nmethods; i++) if (methods[i]!='s') break;
+    if (i < nmethods)
+    { distmatrix =
+        distancematrix(nrows, ncolumns, data, mask, weight, dist, transpose);
+      if (!distmatrix) return 0; /* Insufficient memory */
+      ldistmatrix = 1;
     }
-    free(data[is]);
-    free(mask[is]);
-    data[is] = data[nnodes-inode];
-    mask[is] = mask[nnodes-inode];
-  
-    /* Fix the distances */
-    distid[is] = distid[nnodes-inode];
-    for (i = 0; i < is; i++)
-      distmatrix[is][i] = distmatrix[nnodes-inode][i];
-    for (i = is + 1; i < nnodes-inode; i++)
-      distmatrix[i][is] = distmatrix[nnodes-inode][i];
+  }
 
-    distid[js] = -inode-1;
-    for (i = 0; i < js; i++)
-      distmatrix[js][i] = metric(ndata,data,data,mask,mask,weight,js,i,0);
-    for (i = js + 1; i < nnodes-inode; i++)
-      distmatrix[i][js] = metric(ndata,data,data,mask,mask,weight,js,i,0);
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (i = 0; i < nmethods; i++)
+  { const char method = methods[i];
+    Node* result = NULL;
+    if (method=='s')
+      /* Single-linkage clustering does not modify the distance matrix */
+      result = treeworker(nrows, ncolumns, data, mask, weight, transpose,
+                          dist, method, distmatrix);
+    else
+    { double** copy = copydistancematrix(nelements, distmatrix);
+      if (copy)
+      { int j;
+        result = treeworker(nrows, ncolumns, data, mask, weight, transpose,
+                            dist, method, copy);
+        for (j = 1; j < nelements; j++) free(copy[j]);
+        free(copy);
+      }
+    }
+    trees[i] = result;
+    if (!result)
+    {
+      #pragma omp atomic write
+      ok = 0;
+    }
   }
 
-  /* Free temporarily allocated space */
-  free(data[0]);
-  free(mask[0]);
-  free(data);
-  free(mask);
-  free(distid);
- 
-  return result;
-}
+  if (!ok)
+  { for (i = 0; i < nmethods; i++)
+    { if (trees[i]) free(trees[i]);
+      trees[i] = NULL;
+    }
+  }
 
-/* ******************************************************************** */
+  /* Deallocate space for distance matrix, if it was allocated by treeclusters */
+  if (ldistmatrix)
+  { for (i = 1; i < nelements; i++) free(distmatrix[i]);
+    free(distmatrix);
+  }
 
-static
-int nodecompare(const void* a, const void* b)
-/* Helper function for qsort. */
-{ const Node* node1 = (const Node*)a;
-  const Node* node2 = (const Node*)b;
-  const double term1 = node1->distance;
-  const double term2 = node2->distance;
-  if (term1 < term2) return -1;
-  if (term1 > term2) return +1;
-  return 0;
+  return ok;
 }
 
-/* ---------------------------------------------------------------------- */
-
-static
-Node* pslcluster (int nrows, int ncolumns, double** data, int** mask,
-  double weight[], double** distmatrix, char dist, int transpose)
+/* ******************************************************************* */
 
+Node* approxtreecluster (int nrows, int ncolumns, double** data, int** mask,
+  double weight[], int transpose, char dist, char method, int nsummary,
+  int refine)
 /*
-
 Purpose
 =======
 
-The pslcluster routine performs single-linkage hierarchical clustering, using
-either the distance matrix directly, if available, or by calculating the
-distances from the data array. This implementation is based on the SLINK
-algorithm, described in:
-Sibson, R. (1973). SLINK: An optimally efficient algorithm for the single-link
-cluster method. The Computer Journal, 16(1): 30-34.
-The output of this algorithm is identical to conventional single-linkage
-hierarchical clustering, but is much more memory-efficient and faster. Hence,
-it can be applied to large data sets, for which the conventional single-
-linkage algorithm fails due to lack of memory.
-
+The approxtreecluster routine performs approximate hierarchical clustering of
+large data sets in two stages. First, the elements are summarized into nsummary
+micro-clusters by k-means clustering. Next, the centroids of the
+micro-clusters are clustered hierarchically by treecluster. Finally, each
+micro-cluster is expanded back into its members, giving a hierarchical
+clustering solution for all elements. The time and memory needed scale with
+nsummary^2 instead of with the square of the number of elements.
 
 Arguments
 =========
 
 nrows     (input) int
-The number of rows in the gene expression data matrix, equal to the number of
-genes.
+The number of rows in the data matrix, equal to the number of genes.
 
 ncolumns  (input) int
-The number of columns in the gene expression data matrix, equal to the number of
-microarrays.
+The number of columns in the data matrix, equal to the number of microarrays.
 
 data       (input) double[nrows][ncolumns]
-The array containing the gene expression data.
+The array containing the data of the vectors to be clustered.
 
 mask       (input) int[nrows][ncolumns]
-This array shows which data values are missing. If
-mask[i][j] == 0, then data[i][j] is missing.
+This array shows which data values are missing. If mask[i][j]==0, then
+data[i][j] is missing.
 
-weight (input) double[n]
-The weights that are used to calculate the distance. The length of this vector
-is ncolumns if genes are being clustered, and nrows if microarrays are being
-clustered.
+weight (input) double array[n]
+The weights that are used to calculate the distance.
 
 transpose  (input) int
 If transpose==0, the rows of the matrix are clustered. Otherwise, columns
 of the matrix are clustered.
 
 dist       (input) char
-Defines which distance measure is used, as given by the table:
-dist=='e': Euclidean distance
-dist=='b': City-block distance
-dist=='c': correlation
-dist=='a': absolute value of the correlation
-dist=='u': uncentered correlation
-dist=='x': absolute uncentered correlation
-dist=='s': Spearman's rank correlation
-dist=='k': Kendall's tau
-For other values of dist, the default (Euclidean distance) is used.
+Defines which distance measure is used; see treecluster.
 
-distmatrix (input) double**
-The distance matrix. If the distance matrix is passed by the calling routine
-treecluster, it is used by pslcluster to speed up the clustering calculation.
-The pslcluster routine does not modify the contents of distmatrix, and does
-not deallocate it. If distmatrix is NULL, the pairwise distances are calculated
-by the pslcluster routine from the gene expression data (the data and mask
-arrays) and stored in temporary arrays. If distmatrix is passed, the original
-gene expression data (specified by the data and mask arguments) are not needed
-and are therefore ignored.
+method     (input) char
+Defines which hierarchical clustering method is used; see treecluster.
+
+nsummary   (input) int
+The number of micro-clusters. The k-means clustering starts from a
+deterministic initial assignment, in which element i is assigned to
+micro-cluster i % nsummary. If nsummary is not smaller than the number of
+elements, the exact solution is calculated by treecluster.
 
+refine     (input) int
+If refine is nonzero, the members of each micro-cluster are clustered exactly
+by treecluster. Otherwise, the members of each micro-cluster are joined one by
+one at a distance of zero.
 
 Return value
 ============
 
 A pointer to a newly allocated array of Node structs, describing the
-hierarchical clustering solution consisting of nelements-1 nodes. Depending on
-whether genes (rows) or microarrays (columns) were clustered, nelements is
-equal to nrows or ncolumns. See src/cluster.h for a description of the Node
-structure.
-If a memory error occurs, pslcluster returns NULL.
-
+hierarchical clustering solution consisting of nelements-1 nodes. The nodes
+within the micro-clusters are stored first, followed by the nodes joining the
+micro-clusters. The latter are stored in the order given by treecluster, so
+that cuttree can be used to divide the elements into at most nsummary
+clusters. If a memory error occurs, approxtreecluster returns NULL.
 ========================================================================
 */
 { int i, j, k;
-  const int nelements = transpose ? ncolumns : nrows;
-  const int nnodes = nelements - 1;
-  int* vector;
-  double* temp;
-  int* index;
+  int ok = 1;
+  int ifound;
+  int nclusters;
+  double error;
+  const int nelements = (transpose==0) ? nrows : ncolumns;
+  const int ndata = (transpose==0) ? ncolumns : nrows;
+  int* clusterid;
+  int* start;
+  int* members;
+  int* mapping;
+  double** cdata;
+  int** cmask;
+  Node* top = NULL;
   Node* result;
-  temp = malloc(nnodes*sizeof(double));
-  if(!temp) return NULL;
-  index = malloc(nelements*sizeof(int));
-  if(!index)
-  { free(temp);
-    return NULL;
-  }
-  vector = malloc(nnodes*sizeof(int));
-  if(!vector)
-  { free(index);
-    free(temp);
+
+  if (nsummary >= nelements || nsummary < 1)
+    return treecluster(nrows, ncolumns, data, mask, weight, transpose, dist,
+                       method, NULL);
+
+  clusterid = malloc(nelements*sizeof(int));
+  if (!clusterid) return NULL;
+  for (i = 0; i < nelements; i++) clusterid[i] = i % nsummary;
+  kcluster(nsummary, nrows, ncolumns, data, mask, weight, transpose, 0, 'a',
+           dist, 'r', 0, clusterid, &error, &ifound, NULL, NULL);
+  if (ifound < 1)
+  { free(clusterid);
     return NULL;
   }
-  result = malloc(nelements*sizeof(Node));
-  if(!result)
-  { free(vector);
-    free(index);
-    free(temp);
+
+  start = malloc((nsummary+1)*sizeof(int));
+  members = malloc(nelements*sizeof(int));
+  mapping = malloc(nsummary*sizeof(int));
+  result = malloc((nelements-1)*sizeof(Node));
+  if (!start || !members || !mapping || !result)
+  { free(clusterid);
+    if (start) free(start);
+    if (members) free(members);
+    if (mapping) free(mapping);
+    if (result) free(result);
     return NULL;
   }
 
-  for (i = 0; i < nnodes; i++) vector[i] = i;
-
-  if(distmatrix)
-  { for (i = 0; i < nrows; i++)
-    { result[i].distance = DBL_MAX;
-      for (j = 0; j < i; j++) temp[j] = distmatrix[i][j];
-      for (j = 0; j < i; j++)
-      { k = vector[j];
-        if (result[j].distance >= temp[j])
-        { if (result[j].distance < temp[k]) temp[k] = result[j].distance;
-          result[j].distance = temp[j];
-          vector[j] = i;
+  /* Number the micro-clusters consecutively, skipping empty ones */
+  for (k = 0; k < nsummary; k++) mapping[k] = 0;
+  for (i = 0; i < nelements; i++) mapping[clusterid[i]]++;
+  nclusters = 0;
+  for (k = 0; k < nsummary; k++)
+  { if (mapping[k] > 0)
+    { start[nclusters] = mapping[k];
+      mapping[k] = nclusters++;
+    }
+    else mapping[k] = -1;
+  }
+  for (i = 0; i < nelements; i++) clusterid[i] = mapping[clusterid[i]];
+  free(mapping);
+
+  /* Store the members of each micro-cluster consecutively */
+  j = 0;
+  for (k = 0; k < nclusters; k++)
+  { int count = start[k];
+    start[k] = j;
+    j += count;
+  }
+  start[nclusters] = nelements;
+  for (i = 0; i < nelements; i++) members[start[clusterid[i]]++] = i;
+  for (k = nclusters; k > 0; k--) start[k] = start[k-1];
+  start[0] = 0;
+
+  /* Expand each micro-cluster into a subtree. The nodes of micro-cluster k
+   * are stored starting at index start[k]-k. */
+  #pragma omp parallel for schedule(dynamic, 1) private(i, j)
+  for (k = 0; k < nclusters; k++)
+  { const int n = start[k+1] - start[k];
+    const int offset = start[k] - k;
+    const int* index = members + start[k];
+    Node* subtree = NULL;
+    if (n < 2) continue;
+    if (refine)
+    { double** subdata = NULL;
+      int** submask = NULL;
+      if (transpose==0)
+      { subdata = malloc(n*sizeof(double*));
+        submask = malloc(n*sizeof(int*));
+        if (subdata && submask)
+        { for (i = 0; i < n; i++)
+          { subdata[i] = data[index[i]];
+            submask[i] = mask[index[i]];
+          }
+          subtree = treecluster(n, ncolumns, subdata, submask, weight, 0,
+                                dist, method, NULL);
         }
-        else if (temp[j] < temp[k]) temp[k] = temp[j];
+        if (subdata) free(subdata);
+        if (submask) free(submask);
       }
-      for (j = 0; j < i; j++)
+      else if (makedatamask(nrows, n, &subdata, &submask))
+      { for (i = 0; i < nrows; i++)
+        { for (j = 0; j < n; j++)
+          { subdata[i][j] = data[i][index[j]];
+            submask[i][j] = mask[i][index[j]];
+          }
+        }
+        subtree = treecluster(nrows, n, subdata, submask, weight, 1,
+                              dist, method, NULL);
+        freedatamask(nrows, subdata, submask);
+      }
+      if (!subtree)
       {
-        if (result[j].distance >= result[vector[j]].distance) vector[j] = i;
+        #pragma omp atomic write
+        ok = 0;
+        continue;
+      }
+      for (i = 0; i < n-1; i++)
+      { int left = subtree[i].left;
+        int right = subtree[i].right;
+        result[offset+i].left = (left>=0) ? index[left] : left-offset;
+        result[offset+i].right = (right>=0) ? index[right] : right-offset;
+        result[offset+i].distance = subtree[i].distance;
+      }
+      free(subtree);
+    }
+    else
+    { result[offset].left = index[0];
+      result[offset].right = index[1];
+      result[offset].distance = 0.0;
+      for (i = 1; i < n-1; i++)
+      { result[offset+i].left = -(offset+i);
+        result[offset+i].right = index[i+1];
+        result[offset+i].distance = 0.0;
       }
     }
   }
-  else
-  { const int ndata = transpose ? nrows : ncolumns;
-    /* Set the metric function as indicated by dist */
-    double (*metric)
-      (int, double**, double**, int**, int**, const double[], int, int, int) =
-         setmetric(dist);
+  if (!ok)
+  { free(clusterid);
+    free(start);
+    free(members);
+    free(result);
+    return NULL;
+  }
 
-    for (i = 0; i < nelements; i++)
-    { result[i].distance = DBL_MAX;
-      for (j = 0; j < i; j++) temp[j] =
-        metric(ndata, data, data, mask, mask, weight, i, j, transpose);
-      for (j = 0; j < i; j++)
-      { k = vector[j];
-        if (result[j].distance >= temp[j])
-        { if (result[j].distance < temp[k]) temp[k] = result[j].distance;
-          result[j].distance = temp[j];
-          vector[j] = i;
+  /* Join the micro-clusters by clustering their centroids */
+  if (nclusters > 1)
+  { if (transpose==0) ok = makedatamask(nclusters, ndata, &cdata, &cmask);
+    else ok = makedatamask(ndata, nclusters, &cdata, &cmask);
+    if (ok)
+    { ok = getclustercentroids(nclusters, nrows, ncolumns, data, mask,
+                               clusterid, cdata, cmask, transpose, 'a');
+      if (ok)
+      { if (transpose==0)
+          top = treecluster(nclusters, ndata, cdata, cmask, weight, 0, dist,
+                            method, NULL);
+        else
+          top = treecluster(ndata, nclusters, cdata, cmask, weight, 1, dist,
+                            method, NULL);
+        if (!top) ok = 0;
+      }
+      if (transpose==0) freedatamask(nclusters, cdata, cmask);
+      else freedatamask(ndata, cdata, cmask);
+    }
+    if (ok)
+    { const int offset = nelements - nclusters;
+      for (i = 0; i < nclusters-1; i++)
+      { for (j = 0; j < 2; j++)
+        { int node = (j==0) ? top[i].left : top[i].right;
+          if (node < 0) node -= offset;
+          else
+          { /* Replace the micro-cluster by the root of its subtree */
+            const int n = start[node+1] - start[node];
+            if (n==1) node = members[start[node]];
+            else node = -(start[node+1]-node-1);
+          }
+          if (j==0) result[offset+i].left = node;
+          else result[offset+i].right = node;
         }
-        else if (temp[j] < temp[k]) temp[k] = temp[j];
+        result[offset+i].distance = top[i].distance;
       }
-      for (j = 0; j < i; j++)
-        if (result[j].distance >= result[vector[j]].distance) vector[j] = i;
+      free(top);
     }
   }
-  free(temp);
-
-  for (i = 0; i < nnodes; i++) result[i].left = i;
-  qsort(result, nnodes, sizeof(Node), nodecompare);
 
-  for (i = 0; i < nelements; i++) index[i] = i;
-  for (i = 0; i < nnodes; i++)
-  { j = result[i].left;
-    k = vector[j];
-    result[i].left = index[j];
-    result[i].right = index[k];
-    index[k] = -i-1;
+  free(clusterid);
+  free(start);
+  free(members);
+  if (!ok)
+  { free(result);
+    return NULL;
   }
-  free(vector);
-  free(index);
-
-  result = realloc(result, nnodes*sizeof(Node));
-
   return result;
 }
-/* ******************************************************************** */
-
-static Node* pmlcluster (int nelements, double** distmatrix)
-/*
-
-Purpose
-=======
-
-The pmlcluster routine performs clustering using pairwise maximum- (complete-)
-linking on the given distance matrix.
-
-Arguments
-=========
 
-nelements     (input) int
-The number of elements to be clustered.
+/* ******************************************************************* */
 
-distmatrix (input) double**
-The distance matrix, with nelements rows, each row being filled up to the
-diagonal. The elements on the diagonal are not used, as they are assumed to be
-zero. The distance matrix will be modified by this routine.
+typedef struct {int id; int count; double value;} Link;
+/* The linkage between a cluster and its neighbor id, based on count edges. For
+ * average linkage, value is the sum of the edge distances; for single and
+ * maximum linkage, it is their minimum or maximum, respectively. */
 
-Return value
-============
+typedef struct {double distance; int i; int j;} Candidate;
+/* A candidate merge of clusters i and j (with i < j) in the priority queue */
 
-A pointer to a newly allocated array of Node structs, describing the
-hierarchical clustering solution consisting of nelements-1 nodes. Depending on
-whether genes (rows) or microarrays (columns) were clustered, nelements is
-equal to nrows or ncolumns. See src/cluster.h for a description of the Node
-structure.
-If a memory error occurs, pmlcluster returns NULL.
-========================================================================
-*/
-{ int j;
-  int n;
-  int* clusterid;
-  Node* result;
+static int
+candidatebefore(const Candidate* a, const Candidate* b)
+/* Returns 1 if candidate a is to be merged before candidate b. Ties are broken
+ * by the cluster numbers, so that the result is deterministic. */
+{ if (a->distance < b->distance) return 1;
+  if (a->distance > b->distance) return 0;
+  if (a->i != b->i) return a->i < b->i;
+  return a->j < b->j;
+}
 
-  clusterid = malloc(nelements*sizeof(int));
-  if(!clusterid) return NULL;
-  result = malloc((nelements-1)*sizeof(Node));
-  if (!result)
-  { free(clusterid);
-    return NULL;
+static void
+heappush(Candidate heap[], int* n, Candidate candidate)
+{ int i = (*n)++;
+  while (i > 0)
+  { const int parent = (i-1)/2;
+    if (!candidatebefore(&candidate, &heap[parent])) break;
+    heap[i] = heap[parent];
+    i = parent;
   }
+  heap[i] = candidate;
+}
 
-  /* Setup a list specifying to which cluster a gene belongs */
-  for (j = 0; j < nelements; j++) clusterid[j] = j;
-
-  for (n = nelements; n > 1; n--)
-  { int is = 1;
-    int js = 0;
-    result[nelements-n].distance = find_closest_pair(n, distmatrix, &is, &js);
-
-    /* Fix the distances */
-    for (j = 0; j < js; j++)
-      distmatrix[js][j] = max(distmatrix[is][j],distmatrix[js][j]);
-    for (j = js+1; j < is; j++)
-      distmatrix[j][js] = max(distmatrix[is][j],distmatrix[j][js]);
-    for (j = is+1; j < n; j++)
-      distmatrix[j][js] = max(distmatrix[j][is],distmatrix[j][js]);
-
-    for (j = 0; j < is; j++) distmatrix[is][j] = distmatrix[n-1][j];
-    for (j = is+1; j < n-1; j++) distmatrix[j][is] = distmatrix[n-1][j];
+static Candidate
+heappop(Candidate heap[], int* n)
+{ int i = 0;
+  const Candidate top = heap[0];
+  const Candidate last = heap[--(*n)];
+  while (1)
+  { int child = 2*i+1;
+    if (child >= *n) break;
+    if (child+1 < *n && candidatebefore(&heap[child+1], &heap[child])) child++;
+    if (!candidatebefore(&heap[child], &last)) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  if (*n > 0) heap[i] = last;
+  return top;
+}
 
-    /* Update clusterids */
-    result[nelements-n].left = clusterid[is];
-    result[nelements-n].right = clusterid[js];
-    clusterid[js] = n-nelements-1;
-    clusterid[is] = clusterid[n-1];
+static int
+findroot(int parent[], int i)
+/* Union-find with path compression */
+{ int root = i;
+  int next;
+  while (parent[root]!=root) root = parent[root];
+  while (parent[i]!=root)
+  { next = parent[i];
+    parent[i] = root;
+    i = next;
   }
-  free(clusterid);
+  return root;
+}
 
-  return result;
+static int
+mergelinks(int nlinks, const Link links[], Link merged[], int parent[],
+  int position[], int self, char method)
+/* Combines the links that refer to the same cluster, after replacing each
+ * neighbor by the cluster it currently belongs to. Links to the cluster self
+ * are dropped. The combined links are stored in merged, and their number is
+ * returned. On input and on output, position[i]==-1 for all i. */
+{ int i, k;
+  int n = 0;
+  for (i = 0; i < nlinks; i++)
+  { const int id = findroot(parent, links[i].id);
+    if (id==self) continue;
+    k = position[id];
+    if (k < 0)
+    { position[id] = n;
+      merged[n].id = id;
+      merged[n].count = links[i].count;
+      merged[n].value = links[i].value;
+      n++;
+    }
+    else
+    { merged[k].count += links[i].count;
+      switch (method)
+      { case 's':
+          if (links[i].value < merged[k].value) merged[k].value = links[i].value;
+          break;
+        case 'm':
+          if (links[i].value > merged[k].value) merged[k].value = links[i].value;
+          break;
+        default:
+          merged[k].value += links[i].value;
+          break;
+      }
+    }
+  }
+  for (k = 0; k < n; k++) position[merged[k].id] = -1;
+  return n;
 }
 
-/* ******************************************************************* */
+/* ---------------------------------------------------------------------- */
 
-static Node* palcluster (int nelements, double** distmatrix)
+Node* sparsetreecluster (int nelements, int nedges, const int edgei[],
+  const int edgej[], const double edged[], char method)
 /*
 Purpose
 =======
 
-The palcluster routine performs clustering using pairwise average
-linking on the given distance matrix.
-
+The sparsetreecluster routine performs hierarchical clustering on a sparse
+graph, for example a k-nearest-neighbor graph or a graph of all pairs with a
+distance below a threshold. Only the distances given by the edges are used;
+the memory needed is proportional to the number of edges instead of to the
+square of the number of elements. Clusters are merged in the order given by a
+priority queue of candidate merges, while a union-find structure keeps track of
+the cluster to which each element belongs.
+
+Two clusters can only be merged if they are connected by at least one edge. The
+distance between two clusters is calculated from the edges between them only:
+their smallest (method=='s'), largest (method=='m'), or average (method=='a')
+distance. For single-linkage clustering, this gives the same result as
+treecluster on the full distance matrix if the graph contains the minimum
+spanning tree. Once no edges are left, the remaining clusters are joined one by
+one at distance DBL_MAX, so that the result is a complete tree; the nodes
+with distance DBL_MAX can be removed to obtain a forest.
+
 Arguments
 =========
 
-nelements     (input) int
+nelements  (input) int
 The number of elements to be clustered.
 
-distmatrix (input) double**
-The distance matrix, with nelements rows, each row being filled up to the
-diagonal. The elements on the diagonal are not used, as they are assumed to be
-zero. The distance matrix will be modified by this routine.
+nedges     (input) int
+The number of edges.
+
+edgei      (input) int[nedges]
+edgej      (input) int[nedges]
+edged      (input) double[nedges]
+Edge k connects elements edgei[k] and edgej[k] with distance edged[k]. Edges
+between an element and itself and edges referring to nonexisting elements are
+ignored. If an edge occurs more than once, the distances are combined in the
+same way as the distances between clusters.
+
+method     (input) char
+Defines which hierarchical clustering method is used:
+method=='s': single-linkage clustering
+method=='m': maximum- (or complete-) linkage clustering
+method=='a': average-linkage clustering
 
 Return value
 ============
 
 A pointer to a newly allocated array of Node structs, describing the
-hierarchical clustering solution consisting of nelements-1 nodes. Depending on
-whether genes (rows) or microarrays (columns) were clustered, nelements is
-equal to nrows or ncolumns. See src/cluster.h for a description of the Node
-structure.
-If a memory error occurs, palcluster returns NULL.
+hierarchical clustering solution consisting of nelements-1 nodes, in the order
+in which they were formed. If a memory error occurs, sparsetreecluster returns
+NULL.
 ========================================================================
 */
-{ int j;
-  int n;
-  int* clusterid;
-  int* number;
+{ int i, j, k;
+  int ok = 1;
+  int inode = 0;
+  int nheap = 0;
+  int nheapmax = 0;
+  const int nclusters = 2*nelements-1;
+  int* parent;
+  int* position;
+  int* nlinks;
+  Link** links;
+  Link* buffer;
+  Candidate* heap;
   Node* result;
 
-  clusterid = malloc(nelements*sizeof(int));
-  if(!clusterid) return NULL;
-  number = malloc(nelements*sizeof(int));
-  if(!number)
-  { free(clusterid);
-    return NULL;
-  }
+  if (nelements < 2) return NULL;
+
+  parent = malloc(nclusters*sizeof(int));
+  position = malloc(nclusters*sizeof(int));
+  nlinks = calloc(nclusters, sizeof(int));
+  links = calloc(nclusters, sizeof(Link*));
   result = malloc((nelements-1)*sizeof(Node));
-  if (!result)
-  { free(clusterid);
-    free(number);
+  if (!parent || !position || !nlinks || !links || !result)
+  { if (parent) free(parent);
+    if (position) free(position);
+    if (nlinks) free(nlinks);
+    if (links) free(links);
+    if (result) free(result);
     return NULL;
   }
 
-  /* Setup a list specifying to which cluster a gene belongs, and keep track
-   * of the number of elements in each cluster (needed to calculate the
-   * average). */
-  for (j = 0; j < nelements; j++)
-  { number[j] = 1;
-    clusterid[j] = j;
+  for (i = 0; i < nclusters; i++)
+  { parent[i] = i;
+    position[i] = -1;
   }
 
-  for (n = nelements; n > 1; n--)
-  { int sum;
-    int is = 1;
-    int js = 0;
-    result[nelements-n].distance = find_closest_pair(n, distmatrix, &is, &js);
+  /* Collect the edges of each element */
+  for (k = 0; k < nedges; k++)
+  { i = edgei[k];
+    j = edgej[k];
+    if (i==j || i < 0 || j < 0 || i >= nelements || j >= nelements) continue;
+    nlinks[i]++;
+    nlinks[j]++;
+  }
+  for (i = 0; i < nelements; i++)
+  { if (nlinks[i]==0) continue;
+    links[i] = malloc(nlinks[i]*sizeof(Link));
+    if (!links[i])
+    { ok = 0;
+      break;
+    }
+    nlinks[i] = 0;
+  }
+  if (ok)
+  { for (k = 0; k < nedges; k++)
+    { Link* link;
+      i = edgei[k];
+      j = edgej[k];
+      if (i==j || i < 0 || j < 0 || i >= nelements || j >= nelements) continue;
+      link = &links[i][nlinks[i]++];
+      link->id = j;
+      link->count = 1;
+      link->value = edged[k];
+      link = &links[j][nlinks[j]++];
+      link->id = i;
+      link->count = 1;
+      link->value = edged[k];
+    }
+    for (i = 0; i < nelements; i++) nheapmax += nlinks[i];
+  }
 
-    /* Save result */
-    result[nelements-n].left = clusterid[is];
-    result[nelements-n].right = clusterid[js];
+  /* The heap needs one entry for each pair of elements connected by an edge,
+   * and one for each neighbor of each newly formed cluster. The latter number
+   * is at most the total number of links. */
+  heap = ok ? malloc((nheapmax+1)*sizeof(Candidate)) : NULL;
+  buffer = heap ? malloc((nheapmax+1)*sizeof(Link)) : NULL;
+  if (!buffer)
+  { if (heap) free(heap);
+    for (i = 0; i < nelements; i++) if (links[i]) free(links[i]);
+    free(parent);
+    free(position);
+    free(nlinks);
+    free(links);
+    free(result);
+    return NULL;
+  }
 
-    /* Fix the distances */
-    sum = number[is] + number[js];
-    for (j = 0; j < js; j++)
-    { distmatrix[js][j] = distmatrix[is][j]*number[is]
-                        + distmatrix[js][j]*number[js];
-      distmatrix[js][j] /= sum;
+  /* Combine duplicate edges, and add the candidate merges to the heap */
+  for (i = 0; i < nelements; i++)
+  { const int n = mergelinks(nlinks[i], links[i], buffer, parent, position, i,
+                             method);
+    for (k = 0; k < n; k++)
+    { Candidate candidate;
+      links[i][k] = buffer[k];
+      if (buffer[k].id < i) continue;
+      candidate.i = i;
+      candidate.j = buffer[k].id;
+      candidate.distance = (method=='a') ? buffer[k].value / buffer[k].count
+                                         : buffer[k].value;
+      heappush(heap, &nheap, candidate);
+    }
+    nlinks[i] = n;
+  }
+
+  while (nheap > 0)
+  { int n;
+    const int c = nelements + inode;
+    Candidate candidate = heappop(heap, &nheap);
+    i = candidate.i;
+    j = candidate.j;
+    /* Skip candidates referring to clusters that were merged already */
+    if (parent[i]!=i || parent[j]!=j) continue;
+
+    result[inode].left = (i < nelements) ? i : nelements-i-1;
+    result[inode].right = (j < nelements) ? j : nelements-j-1;
+    result[inode].distance = candidate.distance;
+    inode++;
+    parent[i] = c;
+    parent[j] = c;
+
+    /* Collect the links of the new cluster */
+    n = nlinks[i] + nlinks[j];
+    if (n > 0)
+    { memcpy(buffer, links[i], nlinks[i]*sizeof(Link));
+      memcpy(buffer+nlinks[i], links[j], nlinks[j]*sizeof(Link));
+      if (links[i]) free(links[i]);
+      if (links[j]) free(links[j]);
+      links[i] = NULL;
+      links[j] = NULL;
+      links[c] = malloc(n*sizeof(Link));
+      if (!links[c])
+      { ok = 0;
+        break;
+      }
+      n = mergelinks(n, buffer, links[c], parent, position, c, method);
     }
-    for (j = js+1; j < is; j++)
-    { distmatrix[j][js] = distmatrix[is][j]*number[is]
-                        + distmatrix[j][js]*number[js];
-      distmatrix[j][js] /= sum;
+    nlinks[c] = n;
+
+    /* Check if the heap has enough space for the new candidates; if not,
+     * remove the candidates that are no longer valid. */
+    if (nheap + n > nheapmax)
+    { int m = 0;
+      for (k = 0; k < nheap; k++)
+        if (parent[heap[k].i]==heap[k].i && parent[heap[k].j]==heap[k].j)
+          heap[m++] = heap[k];
+      nheap = 0;
+      for (k = 0; k < m; k++) heappush(heap, &nheap, heap[k]);
     }
-    for (j = is+1; j < n; j++)
-    { distmatrix[j][js] = distmatrix[j][is]*number[is]
-                        + distmatrix[j][js]*number[js];
-      distmatrix[j][js] /= sum;
+    for (k = 0; k < n; k++)
+    { const Link* link = &links[c][k];
+      candidate.i = link->id;
+      candidate.j = c;
+      candidate.distance = (method=='a') ? link->value / link->count
+                                         : link->value;
+      heappush(heap, &nheap, candidate);
     }
+  }
 
-    for (j = 0; j < is; j++) distmatrix[is][j] = distmatrix[n-1][j];
-    for (j = is+1; j < n-1; j++) distmatrix[j][is] = distmatrix[n-1][j];
+  if (ok)
+  { /* Join the remaining clusters at an infinite distance */
+    const int n = nelements + inode;
+    j = -1;
+    for (i = 0; i < n; i++)
+    { if (parent[i]!=i) continue;
+      if (j >= 0)
+      { const int c = nelements + inode;
+        result[inode].left = (j < nelements) ? j : nelements-j-1;
+        result[inode].right = (i < nelements) ? i : nelements-i-1;
+        result[inode].distance = DBL_MAX;
+        inode++;
+        parent[i] = c;
+        parent[j] = c;
+        j = c;
+      }
+      else j = i;
+    }
+  }
 
-    /* Update number of elements in the clusters */
-    number[js] = sum;
-    number[is] = number[n-1];
+  for (i = 0; i < nclusters; i++) if (links[i]) free(links[i]);
+  free(links);
+  free(nlinks);
+  free(heap);
+  free(buffer);
+  free(parent);
+  free(position);
 
-    /* Update clusterids */
-    clusterid[js] = n-nelements-1;
-    clusterid[is] = clusterid[n-1];
+  if (!ok)
+  { free(result);
+    return NULL;
   }
-  free(clusterid);
-  free(number);
-
   return result;
 }
 
 /* ******************************************************************* */
 
-Node* treecluster (int nrows, int ncolumns, double** data, int** mask,
-  double weight[], int transpose, char dist, char method, double** distmatrix)
-/*
-Purpose
-=======
-
-The treecluster routine performs hierarchical clustering using pairwise
-single-, maximum-, centroid-, or average-linkage, as defined by method, on a
-given set of gene expression data, using the distance metric given by dist.
-If successful, the function returns a pointer to a newly allocated Tree struct
-containing the hierarchical clustering solution, and NULL if a memory error
-occurs. The pointer should be freed by the calling routine to prevent memory
-leaks.
+static double
+pairvalue(double** matrix, int i, int j)
+/* Returns the value for the pair (i,j) stored in a ragged matrix, or zero if
+ * i==j. */
+{ if (i > j) return matrix[i][j];
+  if (i < j) return matrix[j][i];
+  return 0.0;
+}
 
-Arguments
-=========
+static int
+candidatecompare(const void* a, const void* b)
+/* Helper function for qsort. */
+{ return candidatebefore((const Candidate*)a, (const Candidate*)b) ? -1 : +1;
+}
 
-nrows     (input) int
-The number of rows in the data matrix, equal to the number of genes.
+static void
+getinterval(int child, const int start[], const int size[], const int where[],
+  int* first, int* n)
+/* Finds the positions of the elements below a node or element in the leaf
+ * order, which are first..first+n-1. */
+{ if (child >= 0)
+  { *first = where[child];
+    *n = 1;
+  }
+  else
+  { *first = start[-child-1];
+    *n = size[-child-1];
+  }
+}
 
-ncolumns  (input) int
-The number of columns in the data matrix, equal to the number of microarrays.
+static int
+getopposite(const Node* tree, int child, int element, const int start[],
+  const int size[], const int where[], int* first, int* n)
+/* Finds the elements that can end the ordering of the subtree below child if
+ * it starts with element: the elements in the other branch of child, or the
+ * element itself if child is an element. Returns which branch was found. */
+{ int left, right;
+  if (child >= 0)
+  { *first = where[element];
+    *n = 1;
+    return 0;
+  }
+  left = tree[-child-1].left;
+  right = tree[-child-1].right;
+  getinterval(left, start, size, where, first, n);
+  if (where[element] >= *first && where[element] < *first + *n)
+  { getinterval(right, start, size, where, first, n);
+    return 1;
+  }
+  return 0;
+}
 
-data       (input) double[nrows][ncolumns]
-The array containing the data of the vectors to be clustered.
+/* ---------------------------------------------------------------------- */
 
-mask       (input) int[nrows][ncolumns]
-This array shows which data values are missing. If mask[i][j]==0, then
-data[i][j] is missing.
+int optimalleaforder (int nelements, Node* tree, double** distmatrix,
+  int order[])
+/*
+Purpose
+=======
 
-weight (input) double array[n]
-The weights that are used to calculate the distance.
+The optimalleaforder routine finds the order of the elements in a hierarchical
+clustering tree that minimizes the sum of the distances between adjacent
+elements, among all orders obtained by swapping the two branches of the nodes.
+The algorithm of Bar-Joseph, Gifford, and Jaakkola (Bioinformatics 17, Suppl 1,
+S22 (2001)) is used. For each pair of elements i and j, the minimum cost of the
+subtree below the node joining them, with i and j at its two ends, is stored.
+The candidates for the inner ends of the two branches are examined in order of
+increasing cost, which allows the search to stop early; the worst case is
+O(nelements^3), but in practice most candidates are never examined.
 
-transpose  (input) int
-If transpose==0, the rows of the matrix are clustered. Otherwise, columns
-of the matrix are clustered.
+Arguments
+=========
 
-dist       (input) char
-Defines which distance measure is used, as given by the table:
-dist=='e': Euclidean distance
-dist=='b': City-block distance
-dist=='c': correlation
-dist=='a': absolute value of the correlation
-dist=='u': uncentered correlation
-dist=='x': absolute uncentered correlation
-dist=='s': Spearman's rank correlation
-dist=='k': Kendall's tau
-For other values of dist, the default (Euclidean distance) is used.
+nelements      (input) int
+The number of elements that were clustered.
 
-method     (input) char
-Defines which hierarchical clustering method is used:
-method=='s': pairwise single-linkage clustering
-method=='m': pairwise maximum- (or complete-) linkage clustering
-method=='a': pairwise average-linkage clustering
-method=='c': pairwise centroid-linkage clustering
-For the first three, either the distance matrix or the gene expression data is
-sufficient to perform the clustering algorithm. For pairwise centroid-linkage
-clustering, however, the gene expression data are always needed, even if the
-distance matrix itself is available.
+tree           (input) Node[nelements-1]
+The clustering solution. Each node in the array describes one linking event,
+with tree[i].left and tree[i].right representig the elements that were joined.
+The original elements are numbered 0..nelements-1, nodes are numbered
+-1..-(nelements-1).
 
 distmatrix (input) double**
-The distance matrix. If the distance matrix is zero initially, the distance
-matrix will be allocated and calculated from the data by treecluster, and
-deallocated before treecluster returns. If the distance matrix is passed by the
-calling routine, treecluster will modify the contents of the distance matrix as
-part of the clustering algorithm, but will not deallocate it. The calling
-routine should deallocate the distance matrix after the return from treecluster.
+The distance matrix, with nelements rows, each row being filled up to the
+diagonal. It is not modified.
+
+order          (output) int[nelements]
+The position of each element in the optimal order.
 
 Return value
 ============
 
-A pointer to a newly allocated array of Node structs, describing the
-hierarchical clustering solution consisting of nelements-1 nodes. Depending on
-whether genes (rows) or microarrays (columns) were clustered, nelements is
-equal to nrows or ncolumns. See src/cluster.h for a description of the Node
-structure.
-If a memory error occurs, treecluster returns NULL.
-
+1 if successful, and 0 if a memory error occurs.
 ========================================================================
 */
-{ Node* result = NULL;
-  const int nelements = (transpose==0) ? nrows : ncolumns;
-  const int ldistmatrix = (distmatrix==NULL && method!='s') ? 1 : 0;
+{ int i, j, k;
+  int v;
+  int root = -1;
+  int nstack = 0;
+  int position = 0;
+  int ok = 1;
+  const int nnodes = nelements - 1;
+  int* parent;
+  int* start;
+  int* size;
+  int* leaves;
+  int* where;
+  int* stack;
+  double** cost;
+  double* bounds;
+  Candidate* candidates;
+
+  if (nelements < 2)
+  { if (nelements==1) order[0] = 0;
+    return 1;
+  }
 
-  if (nelements < 2) return NULL;
+  parent = malloc(nnodes*sizeof(int));
+  start = malloc(nnodes*sizeof(int));
+  size = malloc(nnodes*sizeof(int));
+  leaves = malloc(nelements*sizeof(int));
+  where = malloc(nelements*sizeof(int));
+  stack = malloc(4*nelements*sizeof(int));
+  candidates = malloc(nelements*sizeof(Candidate));
+  bounds = malloc(2*nelements*sizeof(double));
+  cost = malloc(nelements*sizeof(double*));
+  if (cost)
+  { cost[0] = NULL;
+    for (i = 1; i < nelements; i++)
+    { cost[i] = malloc(i*sizeof(double));
+      if (!cost[i]) break;
+    }
+    if (i < nelements)
+    { while (--i > 0) free(cost[i]);
+      free(cost);
+      cost = NULL;
+    }
+  }
+  if (!parent || !start || !size || !leaves || !where || !stack
+   || !candidates || !bounds || !cost)
+  { if (parent) free(parent);
+    if (start) free(start);
+    if (size) free(size);
+    if (leaves) free(leaves);
+    if (where) free(where);
+    if (stack) free(stack);
+    if (candidates) free(candidates);
+    if (bounds) free(bounds);
+    if (cost)
+    { for (i = 1; i < nelements; i++) free(cost[i]);
+      free(cost);
+    }
+    return 0;
+  }
 
-  /* Calculate the distance matrix if the user didn't give it */
-  if(ldistmatrix)
-  { distmatrix =
-      distancematrix(nrows, ncolumns, data, mask, weight, dist, transpose);
-    if (!distmatrix) return NULL; /* Insufficient memory */
+  /* Find the top node */
+  for (i = 0; i < nnodes; i++) parent[i] = -1;
+  for (i = 0; i < nnodes; i++)
+  { if (tree[i].left < 0) parent[-tree[i].left-1] = i;
+    if (tree[i].right < 0) parent[-tree[i].right-1] = i;
+  }
+  for (i = 0; i < nnodes; i++) if (parent[i] < 0) root = i;
+
+  /* Number the elements in the order in which they appear in the tree, such
+   * that the elements below each node are consecutive. The nodes are stored
+   * in parent in the order in which they are visited. */
+  k = 0;
+  stack[nstack++] = -root-1;
+  while (nstack > 0)
+  { const int child = stack[--nstack];
+    if (child >= 0)
+    { where[child] = position;
+      leaves[position++] = child;
+    }
+    else
+    { v = -child-1;
+      start[v] = position;
+      parent[k++] = v;
+      stack[nstack++] = tree[v].right;
+      stack[nstack++] = tree[v].left;
+    }
+  }
+  for (k = nnodes-1; k >= 0; k--)
+  { int first, n;
+    v = parent[k];
+    getinterval(tree[v].left, start, size, where, &first, &n);
+    size[v] = n;
+    getinterval(tree[v].right, start, size, where, &first, &n);
+    size[v] += n;
   }
 
-  switch(method)
-  { case 's':
-      result = pslcluster(nrows, ncolumns, data, mask, weight, distmatrix,
-                          dist, transpose);
-      break;
-    case 'm':
-      result = pmlcluster(nelements, distmatrix);
-      break;
-    case 'a':
-      result = palcluster(nelements, distmatrix);
-      break;
-    case 'c':
-      result = pclcluster(nrows, ncolumns, data, mask, weight, distmatrix,
-                          dist, transpose);
+  /* Find the minimum cost for each pair of ends, from the bottom up */
+  for (k = nnodes-1; k >= 0 && ok; k--)
+  { int a;
+    int afirst, an, bfirst, bn;
+    int achild, bchild;
+    int nlist = 0;
+    int* offsets;
+    int* lists;
+    v = parent[k];
+    /* The elements of the larger branch are examined in the outer loop */
+    achild = tree[v].left;
+    bchild = tree[v].right;
+    getinterval(achild, start, size, where, &afirst, &an);
+    getinterval(bchild, start, size, where, &bfirst, &bn);
+    if (bn > an)
+    { i = achild; achild = bchild; bchild = i;
+      i = afirst; afirst = bfirst; bfirst = i;
+      i = an; an = bn; bn = i;
+    }
+
+    /* For each end b in the smaller branch, sort the candidates for the
+     * inner end by their cost */
+    for (j = 0; j < bn; j++)
+    { int first, n;
+      getopposite(tree, bchild, leaves[bfirst+j], start, size, where,
+                  &first, &n);
+      nlist += n;
+    }
+    offsets = malloc((bn+1)*sizeof(int));
+    lists = malloc(nlist*sizeof(int));
+    if (!offsets || !lists)
+    { if (offsets) free(offsets);
+      if (lists) free(lists);
+      ok = 0;
       break;
+    }
+    nlist = 0;
+    for (j = 0; j < bn; j++)
+    { int first, n;
+      const int eb = leaves[bfirst+j];
+      getopposite(tree, bchild, eb, start, size, where, &first, &n);
+      for (i = 0; i < n; i++)
+      { candidates[i].i = leaves[first+i];
+        candidates[i].j = 0;
+        candidates[i].distance = pairvalue(cost, leaves[first+i], eb);
+      }
+      qsort(candidates, n, sizeof(Candidate), candidatecompare);
+      offsets[j] = nlist;
+      for (i = 0; i < n; i++) lists[nlist++] = candidates[i].i;
+    }
+    offsets[bn] = nlist;
+
+    /* For each element l in the smaller branch, find the smallest distance
+     * to the elements in each branch of the larger subtree */
+    for (a = 0; a < 2; a++)
+    { int first, n;
+      if (achild >= 0)
+      { first = afirst;
+        n = an;
+      }
+      else
+      { const int child = (a==0) ? tree[-achild-1].left
+                                 : tree[-achild-1].right;
+        getinterval(child, start, size, where, &first, &n);
+      }
+      for (j = 0; j < bn; j++)
+      { double bound = DBL_MAX;
+        for (i = 0; i < n; i++)
+        { const double d = pairvalue(distmatrix, leaves[first+i],
+                                                 leaves[bfirst+j]);
+          if (d < bound) bound = d;
+        }
+        bounds[a*bn+j] = bound;
+      }
+    }
+
+    /* The ends in the larger branch are independent of each other. Each
+     * thread uses its own workspace. */
+    #pragma omp parallel if (an > 64) private(j)
+    { Candidate* tcandidates = malloc(an*sizeof(Candidate));
+      double* tpartial = malloc(bn*sizeof(double));
+      if (!tcandidates || !tpartial)
+      {
+        #pragma omp atomic write
+        ok = 0;
+      }
+      #pragma omp for schedule(dynamic, 4)
+      for (i = 0; i < an; i++)
+      { int first, n;
+        double smallest[2];
+        const int ea = leaves[afirst+i];
+        const double* bound;
+        int abranch;
+        if (!tcandidates || !tpartial) continue;
+        abranch = getopposite(tree, achild, ea, start, size, where,
+                              &first, &n);
+        bound = bounds + abranch*bn;
+        for (j = 0; j < n; j++)
+        { tcandidates[j].i = leaves[first+j];
+          tcandidates[j].j = 0;
+          tcandidates[j].distance = pairvalue(cost, ea, leaves[first+j]);
+        }
+        qsort(tcandidates, n, sizeof(Candidate), candidatecompare);
+        /* The minimum cost of the larger subtree starting at ea, followed by
+         * element el of the smaller branch */
+        for (j = 0; j < bn; j++)
+        { int ik;
+          const int el = leaves[bfirst+j];
+          double best = DBL_MAX;
+          for (ik = 0; ik < n; ik++)
+          { const double ck = tcandidates[ik].distance;
+            double c;
+            if (ck + bound[j] >= best) break;
+            c = ck + pairvalue(distmatrix, tcandidates[ik].i, el);
+            if (c < best) best = c;
+          }
+          tpartial[j] = best;
+        }
+        /* The smallest of these for each branch of the smaller subtree */
+        smallest[0] = DBL_MAX;
+        smallest[1] = DBL_MAX;
+        for (j = 0; j < bn; j++)
+        { int lfirst, ln;
+          int branch = 0;
+          if (bchild < 0)
+            branch = 1 - getopposite(tree, bchild, leaves[bfirst+j], start,
+                                     size, where, &lfirst, &ln);
+          if (tpartial[j] < smallest[branch]) smallest[branch] = tpartial[j];
+        }
+        for (j = 0; j < bn; j++)
+        { int il;
+          int lfirst, ln;
+          const int eb = leaves[bfirst+j];
+          const int* list = lists + offsets[j];
+          const int nl = offsets[j+1] - offsets[j];
+          const int bbranch = getopposite(tree, bchild, eb, start, size, where,
+                                          &lfirst, &ln);
+          double best = DBL_MAX;
+          for (il = 0; il < nl; il++)
+          { const int el = list[il];
+            const double cl = pairvalue(cost, el, eb);
+            double c;
+            if (cl + smallest[bbranch] >= best) break;
+            c = tpartial[where[el]-bfirst] + cl;
+            if (c < best) best = c;
+          }
+          if (ea > eb) cost[ea][eb] = best;
+          else cost[eb][ea] = best;
+        }
+      }
+      if (tcandidates) free(tcandidates);
+      if (tpartial) free(tpartial);
+    }
+    free(offsets);
+    free(lists);
   }
 
-  /* Deallocate space for distance matrix, if it was allocated by treecluster */
-  if(ldistmatrix)
-  { int i;
-    for (i = 1; i < nelements; i++) free(distmatrix[i]);
-    free (distmatrix);
+  if (ok)
+  { /* Find the best pair of ends for the top node */
+    int afirst, an, bfirst, bn;
+    int a = -1;
+    int b = -1;
+    double best = DBL_MAX;
+    getinterval(tree[root].left, start, size, where, &afirst, &an);
+    getinterval(tree[root].right, start, size, where, &bfirst, &bn);
+    for (i = 0; i < an; i++)
+      for (j = 0; j < bn; j++)
+      { const double c = pairvalue(cost, leaves[afirst+i], leaves[bfirst+j]);
+        if (c < best)
+        { best = c;
+          a = leaves[afirst+i];
+          b = leaves[bfirst+j];
+        }
+      }
+
+    /* Trace back the optimal order. Each entry in the stack consists of a
+     * node or element, the elements at its two ends, and its position. */
+    nstack = 0;
+    stack[nstack++] = -root-1;
+    stack[nstack++] = a;
+    stack[nstack++] = b;
+    stack[nstack++] = 0;
+    while (nstack > 0)
+    { int firstchild, secondchild;
+      int kfirst, kn, lfirst, ln;
+      int ek = -1;
+      int el = -1;
+      const int position = stack[--nstack];
+      const int eb = stack[--nstack];
+      const int ea = stack[--nstack];
+      const int child = stack[--nstack];
+      if (child >= 0)
+      { order[child] = position;
+        continue;
+      }
+      v = -child-1;
+      firstchild = tree[v].left;
+      secondchild = tree[v].right;
+      getinterval(firstchild, start, size, where, &kfirst, &kn);
+      if (where[ea] < kfirst || where[ea] >= kfirst + kn)
+      { firstchild = tree[v].right;
+        secondchild = tree[v].left;
+        getinterval(firstchild, start, size, where, &kfirst, &kn);
+      }
+      j = kn; /* the number of elements in the first branch */
+      getopposite(tree, firstchild, ea, start, size, where, &kfirst, &kn);
+      getopposite(tree, secondchild, eb, start, size, where, &lfirst, &ln);
+      best = DBL_MAX;
+      for (i = 0; i < kn; i++)
+      { const int e1 = leaves[kfirst+i];
+        const double c1 = pairvalue(cost, ea, e1);
+        for (k = 0; k < ln; k++)
+        { const int e2 = leaves[lfirst+k];
+          const double c = c1 + pairvalue(distmatrix, e1, e2)
+                              + pairvalue(cost, e2, eb);
+          if (c < best)
+          { best = c;
+            ek = e1;
+            el = e2;
+          }
+        }
+      }
+      stack[nstack++] = firstchild;
+      stack[nstack++] = ea;
+      stack[nstack++] = ek;
+      stack[nstack++] = position;
+      stack[nstack++] = secondchild;
+      stack[nstack++] = el;
+      stack[nstack++] = eb;
+      stack[nstack++] = position + j;
+    }
   }
- 
-  return result;
+
+  for (i = 1; i < nelements; i++) free(cost[i]);
+  free(cost);
+  free(parent);
+  free(start);
+  free(size);
+  free(leaves);
+  free(where);
+  free(stack);
+  free(candidates);
+  free(bounds);
+  return ok;
 }
 
 /* ******************************************************************* */
@@ -3838,8 +8386,10 @@ If a memory error occurs, treecluster returns NULL.
 static
 void somworker (int nrows, int ncolumns, double** data, int** mask,
   const double weights[], int transpose, int nxgrid, int nygrid,
-  double inittau, double*** celldata, int niter, char dist)
-
+  double inittau, double*** celldata, int niter, char dist,
+  RandomState* state, Monitor* monitor)
+/* The random numbers are drawn from state. The progress is reported after
+ * each sweep through the data if monitor is not NULL. */
 { const int nelements = (transpose==0) ? nrows : ncolumns;
   const int ndata = (transpose==0) ? ncolumns : nrows;
   int i, j;
@@ -3848,6 +8398,9 @@ void somworker (int nrows, int ncolumns, double** data, int** mask,
   int ix, iy;
   int* index;
   int iter;
+  int* cell = NULL;
+  int nmoved = 0;
+  double total = 0.0;
   /* Maximum radius in which nodes are adjusted */
   double maxradius = sqrt(nxgrid*nxgrid+nygrid*nygrid);
 
@@ -3908,7 +8461,7 @@ void somworker (int nrows, int ncolumns, double** data, int** mask,
   { for (iy = 0; iy < nygrid; iy++)
     { double sum = 0.;
       for (i = 0; i < ndata; i++)
-      { double term = -1.0 + 2.0*uniform();
+      { double term = -1.0 + 2.0*nextuniform(state);
         celldata[ix][iy][i] = term;
         sum += term * term;
       }
@@ -3921,12 +8474,19 @@ void somworker (int nrows, int ncolumns, double** data, int** mask,
   index = malloc(nelements*sizeof(int));
   for (i = 0; i < nelements; i++) index[i] = i;
   for (i = 0; i < nelements; i++)
-  { j = (int) (i + (nelements-i)*uniform());
+  { j = (int) (i + (nelements-i)*nextuniform(state));
     ix = index[j];
     index[j] = index[i];
     index[i] = ix;
   }
 
+  /* Keep track of the cell to which each element was closest at its previous
+   * visit */
+  if (monitor)
+  { cell = malloc(nelements*sizeof(int));
+    if (cell) for (i = 0; i < nelements; i++) cell[i] = -1;
+  }
+
   /* Start the iteration */
   for (iter = 0; iter < niter; iter++)
   { int ixbest = 0;
@@ -3951,6 +8511,7 @@ void somworker (int nrows, int ncolumns, double** data, int** mask,
           }
         }
       }
+      total += closest;
       for (ix = 0; ix < nxgrid; ix++)
       { for (iy = 0; iy < nygrid; iy++)
         { if (sqrt((ix-ixbest)*(ix-ixbest)+(iy-iybest)*(iy-iybest))<radius)
@@ -3999,6 +8560,7 @@ void somworker (int nrows, int ncolumns, double** data, int** mask,
         }
       }
       free(celldatavector);
+      total += closest;
       for (ix = 0; ix < nxgrid; ix++)
       { for (iy = 0; iy < nygrid; iy++)
         { if (sqrt((ix-ixbest)*(ix-ixbest)+(iy-iybest)*(iy-iybest))<radius)
@@ -4021,7 +8583,22 @@ void somworker (int nrows, int ncolumns, double** data, int** mask,
         }
       }
     }
+    if (monitor)
+    { const int k = ixbest*nygrid + iybest;
+      if (cell)
+      { if (cell[iobject]!=k) nmoved++;
+        cell[iobject] = k;
+      }
+      if (iter % nelements == nelements-1 || iter == niter-1)
+      { const int stop = report(monitor, iter/nelements + 1, total,
+                                cell ? nmoved : -1);
+        total = 0.0;
+        nmoved = 0;
+        if (stop) break;
+      }
+    }
   }
+  if (cell) free(cell);
   if (transpose==0)
     for (i = 0; i < nygrid; i++) free(dummymask[i]);
   else
@@ -4121,7 +8698,9 @@ void somassign (int nrows, int ncolumns, double** data, int** mask,
 
 void somcluster (int nrows, int ncolumns, double** data, int** mask,
   const double weight[], int transpose, int nxgrid, int nygrid,
-  double inittau, int niter, char dist, double*** celldata, int clusterid[][2])
+  double inittau, int niter, char dist, unsigned long seed,
+  double*** celldata, int clusterid[][2], ClusterCallback callback,
+  void* context)
 /*
 
 Purpose
@@ -4181,6 +8760,11 @@ dist=='s': Spearman's rank correlation
 dist=='k': Kendall's tau
 For other values of dist, the default (Euclidean distance) is used.
 
+seed       (input) unsigned long
+The seed of the random number generator, which is used to initialize the
+cells and to choose the order in which the elements are used. If seed==0, a
+seed is chosen based on the current time.
+
 celldata (output) double[nxgrid][nygrid][ncolumns] if transpose==0;
                   double[nxgrid][nygrid][nrows]    if tranpose==1
 The gene expression data for each node (cell) in the 2D grid. This can be
@@ -4196,12 +8780,26 @@ cluster assignments are not returned. If clusterid is not NULL, enough memory
 should be allocated to store the clustering information before calling
 somcluster.
 
+callback   (input) ClusterCallback
+If callback is not NULL, it is called after each sweep through the data, in
+which each element is used once, as described for kcluster. The iteration
+number counts the sweeps; the total is the sum of distances of the elements
+to the closest cell at the time they were used, and the number of elements
+that changed cluster is the number of elements that were closest to a
+different cell than in the previous sweep. If the callback returns a nonzero
+value, the remaining iterations are skipped.
+
+context    (input) void*
+A pointer that is passed unchanged to the callback.
+
 ========================================================================
 */
 { const int nobjects = (transpose==0) ? nrows : ncolumns;
   const int ndata = (transpose==0) ? ncolumns : nrows;
   int i,j;
   const int lcelldata = (celldata==NULL) ? 0 : 1;
+  Monitor monitor;
+  RandomState state;
 
   if (nobjects < 2) return;
 
@@ -4214,8 +8812,10 @@ somcluster.
     }
   }
 
+  if (callback) initmonitor(&monitor, callback, context);
+  seedstream(&state, seed ? seed : randomseed(), 0);
   somworker (nrows, ncolumns, data, mask, weight, transpose, nxgrid, nygrid,
-    inittau, celldata, niter, dist);
+    inittau, celldata, niter, dist, &state, callback ? &monitor : NULL);
   if (clusterid)
     somassign (nrows, ncolumns, data, mask, weight, transpose,
       nxgrid, nygrid, celldata, dist, clusterid);
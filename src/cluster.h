@@ -48,6 +48,21 @@ double** distancematrix (int ngenes, int ndata, double** data,
   int** mask, double* weight, char dist, int transpose);
 
 /* Chapter 3 */
+typedef struct {int pass; int iteration; double total; int nmoved;
+  double elapsed;} ClusterProgress;
+/*
+ * A ClusterProgress struct is passed to the progress callback of kcluster,
+ * minibatchkcluster, kmedoids, and somcluster after each iteration. It
+ * contains the pass number (starting at 0), the iteration number within the
+ * pass (starting at 1), the within-cluster sum of distances found in that
+ * iteration, the number of elements that changed cluster, and the elapsed
+ * (wall-clock) time in seconds since the clustering routine was called; if
+ * the library was compiled without OpenMP, this time is in whole seconds. If
+ * the callback returns a nonzero value, the current pass is finished with its
+ * present solution and no further passes are performed.
+ */
+typedef int (*ClusterCallback)(const ClusterProgress* progress, void* context);
+
 int getclustercentroids(int nclusters, int nrows, int ncolumns,
   double** data, int** mask, int clusterid[], double** cdata, int** cmask,
   int transpose, char method);
@@ -55,9 +70,49 @@ void getclustermedoids(int nclusters, int nelements, double** distance,
   int clusterid[], int centroids[], double errors[]);
 void kcluster (int nclusters, int ngenes, int ndata, double** data,
   int** mask, double weight[], int transpose, int npass, char method, char dist,
-  int clusterid[], double* error, int* ifound);
+  char init, unsigned long seed, int clusterid[], double* error, int* ifound,
+  ClusterCallback callback, void* context);
+int kclustersweep (int kmin, int kmax, int nrows, int ncolumns,
+  double** data, int** mask, double weight[], int transpose, int npass,
+  char method, char dist, char init, unsigned long seed, int** clusterid,
+  double error[], double score[]);
+void minibatchkcluster (int nclusters, int nelements, int ndata,
+  int (*getrows)(void* context, int n, const int index[], double** data,
+                 int** mask),
+  void* context, double weight[], char dist, int batchsize, int niter,
+  int npass, unsigned long seed, int clusterid[], double* error, int* ifound,
+  ClusterCallback callback, void* callbackcontext);
+typedef struct {double** data; int** mask; int transpose; int ndata;}
+  DataSource;
+/*
+ * A DataSource describes a data matrix in memory, with ndata values for each
+ * element. If transpose==0, the elements are the rows of the matrix, and
+ * otherwise its columns. Passing getdatarows and a pointer to a DataSource to
+ * minibatchkcluster clusters the elements of the matrix.
+ */
+int getdatarows(void* context, int n, const int index[], double** data,
+  int** mask);
+typedef struct datafile DataFile;
+DataFile* opendatafile(const char filename[], char format);
+void closedatafile(DataFile* datafile);
+void datafileshape(const DataFile* datafile, int* nrows, int* ncolumns);
+const double* datafileweight(const DataFile* datafile);
+int getdatafilerows(void* datafile, int n, const int index[], double** data,
+  int** mask);
+void streamkcluster (int nclusters, int nelements, int ndata,
+  int (*getrows)(void* context, int n, const int index[], double** data,
+                 int** mask),
+  void* context, double weight[], char dist, int npass, unsigned long seed,
+  int clusterid[], double* error, int* ifound, ClusterCallback callback,
+  void* callbackcontext);
 void kmedoids (int nclusters, int nelements, double** distance,
-  int npass, int clusterid[], double* error, int* ifound);
+  int npass, unsigned long seed, int clusterid[], double* error, int* ifound,
+  ClusterCallback callback, void* context);
+int pam (int nclusters, int nelements, double** distmatrix, int clusterid[],
+  double* error, ClusterCallback callback, void* context);
+int silhouette (int nclusters, int nrows, int ncolumns, double** data,
+  int** mask, double weight[], int transpose, char dist, double** distmatrix,
+  const int clusterid[], double widths[], double* average);
 
 /* Chapter 4 */
 typedef struct {int left; int right; double distance;} Node;
@@ -73,13 +128,26 @@ typedef struct {int left; int right; double distance;} Node;
 
 Node* treecluster (int nrows, int ncolumns, double** data, int** mask,
   double weight[], int transpose, char dist, char method, double** distmatrix);
+int treeclusters (int nrows, int ncolumns, double** data, int** mask,
+  double weight[], int transpose, char dist, int nmethods, const char methods[],
+  double** distmatrix, Node* trees[]);
+Node* approxtreecluster (int nrows, int ncolumns, double** data, int** mask,
+  double weight[], int transpose, char dist, char method, int nsummary,
+  int refine);
+Node* sparsetreecluster (int nelements, int nedges, const int edgei[],
+  const int edgej[], const double edged[], char method);
 void cuttree (int nelements, Node* tree, int nclusters, int clusterid[]);
+void cuttrees (int nelements, Node* tree, int nlevels, const int nclusters[],
+  int** clusterid);
+int optimalleaforder (int nelements, Node* tree, double** distmatrix,
+  int order[]);
 
 /* Chapter 5 */
 void somcluster (int nrows, int ncolumns, double** data, int** mask,
   const double weight[], int transpose, int nxnodes, int nynodes,
-  double inittau, int niter, char dist, double*** celldata,
-  int clusterid[][2]);
+  double inittau, int niter, char dist, unsigned long seed,
+  double*** celldata, int clusterid[][2], ClusterCallback callback,
+  void* context);
 
 /* Chapter 6 */
 int pca(int m, int n, double** u, double** v, double* w);